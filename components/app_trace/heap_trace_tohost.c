@@ -0,0 +1,65 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+#define HEAP_TRACE_SRCFILE /* don't warn on inclusion here */
+#include "esp_heap_trace.h"
+#undef HEAP_TRACE_SRCFILE
+
+#include "esp_app_trace.h"
+
+#if CONFIG_HEAP_TRACING && CONFIG_ESP32_APPTRACE_ENABLE
+
+#define STACK_DEPTH CONFIG_HEAP_TRACING_STACK_DEPTH
+
+/* Each event is sent as one packet of 32-bit little endian words:
+
+   - header: magic number in bits 0-15, event type in bits 16-23, stack depth in bits 24-31
+   - ccount
+   - address
+   - size
+   - 'stack depth' words of call stack (alloced_by for an allocation, freed_by for a free)
+
+   tools/esp_app_trace/heap_trace_proc.py decodes this format.
+*/
+#define HEAP_TRACE_PACKET_MAGIC 0x4854
+
+static IRAM_ATTR bool tohost_write(heap_trace_event_t event, const heap_trace_record_t *record, void *arg)
+{
+    uint32_t packet[4 + STACK_DEPTH];
+    packet[0] = HEAP_TRACE_PACKET_MAGIC | (event << 16) | (STACK_DEPTH << 24);
+    packet[1] = record->ccount;
+    packet[2] = (uint32_t)record->address;
+    packet[3] = record->size;
+    for (int i = 0; i < STACK_DEPTH; i++) {
+        packet[4 + i] = (uint32_t)((event == HEAP_TRACE_EVENT_ALLOC) ? record->alloced_by[i] : record->freed_by[i]);
+    }
+    /* don't wait for space, if the host isn't reading fast enough the event is lost */
+    return esp_apptrace_write(ESP_APPTRACE_DEST_TRAX, packet, sizeof(packet), 0) == ESP_OK;
+}
+
+esp_err_t heap_trace_init_tohost(void)
+{
+    return heap_trace_set_stream(tohost_write, NULL);
+}
+
+#else
+
+esp_err_t heap_trace_init_tohost(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
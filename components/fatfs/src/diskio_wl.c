@@ -55,14 +55,9 @@ DRESULT ff_wl_write (BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
     ESP_LOGV(TAG, "ff_wl_write - pdrv=%i, sector=%i, count=%i\n", (unsigned int)pdrv, (unsigned int)sector, (unsigned int)count);
     wl_handle_t wl_handle = ff_wl_handles[pdrv];
     assert(wl_handle + 1);
-    esp_err_t err = wl_erase_range(wl_handle, sector * wl_sector_size(wl_handle), count * wl_sector_size(wl_handle));
+    esp_err_t err = wl_write_sectors(wl_handle, sector, buff, count);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "wl_erase_range failed (%d)", err);
-        return RES_ERROR;
-    }
-    err = wl_write(wl_handle, sector * wl_sector_size(wl_handle), buff, count * wl_sector_size(wl_handle));
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "wl_write failed (%d)", err);
+        ESP_LOGE(TAG, "wl_write_sectors failed (%d)", err);
         return RES_ERROR;
     }
     return RES_OK;
@@ -74,8 +69,14 @@ DRESULT ff_wl_ioctl (BYTE pdrv, BYTE cmd, void *buff)
     ESP_LOGV(TAG, "ff_wl_ioctl: cmd=%i\n", cmd);
     assert(wl_handle + 1);
     switch (cmd) {
-    case CTRL_SYNC:
+    case CTRL_SYNC: {
+        esp_err_t err = wl_flush(wl_handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "wl_flush failed (%d)", err);
+            return RES_ERROR;
+        }
         return RES_OK;
+    }
     case GET_SECTOR_COUNT:
         *((DWORD *) buff) = wl_size(wl_handle) / wl_sector_size(wl_handle);
         return RES_OK;
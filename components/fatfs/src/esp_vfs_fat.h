@@ -26,6 +26,16 @@
 extern "C" {
 #endif
 
+/**
+ * @brief ioctl request which enables or disables fast seek mode of an open file
+ *
+ * The argument is an int, non-zero to enable fast seek mode and zero to disable it.
+ * In fast seek mode, lseek finds the position using a table of file fragments kept
+ * in RAM, instead of following the cluster chain in FAT. Writing past the end of
+ * the file disables fast seek mode.
+ */
+#define FATFS_IOCTL_FAST_SEEK   0x4601
+
 /**
  * @brief Register FATFS with VFS component
  *
@@ -86,6 +96,10 @@ esp_err_t esp_vfs_fat_unregister_path(const char* base_path);
 
 /**
  * @brief Configuration arguments for esp_vfs_fat_sdmmc_mount and esp_vfs_fat_spiflash_mount functions
+ *
+ * Initialize the whole structure to zero (e.g. with '= {}' or '= { 0 }') before
+ * setting the fields: fields added in later versions keep their previous behavior
+ * when they are zero.
  */
 typedef struct {
     /**
@@ -108,11 +122,49 @@ typedef struct {
      * sector size.
      */
     size_t allocation_unit_size;
+    /**
+     * Size of the readahead buffer of each open file, in bytes.
+     *
+     * When a read is shorter than this size and continues where the previous
+     * read of the file ended, this many bytes are read from the file at once,
+     * and the following reads are served from the buffer.
+     * Setting this field to 0 disables readahead.
+     */
+    size_t read_ahead_size;
+    /**
+     * Size of the write buffer of each open file, in bytes.
+     *
+     * Writes shorter than this size are collected in the buffer and passed
+     * to FatFs together, when the buffer is full, or on lseek, read, fsync
+     * and close. Errors of the buffered writes are reported by these calls.
+     * Setting this field to 0 disables write buffering.
+     */
+    size_t write_buffer_size;
 } esp_vfs_fat_mount_config_t;
 
 // Compatibility definition
 typedef esp_vfs_fat_mount_config_t esp_vfs_fat_sdmmc_mount_config_t;
 
+/**
+ * @brief Register FATFS with VFS component, with per-file buffers
+ *
+ * Same as esp_vfs_fat_register, but also sets up readahead and write buffers
+ * of open files, as given by read_ahead_size and write_buffer_size fields of
+ * mount_config. Buffers are allocated when a file uses them first, and freed
+ * when the file is closed.
+ *
+ * @param base_path  path prefix where FATFS should be registered
+ * @param fat_drive  FATFS drive specification; if only one drive is used, can be an empty string
+ * @param mount_config  pointer to structure with max_files and buffer sizes
+ * @param[out] out_fs  pointer to FATFS structure which can be used for FATFS f_mount call is returned via this argument.
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if esp_vfs_fat_register was already called
+ *      - ESP_ERR_NO_MEM if not enough memory or too many VFSes already registered
+ */
+esp_err_t esp_vfs_fat_register_cfg(const char* base_path, const char* fat_drive,
+        const esp_vfs_fat_mount_config_t* mount_config, FATFS** out_fs);
+
 /**
  * @brief Convenience function to get FAT filesystem on SD card registered in VFS
  *
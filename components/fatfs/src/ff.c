@@ -905,6 +905,23 @@ void unlock_fs (
 	}
 }
 
+
+/* Functions which only read the volume may run in several tasks at once with a
+/  shared grant. Such readers must hold the window lock while they use fs->win. */
+
+static
+int lock_fs_shared (	/* 1:Ok, 0:timeout */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	return ff_req_grant_shared(fs->sobj);
+}
+
+#define LOCK_WINDOW(fs, shared)		{ if (shared) ff_lock_window((fs)->sobj); }
+#define UNLOCK_WINDOW(fs, shared)	{ if (shared) ff_unlock_window((fs)->sobj); }
+#else
+#define LOCK_WINDOW(fs, shared)
+#define UNLOCK_WINDOW(fs, shared)
 #endif
 
 
@@ -1211,6 +1228,29 @@ DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFFF:Clust
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT access - Read value of a FAT entry for a reader                   */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD get_fat_win (		/* Same as get_fat() */
+	FFOBJID* obj,	/* Corresponding object */
+	DWORD clst,		/* Cluster number to get the value */
+	int shared		/* The caller holds a shared grant */
+)
+{
+	DWORD val;
+
+
+	LOCK_WINDOW(obj->fs, shared);
+	val = get_fat(obj, clst);
+	UNLOCK_WINDOW(obj->fs, shared);
+	return val;
+}
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* FAT access - Change value of a FAT entry                              */
@@ -3441,14 +3481,50 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 
 
 
+#if FF_FS_REENTRANT && FF_FS_MINIMIZE == 0
+/*-----------------------------------------------------------------------*/
+/* Get a shared grant for reading a mounted volume                       */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT find_volume_shared (	/* FR_OK(0): successful, FR_NOT_READY: volume has to be mounted by find_volume() */
+	const TCHAR** path,	/* Pointer to pointer to the path name (drive number) */
+	FATFS** rfs			/* Pointer to pointer to the found filesystem object */
+)
+{
+	const TCHAR *p = *path;
+	int vol;
+	FATFS *fs;
+
+
+	*rfs = 0;
+	vol = get_ldnumber(&p);
+	if (vol < 0) return FR_INVALID_DRIVE;
+	fs = FatFs[vol];
+	if (!fs) return FR_NOT_ENABLED;
+	if (!lock_fs_shared(fs)) return FR_TIMEOUT;
+	if (fs->fs_type == 0 || (disk_status(fs->pdrv) & STA_NOINIT)) {
+		ff_rel_grant(fs->sobj);
+		return FR_NOT_READY;
+	}
+	*path = p;
+	*rfs = fs;
+	return FR_OK;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Check if the file/directory object is valid or not                    */
 /*-----------------------------------------------------------------------*/
 
 static
-FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
+FRESULT validate_grant (	/* Returns FR_OK or FR_INVALID_OBJECT */
 	FFOBJID* obj,	/* Pointer to the FFOBJID, the 1st member in the FIL/DIR object, to check validity */
-	FATFS** rfs		/* Pointer to pointer to the owner filesystem object to return */
+	FATFS** rfs,	/* Pointer to pointer to the owner filesystem object to return */
+	int shared		/* Obtain a shared grant for reading the volume */
 )
 {
 	FRESULT res = FR_INVALID_OBJECT;
@@ -3456,7 +3532,7 @@ FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 
 	if (obj && obj->fs && obj->fs->fs_type && obj->id == obj->fs->id) {	/* Test if the object is valid */
 #if FF_FS_REENTRANT
-		if (lock_fs(obj->fs)) {	/* Obtain the filesystem object */
+		if (shared ? lock_fs_shared(obj->fs) : lock_fs(obj->fs)) {	/* Obtain the filesystem object */
 			if (!(disk_status(obj->fs->pdrv) & STA_NOINIT)) { /* Test if the phsical drive is kept initialized */
 				res = FR_OK;
 			} else {
@@ -3476,6 +3552,16 @@ FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 }
 
 
+static
+FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
+	FFOBJID* obj,	/* Pointer to the FFOBJID, the 1st member in the FIL/DIR object, to check validity */
+	FATFS** rfs		/* Pointer to pointer to the owner filesystem object to return */
+)
+{
+	return validate_grant(obj, rfs, 0);
+}
+
+
 
 
 /*---------------------------------------------------------------------------
@@ -3741,10 +3827,12 @@ FRESULT f_read (
 	FSIZE_t remain;
 	UINT rcnt, cc, csect;
 	BYTE *rbuff = (BYTE*)buff;
+	int shared;
 
 
 	*br = 0;	/* Clear read byte counter */
-	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
+	shared = fp && !(fp->flag & FA_WRITE);		/* Files which are not open for writing are read with a shared grant */
+	res = validate_grant(&fp->obj, &fs, shared);	/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
 	remain = fp->obj.objsize - fp->fptr;
@@ -3764,7 +3852,7 @@ FRESULT f_read (
 					} else
 #endif
 					{
-						clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
+						clst = get_fat_win(&fp->obj, fp->clust, shared);	/* Follow cluster chain on the FAT */
 					}
 				}
 				if (clst < 2) ABORT(fs, FR_INT_ERR);
@@ -3779,10 +3867,18 @@ FRESULT f_read (
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
+#if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2 && FF_FS_TINY
+				if (shared) {	/* Other readers may flush the window during the read, write back a dirty sector in advance */
+					LOCK_WINDOW(fs, shared);
+					res = (fs->wflag && fs->winsect - sect < cc) ? sync_window(fs) : FR_OK;
+					UNLOCK_WINDOW(fs, shared);
+					if (res != FR_OK) ABORT(fs, res);
+				}
+#endif
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
-				if (fs->wflag && fs->winsect - sect < cc) {
+				if (!shared && fs->wflag && fs->winsect - sect < cc) {
 					mem_cpy(rbuff + ((fs->winsect - sect) * SS(fs)), fs->win, SS(fs));
 				}
 #else
@@ -3810,8 +3906,11 @@ FRESULT f_read (
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes left in the sector */
 		if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
-		mem_cpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
+		LOCK_WINDOW(fs, shared);
+		res = move_window(fs, fp->sect);	/* Move sector window */
+		if (res == FR_OK) mem_cpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
+		UNLOCK_WINDOW(fs, shared);
+		if (res != FR_OK) ABORT(fs, FR_DISK_ERR);
 #else
 		mem_cpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #endif
@@ -4226,14 +4325,16 @@ FRESULT f_lseek (
 	FATFS *fs;
 	DWORD clst, bcs, nsect;
 	FSIZE_t ifptr;
+	int shared;
 #if FF_USE_FASTSEEK
 	DWORD cl, pcl, ncl, tcl, dsc, tlen, ulen, *tbl;
 #endif
 
-	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	shared = fp && !(fp->flag & FA_WRITE);	/* Files which are not open for writing are sought with a shared grant */
+	res = validate_grant(&fp->obj, &fs, shared);	/* Check validity of the file object */
 	if (res == FR_OK) res = (FRESULT)fp->err;
 #if FF_FS_EXFAT && !FF_FS_READONLY
-	if (res == FR_OK && fs->fs_type == FS_EXFAT) {
+	if (res == FR_OK && !shared && fs->fs_type == FS_EXFAT) {
 		res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* Fill last fragment on the FAT if needed */
 	}
 #endif
@@ -4251,7 +4352,7 @@ FRESULT f_lseek (
 					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
 					do {
 						pcl = cl; ncl++;
-						cl = get_fat(&fp->obj, cl);
+						cl = get_fat_win(&fp->obj, cl, shared);
 						if (cl <= 1) ABORT(fs, FR_INT_ERR);
 						if (cl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 					} while (cl == pcl + 1);
@@ -4311,7 +4412,7 @@ FRESULT f_lseek (
 			} else {									/* When seek to back cluster, */
 				clst = fp->obj.sclust;					/* start from the first cluster */
 #if !FF_FS_READONLY
-				if (clst == 0) {						/* If no cluster chain, create a new chain */
+				if (clst == 0 && !shared) {				/* If no cluster chain, create a new chain */
 					clst = create_chain(&fp->obj, 0);
 					if (clst == 1) ABORT(fs, FR_INT_ERR);
 					if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
@@ -4336,7 +4437,7 @@ FRESULT f_lseek (
 					} else
 #endif
 					{
-						clst = get_fat(&fp->obj, clst);	/* Follow cluster chain if not in write mode */
+						clst = get_fat_win(&fp->obj, clst, shared);	/* Follow cluster chain if not in write mode */
 					}
 					if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 					if (clst <= 1 || clst >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
@@ -4569,12 +4670,22 @@ FRESULT f_stat (
 {
 	FRESULT res;
 	FF_DIR dj;
+	int shared = 0;
 	DEF_NAMBUF
 
 
 	/* Get logical drive */
-	res = find_volume(&path, &dj.obj.fs, 0);
+#if FF_FS_REENTRANT
+	res = find_volume_shared(&path, &dj.obj.fs);	/* Look up the path with a shared grant if the volume is mounted */
+	if (res == FR_OK) {
+		shared = 1;
+	} else if (res == FR_NOT_READY)
+#endif
+	{
+		res = find_volume(&path, &dj.obj.fs, 0);
+	}
 	if (res == FR_OK) {
+		LOCK_WINDOW(dj.obj.fs, shared);	/* The window and the name buffer are shared with other readers */
 		INIT_NAMBUF(dj.obj.fs);
 		res = follow_path(&dj, path);	/* Follow the file path */
 		if (res == FR_OK) {				/* Follow completed */
@@ -4585,6 +4696,7 @@ FRESULT f_stat (
 			}
 		}
 		FREE_NAMBUF();
+		UNLOCK_WINDOW(dj.obj.fs, shared);
 	}
 
 	LEAVE_FF(dj.obj.fs, res);
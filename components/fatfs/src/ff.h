@@ -319,6 +319,9 @@ void ff_memfree (void* mblock);			/* Free memory block */
 int ff_cre_syncobj (BYTE vol, FF_SYNC_t* sobj);	/* Create a sync object */
 int ff_req_grant (FF_SYNC_t sobj);		/* Lock sync object */
 void ff_rel_grant (FF_SYNC_t sobj);		/* Unlock sync object */
+int ff_req_grant_shared (FF_SYNC_t sobj);	/* Lock sync object for reading */
+void ff_lock_window (FF_SYNC_t sobj);	/* Lock the volume window for a reader */
+void ff_unlock_window (FF_SYNC_t sobj);	/* Unlock the volume window */
 int ff_del_syncobj (FF_SYNC_t sobj);	/* Delete a sync object */
 #endif
 
@@ -61,6 +61,23 @@ void ff_memfree (
 
 #if FF_FS_REENTRANT	/* Mutal exclusion */
 
+#include "freertos/task.h"
+
+/* The volume lock lets several tasks read files of a volume at once.
+/  Functions which may modify the volume get an exclusive grant: they hold
+/  the gate and wait until all readers have left. Readers pass through the
+/  gate only to register themselves, and serialize their accesses to the
+/  sector window of the volume (fs->win) with the window mutex.
+*/
+
+struct ff_sync_obj {
+	SemaphoreHandle_t gate;		/* Held by the task with the exclusive grant */
+	SemaphoreHandle_t window;	/* Protects readers and the window of the volume */
+	SemaphoreHandle_t idle;		/* Given when the last reader leaves */
+	TaskHandle_t owner;			/* Task with the exclusive grant */
+	int readers;				/* Number of shared grants */
+};
+
 /*------------------------------------------------------------------------*/
 /* Create a Synchronization Object                                        */
 /*------------------------------------------------------------------------*/
@@ -75,8 +92,19 @@ int ff_cre_syncobj (	/* 1:Function succeeded, 0:Could not create the sync object
 	FF_SYNC_t *sobj		/* Pointer to return the created sync object */
 )
 {
-    *sobj = xSemaphoreCreateMutex();
-    return (*sobj != NULL) ? 1 : 0;
+    FF_SYNC_t obj = ff_memcalloc(1, sizeof(struct ff_sync_obj));
+    if (obj == NULL) {
+        return 0;
+    }
+    obj->gate = xSemaphoreCreateMutex();
+    obj->window = xSemaphoreCreateMutex();
+    obj->idle = xSemaphoreCreateBinary();
+    if (obj->gate == NULL || obj->window == NULL || obj->idle == NULL) {
+        ff_del_syncobj(obj);
+        return 0;
+    }
+    *sobj = obj;
+    return 1;
 }
 
 
@@ -92,7 +120,16 @@ int ff_del_syncobj (	/* 1:Function succeeded, 0:Could not delete due to an error
 	FF_SYNC_t sobj		/* Sync object tied to the logical drive to be deleted */
 )
 {
-    vSemaphoreDelete(sobj);
+    if (sobj->gate) {
+        vSemaphoreDelete(sobj->gate);
+    }
+    if (sobj->window) {
+        vSemaphoreDelete(sobj->window);
+    }
+    if (sobj->idle) {
+        vSemaphoreDelete(sobj->idle);
+    }
+    ff_memfree(sobj);
     return 1;
 }
 
@@ -108,7 +145,47 @@ int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a gran
 	FF_SYNC_t sobj	/* Sync object to wait */
 )
 {
-    return (xSemaphoreTake(sobj, FF_FS_TIMEOUT) == pdTRUE) ? 1 : 0;
+    if (xSemaphoreTake(sobj->gate, FF_FS_TIMEOUT) != pdTRUE) {
+        return 0;
+    }
+    /* no new readers can come in while the gate is held, wait for the active ones */
+    for (;;) {
+        xSemaphoreTake(sobj->window, portMAX_DELAY);
+        int readers = sobj->readers;
+        xSemaphoreGive(sobj->window);
+        if (readers == 0) {
+            break;
+        }
+        if (xSemaphoreTake(sobj->idle, FF_FS_TIMEOUT) != pdTRUE) {
+            xSemaphoreGive(sobj->gate);
+            return 0;
+        }
+    }
+    sobj->owner = xTaskGetCurrentTaskHandle();
+    return 1;
+}
+
+
+/*------------------------------------------------------------------------*/
+/* Request Shared Grant to Read the Volume                                */
+/*------------------------------------------------------------------------*/
+/* This function is called on entering functions which only read the volume.
+/  The caller has to hold the window lock while it uses the window of the
+/  volume. When a 0 is returned, the file function fails with FR_TIMEOUT.
+*/
+
+int ff_req_grant_shared (	/* 1:Got a grant to read the volume, 0:Could not get a grant */
+	FF_SYNC_t sobj	/* Sync object to wait */
+)
+{
+    if (xSemaphoreTake(sobj->gate, FF_FS_TIMEOUT) != pdTRUE) {
+        return 0;
+    }
+    xSemaphoreTake(sobj->window, portMAX_DELAY);
+    sobj->readers++;
+    xSemaphoreGive(sobj->window);
+    xSemaphoreGive(sobj->gate);
+    return 1;
 }
 
 
@@ -116,13 +193,49 @@ int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a gran
 /* Release Grant to Access the Volume                                     */
 /*------------------------------------------------------------------------*/
 /* This function is called on leaving file functions to unlock the volume.
+/  It releases the exclusive or the shared grant held by the calling task,
+/  and the window lock if a reader leaves a function early while holding it.
 */
 
 void ff_rel_grant (
 	FF_SYNC_t sobj	/* Sync object to be signaled */
 )
 {
-    xSemaphoreGive(sobj);
+    if (sobj->owner == xTaskGetCurrentTaskHandle()) {
+        sobj->owner = NULL;
+        xSemaphoreGive(sobj->gate);
+        return;
+    }
+    if (xSemaphoreGetMutexHolder(sobj->window) != xTaskGetCurrentTaskHandle()) {
+        xSemaphoreTake(sobj->window, portMAX_DELAY);
+    }
+    if (--sobj->readers == 0) {
+        xSemaphoreGive(sobj->idle);
+    }
+    xSemaphoreGive(sobj->window);
+}
+
+
+/*------------------------------------------------------------------------*/
+/* Lock/Unlock the Window of the Volume                                   */
+/*------------------------------------------------------------------------*/
+/* Tasks with a shared grant call these functions around accesses to the
+/  window of the volume. The lock must not be held across other calls to
+/  the functions above.
+*/
+
+void ff_lock_window (
+	FF_SYNC_t sobj	/* Sync object of the volume */
+)
+{
+    xSemaphoreTake(sobj->window, portMAX_DELAY);
+}
+
+void ff_unlock_window (
+	FF_SYNC_t sobj	/* Sync object of the volume */
+)
+{
+    xSemaphoreGive(sobj->window);
 }
 
 #endif
@@ -19,11 +19,37 @@
 #include <sys/errno.h>
 #include <sys/fcntl.h>
 #include <sys/lock.h>
+#include <sys/param.h>
 #include "esp_vfs.h"
+#include "esp_vfs_fat.h"
 #include "esp_log.h"
 #include "ff.h"
 #include "diskio.h"
 
+#ifdef CONFIG_FATFS_FAST_SEEK_FILE_SIZE
+#define FAST_SEEK_FILE_SIZE CONFIG_FATFS_FAST_SEEK_FILE_SIZE
+#else
+#define FAST_SEEK_FILE_SIZE 0
+#endif
+
+/* Initial size of the cluster link map table, in DWORDs; enough for 7 fragments */
+#define FAST_SEEK_TABLE_SIZE 16
+
+/* Readahead or write buffer of an open file.
+ * With read data, FIL position is at the end of the data, and the file position seen by the
+ * application is at 'off'. With write data ('dirty'), FIL position is at the start of the data,
+ * and the application position is at the end of it. Without data, both positions are the same.
+ */
+typedef struct {
+    uint8_t* data;      /* allocated on first use */
+    size_t size;        /* size of data, read_ahead_size or write_buffer_size */
+    FSIZE_t start;      /* file position of data[0] */
+    size_t len;         /* number of valid bytes in data */
+    size_t off;         /* offset of the next byte to read in data */
+    bool dirty;         /* data has to be written to the file at 'start' */
+    FSIZE_t read_end;   /* position where the previous read ended; used to detect sequential reads */
+} vfs_fat_buf_t;
+
 typedef struct {
     char fat_drive[8];  /* FAT drive name */
     char base_path[ESP_VFS_PATH_MAX];   /* base path in VFS where partition is registered */
@@ -33,6 +59,10 @@ typedef struct {
     char tmp_path_buf[FILENAME_MAX+3];  /* temporary buffer used to prepend drive name to the path */
     char tmp_path_buf2[FILENAME_MAX+3]; /* as above; used in functions which take two path arguments */
     bool *o_append;  /* O_APPEND is stored here for each max_files entries (because O_APPEND is not compatible with FA_OPEN_APPEND) */
+    size_t read_ahead_size;     /* size of readahead buffers; 0 if disabled */
+    size_t write_buffer_size;   /* size of write buffers; 0 if disabled */
+    vfs_fat_buf_t *bufs;        /* buffer of each of max_files entries */
+    _lock_t *file_locks;        /* guard for the buffer and FIL of each of max_files entries, a file may be shared by tasks */
     FIL files[0];   /* array with max_files entries; must be the final member of the structure */
 } vfs_fat_ctx_t;
 
@@ -87,6 +117,7 @@ static int vfs_fat_rmdir(void* ctx, const char* name);
 static int vfs_fat_access(void* ctx, const char *path, int amode);
 static int vfs_fat_truncate(void* ctx, const char *path, off_t length);
 static int vfs_fat_utime(void* ctx, const char *path, const struct utimbuf *times);
+static int vfs_fat_ioctl(void* ctx, int fd, int cmd, va_list args);
 
 static vfs_fat_ctx_t* s_fat_ctxs[FF_VOLUMES] = { NULL, NULL };
 //backwards-compatibility with esp_vfs_fat_unregister()
@@ -114,6 +145,16 @@ static size_t find_unused_context_index()
 
 esp_err_t esp_vfs_fat_register(const char* base_path, const char* fat_drive, size_t max_files, FATFS** out_fs)
 {
+    const esp_vfs_fat_mount_config_t mount_config = {
+        .max_files = max_files,
+    };
+    return esp_vfs_fat_register_cfg(base_path, fat_drive, &mount_config, out_fs);
+}
+
+esp_err_t esp_vfs_fat_register_cfg(const char* base_path, const char* fat_drive,
+        const esp_vfs_fat_mount_config_t* mount_config, FATFS** out_fs)
+{
+    size_t max_files = mount_config->max_files;
     size_t ctx = find_context_index_by_path(base_path);
     if (ctx < FF_VOLUMES) {
         return ESP_ERR_INVALID_STATE;
@@ -148,6 +189,7 @@ esp_err_t esp_vfs_fat_register(const char* base_path, const char* fat_drive, siz
         .access_p = &vfs_fat_access,
         .truncate_p = &vfs_fat_truncate,
         .utime_p = &vfs_fat_utime,
+        .ioctl_p = &vfs_fat_ioctl,
     };
     size_t ctx_size = sizeof(vfs_fat_ctx_t) + max_files * sizeof(FIL);
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ff_memcalloc(1, ctx_size);
@@ -155,22 +197,34 @@ esp_err_t esp_vfs_fat_register(const char* base_path, const char* fat_drive, siz
         return ESP_ERR_NO_MEM;
     }
     fat_ctx->o_append = ff_memalloc(max_files * sizeof(bool));
-    if (fat_ctx->o_append == NULL) {
+    fat_ctx->bufs = ff_memcalloc(max_files, sizeof(vfs_fat_buf_t));
+    fat_ctx->file_locks = ff_memcalloc(max_files, sizeof(_lock_t));
+    if (fat_ctx->o_append == NULL || fat_ctx->bufs == NULL || fat_ctx->file_locks == NULL) {
+        free(fat_ctx->o_append);
+        free(fat_ctx->bufs);
+        free(fat_ctx->file_locks);
         free(fat_ctx);
         return ESP_ERR_NO_MEM;
     }
     fat_ctx->max_files = max_files;
+    fat_ctx->read_ahead_size = mount_config->read_ahead_size;
+    fat_ctx->write_buffer_size = mount_config->write_buffer_size;
     strlcpy(fat_ctx->fat_drive, fat_drive, sizeof(fat_ctx->fat_drive) - 1);
     strlcpy(fat_ctx->base_path, base_path, sizeof(fat_ctx->base_path) - 1);
 
     esp_err_t err = esp_vfs_register(base_path, &vfs, fat_ctx);
     if (err != ESP_OK) {
         free(fat_ctx->o_append);
+        free(fat_ctx->bufs);
+        free(fat_ctx->file_locks);
         free(fat_ctx);
         return err;
     }
 
     _lock_init(&fat_ctx->lock);
+    for (size_t i = 0; i < max_files; i++) {
+        _lock_init(&fat_ctx->file_locks[i]);
+    }
     s_fat_ctxs[ctx] = fat_ctx;
 
     //compatibility
@@ -193,7 +247,12 @@ esp_err_t esp_vfs_fat_unregister_path(const char* base_path)
         return err;
     }
     _lock_close(&fat_ctx->lock);
+    for (size_t i = 0; i < fat_ctx->max_files; i++) {
+        _lock_close(&fat_ctx->file_locks[i]);
+    }
     free(fat_ctx->o_append);
+    free(fat_ctx->bufs);
+    free(fat_ctx->file_locks);
     free(fat_ctx);
     s_fat_ctxs[ctx] = NULL;
     return ESP_OK;
@@ -275,9 +334,117 @@ static int fresult_to_errno(FRESULT fr)
     return ENOTSUP;
 }
 
+static void fast_seek_disable(FIL* file)
+{
+    free(file->cltbl);
+    file->cltbl = NULL;
+}
+
+/* Build the cluster link map table of the file, growing it until all fragments fit */
+static FRESULT fast_seek_enable(FIL* file)
+{
+    if (file->cltbl != NULL) {
+        return FR_OK;
+    }
+    DWORD size = FAST_SEEK_TABLE_SIZE;
+    while (true) {
+        DWORD* table = ff_memalloc(size * sizeof(DWORD));
+        if (table == NULL) {
+            return FR_NOT_ENOUGH_CORE;
+        }
+        table[0] = size;
+        file->cltbl = table;
+        FRESULT res = f_lseek(file, CREATE_LINKMAP);
+        if (res == FR_OK) {
+            return FR_OK;
+        }
+        // on FR_NOT_ENOUGH_CORE, the first item is the required table size
+        DWORD required = table[0];
+        fast_seek_disable(file);
+        if (res != FR_NOT_ENOUGH_CORE || required <= size) {
+            return res;
+        }
+        size = required;
+    }
+}
+
 static void file_cleanup(vfs_fat_ctx_t* ctx, int fd)
 {
+    fast_seek_disable(&ctx->files[fd]);
     memset(&ctx->files[fd], 0, sizeof(FIL));
+    free(ctx->bufs[fd].data);
+    memset(&ctx->bufs[fd], 0, sizeof(vfs_fat_buf_t));
+}
+
+static FRESULT file_write(FIL* file, const void* data, size_t size, unsigned* written)
+{
+    if (file->cltbl != NULL && f_tell(file) + size > f_size(file)) {
+        // the cluster link map table doesn't cover new clusters
+        fast_seek_disable(file);
+    }
+    return f_write(file, data, size, written);
+}
+
+/* Position of the file seen by the application */
+static FSIZE_t buf_tell(FIL* file, const vfs_fat_buf_t* buf)
+{
+    if (buf->dirty) {
+        return buf->start + buf->len;
+    }
+    if (buf->len > 0) {
+        return buf->start + buf->off;
+    }
+    return f_tell(file);
+}
+
+/* Size of the file, including data in the write buffer */
+static FSIZE_t buf_size(FIL* file, const vfs_fat_buf_t* buf)
+{
+    if (buf->dirty && buf->start + buf->len > f_size(file)) {
+        return buf->start + buf->len;
+    }
+    return f_size(file);
+}
+
+static bool buf_alloc(vfs_fat_buf_t* buf, size_t size)
+{
+    if (buf->size != size) {
+        free(buf->data);
+        buf->data = ff_memalloc(size);
+        buf->size = (buf->data != NULL) ? size : 0;
+    }
+    return buf->data != NULL;
+}
+
+/* Write data of the write buffer to the file. Data is dropped even if the write fails. */
+static FRESULT buf_write_back(FIL* file, vfs_fat_buf_t* buf)
+{
+    if (!buf->dirty) {
+        return FR_OK;
+    }
+    unsigned written = 0;
+    FRESULT res = file_write(file, buf->data, buf->len, &written);
+    if (res == FR_OK && written != buf->len) {
+        // disk is full
+        res = FR_DENIED;
+    }
+    buf->len = 0;
+    buf->dirty = false;
+    return res;
+}
+
+/* Empty the buffer, so that FIL position is the position seen by the application */
+static FRESULT buf_release(FIL* file, vfs_fat_buf_t* buf)
+{
+    if (buf->dirty) {
+        return buf_write_back(file, buf);
+    }
+    FRESULT res = FR_OK;
+    if (buf->len > 0 && buf->off != buf->len) {
+        res = f_lseek(file, buf->start + buf->off);
+    }
+    buf->len = 0;
+    return res;
 }
 
 /**
@@ -327,24 +494,80 @@ static int vfs_fat_open(void* ctx, const char * path, int flags, int mode)
     // therefore this flag is stored here (at this VFS level) in order to save
     // memory.
     fat_ctx->o_append[fd] = (flags & O_APPEND) == O_APPEND;
+    // Fast seek mode can't extend the file, so it is only enabled automatically for reading
+    FIL* file = &fat_ctx->files[fd];
+    if (FAST_SEEK_FILE_SIZE > 0 && (flags & O_ACCMODE) == O_RDONLY && f_size(file) >= FAST_SEEK_FILE_SIZE) {
+        res = fast_seek_enable(file);
+        if (res != FR_OK) {
+            // lseek still works, only slower
+            ESP_LOGD(TAG, "%s: fast seek fresult=%d", __func__, res);
+        }
+    }
     _lock_release(&fat_ctx->lock);
     return fd;
 }
 
-static ssize_t vfs_fat_write(void* ctx, int fd, const void * data, size_t size)
+/* file_locked_* functions are called with the lock of the file held */
+static ssize_t file_locked_write(void* ctx, int fd, const void * data, size_t size)
 {
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
     FIL* file = &fat_ctx->files[fd];
+    vfs_fat_buf_t* buf = &fat_ctx->bufs[fd];
     FRESULT res;
-    if (fat_ctx->o_append[fd]) {
-        if ((res = f_lseek(file, f_size(file))) != FR_OK) {
+    if (fat_ctx->o_append[fd] && buf_tell(file, buf) != buf_size(file, buf)) {
+        res = buf_release(file, buf);
+        if (res == FR_OK) {
+            res = f_lseek(file, f_size(file));
+        }
+        if (res != FR_OK) {
             ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
             errno = fresult_to_errno(res);
             return -1;
         }
     }
+    if (size < fat_ctx->write_buffer_size) {
+        res = FR_OK;
+        if (!buf->dirty) {
+            res = buf_release(file, buf);
+            buf->start = f_tell(file);
+        }
+        if (res == FR_OK && (buf->dirty || buf_alloc(buf, fat_ctx->write_buffer_size))) {
+            // The buffer is written back when it reaches a multiple of its size in the file,
+            // so that FatFs writes whole sectors directly, without the sector buffer
+            const uint8_t* src = (const uint8_t*) data;
+            size_t left = size;
+            while (left > 0 && res == FR_OK) {
+                size_t space = buf->size - buf->start % buf->size - buf->len;
+                size_t count = MIN(left, space);
+                memcpy(buf->data + buf->len, src, count);
+                buf->len += count;
+                buf->dirty = true;
+                src += count;
+                left -= count;
+                if (count == space) {
+                    res = buf_write_back(file, buf);
+                    buf->start = f_tell(file);
+                }
+            }
+            if (res == FR_OK) {
+                return size;
+            }
+        }
+        if (res != FR_OK) {
+            ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
+            errno = fresult_to_errno(res);
+            return -1;
+        }
+        // without memory for the buffer, write directly
+    }
+    res = buf_release(file, buf);
+    if (res != FR_OK) {
+        ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
+        errno = fresult_to_errno(res);
+        return -1;
+    }
     unsigned written = 0;
-    res = f_write(file, data, size, &written);
+    res = file_write(file, data, size, &written);
     if (res != FR_OK) {
         ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
         errno = fresult_to_errno(res);
@@ -355,12 +578,54 @@ static ssize_t vfs_fat_write(void* ctx, int fd, const void * data, size_t size)
     return written;
 }
 
-static ssize_t vfs_fat_read(void* ctx, int fd, void * dst, size_t size)
+static ssize_t file_locked_read(void* ctx, int fd, void * dst, size_t size)
 {
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
     FIL* file = &fat_ctx->files[fd];
+    vfs_fat_buf_t* buf = &fat_ctx->bufs[fd];
+    FRESULT res = buf_write_back(file, buf);
+    if (res != FR_OK) {
+        ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
+        errno = fresult_to_errno(res);
+        return -1;
+    }
+    bool sequential = buf_tell(file, buf) == buf->read_end;
+    size_t copied = 0;
+    if (buf->len > 0) {
+        copied = MIN(size, buf->len - buf->off);
+        memcpy(dst, buf->data + buf->off, copied);
+        buf->off += copied;
+        if (buf->off == buf->len) {
+            buf->len = 0;
+        }
+    }
     unsigned read = 0;
-    FRESULT res = f_read(file, dst, size, &read);
+    res = FR_OK;
+    if (copied < size) {
+        // buffer is empty, FIL position is the position of the application
+        uint8_t* dst_rest = (uint8_t*) dst + copied;
+        size_t size_rest = size - copied;
+        // readahead ends at a multiple of its size in the file, so that FatFs reads whole sectors
+        size_t ahead = 0;
+        if (sequential && fat_ctx->read_ahead_size > 0) {
+            ahead = fat_ctx->read_ahead_size - f_tell(file) % fat_ctx->read_ahead_size;
+        }
+        if (size_rest < ahead && buf_alloc(buf, fat_ctx->read_ahead_size)) {
+            buf->start = f_tell(file);
+            res = f_read(file, buf->data, ahead, &read);
+            buf->len = read;
+            buf->off = MIN(size_rest, read);
+            memcpy(dst_rest, buf->data, buf->off);
+            read = buf->off;
+            if (buf->off == buf->len) {
+                buf->len = 0;
+            }
+        } else {
+            res = f_read(file, dst_rest, size_rest, &read);
+        }
+    }
+    read += copied;
+    buf->read_end = buf_tell(file, buf);
     if (res != FR_OK) {
         ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
         errno = fresult_to_errno(res);
@@ -371,12 +636,35 @@ static ssize_t vfs_fat_read(void* ctx, int fd, void * dst, size_t size)
     return read;
 }
 
+static ssize_t vfs_fat_write(void* ctx, int fd, const void * data, size_t size)
+{
+    vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
+    _lock_acquire(&fat_ctx->file_locks[fd]);
+    ssize_t ret = file_locked_write(ctx, fd, data, size);
+    _lock_release(&fat_ctx->file_locks[fd]);
+    return ret;
+}
+
+static ssize_t vfs_fat_read(void* ctx, int fd, void * dst, size_t size)
+{
+    vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
+    _lock_acquire(&fat_ctx->file_locks[fd]);
+    ssize_t ret = file_locked_read(ctx, fd, dst, size);
+    _lock_release(&fat_ctx->file_locks[fd]);
+    return ret;
+}
+
 static int vfs_fat_fsync(void* ctx, int fd)
 {
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
     _lock_acquire(&fat_ctx->lock);
+    _lock_acquire(&fat_ctx->file_locks[fd]);
     FIL* file = &fat_ctx->files[fd];
-    FRESULT res = f_sync(file);
+    FRESULT res = buf_write_back(file, &fat_ctx->bufs[fd]);
+    if (res == FR_OK) {
+        res = f_sync(file);
+    }
+    _lock_release(&fat_ctx->file_locks[fd]);
     _lock_release(&fat_ctx->lock);
     int rc = 0;
     if (res != FR_OK) {
@@ -391,9 +679,15 @@ static int vfs_fat_close(void* ctx, int fd)
 {
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
     _lock_acquire(&fat_ctx->lock);
+    _lock_acquire(&fat_ctx->file_locks[fd]);
     FIL* file = &fat_ctx->files[fd];
-    FRESULT res = f_close(file);
+    FRESULT res = buf_write_back(file, &fat_ctx->bufs[fd]);
+    FRESULT res_close = f_close(file);
+    if (res == FR_OK) {
+        res = res_close;
+    }
     file_cleanup(fat_ctx, fd);
+    _lock_release(&fat_ctx->file_locks[fd]);
     _lock_release(&fat_ctx->lock);
     int rc = 0;
     if (res != FR_OK) {
@@ -404,37 +698,62 @@ static int vfs_fat_close(void* ctx, int fd)
     return rc;
 }
 
-static off_t vfs_fat_lseek(void* ctx, int fd, off_t offset, int mode)
+static off_t file_locked_lseek(void* ctx, int fd, off_t offset, int mode)
 {
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
     FIL* file = &fat_ctx->files[fd];
+    vfs_fat_buf_t* buf = &fat_ctx->bufs[fd];
     off_t new_pos;
     if (mode == SEEK_SET) {
         new_pos = offset;
     } else if (mode == SEEK_CUR) {
-        off_t cur_pos = f_tell(file);
+        off_t cur_pos = buf_tell(file, buf);
         new_pos = cur_pos + offset;
     } else if (mode == SEEK_END) {
-        off_t size = f_size(file);
+        off_t size = buf_size(file, buf);
         new_pos = size + offset;
     } else {
         errno = EINVAL;
         return -1;
     }
-    FRESULT res = f_lseek(file, new_pos);
+    if (!buf->dirty && buf->len > 0 && new_pos >= buf->start && new_pos < buf->start + buf->len) {
+        // position is in the readahead buffer
+        buf->off = new_pos - buf->start;
+        return new_pos;
+    }
+    FRESULT res = buf_write_back(file, buf);
+    buf->len = 0;
+    if (res == FR_OK) {
+        res = f_lseek(file, new_pos);
+    }
     if (res != FR_OK) {
         ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
         errno = fresult_to_errno(res);
         return -1;
     }
+    if (file->cltbl != NULL) {
+        // fast seek mode doesn't move past the end of the file
+        return f_tell(file);
+    }
     return new_pos;
 }
 
+static off_t vfs_fat_lseek(void* ctx, int fd, off_t offset, int mode)
+{
+    vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
+    _lock_acquire(&fat_ctx->file_locks[fd]);
+    off_t ret = file_locked_lseek(ctx, fd, offset, mode);
+    _lock_release(&fat_ctx->file_locks[fd]);
+    return ret;
+}
+
 static int vfs_fat_fstat(void* ctx, int fd, struct stat * st)
 {
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
     FIL* file = &fat_ctx->files[fd];
-    st->st_size = f_size(file);
+    _lock_acquire(&fat_ctx->file_locks[fd]);
+    st->st_size = buf_size(file, &fat_ctx->bufs[fd]);
+    _lock_release(&fat_ctx->file_locks[fd]);
     st->st_mode = S_IRWXU | S_IRWXG | S_IRWXO | S_IFREG;
     st->st_mtime = 0;
     st->st_atime = 0;
@@ -460,11 +779,18 @@ static int vfs_fat_stat(void* ctx, const char * path, struct stat * st)
     }
 
     vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
-    _lock_acquire(&fat_ctx->lock);
-    prepend_drive_to_path(fat_ctx, &path, NULL);
+    // f_stat takes a shared grant of the volume, so the path isn't built in tmp_path_buf,
+    // which would need ctx->lock and serialize stat calls
+    size_t full_path_size = strlen(fat_ctx->fat_drive) + strlen(path) + 1;
+    char* full_path = ff_memalloc(full_path_size);
+    if (full_path == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(full_path, full_path_size, "%s%s", fat_ctx->fat_drive, path);
     FILINFO info;
-    FRESULT res = f_stat(path, &info);
-    _lock_release(&fat_ctx->lock);
+    FRESULT res = f_stat(full_path, &info);
+    free(full_path);
     if (res != FR_OK) {
         ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
         errno = fresult_to_errno(res);
@@ -880,3 +1206,29 @@ static int vfs_fat_utime(void *ctx, const char *path, const struct utimbuf *time
 
     return 0;
 }
+
+static int vfs_fat_ioctl(void* ctx, int fd, int cmd, va_list args)
+{
+    vfs_fat_ctx_t* fat_ctx = (vfs_fat_ctx_t*) ctx;
+    FIL* file = &fat_ctx->files[fd];
+    if (cmd != FATFS_IOCTL_FAST_SEEK) {
+        errno = EINVAL;
+        return -1;
+    }
+    bool enable = va_arg(args, int);
+    // the table is built from clusters allocated in FAT
+    _lock_acquire(&fat_ctx->file_locks[fd]);
+    FRESULT res = buf_release(file, &fat_ctx->bufs[fd]);
+    if (res == FR_OK && enable) {
+        res = fast_seek_enable(file);
+    } else if (res == FR_OK) {
+        fast_seek_disable(file);
+    }
+    _lock_release(&fat_ctx->file_locks[fd]);
+    if (res != FR_OK) {
+        ESP_LOGD(TAG, "%s: fresult=%d", __func__, res);
+        errno = fresult_to_errno(res);
+        return -1;
+    }
+    return 0;
+}
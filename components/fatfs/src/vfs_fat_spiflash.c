@@ -64,11 +64,11 @@ esp_err_t esp_vfs_fat_spiflash_mount(const char* base_path,
         goto fail;
     }
     FATFS *fs;
-    result = esp_vfs_fat_register(base_path, drv, mount_config->max_files, &fs);
+    result = esp_vfs_fat_register_cfg(base_path, drv, mount_config, &fs);
     if (result == ESP_ERR_INVALID_STATE) {
         // it's okay, already registered with VFS
     } else if (result != ESP_OK) {
-        ESP_LOGD(TAG, "esp_vfs_fat_register failed 0x(%x)", result);
+        ESP_LOGD(TAG, "esp_vfs_fat_register_cfg failed 0x(%x)", result);
         goto fail;
     }
 
@@ -161,11 +161,11 @@ esp_err_t esp_vfs_fat_rawflash_mount(const char* base_path,
     }
 
     FATFS *fs;
-    result = esp_vfs_fat_register(base_path, drv, mount_config->max_files, &fs);
+    result = esp_vfs_fat_register_cfg(base_path, drv, mount_config, &fs);
     if (result == ESP_ERR_INVALID_STATE) {
         // it's okay, already registered with VFS
     } else if (result != ESP_OK) {
-        ESP_LOGD(TAG, "esp_vfs_fat_register failed 0x(%x)", result);
+        ESP_LOGD(TAG, "esp_vfs_fat_register_cfg failed 0x(%x)", result);
         goto fail;
     }
 
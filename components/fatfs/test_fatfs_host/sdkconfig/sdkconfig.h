@@ -4,3 +4,4 @@
 #define CONFIG_LOG_DEFAULT_LEVEL 3
 #define CONFIG_PARTITION_TABLE_OFFSET 0x8000
 #define CONFIG_ESPTOOLPY_FLASHSIZE "8MB"
+#define CONFIG_FATFS_TIMEOUT_MS 10000
@@ -1,53 +1,80 @@
 #include <stdio.h>
 #include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
 
 #include "ff.h"
 #include "esp_partition.h"
 #include "wear_levelling.h"
 #include "diskio.h"
 #include "diskio_wl.h"
+#include "esp_vfs.h"
+#include "esp_vfs_fat.h"
+#include "SpiFlash.h"
 
 #include "catch.hpp"
 
 extern "C" void init_spi_flash(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin);
+extern SpiFlash spiflash;
 
-TEST_CASE("create volume, open file, write and read back data", "[fatfs]")
+static FATFS s_fs;
+
+// Create FAT volume on the wear-levelled partition and mount it as the default volume
+static void test_setup(wl_handle_t* wl_handle, BYTE* pdrv)
 {
     init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
 
     FRESULT fr_result;
-    BYTE pdrv;
-    FATFS fs;
-    FIL file;
-    UINT bw;
-
     esp_err_t esp_result;
 
     const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, "storage");
-    
+
     // Mount wear-levelled partition
-    wl_handle_t wl_handle;
-    esp_result = wl_mount(partition, &wl_handle);
+    esp_result = wl_mount(partition, wl_handle);
     REQUIRE(esp_result == ESP_OK);
 
     // Get a physical drive
-    esp_result = ff_diskio_get_drive(&pdrv);
+    esp_result = ff_diskio_get_drive(pdrv);
     REQUIRE(esp_result == ESP_OK);
 
     // Register physical drive as wear-levelled partition
-    esp_result = ff_diskio_register_wl_partition(pdrv, wl_handle);
+    esp_result = ff_diskio_register_wl_partition(*pdrv, *wl_handle);
+    REQUIRE(esp_result == ESP_OK);
 
     // Create FAT volume on the entire disk
     DWORD part_list[] = {100, 0, 0, 0};
     BYTE work_area[FF_MAX_SS];
 
-    fr_result = f_fdisk(pdrv, part_list, work_area);
+    fr_result = f_fdisk(*pdrv, part_list, work_area);
     REQUIRE(fr_result == FR_OK);
     fr_result = f_mkfs("", FM_ANY, 0, work_area, sizeof(work_area)); // Use default volume
+    REQUIRE(fr_result == FR_OK);
 
     // Mount the volume
-    fr_result = f_mount(&fs, "", 0);
+    fr_result = f_mount(&s_fs, "", 0);
     REQUIRE(fr_result == FR_OK);
+}
+
+static void test_teardown(wl_handle_t wl_handle, BYTE pdrv)
+{
+    // Unmount default volume
+    REQUIRE(f_mount(0, "", 0) == FR_OK);
+
+    ff_diskio_unregister(pdrv);
+    REQUIRE(wl_unmount(wl_handle) == ESP_OK);
+}
+
+TEST_CASE("create volume, open file, write and read back data", "[fatfs]")
+{
+    FRESULT fr_result;
+    FIL file;
+    UINT bw;
+
+    wl_handle_t wl_handle;
+    BYTE pdrv;
+    test_setup(&wl_handle, &pdrv);
 
     // Open, write and read data
     fr_result = f_open(&file, "test.txt", FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
@@ -84,10 +111,425 @@ TEST_CASE("create volume, open file, write and read back data", "[fatfs]")
     fr_result = f_close(&file);
     REQUIRE(fr_result == FR_OK);
 
-    // Unmount default volume
-    fr_result = f_mount(0, "", 0);
-    REQUIRE(fr_result == FR_OK);
+    test_teardown(wl_handle, pdrv);
 
     free(read);
     free(data);
 }
+
+// Register the default volume in VFS at /fat, with the given per-file buffers
+static void test_vfs_register(size_t read_ahead_size, size_t write_buffer_size)
+{
+    esp_vfs_fat_mount_config_t mount_config = {};
+    mount_config.max_files = 2;
+    mount_config.read_ahead_size = read_ahead_size;
+    mount_config.write_buffer_size = write_buffer_size;
+    FATFS* fs;
+    REQUIRE(esp_vfs_fat_register_cfg("/fat", "", &mount_config, &fs) == ESP_OK);
+    REQUIRE(f_mount(fs, "", 0) == FR_OK);
+}
+
+static void test_vfs_unregister()
+{
+    REQUIRE(f_mount(0, "", 0) == FR_OK);
+    REQUIRE(esp_vfs_fat_unregister_path("/fat") == ESP_OK);
+}
+
+static uint32_t random_read_checks(int fd, uint32_t file_size, uint32_t file_id, int count)
+{
+    uint32_t seed = 1;
+    uint32_t errors = 0;
+    uint32_t buf[16];
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t offset = (seed >> 8) % (file_size - sizeof(buf));
+        offset -= offset % sizeof(uint32_t);
+        REQUIRE(esp_vfs_lseek(NULL, fd, offset, SEEK_SET) == (off_t) offset);
+        REQUIRE(esp_vfs_read(NULL, fd, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+        for (size_t m = 0; m < sizeof(buf) / sizeof(uint32_t); m++) {
+            if (buf[m] != ((offset + m * sizeof(uint32_t)) ^ file_id)) {
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+TEST_CASE("random-offset reads with and without fast seek", "[fatfs][fast_seek]")
+{
+    FIL file[2];
+    UINT bw;
+
+    wl_handle_t wl_handle;
+    BYTE pdrv;
+    test_setup(&wl_handle, &pdrv);
+
+    // Write two files in turns, so that their clusters interleave
+    const uint32_t chunk_size = 4096;
+    const uint32_t chunks = 64;
+    const uint32_t file_size = chunk_size * chunks;
+    uint32_t* chunk = (uint32_t*) malloc(chunk_size);
+    const char* names[] = {"a.bin", "b.bin"};
+    for (int f = 0; f < 2; f++) {
+        REQUIRE(f_open(&file[f], names[f], FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    }
+    for (uint32_t c = 0; c < chunks; c++) {
+        for (uint32_t f = 0; f < 2; f++) {
+            for (uint32_t m = 0; m < chunk_size / sizeof(uint32_t); m++) {
+                chunk[m] = (c * chunk_size + m * sizeof(uint32_t)) ^ f;
+            }
+            REQUIRE(f_write(&file[f], chunk, chunk_size, &bw) == FR_OK);
+            REQUIRE(bw == chunk_size);
+        }
+    }
+    for (int f = 0; f < 2; f++) {
+        REQUIRE(f_close(&file[f]) == FR_OK);
+    }
+    free(chunk);
+
+    // every chunk is a separate fragment, more than the initial size of the cluster link map table
+    test_vfs_register(0, 0);
+    int fd = esp_vfs_open(NULL, "/fat/a.bin", O_RDONLY, 0);
+    REQUIRE(fd >= 0);
+    const int count = 20000;
+    double time_ms[2];
+    double flash_time_ms[2];
+    uint32_t flash_reads[2];
+    for (int fast = 0; fast < 2; fast++) {
+        REQUIRE(esp_vfs_ioctl(fd, FATFS_IOCTL_FAST_SEEK, fast) == 0);
+        spiflash.reset_stats();
+        auto start = std::chrono::steady_clock::now();
+        CHECK(random_read_checks(fd, file_size, 0, count) == 0);
+        auto end = std::chrono::steady_clock::now();
+        time_ms[fast] = std::chrono::duration<double, std::milli>(end - start).count();
+        flash_time_ms[fast] = spiflash.get_time() / 1000.0;
+        flash_reads[fast] = spiflash.get_read_ops();
+    }
+    // fast seek mode stops at the end of the file
+    CHECK(esp_vfs_lseek(NULL, fd, file_size + 100, SEEK_SET) == (off_t) file_size);
+    REQUIRE(esp_vfs_ioctl(fd, FATFS_IOCTL_FAST_SEEK, 0) == 0);
+    printf("%d random reads from %d kB file: follow FAT %.1f ms, %d flash reads (%.1f ms); fast seek %.1f ms, %d flash reads (%.1f ms)\n",
+           count, (int) file_size / 1024, time_ms[0], (int) flash_reads[0], flash_time_ms[0],
+           time_ms[1], (int) flash_reads[1], flash_time_ms[1]);
+    CHECK(flash_reads[1] < flash_reads[0]);
+    REQUIRE(esp_vfs_close(NULL, fd) == 0);
+
+    test_vfs_unregister();
+    test_teardown(wl_handle, pdrv);
+}
+
+TEST_CASE("small records through vfs_fat with and without file buffers", "[fatfs][vfs_buffers]")
+{
+    wl_handle_t wl_handle;
+    BYTE pdrv;
+    test_setup(&wl_handle, &pdrv);
+
+    const size_t record_size = 24;
+    const size_t records = 4096;
+    char record[record_size + 1];
+    double write_flash_ms[2];
+    double read_flash_ms[2];
+    for (int buffered = 0; buffered < 2; buffered++) {
+        test_vfs_register(buffered ? 4096 : 0, buffered ? 4096 : 0);
+
+        spiflash.reset_stats();
+        int fd = esp_vfs_open(NULL, "/fat/log.csv", O_WRONLY | O_CREAT | O_TRUNC, 0);
+        REQUIRE(fd >= 0);
+        for (size_t i = 0; i < records; i++) {
+            snprintf(record, sizeof(record), "%8d,%8d,%4d\n", (int) i, (int) (i * 7919), (int) (i % 1000));
+            REQUIRE(esp_vfs_write(NULL, fd, record, record_size) == (ssize_t) record_size);
+        }
+        REQUIRE(esp_vfs_close(NULL, fd) == 0);
+        write_flash_ms[buffered] = spiflash.get_time() / 1000.0;
+
+        struct stat st;
+        REQUIRE(esp_vfs_stat(NULL, "/fat/log.csv", &st) == 0);
+        CHECK(st.st_size == (off_t) (record_size * records));
+        CHECK(esp_vfs_stat(NULL, "/fat/missing.csv", &st) == -1);
+
+        spiflash.reset_stats();
+        fd = esp_vfs_open(NULL, "/fat/log.csv", O_RDONLY, 0);
+        REQUIRE(fd >= 0);
+        for (size_t i = 0; i < records; i++) {
+            REQUIRE(esp_vfs_read(NULL, fd, record + i % 2, record_size) == (ssize_t) record_size);
+            memmove(record, record + i % 2, record_size);
+            record[record_size] = 0;
+            if (i % 1024 == 0) {
+                int fields[3];
+                REQUIRE(sscanf(record, "%d,%d,%d", &fields[0], &fields[1], &fields[2]) == 3);
+                REQUIRE(fields[0] == (int) i);
+                REQUIRE(fields[1] == (int) (i * 7919));
+                REQUIRE(fields[2] == (int) (i % 1000));
+            }
+        }
+        CHECK(esp_vfs_read(NULL, fd, record, record_size) == 0);
+        REQUIRE(esp_vfs_close(NULL, fd) == 0);
+        read_flash_ms[buffered] = spiflash.get_time() / 1000.0;
+
+        test_vfs_unregister();
+    }
+    // Throughput is limited by the time the flash simulator spends in flash operations
+    double kbytes = record_size * records / 1024.0;
+    printf("Writing %d records of %d bytes: unbuffered %.1f ms (%.1f kB/s); buffered %.1f ms (%.1f kB/s)\n",
+           (int) records, (int) record_size, write_flash_ms[0], kbytes * 1000 / write_flash_ms[0],
+           write_flash_ms[1], kbytes * 1000 / write_flash_ms[1]);
+    printf("Reading %d records of %d bytes: unbuffered %.1f ms (%.1f kB/s); buffered %.1f ms (%.1f kB/s)\n",
+           (int) records, (int) record_size, read_flash_ms[0], kbytes * 1000 / read_flash_ms[0],
+           read_flash_ms[1], kbytes * 1000 / read_flash_ms[1]);
+    CHECK(write_flash_ms[1] * 2 < write_flash_ms[0]);
+    CHECK(read_flash_ms[1] < read_flash_ms[0]);
+
+    test_teardown(wl_handle, pdrv);
+}
+
+TEST_CASE("file buffers of vfs_fat keep file contents and position consistent", "[fatfs][vfs_buffers]")
+{
+    wl_handle_t wl_handle;
+    BYTE pdrv;
+    test_setup(&wl_handle, &pdrv);
+    test_vfs_register(256, 256);
+
+    // Do the same random operations on the file and on a copy in RAM
+    const size_t max_size = 8192;
+    uint8_t* expected = (uint8_t*) calloc(1, max_size);
+    uint8_t* data = (uint8_t*) malloc(max_size);
+    size_t size = 0;
+    size_t pos = 0;
+    int fd = esp_vfs_open(NULL, "/fat/rand.bin", O_RDWR | O_CREAT | O_TRUNC, 0);
+    REQUIRE(fd >= 0);
+    srand(1);
+    for (int i = 0; i < 5000; i++) {
+        size_t len = (rand() % 4 == 0) ? rand() % 600 : rand() % 40;
+        switch (rand() % 4) {
+        case 0: { // write, maybe past the end of the file
+            len = std::min(len, max_size - pos);
+            for (size_t k = 0; k < len; k++) {
+                data[k] = rand();
+            }
+            REQUIRE(esp_vfs_write(NULL, fd, data, len) == (ssize_t) len);
+            memcpy(expected + pos, data, len);
+            pos += len;
+            size = std::max(size, pos);
+            break;
+        }
+        case 1: { // read
+            ssize_t res = esp_vfs_read(NULL, fd, data, len);
+            size_t read = std::min(len, size - std::min(pos, size));
+            REQUIRE(res == (ssize_t) read);
+            REQUIRE(memcmp(data, expected + pos, read) == 0);
+            pos += read;
+            break;
+        }
+        case 2: { // seek forward or backward within the file
+            pos = rand() % (size + 1);
+            REQUIRE(esp_vfs_lseek(NULL, fd, pos, SEEK_SET) == (off_t) pos);
+            break;
+        }
+        case 3: { // check position and size
+            REQUIRE(esp_vfs_lseek(NULL, fd, 0, SEEK_CUR) == (off_t) pos);
+            struct stat st;
+            REQUIRE(esp_vfs_fstat(NULL, fd, &st) == 0);
+            REQUIRE(st.st_size == (off_t) size);
+            break;
+        }
+        }
+    }
+    REQUIRE(esp_vfs_close(NULL, fd) == 0);
+
+    // Data written in the last operations is in the file after close
+    fd = esp_vfs_open(NULL, "/fat/rand.bin", O_RDONLY, 0);
+    REQUIRE(fd >= 0);
+    REQUIRE(esp_vfs_read(NULL, fd, data, max_size) == (ssize_t) size);
+    CHECK(memcmp(data, expected, size) == 0);
+    REQUIRE(esp_vfs_close(NULL, fd) == 0);
+
+    // With O_APPEND, every write goes to the end of the file
+    fd = esp_vfs_open(NULL, "/fat/rand.bin", O_RDWR | O_APPEND, 0);
+    REQUIRE(fd >= 0);
+    REQUIRE(esp_vfs_read(NULL, fd, data, 10) == 10);
+    REQUIRE(esp_vfs_write(NULL, fd, "append", 6) == 6);
+    REQUIRE(esp_vfs_lseek(NULL, fd, 0, SEEK_CUR) == (off_t) size + 6);
+    REQUIRE(esp_vfs_lseek(NULL, fd, 0, SEEK_SET) == 0);
+    REQUIRE(esp_vfs_write(NULL, fd, "end", 3) == 3);
+    REQUIRE(esp_vfs_lseek(NULL, fd, -9, SEEK_END) == (off_t) size);
+    REQUIRE(esp_vfs_read(NULL, fd, data, 20) == 9);
+    CHECK(memcmp(data, "appendend", 9) == 0);
+    REQUIRE(esp_vfs_close(NULL, fd) == 0);
+
+    free(data);
+    free(expected);
+    test_vfs_unregister();
+    test_teardown(wl_handle, pdrv);
+}
+
+// RAM disk whose reads take some time, like transfers from a card, and can overlap
+static const UINT s_ram_disk_sector_size = 512;
+static const DWORD s_ram_disk_sectors = 8192;
+static BYTE* s_ram_disk;
+static int s_ram_disk_read_latency_us;
+
+static DSTATUS ram_disk_init(BYTE pdrv)
+{
+    return 0;
+}
+
+static DSTATUS ram_disk_status(BYTE pdrv)
+{
+    return 0;
+}
+
+static DRESULT ram_disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(s_ram_disk_read_latency_us));
+    memcpy(buff, s_ram_disk + sector * s_ram_disk_sector_size, count * s_ram_disk_sector_size);
+    return RES_OK;
+}
+
+static DRESULT ram_disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
+{
+    memcpy(s_ram_disk + sector * s_ram_disk_sector_size, buff, count * s_ram_disk_sector_size);
+    return RES_OK;
+}
+
+static DRESULT ram_disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+    switch (cmd) {
+    case CTRL_SYNC:
+        return RES_OK;
+    case GET_SECTOR_COUNT:
+        *((DWORD*) buff) = s_ram_disk_sectors;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *((WORD*) buff) = s_ram_disk_sector_size;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *((DWORD*) buff) = 1;
+        return RES_OK;
+    }
+    return RES_ERROR;
+}
+
+// Read a file written by the test below and count bytes which differ from the pattern
+static int read_file_checks(const char* name, BYTE mode, uint32_t file_size, uint32_t chunk_size)
+{
+    FIL file;
+    UINT br;
+    int errors = 0;
+    FILINFO info;
+    if (f_stat(name, &info) != FR_OK || info.fsize != file_size || f_open(&file, name, mode) != FR_OK) {
+        return -1;
+    }
+    uint8_t* data = (uint8_t*) malloc(chunk_size);
+    for (uint32_t offset = 0; offset < file_size; offset += br) {
+        if (f_read(&file, data, chunk_size, &br) != FR_OK || br == 0) {
+            errors++;
+            break;
+        }
+        for (uint32_t i = 0; i < br; i++) {
+            errors += data[i] != (uint8_t) ((offset + i) * 7 + name[0]);
+        }
+    }
+    f_close(&file);
+    free(data);
+    return errors;
+}
+
+TEST_CASE("several tasks read files of one volume at once", "[fatfs][concurrent_readers]")
+{
+    s_ram_disk = (BYTE*) calloc(s_ram_disk_sectors, s_ram_disk_sector_size);
+    s_ram_disk_read_latency_us = 0;
+    const ff_diskio_impl_t ram_disk_impl = {
+        .init = &ram_disk_init,
+        .status = &ram_disk_status,
+        .read = &ram_disk_read,
+        .write = &ram_disk_write,
+        .ioctl = &ram_disk_ioctl
+    };
+    BYTE pdrv;
+    REQUIRE(ff_diskio_get_drive(&pdrv) == ESP_OK);
+    ff_diskio_register(pdrv, &ram_disk_impl);
+
+    DWORD part_list[] = {100, 0, 0, 0};
+    BYTE work_area[FF_MAX_SS];
+    REQUIRE(f_fdisk(pdrv, part_list, work_area) == FR_OK);
+    REQUIRE(f_mkfs("", FM_ANY, 16 * 1024, work_area, sizeof(work_area)) == FR_OK);
+    REQUIRE(f_mount(&s_fs, "", 0) == FR_OK);
+
+    const int readers = 4;
+    const uint32_t file_size = 128 * 1024;
+    const char* names[readers + 1] = {"a.bin", "b.bin", "c.bin", "d.bin", "e.bin"};
+    uint8_t* data = (uint8_t*) malloc(file_size);
+    for (int f = 0; f < readers; f++) {
+        FIL file;
+        UINT bw;
+        for (uint32_t i = 0; i < file_size; i++) {
+            data[i] = (uint8_t) (i * 7 + names[f][0]);
+        }
+        REQUIRE(f_open(&file, names[f], FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+        REQUIRE(f_write(&file, data, file_size, &bw) == FR_OK);
+        REQUIRE(bw == file_size);
+        REQUIRE(f_close(&file) == FR_OK);
+    }
+
+    // Files opened for writing too are read with the exclusive lock, the others with the shared one.
+    // Meanwhile another task keeps writing a file of its own.
+    auto read_files = [&](bool shared, uint32_t chunk_size) {
+        std::vector<int> errors(readers);
+        std::vector<std::thread> threads;
+        FRESULT writer_result = FR_OK;
+        auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < readers; f++) {
+            threads.emplace_back([&, f]() {
+                errors[f] = read_file_checks(names[f], shared ? FA_READ : FA_READ | FA_WRITE, file_size, chunk_size);
+            });
+        }
+        std::thread writer([&]() {
+            FIL file;
+            UINT bw;
+            writer_result = f_open(&file, names[readers], FA_CREATE_ALWAYS | FA_WRITE);
+            for (uint32_t offset = 0; offset < file_size && writer_result == FR_OK; offset += chunk_size) {
+                writer_result = f_write(&file, data, chunk_size, &bw);
+            }
+            if (writer_result == FR_OK) {
+                writer_result = f_close(&file);
+            }
+        });
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+        writer.join();
+        for (int f = 0; f < readers; f++) {
+            CHECK(errors[f] == 0);
+        }
+        CHECK(writer_result == FR_OK);
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    };
+
+    s_ram_disk_read_latency_us = 200;
+    const uint32_t chunk_size = 4096;
+    double time_ms[2];
+    for (int shared = 0; shared < 2; shared++) {
+        time_ms[shared] = read_files(shared, chunk_size);
+    }
+    printf("%d tasks reading %d kB files in %d byte chunks: exclusive lock %.1f ms, shared lock %.1f ms\n",
+           readers, (int) file_size / 1024, (int) chunk_size, time_ms[0], time_ms[1]);
+    CHECK(time_ms[1] * 2 < time_ms[0]);
+
+    // Chunks which are not a multiple of the sector size also go through the window of the volume
+    read_files(true, 3000);
+
+    // The volume is consistent after concurrent reads and writes
+    s_ram_disk_read_latency_us = 0;
+    FILINFO info;
+    REQUIRE(f_stat(names[readers], &info) == FR_OK);
+    CHECK(info.fsize >= file_size);
+    for (int f = 0; f < readers; f++) {
+        CHECK(read_file_checks(names[f], FA_READ, file_size, 4096) == 0);
+    }
+
+    free(data);
+    REQUIRE(f_mount(0, "", 0) == FR_OK);
+    ff_diskio_unregister(pdrv);
+    free(s_ram_disk);
+}
@@ -2,7 +2,11 @@
 # Component Makefile
 #
 
-COMPONENT_OBJS := heap_caps_init.o heap_caps.o multi_heap.o heap_trace.o
+COMPONENT_OBJS := heap_caps_init.o heap_caps.o heap_pool.o multi_heap.o multi_heap_tlsf.o heap_trace.o
+
+ifdef CONFIG_HEAP_SMALL_CACHE
+COMPONENT_OBJS += heap_small_cache.o
+endif
 
 ifndef CONFIG_HEAP_POISONING_DISABLED
 COMPONENT_OBJS += multi_heap_poisoning.o
@@ -15,12 +15,16 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <sys/param.h>
 #include "esp_attr.h"
 #include "esp_heap_caps.h"
 #include "multi_heap.h"
 #include "esp_log.h"
 #include "heap_private.h"
+#ifdef CONFIG_HEAP_SMALL_CACHE
+#include "heap_small_cache.h"
+#endif
 
 /*
 This file, combined with a region allocator that supports multiple heaps, solves the problem that the ESP32 has RAM
@@ -60,6 +64,203 @@ bool heap_caps_match(const heap_t *heap, uint32_t caps)
     return heap->heap != NULL && ((get_all_caps(heap) & caps) == caps);
 }
 
+/* Caps masks which heap_caps_malloc() & co are commonly called with. For each of these, the heaps which have all the
+   caps are linked into a list (via heap_t.dispatch_next) in the order heap_caps_malloc() tries them, so only these
+   heaps have to be looked at. Other masks search all registered heaps.
+
+   (In DRAM as heap_caps_malloc() may run while the flash cache is disabled.)
+*/
+static DRAM_ATTR const uint32_t dispatch_masks[HEAP_DISPATCH_MASKS] = {
+    MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL,
+    MALLOC_CAP_DEFAULT,
+    MALLOC_CAP_8BIT,
+    MALLOC_CAP_32BIT,
+    MALLOC_CAP_INTERNAL,
+    MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+    MALLOC_CAP_DMA,
+    MALLOC_CAP_DMA | MALLOC_CAP_8BIT,
+    MALLOC_CAP_SPIRAM,
+    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+    MALLOC_CAP_DEFAULT | MALLOC_CAP_SPIRAM,
+    MALLOC_CAP_EXEC | MALLOC_CAP_32BIT,
+};
+
+static heap_t *dispatch_first[HEAP_DISPATCH_MASKS];
+
+/* Return the index of caps in dispatch_masks, or -1 */
+IRAM_ATTR static int dispatch_mask_index(uint32_t caps)
+{
+    for (int mask = 0; mask < HEAP_DISPATCH_MASKS; mask++) {
+        if (dispatch_masks[mask] == caps) {
+            return mask;
+        }
+    }
+    return -1;
+}
+
+/* Return the first priority at which the heap has any of the caps in mask, as heap_caps_malloc() tries all heaps
+   with a capability at priority 0 before those which have it at priority 1, etc. */
+static int dispatch_prio(const heap_t *heap, uint32_t mask)
+{
+    int prio = 0;
+    while (prio < SOC_MEMORY_TYPE_NO_PRIOS && (heap->caps[prio] & mask) == 0) {
+        prio++;
+    }
+    return prio;
+}
+
+/* Return true if heap 'a' comes before heap 'b' in registered_heaps */
+static bool registered_before(const heap_t *a, const heap_t *b)
+{
+    for (const heap_t *heap = SLIST_NEXT(a, next); heap != NULL; heap = SLIST_NEXT(heap, next)) {
+        if (heap == b) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void heap_caps_dispatch_init(heap_t *heap)
+{
+    heap->all_caps = 0;
+    for (int prio = 0; prio < SOC_MEMORY_TYPE_NO_PRIOS; prio++) {
+        heap->all_caps |= heap->caps[prio];
+    }
+    for (int mask = 0; mask < HEAP_DISPATCH_MASKS; mask++) {
+        heap->dispatch_next[mask] = NULL;
+    }
+}
+
+void heap_caps_dispatch_add(heap_t *heap)
+{
+    assert(heap->heap != NULL);
+    for (int mask = 0; mask < HEAP_DISPATCH_MASKS; mask++) {
+        if ((heap->all_caps & dispatch_masks[mask]) != dispatch_masks[mask]) {
+            continue;
+        }
+        int prio = dispatch_prio(heap, dispatch_masks[mask]);
+        heap_t **link = &dispatch_first[mask];
+        while (*link != NULL) {
+            int link_prio = dispatch_prio(*link, dispatch_masks[mask]);
+            if (link_prio > prio || (link_prio == prio && registered_before(heap, *link))) {
+                break;
+            }
+            link = &(*link)->dispatch_next[mask];
+        }
+        heap->dispatch_next[mask] = *link;
+        /* a reader on the other CPU must not see the heap before its next pointer */
+        __sync_synchronize();
+        *link = heap;
+    }
+}
+
+/* Return the heap after 'heap' (or the first heap if NULL) which has all of caps. 'mask' is dispatch_mask_index(caps).
+*/
+IRAM_ATTR static heap_t *next_matching_heap(heap_t *heap, uint32_t caps, int mask)
+{
+    if (mask >= 0) {
+        return (heap == NULL) ? dispatch_first[mask] : heap->dispatch_next[mask];
+    }
+    heap = (heap == NULL) ? SLIST_FIRST(&registered_heaps) : SLIST_NEXT(heap, next);
+    while (heap != NULL && !heap_caps_match(heap, caps)) {
+        heap = SLIST_NEXT(heap, next);
+    }
+    return heap;
+}
+
+#ifdef CONFIG_HEAP_SMALL_CACHE
+/* Allocations which ask for no other caps than these can be served from the small block cache, and blocks freed
+   into a heap which has all of them can be put into it. */
+#define SMALL_CACHE_CAPS (MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT | MALLOC_CAP_32BIT)
+
+/* One cache per CPU. Each is normally only used by its own CPU, but its mux is taken anyway as a task may migrate
+   between reading the core ID and entering the critical section, and heap_caps_get_info() reads all caches. */
+static small_cache_t small_caches[portNUM_PROCESSORS];
+static portMUX_TYPE small_cache_mux[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = portMUX_INITIALIZER_UNLOCKED
+};
+
+/* Try to take a block for this allocation from the cache of the current CPU. If there is none but the allocation
+   could have been served from the cache, *size is rounded up to its size class, so that the block can be cached
+   when it's freed.
+*/
+IRAM_ATTR static void *small_cache_malloc(size_t *size, uint32_t caps)
+{
+    if (*size == 0 || (caps & ~SMALL_CACHE_CAPS) != 0) {
+        return NULL;
+    }
+    int cls = small_cache_class(*size);
+    if (cls < 0) {
+        return NULL;
+    }
+    int core = xPortGetCoreID();
+    portENTER_CRITICAL(&small_cache_mux[core]);
+    void *ret = small_cache_get(&small_caches[core], cls);
+    portEXIT_CRITICAL(&small_cache_mux[core]);
+    if (ret == NULL) {
+        *size = small_cache_class_size(cls);
+    }
+    return ret;
+}
+
+/* Put a freed block into the cache of the current CPU. Return false if the caller has to free it instead. */
+IRAM_ATTR static bool small_cache_free(heap_t *heap, void *ptr)
+{
+    if ((get_all_caps(heap) & SMALL_CACHE_CAPS) != SMALL_CACHE_CAPS) {
+        return false;
+    }
+    int cls = small_cache_block_class(multi_heap_get_allocated_size(heap->heap, ptr));
+    if (cls < 0) {
+        return false;
+    }
+    int core = xPortGetCoreID();
+    portENTER_CRITICAL(&small_cache_mux[core]);
+    bool cached = small_cache_put(&small_caches[core], cls, ptr);
+    portEXIT_CRITICAL(&small_cache_mux[core]);
+    return cached;
+}
+
+static heap_t *find_containing_heap(void *ptr);
+
+/* Return all cached blocks to their heaps. Return true if there were any. */
+IRAM_ATTR static bool small_cache_flush(void)
+{
+    bool flushed = false;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+            while (1) {
+                portENTER_CRITICAL(&small_cache_mux[core]);
+                void *p = small_cache_get(&small_caches[core], cls);
+                portEXIT_CRITICAL(&small_cache_mux[core]);
+                if (p == NULL) {
+                    break;
+                }
+                multi_heap_free(find_containing_heap(p)->heap, p);
+                flushed = true;
+            }
+        }
+    }
+    return flushed;
+}
+#endif
+
+/* Allocate from a heap which has all of caps */
+IRAM_ATTR static void *heap_caps_malloc_from(heap_t *heap, size_t size, uint32_t caps)
+{
+    if ((caps & MALLOC_CAP_EXEC) && heap->start >= SOC_DIRAM_DRAM_LOW && heap->start < SOC_DIRAM_DRAM_HIGH) {
+        //This is special, insofar that what we're going to get back is a DRAM address. If so,
+        //we need to 'invert' it (lowest address in DRAM == highest address in IRAM and vice-versa) and
+        //add a pointer to the DRAM equivalent before the address we're going to return.
+        void *ret = multi_heap_malloc(heap->heap, size + 4);
+        if (ret != NULL) {
+            return dram_alloc_to_iram_addr(ret, size + 4);
+        }
+        return NULL;
+    }
+    //Just try to alloc, nothing special.
+    return multi_heap_malloc(heap->heap, size);
+}
+
 /*
 Routine to allocate a bit of memory with certain capabilities. caps is a bitfield of MALLOC_CAP_* bits.
 */
@@ -85,29 +286,36 @@ IRAM_ATTR void *heap_caps_malloc( size_t size, uint32_t caps )
         size = (size + 3) & (~3);
     }
 
-    for (int prio = 0; prio < SOC_MEMORY_TYPE_NO_PRIOS; prio++) {
-        //Iterate over heaps and check capabilities at this priority
-        heap_t *heap;
-        SLIST_FOREACH(heap, &registered_heaps, next) {
-            if (heap->heap == NULL) {
-                continue;
+#ifdef CONFIG_HEAP_SMALL_CACHE
+    ret = small_cache_malloc(&size, caps);
+    if (ret != NULL) {
+        return ret;
+    }
+#endif
+
+    int mask = dispatch_mask_index(caps);
+    if (mask >= 0) {
+        //Only the heaps which have all the requested caps are in the list, highest priority first
+        for (heap_t *heap = dispatch_first[mask]; heap != NULL; heap = heap->dispatch_next[mask]) {
+            ret = heap_caps_malloc_from(heap, size, caps);
+            if (ret != NULL) {
+                return ret;
             }
-            if ((heap->caps[prio] & caps) != 0) {
-                //Heap has at least one of the caps requested. If caps has other bits set that this prio
-                //doesn't cover, see if they're available in other prios.
-                if ((get_all_caps(heap) & caps) == caps) {
-                    //This heap can satisfy all the requested capabilities. See if we can grab some memory using it.
-                    if ((caps & MALLOC_CAP_EXEC) && heap->start >= SOC_DIRAM_DRAM_LOW && heap->start < SOC_DIRAM_DRAM_HIGH) {
-                        //This is special, insofar that what we're going to get back is a DRAM address. If so,
-                        //we need to 'invert' it (lowest address in DRAM == highest address in IRAM and vice-versa) and
-                        //add a pointer to the DRAM equivalent before the address we're going to return.
-                        ret = multi_heap_malloc(heap->heap, size + 4);
-                        if (ret != NULL) {
-                            return dram_alloc_to_iram_addr(ret, size + 4);
-                        }
-                    } else {
-                        //Just try to alloc, nothing special.
-                        ret = multi_heap_malloc(heap->heap, size);
+        }
+    } else {
+        for (int prio = 0; prio < SOC_MEMORY_TYPE_NO_PRIOS; prio++) {
+            //Iterate over heaps and check capabilities at this priority
+            heap_t *heap;
+            SLIST_FOREACH(heap, &registered_heaps, next) {
+                if (heap->heap == NULL) {
+                    continue;
+                }
+                if ((heap->caps[prio] & caps) != 0) {
+                    //Heap has at least one of the caps requested. If caps has other bits set that this prio
+                    //doesn't cover, see if they're available in other prios.
+                    if ((get_all_caps(heap) & caps) == caps) {
+                        //This heap can satisfy all the requested capabilities. See if we can grab some memory using it.
+                        ret = heap_caps_malloc_from(heap, size, caps);
                         if (ret != NULL) {
                             return ret;
                         }
@@ -116,6 +324,12 @@ IRAM_ATTR void *heap_caps_malloc( size_t size, uint32_t caps )
             }
         }
     }
+#ifdef CONFIG_HEAP_SMALL_CACHE
+    //Cached blocks may be what keeps the free memory too fragmented, try again without them.
+    if (small_cache_flush()) {
+        return heap_caps_malloc(size, caps);
+    }
+#endif
     //Nothing usable found.
     return NULL;
 }
@@ -266,6 +480,11 @@ IRAM_ATTR void heap_caps_free( void *ptr)
 
     heap_t *heap = find_containing_heap(ptr);
     assert(heap != NULL && "free() target pointer is outside heap areas");
+#ifdef CONFIG_HEAP_SMALL_CACHE
+    if (small_cache_free(heap, ptr)) {
+        return;
+    }
+#endif
     multi_heap_free(heap->heap, ptr);
 }
 
@@ -326,14 +545,79 @@ IRAM_ATTR void *heap_caps_calloc( size_t n, size_t size, uint32_t caps)
     return result;
 }
 
+#ifdef CONFIG_HEAP_SMALL_CACHE
+/* Add the blocks of 'heap' which are held by the small block caches to the free totals in 'info'.
+   As far as multi_heap is concerned they are still allocated. */
+static void small_cache_get_info(heap_t *heap, multi_heap_info_t *info)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        portENTER_CRITICAL(&small_cache_mux[core]);
+        for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+            const small_cache_magazine_t *mag = &small_caches[core].magazines[cls];
+            for (size_t i = 0; i < mag->count; i++) {
+                if (find_containing_heap(mag->blocks[i]) != heap) {
+                    continue;
+                }
+                size_t size = multi_heap_get_allocated_size(heap->heap, mag->blocks[i]);
+                info->total_free_bytes += size;
+                info->total_allocated_bytes -= size;
+                info->largest_free_block = MAX(info->largest_free_block, size);
+                info->allocated_blocks--;
+                info->free_blocks++;
+            }
+        }
+        portEXIT_CRITICAL(&small_cache_mux[core]);
+    }
+}
+
+/* Check that each cached block is in a heap and is cached for its own size class */
+static bool small_cache_check(bool print_errors)
+{
+    bool valid = true;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        portENTER_CRITICAL(&small_cache_mux[core]);
+        for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+            const small_cache_magazine_t *mag = &small_caches[core].magazines[cls];
+            for (size_t i = 0; i < mag->count && valid; i++) {
+                heap_t *heap = find_containing_heap(mag->blocks[i]);
+                if (heap == NULL
+                    || small_cache_block_class(multi_heap_get_allocated_size(heap->heap, mag->blocks[i])) != cls) {
+                    valid = false;
+                }
+            }
+        }
+        portEXIT_CRITICAL(&small_cache_mux[core]);
+        if (!valid) {
+            if (print_errors) {
+                printf("CORRUPT HEAP: Bad block in small block cache of CPU %d\n", core);
+            }
+            break;
+        }
+    }
+    return valid;
+}
+
+void heap_caps_small_cache_flush(void)
+{
+    small_cache_flush();
+}
+#else
+void heap_caps_small_cache_flush(void)
+{
+}
+#endif
+
 size_t heap_caps_get_free_size( uint32_t caps )
 {
     size_t ret = 0;
-    heap_t *heap;
-    SLIST_FOREACH(heap, &registered_heaps, next) {
-        if (heap_caps_match(heap, caps)) {
-            ret += multi_heap_free_size(heap->heap);
-        }
+    int mask = dispatch_mask_index(caps);
+    for (heap_t *heap = next_matching_heap(NULL, caps, mask); heap != NULL; heap = next_matching_heap(heap, caps, mask)) {
+        ret += multi_heap_free_size(heap->heap);
+#ifdef CONFIG_HEAP_SMALL_CACHE
+        multi_heap_info_t cached = { 0 };
+        small_cache_get_info(heap, &cached);
+        ret += cached.total_free_bytes;
+#endif
     }
     return ret;
 }
@@ -341,11 +625,9 @@ size_t heap_caps_get_free_size( uint32_t caps )
 size_t heap_caps_get_minimum_free_size( uint32_t caps )
 {
     size_t ret = 0;
-    heap_t *heap;
-    SLIST_FOREACH(heap, &registered_heaps, next) {
-        if (heap_caps_match(heap, caps)) {
-            ret += multi_heap_minimum_free_size(heap->heap);
-        }
+    int mask = dispatch_mask_index(caps);
+    for (heap_t *heap = next_matching_heap(NULL, caps, mask); heap != NULL; heap = next_matching_heap(heap, caps, mask)) {
+        ret += multi_heap_minimum_free_size(heap->heap);
     }
     return ret;
 }
@@ -366,6 +648,9 @@ void heap_caps_get_info( multi_heap_info_t *info, uint32_t caps )
         if (heap_caps_match(heap, caps)) {
             multi_heap_info_t hinfo;
             multi_heap_get_info(heap->heap, &hinfo);
+#ifdef CONFIG_HEAP_SMALL_CACHE
+            small_cache_get_info(heap, &hinfo);
+#endif
 
             info->total_free_bytes += hinfo.total_free_bytes;
             info->total_allocated_bytes += hinfo.total_allocated_bytes;
@@ -387,6 +672,9 @@ void heap_caps_print_heap_info( uint32_t caps )
     SLIST_FOREACH(heap, &registered_heaps, next) {
         if (heap_caps_match(heap, caps)) {
             multi_heap_get_info(heap->heap, &info);
+#ifdef CONFIG_HEAP_SMALL_CACHE
+            small_cache_get_info(heap, &info);
+#endif
 
             printf("  At 0x%08x len %d free %d allocated %d min_free %d\n",
                    heap->start, heap->end - heap->start, info.total_free_bytes, info.total_allocated_bytes, info.minimum_free_bytes);
@@ -399,6 +687,7 @@ void heap_caps_print_heap_info( uint32_t caps )
     heap_caps_get_info(&info, caps);
 
     printf("    free %d allocated %d min_free %d largest_free_block %d\n", info.total_free_bytes, info.total_allocated_bytes, info.minimum_free_bytes, info.largest_free_block);
+    heap_pool_print_info(caps);
 }
 
 bool heap_caps_check_integrity(uint32_t caps, bool print_errors)
@@ -413,6 +702,9 @@ bool heap_caps_check_integrity(uint32_t caps, bool print_errors)
             valid = multi_heap_check(heap->heap, print_errors) && valid;
         }
     }
+#ifdef CONFIG_HEAP_SMALL_CACHE
+    valid = small_cache_check(print_errors) && valid;
+#endif
 
     return valid;
 }
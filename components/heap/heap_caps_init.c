@@ -47,6 +47,7 @@ void heap_caps_enable_nonos_stack_heaps()
             register_heap(heap);
             if (heap->heap != NULL) {
                 multi_heap_set_lock(heap->heap, &heap->heap_mux);
+                heap_caps_dispatch_add(heap);
             }
         }
     }
@@ -103,6 +104,7 @@ void heap_caps_init()
         assert(heap_idx <= num_heaps);
 
         memcpy(heap->caps, type->caps, sizeof(heap->caps));
+        heap_caps_dispatch_init(heap);
         heap->start = region->start;
         heap->end = region->start + region->size;
         vPortCPUInitializeMutex(&heap->heap_mux);
@@ -150,6 +152,13 @@ void heap_caps_init()
             SLIST_INSERT_AFTER(&heaps_array[i-1], &heaps_array[i], next);
         }
     }
+
+    /* Build the lists of heaps to try for the common caps masks */
+    for (int i = 0; i < num_heaps; i++) {
+        if (heaps_array[i].heap != NULL) {
+            heap_caps_dispatch_add(&heaps_array[i]);
+        }
+    }
 }
 
 esp_err_t heap_caps_add_region(intptr_t start, intptr_t end)
@@ -212,6 +221,7 @@ esp_err_t heap_caps_add_region_with_caps(const uint32_t caps[], intptr_t start,
         goto done;
     }
     memcpy(p_new->caps, caps, sizeof(p_new->caps));
+    heap_caps_dispatch_init(p_new);
     p_new->start = start;
     p_new->end = end;
     vPortCPUInitializeMutex(&p_new->heap_mux);
@@ -229,6 +239,7 @@ esp_err_t heap_caps_add_region_with_caps(const uint32_t caps[], intptr_t start,
     static _lock_t registered_heaps_write_lock;
     _lock_acquire(&registered_heaps_write_lock);
     SLIST_INSERT_HEAD(&registered_heaps, p_new, next);
+    heap_caps_dispatch_add(p_new);
     _lock_release(&registered_heaps_write_lock);
 
     err = ESP_OK;
@@ -0,0 +1,207 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdbool.h>
+#include <stdio.h>
+#include <assert.h>
+#include <sys/lock.h>
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_heap_pool.h"
+#include "heap_private.h"
+
+/*
+  Pools of fixed-size objects.
+
+  The free objects of a pool form a singly linked list (a stack), with the link stored in the first word of each free
+  object. So that objects can be taken and returned from ISRs and both CPUs without a lock, the list head is only ever
+  changed with the S32C1I compare-and-set instruction.
+
+  Links are object indexes plus one (0 means end of list), so they fit in 16 bits. The upper 16 bits of the head are
+  a counter which changes on every update, so a compare-and-set fails if another CPU or an ISR took an object and
+  returned it in between (the "ABA problem").
+
+  The pool structure is always in internal RAM, as S32C1I doesn't work on external RAM. The objects are allocated
+  with the caps given by the caller.
+*/
+
+#define INDEX_MASK 0xFFFF
+#define TAG_INCREMENT 0x10000
+
+struct heap_pool {
+    volatile uint32_t head;     ///< Update tag (upper 16 bits) and index + 1 of the first free object (lower 16 bits)
+    volatile uint32_t free_count;
+    volatile uint32_t minimum_free_count;
+    volatile uint32_t failed_allocs;
+    size_t elem_size;
+    size_t count;
+    uint8_t *elems;
+    SLIST_ENTRY(heap_pool) next;
+};
+
+static SLIST_HEAD(heap_pool_ll, heap_pool) pools;
+static _lock_t pools_lock;
+
+/* Set *addr to 'set' if it is 'compare', return true if it was */
+IRAM_ATTR static inline bool compare_set(volatile uint32_t *addr, uint32_t compare, uint32_t set)
+{
+    uxPortCompareSet(addr, compare, &set);
+    return set == compare;
+}
+
+/* Add 'delta' to *addr, return the new value */
+IRAM_ATTR static uint32_t atomic_add(volatile uint32_t *addr, int32_t delta)
+{
+    uint32_t value;
+    do {
+        value = *addr;
+    } while (!compare_set(addr, value, value + delta));
+    return value + delta;
+}
+
+IRAM_ATTR static inline uint32_t *elem_link(heap_pool_handle_t pool, uint32_t index)
+{
+    return (uint32_t *)(pool->elems + index * pool->elem_size);
+}
+
+heap_pool_handle_t heap_pool_create(size_t elem_size, size_t count, uint32_t caps)
+{
+    if (elem_size == 0 || count == 0 || count > HEAP_POOL_MAX_COUNT) {
+        return NULL;
+    }
+    elem_size = (elem_size + 3) & ~3;
+    size_t elems_size;
+    if (__builtin_mul_overflow(elem_size, count, &elems_size)) {
+        return NULL;
+    }
+
+    heap_pool_handle_t pool = heap_caps_malloc(sizeof(struct heap_pool), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->elems = heap_caps_malloc(elems_size, caps);
+    if (pool->elems == NULL) {
+        heap_caps_free(pool);
+        return NULL;
+    }
+    pool->elem_size = elem_size;
+    pool->count = count;
+    pool->free_count = count;
+    pool->minimum_free_count = count;
+    pool->failed_allocs = 0;
+
+    for (uint32_t i = 0; i < count - 1; i++) {
+        *elem_link(pool, i) = i + 2;
+    }
+    *elem_link(pool, count - 1) = 0;
+    pool->head = 1;
+
+    _lock_acquire(&pools_lock);
+    SLIST_INSERT_HEAD(&pools, pool, next);
+    _lock_release(&pools_lock);
+    return pool;
+}
+
+void heap_pool_delete(heap_pool_handle_t pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+    _lock_acquire(&pools_lock);
+    SLIST_REMOVE(&pools, pool, heap_pool, next);
+    _lock_release(&pools_lock);
+    heap_caps_free(pool->elems);
+    heap_caps_free(pool);
+}
+
+IRAM_ATTR void *heap_pool_alloc(heap_pool_handle_t pool)
+{
+    uint32_t head, index;
+    do {
+        head = pool->head;
+        index = head & INDEX_MASK;
+        if (index == 0) {
+            atomic_add(&pool->failed_allocs, 1);
+            return NULL;
+        }
+        /* If another CPU or an ISR takes this object first, the link read here may be garbage, but then the
+           compare-and-set fails as the tag has changed */
+    } while (!compare_set(&pool->head, head, ((head + TAG_INCREMENT) & ~INDEX_MASK) | *elem_link(pool, index - 1)));
+
+    uint32_t free_count = atomic_add(&pool->free_count, -1);
+    uint32_t minimum;
+    do {
+        minimum = pool->minimum_free_count;
+    } while (free_count < minimum && !compare_set(&pool->minimum_free_count, minimum, free_count));
+    return elem_link(pool, index - 1);
+}
+
+IRAM_ATTR void heap_pool_free(heap_pool_handle_t pool, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    size_t offset = (uint8_t *)ptr - pool->elems;
+    assert((uint8_t *)ptr >= pool->elems && offset < pool->elem_size * pool->count
+           && offset % pool->elem_size == 0 && "heap_pool_free() pointer is not an object of this pool");
+    uint32_t index = offset / pool->elem_size;
+
+    uint32_t head;
+    do {
+        head = pool->head;
+        *elem_link(pool, index) = head & INDEX_MASK;
+    } while (!compare_set(&pool->head, head, ((head + TAG_INCREMENT) & ~INDEX_MASK) | (index + 1)));
+
+    atomic_add(&pool->free_count, 1);
+}
+
+void heap_pool_get_info(heap_pool_handle_t pool, heap_pool_info_t *info)
+{
+    info->elem_size = pool->elem_size;
+    info->count = pool->count;
+    info->free_count = pool->free_count;
+    info->minimum_free_count = pool->minimum_free_count;
+    info->failed_allocs = pool->failed_allocs;
+}
+
+void heap_pool_print_info(uint32_t caps)
+{
+    bool header_printed = false;
+    _lock_acquire(&pools_lock);
+    heap_pool_handle_t pool;
+    SLIST_FOREACH(pool, &pools, next) {
+        /* only list the pools whose objects are in one of the heaps being printed */
+        intptr_t elems = (intptr_t)pool->elems;
+        bool match = false;
+        heap_t *heap;
+        SLIST_FOREACH(heap, &registered_heaps, next) {
+            if (heap_caps_match(heap, caps) && elems >= heap->start && elems < heap->end) {
+                match = true;
+                break;
+            }
+        }
+        if (!match) {
+            continue;
+        }
+        if (!header_printed) {
+            printf("  Object pools:\n");
+            header_printed = true;
+        }
+        heap_pool_info_t info;
+        heap_pool_get_info(pool, &info);
+        printf("    At 0x%08x elem_size %d count %d free %d min_free %d failed_allocs %d\n",
+               (intptr_t)pool->elems, info.elem_size, info.count, info.free_count, info.minimum_free_count,
+               info.failed_allocs);
+    }
+    _lock_release(&pools_lock);
+}
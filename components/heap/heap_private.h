@@ -28,14 +28,19 @@ extern "C" {
    for heap_caps_init.c to share heap information with heap_caps.c
 */
 
+/* Number of commonly used caps masks for which heap_caps.c keeps a list of the matching heaps */
+#define HEAP_DISPATCH_MASKS 12
+
 /* Type for describing each registered heap */
 typedef struct heap_t_ {
     uint32_t caps[SOC_MEMORY_TYPE_NO_PRIOS]; ///< Capabilities for the type of memory in this heap (as a prioritised set). Copied from soc_memory_types so it's in RAM not flash.
+    uint32_t all_caps; ///< All capabilities of the heap, across all priorities
     intptr_t start;
     intptr_t end;
     portMUX_TYPE heap_mux;
     multi_heap_handle_t heap;
     SLIST_ENTRY(heap_t_) next;
+    struct heap_t_ *dispatch_next[HEAP_DISPATCH_MASKS]; ///< Next heap to try for each dispatch mask, see heap_caps_dispatch_add()
 } heap_t;
 
 /* All registered heaps.
@@ -54,13 +59,19 @@ inline static IRAM_ATTR uint32_t get_all_caps(const heap_t *heap)
     if (heap->heap == NULL) {
         return 0;
     }
-    uint32_t all_caps = 0;
-    for (int prio = 0; prio < SOC_MEMORY_TYPE_NO_PRIOS; prio++) {
-        all_caps |= heap->caps[prio];
-    }
-    return all_caps;
+    return heap->all_caps;
 }
 
+/* Initialise the fields of a new heap_t which are derived from its caps */
+void heap_caps_dispatch_init(heap_t *heap);
+
+/* Add a heap to the dispatch lists of all masks it matches. Must be called once the heap is in registered_heaps and
+   heap->heap is set, with registered_heaps locked against other writers.
+
+   Readers of the dispatch lists don't take any lock, adding a heap changes one pointer in each list.
+*/
+void heap_caps_dispatch_add(heap_t *heap);
+
 /*
  Because we don't want to add _another_ known allocation method to the stack of functions to trace wrt memory tracing,
  these are declared private. The newlib malloc()/realloc() implementation also calls these, so they are declared 
@@ -69,6 +80,9 @@ inline static IRAM_ATTR uint32_t get_all_caps(const heap_t *heap)
 void *heap_caps_realloc_default(void *p, size_t size);
 void *heap_caps_malloc_default(size_t size);
 
+/* Print the statistics of all object pools (see esp_heap_pool.h) in heaps which match caps */
+void heap_pool_print_info(uint32_t caps);
+
 
 #ifdef __cplusplus
 }
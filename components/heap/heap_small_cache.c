@@ -0,0 +1,77 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "heap_small_cache.h"
+
+/* Size classes are about 1.4 times apart, so rounding up an allocation wastes at most a third of it */
+static const uint16_t class_sizes[SMALL_CACHE_CLASSES] = { 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+
+int small_cache_class(size_t size)
+{
+    for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+        if (size <= class_sizes[cls]) {
+            return cls;
+        }
+    }
+    return -1;
+}
+
+size_t small_cache_class_size(int cls)
+{
+    return class_sizes[cls];
+}
+
+int small_cache_block_class(size_t block_size)
+{
+    const size_t max_size = class_sizes[SMALL_CACHE_CLASSES - 1];
+    if (block_size < class_sizes[0] || block_size >= max_size + max_size / 2) {
+        return -1;
+    }
+    if (block_size >= max_size) {
+        return SMALL_CACHE_CLASSES - 1;
+    }
+    /* the block may be bigger than its class size, as the heap doesn't split off tiny free blocks */
+    int cls = small_cache_class(block_size);
+    if (class_sizes[cls] > block_size) {
+        cls--;
+    }
+    return cls;
+}
+
+void *small_cache_get(small_cache_t *cache, int cls)
+{
+    small_cache_magazine_t *mag = &cache->magazines[cls];
+    if (mag->count == 0) {
+        return NULL;
+    }
+    return mag->blocks[--mag->count];
+}
+
+bool small_cache_put(small_cache_t *cache, int cls, void *p)
+{
+    small_cache_magazine_t *mag = &cache->magazines[cls];
+    /* a block freed twice must not be handed out twice, the magazine is short enough to search it */
+    for (size_t i = 0; i < mag->count; i++) {
+        if (mag->blocks[i] == p) {
+            return true;
+        }
+    }
+    if (mag->count == SMALL_CACHE_DEPTH) {
+        return false;
+    }
+    mag->blocks[mag->count++] = p;
+    return true;
+}
@@ -0,0 +1,73 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Cache of freed small heap blocks, used by heap_caps.c if CONFIG_HEAP_SMALL_CACHE is set.
+
+   There is one small_cache_t per CPU. Blocks freed on a CPU are kept in the magazine for their size class, and
+   allocations of that size class on the same CPU take them from there, without taking the heap lock. Blocks in the
+   cache are still allocated as far as multi_heap is concerned.
+
+   This file has no locking and doesn't allocate or free anything itself, the caller does both. It only depends on
+   libc, so it can be tested on the host.
+*/
+
+#ifdef CONFIG_HEAP_SMALL_CACHE_DEPTH
+#define SMALL_CACHE_DEPTH CONFIG_HEAP_SMALL_CACHE_DEPTH
+#else
+#define SMALL_CACHE_DEPTH 8
+#endif
+
+#define SMALL_CACHE_CLASSES 9
+
+typedef struct {
+    void *blocks[SMALL_CACHE_DEPTH];
+    size_t count;
+} small_cache_magazine_t;
+
+typedef struct {
+    small_cache_magazine_t magazines[SMALL_CACHE_CLASSES];
+} small_cache_t;
+
+/* Return the size class for an allocation of 'size' bytes, or -1 if it's too big to be cached */
+int small_cache_class(size_t size);
+
+/* Return the block size for the size class 'cls'. Allocations of this class should request this many bytes
+   from the heap, so their blocks can be reused for any allocation of the class. */
+size_t small_cache_class_size(int cls);
+
+/* Return the size class which a freed block with 'block_size' usable bytes can be reused for, or -1 if none */
+int small_cache_block_class(size_t block_size);
+
+/* Take a block of size class 'cls' from the cache, return NULL if there is none */
+void *small_cache_get(small_cache_t *cache, int cls);
+
+/* Put a freed block of size class 'cls' into the cache, return false if the magazine is full.
+   A block which is already in the magazine (ie it was freed twice) is not added again, and true is returned. */
+bool small_cache_put(small_cache_t *cache, int cls, void *p);
+
+#ifdef __cplusplus
+}
+#endif
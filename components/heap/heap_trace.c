@@ -33,11 +33,44 @@ static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
 static bool tracing;
 static heap_trace_mode_t mode;
 
-/* Buffer used for records, starting at offset 0
+/* Buffer used for records.
+
+   Records are never moved once they are written. The slots in use form a doubly linked list, oldest record first,
+   and the unused slots form a singly linked list. When there is no unused slot, the oldest record is dropped to make
+   space for a new one, so the buffer works as a ring. In leak trace mode, a record which is removed from the middle
+   of the buffer leaves its slot for the next allocation.
+
+   Records are also linked into chains by a hash of their address, so freeing doesn't have to search the buffer. There
+   are at least as many chains as slots, so a chain is usually only one or two records long.
+
+   The links are slot numbers, in an array allocated by heap_trace_init_standalone() which is separate from the
+   buffer, as the buffer's layout is part of the API.
 */
 static heap_trace_record_t *buffer;
 static size_t total_records;
 
+#define SLOT_NONE 0xFFFF
+#define MAX_RECORDS (SLOT_NONE - 1)
+
+typedef struct {
+    uint16_t prev;      ///< Next older record
+    uint16_t next;      ///< Next newer record, or next unused slot
+    uint16_t hash_next; ///< Next record in the same hash chain
+} slot_links_t;
+
+static slot_links_t *links;
+static uint16_t *hash_chains;
+static unsigned hash_bits;   ///< There are (1 << hash_bits) hash chains
+static uint16_t oldest = SLOT_NONE;
+static uint16_t newest = SLOT_NONE;
+static uint16_t unused = SLOT_NONE;
+
+/* Last record found by heap_trace_get(), so reading the records in order doesn't walk the list from the start each
+   time. Invalidated whenever a record is removed, as that changes the index of the records after it.
+*/
+static size_t cursor_index;
+static uint16_t cursor_slot = SLOT_NONE;
+
 /* Count of entries logged in the buffer.
 
    Maximum total_records
@@ -53,6 +86,13 @@ static size_t total_frees;
 /* Has the buffer overflowed and lost trace entries? */
 static bool has_overflowed = false;
 
+/* Callback to stream trace events to, and the number of events it couldn't take */
+static heap_trace_stream_cb_t stream_cb;
+static void *stream_arg;
+static size_t stream_dropped;
+
+static void reset_records(void);
+
 esp_err_t heap_trace_init_standalone(heap_trace_record_t *record_buffer, size_t num_records)
 {
 #ifndef CONFIG_HEAP_TRACING
@@ -62,9 +102,50 @@ esp_err_t heap_trace_init_standalone(heap_trace_record_t *record_buffer, size_t
     if (tracing) {
         return ESP_ERR_INVALID_STATE;
     }
+    if (record_buffer == NULL) {
+        num_records = 0;
+    }
+    if (num_records > MAX_RECORDS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    slot_links_t *new_links = NULL;
+    unsigned new_hash_bits = 1;
+    if (num_records > 0) {
+        while ((1 << new_hash_bits) < num_records) {
+            new_hash_bits++;
+        }
+        new_links = heap_caps_malloc(num_records * sizeof(slot_links_t) + (sizeof(uint16_t) << new_hash_bits),
+                                     MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (new_links == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    heap_caps_free(links);
+
+    links = new_links;
+    hash_chains = (uint16_t *)(new_links + num_records);
+    hash_bits = new_hash_bits;
     buffer = record_buffer;
     total_records = num_records;
-    memset(buffer, 0, num_records * sizeof(heap_trace_record_t));
+    if (buffer != NULL) {
+        memset(buffer, 0, num_records * sizeof(heap_trace_record_t));
+    }
+    reset_records();
+    return ESP_OK;
+}
+
+esp_err_t heap_trace_set_stream(heap_trace_stream_cb_t callback, void *arg)
+{
+#ifndef CONFIG_HEAP_TRACING
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+
+    if (tracing) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stream_cb = callback;
+    stream_arg = arg;
     return ESP_OK;
 }
 
@@ -74,17 +155,23 @@ esp_err_t heap_trace_start(heap_trace_mode_t mode_param)
     return ESP_ERR_NOT_SUPPORTED;
 #endif
 
-    if (buffer == NULL || total_records == 0) {
+    if ((buffer == NULL || total_records == 0) && stream_cb == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
     portENTER_CRITICAL(&trace_mux);
-
     tracing = false;
+    portEXIT_CRITICAL(&trace_mux);
+
+    /* Nothing is recorded while tracing is false, so the records can be reset outside the critical section */
+    reset_records();
+
+    portENTER_CRITICAL(&trace_mux);
+
     mode = mode_param;
-    count = 0;
     total_allocations = 0;
     total_frees = 0;
     has_overflowed = false;
+    stream_dropped = 0;
     heap_trace_resume();
 
     portEXIT_CRITICAL(&trace_mux);
@@ -118,6 +205,31 @@ size_t heap_trace_get_count(void)
     return count;
 }
 
+/* Return the slot of the record at 'index', which must be less than 'count'. Called inside the critical section. */
+static uint16_t find_record(size_t index)
+{
+    size_t i;
+    uint16_t slot;
+    if (cursor_slot != SLOT_NONE && cursor_index <= index && index - cursor_index <= count - 1 - index) {
+        i = cursor_index;
+        slot = cursor_slot;
+    } else if (index < count / 2) {
+        i = 0;
+        slot = oldest;
+    } else {
+        /* closer to the newest record */
+        for (i = count - 1, slot = newest; i > index; i--) {
+            slot = links[slot].prev;
+        }
+    }
+    for (; i < index; i++) {
+        slot = links[slot].next;
+    }
+    cursor_index = index;
+    cursor_slot = slot;
+    return slot;
+}
+
 esp_err_t heap_trace_get(size_t index, heap_trace_record_t *record)
 {
 #ifndef CONFIG_HEAP_TRACING
@@ -132,7 +244,7 @@ esp_err_t heap_trace_get(size_t index, heap_trace_record_t *record)
     if (index >= count) {
         result = ESP_ERR_INVALID_ARG; /* out of range for 'count' */
     } else {
-        memcpy(record, &buffer[index], sizeof(heap_trace_record_t));
+        memcpy(record, &buffer[find_record(index)], sizeof(heap_trace_record_t));
     }
     portEXIT_CRITICAL(&trace_mux);
     return result;
@@ -149,9 +261,21 @@ void heap_trace_dump(void)
     size_t delta_allocs = 0;
     printf("%u allocations trace (%u entry buffer)\n",
            count, total_records);
-    size_t start_count = count;
-    for (int i = 0; i < count; i++) {
-        heap_trace_record_t *rec = &buffer[i];
+    size_t start_events = total_allocations + total_frees;
+
+    portENTER_CRITICAL(&trace_mux);
+    uint16_t slot = oldest;
+    portEXIT_CRITICAL(&trace_mux);
+
+    /* Each record is copied inside the critical section, then printed outside it. If records are added or removed
+       meanwhile, the walk may continue from a reused slot, so it is limited to the size of the buffer. */
+    for (size_t i = 0; i < total_records && slot != SLOT_NONE; i++) {
+        heap_trace_record_t rec_copy;
+        heap_trace_record_t *rec = &rec_copy;
+        portENTER_CRITICAL(&trace_mux);
+        memcpy(rec, &buffer[slot], sizeof(heap_trace_record_t));
+        slot = links[slot].next;
+        portEXIT_CRITICAL(&trace_mux);
 
         if (rec->address != NULL) {
             printf("%d bytes (@ %p) allocated CPU %d ccount 0x%08x caller ",
@@ -181,42 +305,147 @@ void heap_trace_dump(void)
         printf("%u bytes 'leaked' in trace (%u allocations)\n", delta_size, delta_allocs);
     }
     printf("total allocations %u total frees %u\n", total_allocations, total_frees);
-    if (start_count != count) { // only a problem if trace isn't stopped before dumping
+    if (start_events != total_allocations + total_frees) { // only a problem if trace isn't stopped before dumping
         printf("(NB: New entries were traced while dumping, so trace dump may have duplicate entries.)\n");
     }
     if (has_overflowed) {
         printf("(NB: Buffer has overflowed, so trace data is incomplete.)\n");
     }
+    if (stream_dropped > 0) {
+        printf("(NB: %u trace events could not be streamed, so streamed trace data is incomplete.)\n", stream_dropped);
+    }
+}
+
+/* Empty the buffer. Not called while tracing. */
+static void reset_records(void)
+{
+    count = 0;
+    oldest = SLOT_NONE;
+    newest = SLOT_NONE;
+    cursor_slot = SLOT_NONE;
+    unused = (total_records > 0) ? 0 : SLOT_NONE;
+    for (size_t i = 0; i < total_records; i++) {
+        links[i].next = (i + 1 < total_records) ? i + 1 : SLOT_NONE;
+    }
+    if (links != NULL) {
+        memset(hash_chains, 0xFF, sizeof(uint16_t) << hash_bits);
+    }
+}
+
+/* Fibonacci hashing, uses the upper bits of the product as the lower bits of heap addresses are always the same */
+static IRAM_ATTR inline uint16_t *hash_chain(void *address)
+{
+    return &hash_chains[((uint32_t)(intptr_t)address * 2654435761U) >> (32 - hash_bits)];
+}
+
+static IRAM_ATTR void hash_insert(uint16_t slot)
+{
+    uint16_t *chain = hash_chain(buffer[slot].address);
+    links[slot].hash_next = *chain;
+    *chain = slot;
+}
+
+static IRAM_ATTR void hash_remove(uint16_t slot)
+{
+    for (uint16_t *p = hash_chain(buffer[slot].address); *p != SLOT_NONE; p = &links[*p].hash_next) {
+        if (*p == slot) {
+            *p = links[slot].hash_next;
+            return;
+        }
+    }
+}
+
+/* Return the slot of the newest record for address 'p' which is still in the hash chains, or SLOT_NONE */
+static IRAM_ATTR uint16_t hash_find(void *p)
+{
+    uint16_t slot;
+    for (slot = *hash_chain(p); slot != SLOT_NONE; slot = links[slot].hash_next) {
+        if (buffer[slot].address == p) {
+            break;
+        }
+    }
+    return slot;
+}
+
+/* Remove the record in 'slot' from the buffer, and make the slot unused */
+static IRAM_ATTR void remove_record(uint16_t slot)
+{
+    hash_remove(slot);
+
+    slot_links_t *l = &links[slot];
+    if (l->prev != SLOT_NONE) {
+        links[l->prev].next = l->next;
+    } else {
+        oldest = l->next;
+    }
+    if (l->next != SLOT_NONE) {
+        links[l->next].prev = l->prev;
+    } else {
+        newest = l->prev;
+    }
+    // Zero out the record to avoid ambiguity
+    memset(&buffer[slot], 0, sizeof(heap_trace_record_t));
+    l->next = unused;
+    unused = slot;
+
+    cursor_slot = SLOT_NONE;
+    count--;
+}
+
+/* Encode the CPU ID in the LSB of the ccount value */
+inline static uint32_t get_ccount(void)
+{
+    uint32_t ccount = xthal_get_ccount() & ~3;
+#ifndef CONFIG_FREERTOS_UNICORE
+    ccount |= xPortGetCoreID();
+#endif
+    return ccount;
+}
+
+/* Pass an event to the stream callback, if there is one. Called outside the critical section, as the callback may
+   take a while. Returns false if the callback couldn't take the event. */
+static IRAM_ATTR bool stream_event(heap_trace_event_t event, const heap_trace_record_t *record)
+{
+    heap_trace_stream_cb_t cb = stream_cb;
+    return cb == NULL || cb(event, record, stream_arg);
 }
 
 /* Add a new allocation to the heap trace records */
 static IRAM_ATTR void record_allocation(const heap_trace_record_t *record)
 {
+    bool streamed = stream_event(HEAP_TRACE_EVENT_ALLOC, record);
+
     portENTER_CRITICAL(&trace_mux);
     if (tracing) {
-        if (count == total_records) {
-            has_overflowed = true;
-            /* Move the whole buffer back one slot.
-
-               This is a bit slow, compared to treating this buffer as a ringbuffer and rotating a head pointer.
-
-               However, ringbuffer code gets tricky when we remove elements in mid-buffer (for leak trace mode) while
-               trying to keep track of an item count that may overflow.
-            */
-            memmove(&buffer[0], &buffer[1], sizeof(heap_trace_record_t) * (total_records -1));
-            count--;
+        if (!streamed) {
+            stream_dropped++;
+        }
+        if (total_records > 0) {
+            if (unused == SLOT_NONE) {
+                has_overflowed = true;
+                remove_record(oldest);
+            }
+            uint16_t slot = unused;
+            unused = links[slot].next;
+
+            // Copy new record into place, as the newest one
+            memcpy(&buffer[slot], record, sizeof(heap_trace_record_t));
+            links[slot].prev = newest;
+            links[slot].next = SLOT_NONE;
+            if (newest != SLOT_NONE) {
+                links[newest].next = slot;
+            } else {
+                oldest = slot;
+            }
+            newest = slot;
+            hash_insert(slot);
+            count++;
         }
-        // Copy new record into place
-        memcpy(&buffer[count], record, sizeof(heap_trace_record_t));
-        count++;
         total_allocations++;
     }
     portEXIT_CRITICAL(&trace_mux);
 }
 
-// remove a record, used when freeing
-static void remove_record(int index);
-
 /* record a free event in the heap trace log
 
    For HEAP_TRACE_ALL, this means filling in the freed_by pointer.
@@ -224,53 +453,38 @@ static void remove_record(int index);
 */
 static IRAM_ATTR void record_free(void *p, void **callers)
 {
+    bool streamed = true;
+    if (stream_cb != NULL) {
+        heap_trace_record_t rec = {
+            .address = p,
+            .ccount = get_ccount(),
+        };
+        memcpy(rec.freed_by, callers, sizeof(void *) * STACK_DEPTH);
+        streamed = stream_event(HEAP_TRACE_EVENT_FREE, &rec);
+    }
+
     portENTER_CRITICAL(&trace_mux);
-    if (tracing && count > 0) {
-        total_frees++;
-        /* search backwards for the allocation record matching this free */
-        int i;
-        for (i = count - 1; i >= 0; i--) {
-            if (buffer[i].address == p) {
-                break;
-            }
+    if (tracing) {
+        if (!streamed) {
+            stream_dropped++;
         }
+        total_frees++;
+        uint16_t slot = (count > 0) ? hash_find(p) : SLOT_NONE;
 
-        if (i >= 0) {
+        if (slot != SLOT_NONE) {
             if (mode == HEAP_TRACE_ALL) {
-                memcpy(buffer[i].freed_by, callers, sizeof(void *) * STACK_DEPTH);
+                memcpy(buffer[slot].freed_by, callers, sizeof(void *) * STACK_DEPTH);
+                /* the record stays in the buffer, but a later free of the same address belongs to a later allocation */
+                hash_remove(slot);
             } else { // HEAP_TRACE_LEAKS
                 // Leak trace mode, once an allocation is freed we remove it from the list
-                remove_record(i);
+                remove_record(slot);
             }
         }
     }
     portEXIT_CRITICAL(&trace_mux);
 }
 
-/* remove the entry at 'index' from the ringbuffer of saved records */
-static IRAM_ATTR void remove_record(int index)
-{
-    if (index < count - 1) {
-        // Remove the buffer entry from the list
-        memmove(&buffer[index], &buffer[index+1],
-                sizeof(heap_trace_record_t) * (total_records - index - 1));
-    } else {
-        // For last element, just zero it out to avoid ambiguity
-        memset(&buffer[index], 0, sizeof(heap_trace_record_t));
-    }
-    count--;
-}
-
-/* Encode the CPU ID in the LSB of the ccount value */
-inline static uint32_t get_ccount(void)
-{
-    uint32_t ccount = xthal_get_ccount() & ~3;
-#ifndef CONFIG_FREERTOS_UNICORE
-    ccount |= xPortGetCoreID();
-#endif
-    return ccount;
-}
-
 // Caller is 2 stack frames deeper than we care about
 #define STACK_OFFSET  2
 
@@ -231,6 +231,18 @@ bool heap_caps_check_integrity(uint32_t caps, bool print_errors);
  */
 bool heap_caps_check_integrity_addr(intptr_t addr, bool print_errors);
 
+/**
+ * @brief Return all blocks held by the per-CPU small block caches to their heaps.
+ *
+ * If CONFIG_HEAP_SMALL_CACHE is enabled, recently freed blocks of up to 256 bytes are kept
+ * in a cache for each CPU. They are counted as free memory, but are not merged with their
+ * neighbours until they are returned to the heap. Call this before heap_caps_dump() or before
+ * allocating a large block from fragmented memory.
+ *
+ * Does nothing if CONFIG_HEAP_SMALL_CACHE is disabled.
+ */
+void heap_caps_small_cache_flush(void);
+
 /**
  * @brief Enable malloc() in external memory and set limit below which 
  *        malloc() attempts are placed in internal memory.
@@ -0,0 +1,97 @@
+// Copyright 2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Opaque handle to a pool of fixed-size objects */
+typedef struct heap_pool *heap_pool_handle_t;
+
+/** @brief Structure to access pool statistics via heap_pool_get_info */
+typedef struct {
+    size_t elem_size;       ///< Size of each object, rounded up to a multiple of 4 bytes
+    size_t count;           ///< Total number of objects in the pool
+    size_t free_count;      ///< Number of objects which are currently free
+    size_t minimum_free_count; ///< Lowest number of free objects since the pool was created
+    size_t failed_allocs;   ///< Number of heap_pool_alloc() calls which returned NULL as the pool was empty
+} heap_pool_info_t;
+
+/** Maximum number of objects in one pool */
+#define HEAP_POOL_MAX_COUNT 0xFFFF
+
+/**
+ * @brief Create a pool of 'count' objects of 'elem_size' bytes each.
+ *
+ * All objects are allocated with a single call to heap_caps_malloc(), so using a pool
+ * instead of allocating each object from the heap avoids fragmentation, and taking an
+ * object from the pool or returning it doesn't take the heap lock.
+ *
+ * Must not be called from an ISR.
+ *
+ * @param elem_size Size of each object, in bytes. Rounded up to a multiple of 4 bytes.
+ * @param count Number of objects in the pool, at most HEAP_POOL_MAX_COUNT.
+ * @param caps Bitwise OR of MALLOC_CAP_* flags indicating the type of memory to allocate the objects from.
+ *
+ * @return Handle to the new pool, or NULL if the arguments are invalid or there is not enough memory.
+ */
+heap_pool_handle_t heap_pool_create(size_t elem_size, size_t count, uint32_t caps);
+
+/**
+ * @brief Delete a pool and free its memory.
+ *
+ * All objects taken from the pool must have been returned to it, or must not be used anymore.
+ *
+ * Must not be called from an ISR.
+ *
+ * @param pool Pool to delete. If NULL, this function does nothing.
+ */
+void heap_pool_delete(heap_pool_handle_t pool);
+
+/**
+ * @brief Take an object from a pool.
+ *
+ * This function doesn't block and can be called from an ISR.
+ *
+ * @param pool Pool to take the object from.
+ *
+ * @return Pointer to the object, 4 byte aligned, or NULL if all objects are in use.
+ */
+void *heap_pool_alloc(heap_pool_handle_t pool);
+
+/**
+ * @brief Return an object to the pool it was taken from.
+ *
+ * This function doesn't block and can be called from an ISR.
+ *
+ * @param pool Pool which the object was taken from.
+ * @param ptr Pointer to the object, as returned by heap_pool_alloc(). If NULL, this function does nothing.
+ */
+void heap_pool_free(heap_pool_handle_t pool, void *ptr);
+
+/**
+ * @brief Get statistics about a pool.
+ *
+ * @param pool Pool to get the statistics of.
+ * @param info Pointer to a structure which will be filled with the statistics.
+ */
+void heap_pool_get_info(heap_pool_handle_t pool, heap_pool_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
@@ -15,6 +15,7 @@
 
 #include "sdkconfig.h"
 #include <stdint.h>
+#include <stdbool.h>
 #include <esp_err.h>
 
 #ifdef __cplusplus
@@ -45,28 +46,87 @@ typedef struct {
     void *freed_by[CONFIG_HEAP_TRACING_STACK_DEPTH];   ///< Call stack of the caller which freed the memory (all zero if not freed.)
 } heap_trace_record_t;
 
+/**
+ * @brief Type of event passed to a heap_trace_stream_cb_t callback.
+ */
+typedef enum {
+    HEAP_TRACE_EVENT_ALLOC, ///< Memory was allocated. The record has ccount, address, size and alloced_by set.
+    HEAP_TRACE_EVENT_FREE,  ///< Memory was freed. The record has ccount, address and freed_by set, size is zero.
+} heap_trace_event_t;
+
+/**
+ * @brief Callback function which receives each heap trace event, see heap_trace_set_stream().
+ *
+ * The callback is called from inside malloc() and free(), so it must be in IRAM, must not block and must not
+ * allocate or free heap memory. It may be called from either CPU and from an ISR.
+ *
+ * @param event Type of the event.
+ * @param record Trace data of the event. Only valid during the call.
+ * @param arg Argument passed to heap_trace_set_stream().
+ * @return true if the event was accepted, false if it was lost (for example because the transport was full).
+ */
+typedef bool (*heap_trace_stream_cb_t)(heap_trace_event_t event, const heap_trace_record_t *record, void *arg);
+
 /**
  * @brief Initialise heap tracing in standalone mode.
- * @note Standalone mode is the only mode currently supported.
  *
- * This function must be called before any other heap tracing functions.
+ * This function (or heap_trace_set_stream()) must be called before any other heap tracing functions.
+ *
+ * Some internal memory is allocated to index the records, about 8 bytes per record.
  *
  * To disable heap tracing and allow the buffer to be freed, stop tracing and then call heap_trace_init_standalone(NULL, 0);
  *
  * @param record_buffer Provide a buffer to use for heap trace data. Must remain valid any time heap tracing is enabled, meaning
  * it must be allocated from internal memory not in PSRAM.
- * @param num_records Size of the heap trace buffer, as number of record structures.
+ * @param num_records Size of the heap trace buffer, as number of record structures. At most 65534.
  * @return
  *  - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing enabled in menuconfig.
  *  - ESP_ERR_INVALID_STATE Heap tracing is currently in progress.
+ *  - ESP_ERR_INVALID_ARG num_records is too large.
+ *  - ESP_ERR_NO_MEM Not enough internal memory for the index of the records.
  *  - ESP_OK Heap tracing initialised successfully.
  */
 esp_err_t heap_trace_init_standalone(heap_trace_record_t *record_buffer, size_t num_records);
 
+/**
+ * @brief Stream all heap trace events to a callback function.
+ *
+ * While tracing is running, the callback is given each allocation and free as it happens, in addition to
+ * the records kept in the buffer given to heap_trace_init_standalone() (if any). Unlike the buffer, a
+ * stream is not limited in size, so it can be used for long traces.
+ *
+ * The heap trace mode doesn't change which events are streamed. Events the callback doesn't accept are
+ * counted and reported by heap_trace_dump().
+ *
+ * @param callback Function to call for each event, or NULL to stop streaming.
+ * @param arg Argument to pass to the callback.
+ * @return
+ *  - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing enabled in menuconfig.
+ *  - ESP_ERR_INVALID_STATE Heap tracing is currently in progress.
+ *  - ESP_OK Callback set.
+ */
+esp_err_t heap_trace_set_stream(heap_trace_stream_cb_t callback, void *arg);
+
+/**
+ * @brief Stream heap trace events to the host via JTAG, using application level tracing.
+ *
+ * Calls heap_trace_set_stream() with a callback which writes each event to the application trace
+ * TRAX destination. The data can be saved on the host with OpenOCD and decoded with
+ * tools/esp_app_trace/heap_trace_proc.py.
+ *
+ * @return
+ *  - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing or application level tracing to JTAG
+ *    enabled in menuconfig.
+ *  - ESP_ERR_INVALID_STATE Heap tracing is currently in progress.
+ *  - ESP_OK Streaming set up.
+ */
+esp_err_t heap_trace_init_tohost(void);
+
 /**
  * @brief Start heap tracing. All heap allocations & frees will be traced, until heap_trace_stop() is called.
  *
- * @note heap_trace_init_standalone() must be called to provide a valid buffer, before this function is called.
+ * @note heap_trace_init_standalone() must be called to provide a valid buffer, or heap_trace_set_stream() to set a
+ * stream callback, before this function is called.
  *
  * @note Calling this function while heap tracing is running will reset the heap trace state and continue tracing.
  *
@@ -75,7 +135,7 @@ esp_err_t heap_trace_init_standalone(heap_trace_record_t *record_buffer, size_t
  * - HEAP_TRACE_LEAKS means only suspected memory leaks are traced. (When memory is freed, the record is removed from the trace buffer.)
  * @return
  * - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing enabled in menuconfig.
- * - ESP_ERR_INVALID_STATE A non-zero-length buffer has not been set via heap_trace_init_standalone().
+ * - ESP_ERR_INVALID_STATE Neither a non-zero-length buffer nor a stream callback has been set.
  * - ESP_OK Tracing is started.
  */
 esp_err_t heap_trace_start(heap_trace_mode_t mode);
@@ -119,6 +179,9 @@ size_t heap_trace_get_count(void);
  * @note It is safe to call this function while heap tracing is running, however in HEAP_TRACE_LEAK mode record indexing may
  * skip entries unless heap tracing is stopped first.
  *
+ * Records are numbered from the oldest to the newest. Reading them in order of index is fastest, other
+ * orders may have to step through the records in between.
+ *
  * @param index Index (zero-based) of the record to return.
  * @param[out] record Record where the heap trace record will be copied.
  * @return
@@ -28,6 +28,9 @@
 /* Defines compile-time configuration macros */
 #include "multi_heap_config.h"
 
+/* This is the default engine, multi_heap_tlsf.c is used instead if CONFIG_HEAP_ALLOCATOR_TLSF is set */
+#ifndef MULTI_HEAP_TLSF
+
 #ifndef MULTI_HEAP_POISONING
 /* if no heap poisoning, public API aliases directly to these implementations */
 void *multi_heap_malloc(multi_heap_handle_t heap, size_t size)
@@ -380,6 +383,12 @@ void inline multi_heap_internal_unlock(multi_heap_handle_t heap)
     MULTI_HEAP_UNLOCK(heap->lock);
 }
 
+size_t multi_heap_internal_overhead(size_t size)
+{
+    /* same as the free bytes calculation in multi_heap_register_impl() */
+    return sizeof(heap_t) + sizeof(((heap_block_t *)NULL)->header) + sizeof(heap_block_t);
+}
+
 multi_heap_block_handle_t multi_heap_get_first_block(multi_heap_handle_t heap)
 {
     return &heap->first_block;
@@ -746,3 +755,5 @@ void multi_heap_get_info_impl(multi_heap_handle_t heap, multi_heap_info_t *info)
     multi_heap_internal_unlock(heap);
 
 }
+
+#endif // MULTI_HEAP_TLSF
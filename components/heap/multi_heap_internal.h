@@ -13,6 +13,10 @@
 // limitations under the License.
 #pragma once
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Opaque handle to a heap block */
 typedef const struct heap_block *multi_heap_block_handle_t;
 
@@ -66,3 +70,11 @@ void *multi_heap_get_block_address(multi_heap_block_handle_t block);
 
 /* Get the owner identification for a heap block */
 void *multi_heap_get_block_owner(multi_heap_block_handle_t block);
+
+/* Get the number of bytes in a heap of 'size' bytes which are used by the engine itself, ie the difference between
+   'size' and the free size of the heap after it is registered (if the start and size of the heap are aligned). */
+size_t multi_heap_internal_overhead(size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -288,11 +288,8 @@ size_t multi_heap_get_allocated_size(multi_heap_handle_t heap, void *p)
 {
     poison_head_t *head = verify_allocated_region(p, true);
     assert(head != NULL);
-    size_t result = multi_heap_get_allocated_size_impl(heap, head);
-    if (result > 0) {
-        return result - POISON_OVERHEAD;
-    }
-    return 0;
+    /* the block may be bigger than requested, but the tail canary is right after the requested size */
+    return head->alloc_size;
 }
 
 void *multi_heap_get_block_owner(multi_heap_block_handle_t block)
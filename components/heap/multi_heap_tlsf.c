@@ -0,0 +1,888 @@
+// Copyright 2015-2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <multi_heap.h>
+#include "multi_heap_internal.h"
+
+/* Note: Keep platform-specific parts in this header, this source
+   file should depend on libc only */
+#include "multi_heap_platform.h"
+
+/* Defines compile-time configuration macros */
+#include "multi_heap_config.h"
+
+/* Alternative multi_heap engine with segregated free lists, in the style of TLSF ("Two-Level Segregated Fit").
+
+   The engine in multi_heap.c keeps one address-ordered free list and searches it for the best fitting block, so
+   malloc and free take longer the more fragmented the heap is. This engine keeps one free list per size class and
+   two levels of bitmaps telling which lists are not empty, so a big enough free block is usually found with a couple
+   of bit scans. Only if no size class with bigger blocks has a free block (ie the heap is nearly full), the free list
+   of the requested size class is searched for a block which fits. Free blocks know their neighbours, so free() merges
+   them without searching any list.
+
+   Both engines implement the same multi_heap_*_impl functions, only one of them is built (see CONFIG_HEAP_ALLOCATOR).
+*/
+#ifdef MULTI_HEAP_TLSF
+
+#ifndef MULTI_HEAP_POISONING
+/* if no heap poisoning, public API aliases directly to these implementations */
+void *multi_heap_malloc(multi_heap_handle_t heap, size_t size)
+    __attribute__((alias("multi_heap_malloc_impl")));
+
+void multi_heap_free(multi_heap_handle_t heap, void *p)
+    __attribute__((alias("multi_heap_free_impl")));
+
+void *multi_heap_realloc(multi_heap_handle_t heap, void *p, size_t size)
+    __attribute__((alias("multi_heap_realloc_impl")));
+
+size_t multi_heap_get_allocated_size(multi_heap_handle_t heap, void *p)
+    __attribute__((alias("multi_heap_get_allocated_size_impl")));
+
+multi_heap_handle_t multi_heap_register(void *start, size_t size)
+    __attribute__((alias("multi_heap_register_impl")));
+
+void multi_heap_get_info(multi_heap_handle_t heap, multi_heap_info_t *info)
+    __attribute__((alias("multi_heap_get_info_impl")));
+
+size_t multi_heap_free_size(multi_heap_handle_t heap)
+    __attribute__((alias("multi_heap_free_size_impl")));
+
+size_t multi_heap_minimum_free_size(multi_heap_handle_t heap)
+    __attribute__((alias("multi_heap_minimum_free_size_impl")));
+
+void *multi_heap_get_block_address(multi_heap_block_handle_t block)
+    __attribute__((alias("multi_heap_get_block_address_impl")));
+
+void *multi_heap_get_block_owner(multi_heap_block_handle_t block)
+{
+    return NULL;
+}
+
+#endif
+
+#define ALIGN(X) ((X) & ~(sizeof(void *)-1))
+#define ALIGN_UP(X) ALIGN((X)+sizeof(void *)-1)
+
+/* Size classes
+
+   Blocks smaller than SMALL_BLOCK_SIZE are split into SL_INDEX_COUNT classes of equal width (first level index 0).
+   Bigger blocks get first level index 1 for sizes 2^FL_INDEX_SHIFT..2^(FL_INDEX_SHIFT+1)-1, 2 for the next power
+   of two and so on, and every power of two range is split into SL_INDEX_COUNT classes of equal width.
+*/
+#define SL_INDEX_COUNT_LOG2 2
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_SHIFT 6
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+#define FL_INDEX_COUNT (32 - FL_INDEX_SHIFT + 1) /* enough for any heap in a 32-bit address space */
+
+struct heap_block;
+
+/* Block in the heap
+
+   All blocks form a list in address order: 'header' holds a pointer to the next block ORed with the free flag and the
+   "previous block is free" flag. The data of a block ends where the 'header' of the next block begins.
+
+   'prev_phys' is the last word of the previous block's data. It is only valid if the previous block is free (then it
+   points to the previous block), otherwise it belongs to the data of the previous block.
+
+   'next_free' and 'prev_free' are valid if the block is free and link it into the free list of its size class.
+*/
+typedef struct heap_block {
+    struct heap_block *prev_phys;       /* Previous block in the heap, valid if the PREV_FREE flag is set */
+    intptr_t header;                    /* Encodes next block in heap (used or unused) and the flags */
+    union {
+        uint8_t data[1];                /* First byte of data, valid if block is used. Actual size of data is 'block_data_size(block)' */
+        struct {
+            struct heap_block *next_free; /* Next free block of the same size class, valid if block is free */
+            struct heap_block *prev_free; /* Previous free block of the same size class, valid if block is free */
+        };
+    };
+} heap_block_t;
+
+/* These masks apply to the 'header' field of heap_block_t */
+#define BLOCK_FREE_FLAG 0x1  /* If set, this block is free & next_free/prev_free pointers are valid */
+#define PREV_FREE_FLAG 0x2   /* If set, the previous block is free & prev_phys pointer is valid */
+#define NEXT_BLOCK_MASK (~3) /* AND header with this mask to get pointer to next block (free or used) */
+
+/* A free block needs room for the free list pointers, and for 'prev_phys' of the next block */
+#define MIN_BLOCK_DATA_SIZE (sizeof(heap_block_t) - sizeof(intptr_t))
+
+/* Metadata header for the heap, stored at the beginning of heap space and followed by the table of free list heads.
+
+   'first_block' is a "fake" first block, used to provide a pointer to the first block in the heap. This block is
+   never allocated or merged into an adjacent block.
+
+   'last_block' is a pointer to a final free block of length 0, which is added at the end of the heap when it is
+   registered. This block is also never allocated or merged into an adjacent block.
+ */
+typedef struct multi_heap_info {
+    void *lock;
+    size_t free_bytes;
+    size_t minimum_free_bytes;
+    heap_block_t *last_block;
+    size_t fl_count;                      /* Number of first level indexes used by this heap */
+    uint32_t fl_bitmap;                   /* Bit n is set if any free list with first level index n is not empty */
+    uint8_t sl_bitmap[FL_INDEX_COUNT];    /* Bit n of sl_bitmap[f] is set if free list f,n is not empty */
+    heap_block_t first_block;             /* initial 'free block', never allocated */
+    heap_block_t *free[];                 /* Heads of the free lists, fl_count * SL_INDEX_COUNT entries */
+} heap_t;
+
+/* Index of the most significant bit set in 'x' */
+static inline int fls_size(size_t x)
+{
+    return sizeof(unsigned long) * 8 - 1 - __builtin_clzl(x);
+}
+
+/* Return the size class of a free block with 'size' bytes of data */
+static inline void mapping_insert(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    } else {
+        int bit = fls_size(size);
+        *sl = (size >> (bit - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = bit - FL_INDEX_SHIFT + 1;
+    }
+}
+
+/* Return the lowest size class where every free block has at least 'size' bytes of data */
+static inline void mapping_search(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK_SIZE) {
+        size += (SMALL_BLOCK_SIZE / SL_INDEX_COUNT) - 1;
+    } else {
+        size += (1 << (fls_size(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+/* Given a pointer to the 'data' field of a block (ie the previous malloc/realloc result), return a pointer to the
+   containing block.
+*/
+static inline heap_block_t *get_block(const void *data_ptr)
+{
+    return (heap_block_t *)((char *)data_ptr - offsetof(heap_block_t, data));
+}
+
+/* Return the next sequential block in the heap.
+ */
+static inline heap_block_t *get_next_block(const heap_block_t *block)
+{
+    intptr_t next = block->header & NEXT_BLOCK_MASK;
+    if (next == 0) {
+        return NULL; /* last_block */
+    }
+    assert(next > (intptr_t)block);
+    return (heap_block_t *)next;
+}
+
+/* Return true if this block is free. */
+static inline bool is_free(const heap_block_t *block)
+{
+    return block->header & BLOCK_FREE_FLAG;
+}
+
+/* Return true if the block before this one is free (and 'prev_phys' points to it) */
+static inline bool is_prev_free(const heap_block_t *block)
+{
+    return block->header & PREV_FREE_FLAG;
+}
+
+/* Return true if this block is the first in the heap */
+static inline bool is_first_block(const heap_t *heap, const heap_block_t *block)
+{
+    return (block == &heap->first_block);
+}
+
+/* Return true if this block is the last_block in the heap
+   (the only block with no next pointer) */
+static inline bool is_last_block(const heap_block_t *block)
+{
+    return (block->header & NEXT_BLOCK_MASK) == 0;
+}
+
+/* Data size of the block (excludes this block's header) */
+static inline size_t block_data_size(const heap_block_t *block)
+{
+    intptr_t next = (intptr_t)block->header & NEXT_BLOCK_MASK;
+    intptr_t this = (intptr_t)block;
+    if (next == 0) {
+        return 0; /* this is the last block in the heap */
+    }
+    return next - this - sizeof(block->header);
+}
+
+/* Point 'block' to a new next block, keeping the flags */
+static inline void set_next_block(heap_block_t *block, heap_block_t *next)
+{
+    block->header = (intptr_t)next | (block->header & ~NEXT_BLOCK_MASK);
+}
+
+/* Check a block is valid for this heap. Used to verify parameters. */
+static void assert_valid_block(const heap_t *heap, const heap_block_t *block)
+{
+    MULTI_HEAP_ASSERT(block >= &heap->first_block && block <= heap->last_block,
+                      block); // block not in heap
+    if (heap < (const heap_t *)heap->last_block) {
+        const heap_block_t *next = get_next_block(block);
+        MULTI_HEAP_ASSERT(next >= &heap->first_block && next <= heap->last_block, block); // Next block not in heap
+        if (is_free(block)) {
+            // Check block->next_free and block->prev_free are valid
+            MULTI_HEAP_ASSERT(block->next_free == NULL ||
+                              (block->next_free > &heap->first_block && block->next_free < heap->last_block), &block->next_free);
+            MULTI_HEAP_ASSERT(block->prev_free == NULL ||
+                              (block->prev_free > &heap->first_block && block->prev_free < heap->last_block), &block->prev_free);
+        }
+    }
+}
+
+/* Return the head of free list fl,sl */
+static inline heap_block_t **free_list(heap_t *heap, int fl, int sl)
+{
+    return &heap->free[fl * SL_INDEX_COUNT + sl];
+}
+
+/* Add a free block to the free list of its size class */
+static void insert_free_block(heap_t *heap, heap_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_data_size(block), &fl, &sl);
+    MULTI_HEAP_ASSERT(fl < heap->fl_count, block); // block should fit in the heap
+    heap_block_t **head = free_list(heap, fl, sl);
+
+    block->prev_free = NULL;
+    block->next_free = *head;
+    if (*head != NULL) {
+        (*head)->prev_free = block;
+    }
+    *head = block;
+    heap->fl_bitmap |= 1 << fl;
+    heap->sl_bitmap[fl] |= 1 << sl;
+}
+
+/* Remove a free block from the free list of its size class. Must be called before the size of the block changes. */
+static void remove_free_block(heap_t *heap, heap_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_data_size(block), &fl, &sl);
+    heap_block_t **head = free_list(heap, fl, sl);
+
+    if (block->prev_free != NULL) {
+        MULTI_HEAP_ASSERT(block->prev_free->next_free == block, &block->prev_free); // free list should be linked both ways
+        block->prev_free->next_free = block->next_free;
+    } else {
+        MULTI_HEAP_ASSERT(*head == block, block); // block without prev_free should be the head of its list
+        *head = block->next_free;
+    }
+    if (block->next_free != NULL) {
+        MULTI_HEAP_ASSERT(block->next_free->prev_free == block, &block->next_free); // free list should be linked both ways
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (*head == NULL) {
+        heap->sl_bitmap[fl] &= ~(1 << sl);
+        if (heap->sl_bitmap[fl] == 0) {
+            heap->fl_bitmap &= ~(1 << fl);
+        }
+    }
+}
+
+/* Mark a block free and tell the next block about it. Doesn't put the block on a free list. */
+static inline void mark_free(heap_block_t *block)
+{
+    heap_block_t *next = get_next_block(block);
+    block->header |= BLOCK_FREE_FLAG;
+    next->header |= PREV_FREE_FLAG;
+    next->prev_phys = block;
+}
+
+/* Mark a block used and tell the next block about it. Doesn't take the block off its free list. */
+static inline void mark_used(heap_block_t *block)
+{
+    heap_block_t *next = get_next_block(block);
+    block->header &= ~BLOCK_FREE_FLAG;
+    next->header &= ~PREV_FREE_FLAG;
+}
+
+/* Merge block 'b' into the preceding block 'a'. Neither block may be on a free list or counted in free_bytes.
+
+   The resulting block keeps the flags of 'a'.
+*/
+static heap_block_t *merge_adjacent(heap_t *heap, heap_block_t *a, heap_block_t *b)
+{
+    MULTI_HEAP_ASSERT(get_next_block(a) == b, a); // Blocks should be in order
+    assert(!is_first_block(heap, a));
+    assert(!is_last_block(b));
+
+    set_next_block(a, get_next_block(b));
+
+#ifdef MULTI_HEAP_POISONING_SLOW
+    /* b's former block header needs to be replaced with a fill pattern */
+    multi_heap_internal_poison_fill_region(b, sizeof(heap_block_t), true /* free */);
+#endif
+
+    return a;
+}
+
+/* Find a free block with at least 'size' bytes of data. */
+static heap_block_t *find_free_block(heap_t *heap, size_t size)
+{
+    int fl, sl;
+    heap_block_t *block = NULL;
+
+    /* Prefer the first block of the size class of 'size' itself, if it's big enough. Free blocks of a bigger class
+       would be split, which fragments the heap more. */
+    mapping_insert(size, &fl, &sl);
+    if (fl < heap->fl_count) {
+        heap_block_t *head = *free_list(heap, fl, sl);
+        if (head != NULL && block_data_size(head) >= size) {
+            return head;
+        }
+    }
+
+    /* Any block in the first non-empty size class at or after the rounded up size fits */
+    mapping_search(size, &fl, &sl);
+    if (fl < heap->fl_count) {
+        uint32_t sl_map = heap->sl_bitmap[fl] & (~0U << sl);
+        if (sl_map == 0) {
+            uint32_t fl_map = heap->fl_bitmap & (~0U << (fl + 1));
+            if (fl_map != 0) {
+                fl = __builtin_ctz(fl_map);
+                sl_map = heap->sl_bitmap[fl];
+            }
+        }
+        if (sl_map != 0) {
+            sl = __builtin_ctz(sl_map);
+            block = *free_list(heap, fl, sl);
+            MULTI_HEAP_ASSERT(block != NULL, heap); // bitmap should match the free lists
+        }
+    }
+
+    if (block == NULL) {
+        /* No bigger block, but other blocks of the same size class as 'size' may still fit. This list is only
+           searched if the heap is nearly exhausted, and the search takes time linear in the length of the list. */
+        mapping_insert(size, &fl, &sl);
+        if (fl < heap->fl_count) {
+            for (block = *free_list(heap, fl, sl); block != NULL; block = block->next_free) {
+                if (block_data_size(block) >= size) {
+                    break;
+                }
+            }
+        }
+    }
+
+    return block;
+}
+
+/* Split a used block so it can hold at least 'size' bytes of data, making any spare
+   space into a new free block (merged with the next block, if that one is free).
+*/
+static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size)
+{
+    const size_t block_size = block_data_size(block);
+    MULTI_HEAP_ASSERT(!is_free(block), block); // split block shouldn't be free
+    MULTI_HEAP_ASSERT(size <= block_size, block); // size should be valid
+    size = ALIGN_UP(size);
+    if (size < MIN_BLOCK_DATA_SIZE) {
+        size = MIN_BLOCK_DATA_SIZE;
+    }
+
+    /* can't split the head or tail block */
+    assert(!is_first_block(heap, block));
+    assert(!is_last_block(block));
+
+    if (block_size < size + sizeof(heap_block_t)) {
+        /* Can't split 'block' if we're not going to get a usable free block afterwards */
+        return;
+    }
+
+    /* The new block starts so that its 'prev_phys' is the last word of 'block' */
+    heap_block_t *new_block = (heap_block_t *)(block->data + size - sizeof(new_block->prev_phys));
+    heap_block_t *next_block = get_next_block(block);
+
+    new_block->header = (intptr_t)next_block;
+    set_next_block(block, new_block);
+
+    if (is_free(next_block) && !is_last_block(next_block)) {
+        remove_free_block(heap, next_block);
+        heap->free_bytes -= block_data_size(next_block);
+        merge_adjacent(heap, new_block, next_block);
+    }
+
+    mark_free(new_block);
+    insert_free_block(heap, new_block);
+    heap->free_bytes += block_data_size(new_block);
+}
+
+void *multi_heap_get_block_address_impl(multi_heap_block_handle_t block)
+{
+    return ((char *)block + offsetof(heap_block_t, data));
+}
+
+size_t multi_heap_get_allocated_size_impl(multi_heap_handle_t heap, void *p)
+{
+    heap_block_t *pb = get_block(p);
+
+    assert_valid_block(heap, pb);
+    MULTI_HEAP_ASSERT(!is_free(pb), pb); // block shouldn't be free
+    return block_data_size(pb);
+}
+
+/* Return the size of the heap_t header and the free list table of a heap with 'size' bytes */
+static size_t get_control_size(size_t size)
+{
+    int fl, sl;
+    /* enough free lists for a free block of the whole heap size */
+    mapping_insert(size, &fl, &sl);
+    return sizeof(heap_t) + (fl + 1) * SL_INDEX_COUNT * sizeof(heap_block_t *);
+}
+
+size_t multi_heap_internal_overhead(size_t size)
+{
+    /* control data, 'prev_phys' and 'header' of the first free block and of the last block */
+    return get_control_size(size) + 2 * offsetof(heap_block_t, data);
+}
+
+multi_heap_handle_t multi_heap_register_impl(void *start_ptr, size_t size)
+{
+    uintptr_t start = ALIGN_UP((uintptr_t)start_ptr);
+    uintptr_t end = ALIGN((uintptr_t)start_ptr + size);
+    heap_t *heap = (heap_t *)start;
+    int fl, sl;
+
+    if (end < start) {
+        return NULL;
+    }
+    size = end - start;
+
+    /* enough free lists for a free block of the whole heap size */
+    mapping_insert(size, &fl, &sl);
+    size_t control_size = get_control_size(size);
+    if (size < control_size + sizeof(heap_block_t) + offsetof(heap_block_t, data)) {
+        return NULL; /* 'size' is too small to fit a heap here */
+    }
+
+    memset(heap, 0, control_size);
+    heap->fl_count = fl + 1;
+
+    /* last block is 'free' but has a NULL next pointer. Only 'prev_phys' and 'header' of it are in the heap. */
+    heap->last_block = (heap_block_t *)(end - offsetof(heap_block_t, data));
+    heap->last_block->header = BLOCK_FREE_FLAG;
+
+    /* first 'real' (allocatable) free block goes after the free list heads */
+    heap_block_t *first_free_block = (heap_block_t *)(start + control_size);
+    first_free_block->header = (intptr_t)heap->last_block;
+    mark_free(first_free_block);
+    insert_free_block(heap, first_free_block);
+
+    /* first block also 'free' but has legitimate length,
+       malloc will never allocate into this block. */
+    heap->first_block.header = (intptr_t)first_free_block | BLOCK_FREE_FLAG;
+
+    heap->free_bytes = block_data_size(first_free_block);
+    heap->minimum_free_bytes = heap->free_bytes;
+
+    return heap;
+}
+
+void multi_heap_set_lock(multi_heap_handle_t heap, void *lock)
+{
+    heap->lock = lock;
+}
+
+void inline multi_heap_internal_lock(multi_heap_handle_t heap)
+{
+    MULTI_HEAP_LOCK(heap->lock);
+}
+
+void inline multi_heap_internal_unlock(multi_heap_handle_t heap)
+{
+    MULTI_HEAP_UNLOCK(heap->lock);
+}
+
+multi_heap_block_handle_t multi_heap_get_first_block(multi_heap_handle_t heap)
+{
+    return &heap->first_block;
+}
+
+multi_heap_block_handle_t multi_heap_get_next_block(multi_heap_handle_t heap, multi_heap_block_handle_t block)
+{
+    heap_block_t *next = get_next_block(block);
+    /* check for valid free last block to avoid assert in assert_valid_block */
+    if (next == heap->last_block && is_last_block(next) && is_free(next)) {
+        return NULL;
+    }
+    assert_valid_block(heap, next);
+    return next;
+}
+
+bool multi_heap_is_free(multi_heap_block_handle_t block)
+{
+    return is_free(block);
+}
+
+void *multi_heap_malloc_impl(multi_heap_handle_t heap, size_t size)
+{
+    size = ALIGN_UP(size);
+
+    if (size == 0 || heap == NULL) {
+        return NULL;
+    }
+    if (size < MIN_BLOCK_DATA_SIZE) {
+        size = MIN_BLOCK_DATA_SIZE;
+    }
+
+    multi_heap_internal_lock(heap);
+
+    if (heap->free_bytes < size) {
+        multi_heap_internal_unlock(heap);
+        return NULL;
+    }
+
+    heap_block_t *block = find_free_block(heap, size);
+    if (block == NULL) {
+        multi_heap_internal_unlock(heap);
+        return NULL; /* No room in heap */
+    }
+
+    remove_free_block(heap, block);
+    mark_used(block);
+    heap->free_bytes -= block_data_size(block);
+#ifdef MULTI_HEAP_POISONING_SLOW
+    /* 'prev_phys' of the next block is now data of this block, and needs to be replaced with a fill pattern */
+    multi_heap_internal_poison_fill_region(&get_next_block(block)->prev_phys, sizeof(block->prev_phys), true /* free */);
+#endif
+
+    split_if_necessary(heap, block, size);
+
+    if (heap->free_bytes < heap->minimum_free_bytes) {
+        heap->minimum_free_bytes = heap->free_bytes;
+    }
+
+    multi_heap_internal_unlock(heap);
+
+    return block->data;
+}
+
+void multi_heap_free_impl(multi_heap_handle_t heap, void *p)
+{
+    heap_block_t *pb = get_block(p);
+
+    if (heap == NULL || p == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+
+    assert_valid_block(heap, pb);
+    MULTI_HEAP_ASSERT(!is_free(pb), pb); // block should not be free
+    MULTI_HEAP_ASSERT(!is_last_block(pb), pb); // block should not be last block
+    MULTI_HEAP_ASSERT(!is_first_block(heap, pb), pb); // block should not be first block
+
+    /* Try and merge this block into the previous one */
+    if (is_prev_free(pb)) {
+        heap_block_t *prev = pb->prev_phys;
+        assert_valid_block(heap, prev);
+        MULTI_HEAP_ASSERT(is_free(prev), prev); // previous block should be free
+        remove_free_block(heap, prev);
+        heap->free_bytes -= block_data_size(prev);
+        pb = merge_adjacent(heap, prev, pb);
+    }
+
+    /* If next block is free, try to merge the two */
+    heap_block_t *next = get_next_block(pb);
+    if (is_free(next) && !is_last_block(next)) {
+        remove_free_block(heap, next);
+        heap->free_bytes -= block_data_size(next);
+        pb = merge_adjacent(heap, pb, next);
+    }
+
+    mark_free(pb);
+    insert_free_block(heap, pb);
+    heap->free_bytes += block_data_size(pb);
+
+    multi_heap_internal_unlock(heap);
+}
+
+void *multi_heap_realloc_impl(multi_heap_handle_t heap, void *p, size_t size)
+{
+    heap_block_t *pb = get_block(p);
+    void *result;
+    size = ALIGN_UP(size);
+
+    assert(heap != NULL);
+
+    if (p == NULL) {
+        return multi_heap_malloc_impl(heap, size);
+    }
+
+    assert_valid_block(heap, pb);
+    // non-null realloc arg should be allocated
+    MULTI_HEAP_ASSERT(!is_free(pb), pb);
+
+    if (size == 0) {
+        /* note: calling multi_free_impl() here as we've already been
+           through any poison-unwrapping */
+        multi_heap_free_impl(heap, p);
+        return NULL;
+    }
+
+    if (heap == NULL) {
+        return NULL;
+    }
+
+    multi_heap_internal_lock(heap);
+    result = NULL;
+
+    if (size <= block_data_size(pb)) {
+        // Shrinking....
+        split_if_necessary(heap, pb, size);
+        result = pb->data;
+    }
+    else if (heap->free_bytes < size - block_data_size(pb)) {
+        // Growing, but there's not enough total free space in the heap
+        multi_heap_internal_unlock(heap);
+        return NULL;
+    }
+
+    // New size is larger than existing block, see if we can grow into the next block
+    if (result == NULL) {
+        heap_block_t *next = get_next_block(pb);
+        if (is_free(next) && !is_last_block(next)
+            && block_data_size(pb) + sizeof(next->header) + block_data_size(next) >= size) {
+            remove_free_block(heap, next);
+            heap->free_bytes -= block_data_size(next);
+            mark_used(next);
+            pb = merge_adjacent(heap, pb, next);
+            split_if_necessary(heap, pb, size);
+            result = pb->data;
+        }
+    }
+
+    if (result == NULL) {
+        // Need to allocate elsewhere and copy data over
+        //
+        // (Calling _impl versions here as we've already been through any
+        // unwrapping for heap poisoning features.)
+        result = multi_heap_malloc_impl(heap, size);
+        if (result != NULL) {
+            memcpy(result, pb->data, block_data_size(pb));
+            multi_heap_free_impl(heap, pb->data);
+        }
+    }
+
+    if (heap->free_bytes < heap->minimum_free_bytes) {
+        heap->minimum_free_bytes = heap->free_bytes;
+    }
+
+    multi_heap_internal_unlock(heap);
+    return result;
+}
+
+#define FAIL_PRINT(MSG, ...) do {                                       \
+        if (print_errors) {                                             \
+            MULTI_HEAP_STDERR_PRINTF(MSG, __VA_ARGS__);                 \
+        }                                                               \
+        valid = false;                                                  \
+    }                                                                   \
+    while(0)
+
+bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
+{
+    bool valid = true;
+    size_t total_free_bytes = 0;
+    size_t free_blocks = 0;
+    size_t listed_blocks = 0;
+    assert(heap != NULL);
+
+    multi_heap_internal_lock(heap);
+
+    heap_block_t *prev = NULL;
+
+    /* note: not using get_next_block() in loop, so that assertions aren't checked here */
+    for(heap_block_t *b = &heap->first_block; b != NULL; b = (heap_block_t *)(b->header & NEXT_BLOCK_MASK)) {
+        if (b == prev) {
+            FAIL_PRINT("CORRUPT HEAP: Block %p points to itself\n", b);
+            goto done;
+        }
+        if (b < prev) {
+            FAIL_PRINT("CORRUPT HEAP: Block %p is before prev block %p\n", b, prev);
+            goto done;
+        }
+        if (b > heap->last_block || b < &heap->first_block) {
+            FAIL_PRINT("CORRUPT HEAP: Block %p is outside heap (last valid block %p)\n", b, prev);
+            goto done;
+        }
+        if (prev != NULL) {
+            bool prev_free = is_free(prev) && !is_first_block(heap, prev);
+            if (prev_free != is_prev_free(b)) {
+                FAIL_PRINT("CORRUPT HEAP: Block %p has wrong previous block free flag (prev block %p)\n", b, prev);
+            } else if (prev_free && b->prev_phys != prev) {
+                FAIL_PRINT("CORRUPT HEAP: Block %p points to prev block %p but prev block is %p\n", b, b->prev_phys, prev);
+            }
+        }
+        if (is_free(b)) {
+            if (prev != NULL && is_free(prev) && !is_first_block(heap, prev) && !is_last_block(b)) {
+                FAIL_PRINT("CORRUPT HEAP: Two adjacent free blocks found, %p and %p\n", prev, b);
+            }
+            if (!is_first_block(heap, b) && !is_last_block(b)) {
+                total_free_bytes += block_data_size(b);
+                free_blocks++;
+            }
+        }
+        prev = b;
+
+#ifdef MULTI_HEAP_POISONING
+        if (!is_last_block(b) && !is_first_block(heap, b)) {
+            /* For slow heap poisoning, any block should contain correct poisoning patterns and/or fills */
+            bool poison_ok;
+            if (is_free(b)) {
+                uint32_t block_len = (intptr_t)get_next_block(b) - (intptr_t)&b[1];
+                poison_ok = multi_heap_internal_check_block_poisoning(&b[1], block_len, true, print_errors);
+            }
+            else {
+                poison_ok = multi_heap_internal_check_block_poisoning(b->data, block_data_size(b), false, print_errors);
+            }
+            valid = poison_ok && valid;
+        }
+#endif
+
+    } /* for(heap_block_t b = ... */
+
+    if (prev != heap->last_block) {
+        FAIL_PRINT("CORRUPT HEAP: Last block %p not %p\n", prev, heap->last_block);
+    }
+    if (!is_free(heap->last_block)) {
+        FAIL_PRINT("CORRUPT HEAP: Expected prev block %p to be free\n", heap->last_block);
+    }
+
+    if (heap->free_bytes != total_free_bytes) {
+        FAIL_PRINT("CORRUPT HEAP: Expected %u free bytes counted %u\n", (unsigned)heap->free_bytes, (unsigned)total_free_bytes);
+    }
+
+    /* every free block should be on the free list of its size class, and only there */
+    for (int fl = 0; fl < heap->fl_count; fl++) {
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            heap_block_t *prev_free = NULL;
+            heap_block_t *head = *free_list(heap, fl, sl);
+            bool bit_set = (heap->fl_bitmap & (1 << fl)) && (heap->sl_bitmap[fl] & (1 << sl));
+            if (bit_set != (head != NULL)) {
+                FAIL_PRINT("CORRUPT HEAP: Bitmap doesn't match free list %d,%d\n", fl, sl);
+            }
+            for (heap_block_t *b = head; b != NULL; b = b->next_free) {
+                int b_fl, b_sl;
+                if (b <= &heap->first_block || b >= heap->last_block) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p is outside heap (after free block %p)\n", b, prev_free);
+                    goto done;
+                }
+                if (++listed_blocks > free_blocks) {
+                    FAIL_PRINT("CORRUPT HEAP: Free list %d,%d has more blocks than the heap\n", fl, sl);
+                    goto done;
+                }
+                if (!is_free(b)) {
+                    FAIL_PRINT("CORRUPT HEAP: Block %p on free list is not free\n", b);
+                }
+                if (b->prev_free != prev_free) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p points to prev free block %p not %p\n", b, b->prev_free, prev_free);
+                }
+                mapping_insert(block_data_size(b), &b_fl, &b_sl);
+                if (b_fl != fl || b_sl != sl) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p is on the wrong free list %d,%d\n", b, fl, sl);
+                }
+                prev_free = b;
+            }
+        }
+    }
+    if (listed_blocks != free_blocks) {
+        FAIL_PRINT("CORRUPT HEAP: Expected %u free blocks on free lists, found %u\n", (unsigned)free_blocks, (unsigned)listed_blocks);
+    }
+
+ done:
+    multi_heap_internal_unlock(heap);
+
+    return valid;
+}
+
+void multi_heap_dump(multi_heap_handle_t heap)
+{
+    assert(heap != NULL);
+
+    multi_heap_internal_lock(heap);
+    MULTI_HEAP_STDERR_PRINTF("Heap start %p end %p\nFree list bitmap 0x%08x\n", &heap->first_block, heap->last_block, heap->fl_bitmap);
+    for(heap_block_t *b = &heap->first_block; b != NULL; b = get_next_block(b)) {
+        MULTI_HEAP_STDERR_PRINTF("Block %p data size 0x%08x bytes next block %p", b, block_data_size(b), get_next_block(b));
+        if (is_free(b) && !is_first_block(heap, b) && !is_last_block(b)) {
+            MULTI_HEAP_STDERR_PRINTF(" FREE. Next free %p prev free %p\n", b->next_free, b->prev_free);
+        } else {
+            MULTI_HEAP_STDERR_PRINTF("%s", "\n"); /* C macros & optional __VA_ARGS__ */
+        }
+    }
+    multi_heap_internal_unlock(heap);
+}
+
+size_t multi_heap_free_size_impl(multi_heap_handle_t heap)
+{
+    if (heap == NULL) {
+        return 0;
+    }
+    return heap->free_bytes;
+}
+
+size_t multi_heap_minimum_free_size_impl(multi_heap_handle_t heap)
+{
+    if (heap == NULL) {
+        return 0;
+    }
+    return heap->minimum_free_bytes;
+}
+
+void multi_heap_get_info_impl(multi_heap_handle_t heap, multi_heap_info_t *info)
+{
+    memset(info, 0, sizeof(multi_heap_info_t));
+
+    if (heap == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+    for(heap_block_t *b = get_next_block(&heap->first_block); !is_last_block(b); b = get_next_block(b)) {
+        info->total_blocks++;
+        if (is_free(b)) {
+            size_t s = block_data_size(b);
+            info->total_free_bytes += s;
+            if (s > info->largest_free_block) {
+                info->largest_free_block = s;
+            }
+            info->free_blocks++;
+        } else {
+            info->total_allocated_bytes += block_data_size(b);
+            info->allocated_blocks++;
+        }
+    }
+
+    info->minimum_free_bytes = heap->minimum_free_bytes;
+    // heap has wrong total size (address printed here is not indicative of the real error)
+    MULTI_HEAP_ASSERT(info->total_free_bytes == heap->free_bytes, heap);
+
+    multi_heap_internal_unlock(heap);
+
+}
+
+#endif // MULTI_HEAP_TLSF
@@ -0,0 +1,125 @@
+/*
+ Tests for the fixed-size object pool allocator
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_heap_pool.h"
+
+TEST_CASE("heap_pool allocate all objects and return them", "[heap]")
+{
+    const size_t COUNT = 10;
+    void *objs[COUNT];
+    heap_pool_info_t info;
+
+    TEST_ASSERT_NULL(heap_pool_create(0, COUNT, MALLOC_CAP_DEFAULT));
+    TEST_ASSERT_NULL(heap_pool_create(16, 0, MALLOC_CAP_DEFAULT));
+    TEST_ASSERT_NULL(heap_pool_create(16, HEAP_POOL_MAX_COUNT + 1, MALLOC_CAP_DEFAULT));
+
+    heap_pool_handle_t pool = heap_pool_create(13, COUNT, MALLOC_CAP_DEFAULT);
+    TEST_ASSERT_NOT_NULL(pool);
+    heap_pool_get_info(pool, &info);
+    TEST_ASSERT_EQUAL(16, info.elem_size);
+    TEST_ASSERT_EQUAL(COUNT, info.count);
+    TEST_ASSERT_EQUAL(COUNT, info.free_count);
+
+    for (int i = 0; i < COUNT; i++) {
+        objs[i] = heap_pool_alloc(pool);
+        TEST_ASSERT_NOT_NULL(objs[i]);
+        TEST_ASSERT_EQUAL(0, (intptr_t)objs[i] % 4);
+        memset(objs[i], i, 13);
+    }
+    TEST_ASSERT_NULL(heap_pool_alloc(pool));
+    for (int i = 0; i < COUNT; i++) {
+        for (int j = 0; j < 13; j++) {
+            TEST_ASSERT_EQUAL_HEX8(i, ((uint8_t *)objs[i])[j]);
+        }
+    }
+
+    heap_pool_get_info(pool, &info);
+    TEST_ASSERT_EQUAL(0, info.free_count);
+    TEST_ASSERT_EQUAL(0, info.minimum_free_count);
+    TEST_ASSERT_EQUAL(1, info.failed_allocs);
+
+    heap_caps_print_heap_info(MALLOC_CAP_DEFAULT);
+
+    for (int i = 0; i < COUNT; i++) {
+        heap_pool_free(pool, objs[i]);
+    }
+    heap_pool_free(pool, NULL);
+    heap_pool_get_info(pool, &info);
+    TEST_ASSERT_EQUAL(COUNT, info.free_count);
+    TEST_ASSERT_EQUAL(0, info.minimum_free_count);
+
+    /* the last object returned is the first one taken again */
+    TEST_ASSERT_EQUAL_PTR(objs[COUNT - 1], heap_pool_alloc(pool));
+    heap_pool_free(pool, objs[COUNT - 1]);
+    heap_pool_delete(pool);
+}
+
+typedef struct {
+    heap_pool_handle_t pool;
+    SemaphoreHandle_t done;
+    int id;
+    bool ok;
+} pool_task_arg_t;
+
+static void pool_task(void *varg)
+{
+    pool_task_arg_t *arg = (pool_task_arg_t *)varg;
+    void *objs[8];
+    arg->ok = true;
+    for (int i = 0; i < 10000; i++) {
+        int n = 0;
+        for (; n < 8; n++) {
+            objs[n] = heap_pool_alloc(arg->pool);
+            if (objs[n] == NULL) {
+                break;
+            }
+            memset(objs[n], arg->id, 8);
+        }
+        for (int j = 0; j < n; j++) {
+            /* if an object had been given to both tasks, the other one may have overwritten it */
+            for (int k = 0; k < 8; k++) {
+                if (((uint8_t *)objs[j])[k] != arg->id) {
+                    arg->ok = false;
+                }
+            }
+            heap_pool_free(arg->pool, objs[j]);
+        }
+    }
+    xSemaphoreGive(arg->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("heap_pool used from both cores", "[heap]")
+{
+    const size_t COUNT = 12;
+    pool_task_arg_t args[portNUM_PROCESSORS];
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(portNUM_PROCESSORS, 0);
+    heap_pool_handle_t pool = heap_pool_create(8, COUNT, MALLOC_CAP_DEFAULT);
+    TEST_ASSERT_NOT_NULL(pool);
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        args[i] = (pool_task_arg_t) { .pool = pool, .done = done, .id = i + 1 };
+        xTaskCreatePinnedToCore(pool_task, "pool_task", 2048, &args[i], UNITY_FREERTOS_PRIORITY - 1, NULL, i);
+    }
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        TEST_ASSERT(xSemaphoreTake(done, 10000 / portTICK_PERIOD_MS));
+    }
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        TEST_ASSERT(args[i].ok);
+    }
+
+    heap_pool_info_t info;
+    heap_pool_get_info(pool, &info);
+    TEST_ASSERT_EQUAL(COUNT, info.free_count);
+
+    heap_pool_delete(pool);
+    vSemaphoreDelete(done);
+}
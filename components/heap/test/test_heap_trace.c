@@ -10,6 +10,7 @@
 #include <string.h>
 #include "sdkconfig.h"
 #include "unity.h"
+#include "esp_attr.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -59,9 +60,10 @@ TEST_CASE("heap trace leak check", "[heap]")
     heap_trace_get(0, &trace_b);
     TEST_ASSERT_EQUAL_PTR(b, trace_b.address);
 
-    /* buffer deletes trace_a when freed,
-       so trace_b at head of buffer */
-    TEST_ASSERT_EQUAL_PTR(recs[0].address, trace_b.address);
+    /* buffer deletes trace_a when freed, records
+       aren't moved so trace_b is still in slot 1 */
+    TEST_ASSERT_NULL(recs[0].address);
+    TEST_ASSERT_EQUAL_PTR(recs[1].address, trace_b.address);
 
     heap_trace_stop();
 }
@@ -123,6 +125,54 @@ TEST_CASE("heap trace wrapped buffer check", "[heap]")
     heap_trace_stop();
 }
 
+static size_t stream_allocs, stream_frees;
+static void *stream_last_address;
+
+static IRAM_ATTR bool count_stream_events(heap_trace_event_t event, const heap_trace_record_t *record, void *arg)
+{
+    if (event == HEAP_TRACE_EVENT_ALLOC) {
+        stream_allocs++;
+    } else {
+        stream_frees++;
+    }
+    stream_last_address = record->address;
+    return true;
+}
+
+TEST_CASE("heap trace stream callback", "[heap]")
+{
+    const size_t N = 8;
+    heap_trace_record_t recs[N];
+    heap_trace_init_standalone(recs, N);
+    TEST_ASSERT_EQUAL(ESP_OK, heap_trace_set_stream(count_stream_events, NULL));
+
+    printf("Stream test\n"); // Print something before trace starts, or stdout allocations skew total counts
+    fflush(stdout);
+
+    stream_allocs = 0;
+    stream_frees = 0;
+    heap_trace_start(HEAP_TRACE_LEAKS);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, heap_trace_set_stream(NULL, NULL));
+
+    /* more allocations than fit in the buffer are all streamed */
+    void *ptrs[N * 2];
+    for (int i = 0; i < N * 2; i++) {
+        ptrs[i] = malloc(i + 1);
+    }
+    TEST_ASSERT_EQUAL_PTR(ptrs[N * 2 - 1], stream_last_address);
+    for (int i = 0; i < N * 2; i++) {
+        free(ptrs[i]);
+    }
+    TEST_ASSERT_EQUAL_PTR(ptrs[N * 2 - 1], stream_last_address);
+
+    heap_trace_stop();
+    TEST_ASSERT_EQUAL(N * 2, stream_allocs);
+    TEST_ASSERT_EQUAL(N * 2, stream_frees);
+    TEST_ASSERT_EQUAL(0, heap_trace_get_count());
+
+    heap_trace_set_stream(NULL, NULL);
+}
+
 static void print_floats_task(void *ignore)
 {
     heap_trace_start(HEAP_TRACE_ALL);
@@ -0,0 +1,4 @@
+#pragma once
+
+#define ESP_EARLY_LOGI(tag, format, ...) ((void)(tag))
+#define ESP_EARLY_LOGD(tag, format, ...) ((void)(tag))
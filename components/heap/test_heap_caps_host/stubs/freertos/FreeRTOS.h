@@ -0,0 +1,30 @@
+/* Minimal FreeRTOS port for building heap_caps.c on the host. The tests are single threaded, so there is no locking. */
+#pragma once
+#include <stdint.h>
+
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+#define portNUM_PROCESSORS 2
+
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+static inline void vPortCPUInitializeMutex(portMUX_TYPE *mux)
+{
+    mux->owner = 0;
+    mux->count = 0;
+}
+
+static inline int xPortGetCoreID(void)
+{
+    return 0;
+}
+
+static inline void uxPortCompareSet(volatile uint32_t *addr, uint32_t compare, uint32_t *set)
+{
+    *set = __sync_val_compare_and_swap(addr, compare, *set);
+}
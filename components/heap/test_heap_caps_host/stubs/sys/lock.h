@@ -0,0 +1,7 @@
+/* newlib's lock API, not needed as the tests are single threaded */
+#pragma once
+
+typedef int _lock_t;
+
+#define _lock_acquire(lock) ((void)(lock))
+#define _lock_release(lock) ((void)(lock))
@@ -0,0 +1,295 @@
+#include "catch.hpp"
+
+extern "C" {
+#include "soc/soc_memory_layout.h"
+}
+#include "esp_heap_caps.h"
+#include "esp_heap_caps_init.h"
+#include "../heap_private.h"
+#include "../heap_small_cache.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+/* Memory types similar to the ESP32's, heap_caps_init() is given one region of each */
+extern "C" const soc_memory_type_desc_t soc_memory_types[] = {
+    { "DRAM", { MALLOC_CAP_8BIT | MALLOC_CAP_DEFAULT, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_32BIT, 0 }, false, false },
+    { "D/IRAM", { 0, MALLOC_CAP_DMA | MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL | MALLOC_CAP_DEFAULT, MALLOC_CAP_32BIT | MALLOC_CAP_EXEC }, true, false },
+    { "IRAM", { MALLOC_CAP_EXEC | MALLOC_CAP_32BIT | MALLOC_CAP_INTERNAL, 0, 0 }, false, false },
+    { "SPIRAM", { MALLOC_CAP_SPIRAM | MALLOC_CAP_DEFAULT, 0, MALLOC_CAP_8BIT | MALLOC_CAP_32BIT }, false, false },
+};
+extern "C" const size_t soc_memory_type_count = sizeof(soc_memory_types) / sizeof(soc_memory_types[0]);
+
+static const size_t INIT_REGION_SIZE = 16 * 1024;
+static uint8_t init_memory[4][INIT_REGION_SIZE];
+
+extern "C" const soc_memory_region_t soc_memory_regions[] = {
+    { (intptr_t)init_memory[0], INIT_REGION_SIZE, 0, 0 },
+    { (intptr_t)init_memory[1], INIT_REGION_SIZE, 1, 0 },
+    { (intptr_t)init_memory[2], INIT_REGION_SIZE, 2, 0 },
+    { (intptr_t)init_memory[3], INIT_REGION_SIZE, 3, 0 },
+};
+extern "C" const size_t soc_memory_region_count = sizeof(soc_memory_regions) / sizeof(soc_memory_regions[0]);
+
+extern "C" size_t soc_get_available_memory_region_max_count()
+{
+    return soc_memory_region_count;
+}
+
+extern "C" size_t soc_get_available_memory_regions(soc_memory_region_t *regions)
+{
+    memcpy(regions, soc_memory_regions, sizeof(soc_memory_regions));
+    return soc_memory_region_count;
+}
+
+/* heap_caps_init() can only be called once, all test cases share the heaps */
+static void init_heaps()
+{
+    static bool initialised;
+    if (!initialised) {
+        heap_caps_init();
+        initialised = true;
+    }
+}
+
+/* Regions added by heap_caps_add_region_with_caps(), with the caps of each memory type in turn */
+static void add_regions(size_t count, size_t size)
+{
+    init_heaps();
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *start = new uint8_t[size];
+        REQUIRE( ESP_OK == heap_caps_add_region_with_caps(soc_memory_types[i % soc_memory_type_count].caps,
+                                                          (intptr_t)start, (intptr_t)start + size) );
+    }
+}
+
+/* The order heap_caps_malloc() tries the heaps in, worked out the same way it did before the dispatch lists */
+static std::vector<heap_t *> expected_heap_order(uint32_t caps)
+{
+    std::vector<heap_t *> order;
+    for (int prio = 0; prio < SOC_MEMORY_TYPE_NO_PRIOS; prio++) {
+        heap_t *heap;
+        SLIST_FOREACH(heap, &registered_heaps, next) {
+            if (heap->heap != NULL && (heap->caps[prio] & caps) != 0 && heap_caps_match(heap, caps)
+                && std::find(order.begin(), order.end(), heap) == order.end()) {
+                order.push_back(heap);
+            }
+        }
+    }
+    return order;
+}
+
+static heap_t *containing_heap(void *p)
+{
+    heap_t *heap;
+    SLIST_FOREACH(heap, &registered_heaps, next) {
+        if ((intptr_t)p >= heap->start && (intptr_t)p < heap->end) {
+            return heap;
+        }
+    }
+    return NULL;
+}
+
+/* Masks with a dispatch list, and some without */
+static const uint32_t test_caps[] = {
+    MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL,
+    MALLOC_CAP_DEFAULT,
+    MALLOC_CAP_8BIT,
+    MALLOC_CAP_32BIT,
+    MALLOC_CAP_INTERNAL,
+    MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+    MALLOC_CAP_DMA,
+    MALLOC_CAP_DMA | MALLOC_CAP_8BIT,
+    MALLOC_CAP_SPIRAM,
+    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+    MALLOC_CAP_DEFAULT | MALLOC_CAP_SPIRAM,
+    MALLOC_CAP_EXEC | MALLOC_CAP_32BIT,
+    MALLOC_CAP_8BIT | MALLOC_CAP_32BIT,
+    MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL,
+    MALLOC_CAP_SPIRAM | MALLOC_CAP_INTERNAL,
+};
+
+static void check_heap_order()
+{
+    for (uint32_t caps : test_caps) {
+        std::vector<heap_t *> order = expected_heap_order(caps);
+        std::vector<void *> fillers;
+        INFO("caps 0x" << std::hex << caps);
+
+        /* Each allocation must come from the first heap in the expected order which isn't full. Fill each heap
+           in turn to get to the next. */
+        for (heap_t *heap : order) {
+            void *p = heap_caps_malloc(64, caps);
+            REQUIRE( p != NULL );
+            REQUIRE( heap == containing_heap(p) );
+            heap_caps_free(p);
+            heap_caps_small_cache_flush(); // a cached block would be reused from this heap
+            while ((p = multi_heap_malloc(heap->heap, 64)) != NULL) {
+                fillers.push_back(p);
+            }
+        }
+        REQUIRE( NULL == heap_caps_malloc(64, caps) );
+
+        for (void *p : fillers) {
+            heap_caps_free(p);
+        }
+        heap_caps_small_cache_flush();
+
+        size_t free_size = 0;
+        heap_t *heap;
+        SLIST_FOREACH(heap, &registered_heaps, next) {
+            if (heap_caps_match(heap, caps)) {
+                free_size += multi_heap_free_size(heap->heap);
+            }
+        }
+        REQUIRE( free_size == heap_caps_get_free_size(caps) );
+    }
+}
+
+TEST_CASE("heap_caps_malloc tries heaps in priority order", "[heap_caps]")
+{
+    init_heaps();
+    check_heap_order();
+
+    /* the lists have to be updated for regions added at runtime, new regions come first within their priority */
+    add_regions(8, 4096);
+    check_heap_order();
+}
+
+#ifdef CONFIG_HEAP_SMALL_CACHE
+/* Run with "CPPFLAGS=-DCONFIG_HEAP_SMALL_CACHE make test" */
+
+static const uint32_t CACHED_CAPS = MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL;
+
+TEST_CASE("small cache blocks count as free", "[heap_caps][small_cache]")
+{
+    init_heaps();
+    heap_caps_small_cache_flush();
+    const size_t free_size = heap_caps_get_free_size(CACHED_CAPS);
+
+    void *p = heap_caps_malloc(40, CACHED_CAPS);
+    REQUIRE( p != NULL );
+    heap_t *heap = containing_heap(p);
+    const size_t block_size = multi_heap_get_allocated_size(heap->heap, p);
+    multi_heap_info_t allocated;
+    heap_caps_get_info(&allocated, CACHED_CAPS);
+
+    heap_caps_free(p);
+    REQUIRE( block_size == multi_heap_get_allocated_size(heap->heap, p) ); // still allocated in its heap
+
+    multi_heap_info_t cached;
+    heap_caps_get_info(&cached, CACHED_CAPS);
+    REQUIRE( allocated.total_free_bytes + block_size == cached.total_free_bytes );
+    REQUIRE( allocated.total_allocated_bytes - block_size == cached.total_allocated_bytes );
+    REQUIRE( allocated.allocated_blocks - 1 == cached.allocated_blocks );
+    REQUIRE( allocated.free_blocks + 1 == cached.free_blocks );
+    REQUIRE( allocated.total_blocks == cached.total_blocks );
+    REQUIRE( cached.total_free_bytes == heap_caps_get_free_size(CACHED_CAPS) );
+    REQUIRE( heap_caps_check_integrity(CACHED_CAPS, true) );
+    REQUIRE( heap_caps_check_integrity_all(true) );
+
+    /* any allocation of the same size class takes it from the cache */
+    REQUIRE( p == heap_caps_malloc(33, CACHED_CAPS) );
+    heap_caps_free(p);
+
+    heap_caps_small_cache_flush();
+    REQUIRE( free_size == heap_caps_get_free_size(CACHED_CAPS) );
+    REQUIRE( heap_caps_check_integrity_all(true) );
+}
+
+TEST_CASE("small cache doesn't hand out a block freed twice", "[heap_caps][small_cache]")
+{
+    init_heaps();
+    heap_caps_small_cache_flush();
+
+    void *p = heap_caps_malloc(40, CACHED_CAPS);
+    REQUIRE( p != NULL );
+    heap_caps_free(p);
+    heap_caps_free(p);
+    REQUIRE( heap_caps_check_integrity_all(true) );
+
+    void *a = heap_caps_malloc(40, CACHED_CAPS);
+    void *b = heap_caps_malloc(40, CACHED_CAPS);
+    REQUIRE( a == p );
+    REQUIRE( b != NULL );
+    REQUIRE( b != p );
+
+    heap_caps_free(a);
+    heap_caps_free(b);
+    heap_caps_small_cache_flush();
+    REQUIRE( heap_caps_check_integrity_all(true) );
+}
+
+TEST_CASE("heap_caps_malloc flushes the small cache when it runs out of memory", "[heap_caps][small_cache]")
+{
+    init_heaps();
+    heap_caps_small_cache_flush();
+
+    std::vector<void *> blocks;
+    void *p;
+    while ((p = heap_caps_malloc(256, CACHED_CAPS)) != NULL) {
+        blocks.push_back(p);
+    }
+    REQUIRE( blocks.size() > SMALL_CACHE_DEPTH );
+
+    /* The first blocks were split off the start of the same free block, so they are next to each other. Once they
+       go back to their heap, they are merged into a free block big enough for a bigger allocation. */
+    for (size_t i = 0; i < SMALL_CACHE_DEPTH; i++) {
+        heap_caps_free(blocks[i]);
+    }
+    REQUIRE( heap_caps_check_integrity_all(true) );
+    REQUIRE( heap_caps_get_largest_free_block(CACHED_CAPS) < 1024 );
+
+    void *big = heap_caps_malloc(1024, CACHED_CAPS);
+    REQUIRE( big != NULL );
+    REQUIRE( containing_heap(big) == containing_heap(blocks[0]) );
+    REQUIRE( heap_caps_check_integrity_all(true) );
+
+    heap_caps_free(big);
+    for (size_t i = SMALL_CACHE_DEPTH; i < blocks.size(); i++) {
+        heap_caps_free(blocks[i]);
+    }
+    heap_caps_small_cache_flush();
+    REQUIRE( heap_caps_check_integrity_all(true) );
+}
+#endif
+
+/* Run with "make benchmark".
+
+   Prints the time heap_caps_malloc() & heap_caps_free() and heap_caps_get_free_size() take with many heaps, for some
+   caps masks which have a dispatch list and some which don't.
+*/
+TEST_CASE("heap_caps_malloc benchmark with many regions", "[heap_caps][benchmark][.]")
+{
+    const int ITERATIONS = 200000;
+
+    add_regions(60, 4096);
+    size_t num_heaps = 0;
+    heap_t *heap;
+    SLIST_FOREACH(heap, &registered_heaps, next) {
+        num_heaps++;
+    }
+    printf("%zu heaps registered\n", num_heaps);
+
+    for (uint32_t caps : test_caps) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ITERATIONS; i++) {
+            heap_caps_free(heap_caps_malloc(32, caps));
+        }
+        auto malloc_time = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        volatile size_t free_size;
+        for (int i = 0; i < ITERATIONS; i++) {
+            free_size = heap_caps_get_free_size(caps);
+        }
+        auto free_size_time = std::chrono::steady_clock::now() - start;
+        (void)free_size;
+
+        printf("caps 0x%08x: malloc & free avg %lld ns, get_free_size avg %lld ns\n", caps,
+               (long long)(std::chrono::duration_cast<std::chrono::nanoseconds>(malloc_time).count() / ITERATIONS),
+               (long long)(std::chrono::duration_cast<std::chrono::nanoseconds>(free_size_time).count() / ITERATIONS));
+    }
+}
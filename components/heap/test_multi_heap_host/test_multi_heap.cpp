@@ -2,9 +2,36 @@
 #include "multi_heap.h"
 
 #include "../multi_heap_config.h"
+#include "../multi_heap_internal.h"
 
 #include <string.h>
 #include <assert.h>
+#include <chrono>
+
+/* The small heaps in these tests are sized for the best fit engine, which uses 9 words of each heap for its own
+   metadata. Engines with more metadata (ie TLSF with its free list table) use more of the test heap buffer, so they
+   get the same free space. */
+static const size_t BEST_FIT_OVERHEAD = 9 * sizeof(void *);
+
+/* Upper bound of the metadata other engines need on top of BEST_FIT_OVERHEAD, in heaps of up to 1KB */
+static const size_t MAX_EXTRA_OVERHEAD = 64 * sizeof(void *);
+
+/* Size of the buffer for a test heap of 'size' bytes */
+static constexpr size_t test_heap_size(size_t size)
+{
+    return size + MAX_EXTRA_OVERHEAD;
+}
+
+/* Number of bytes of the buffer to register, so the heap has the free space of a best fit heap of 'size' bytes */
+static size_t test_heap_used_size(size_t size)
+{
+    size_t heap_size = size;
+    while (heap_size < multi_heap_internal_overhead(heap_size) + size - BEST_FIT_OVERHEAD) {
+        heap_size += sizeof(void *);
+    }
+    REQUIRE( heap_size <= test_heap_size(size) );
+    return heap_size;
+}
 
 /* Insurance against accidentally using libc heap functions in tests */
 #undef free
@@ -18,9 +45,9 @@
 
 TEST_CASE("multi_heap simple allocations", "[multi_heap]")
 {
-    uint8_t small_heap[128];
+    uint8_t small_heap[test_heap_size(128)];
 
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    multi_heap_handle_t heap = multi_heap_register(small_heap, test_heap_used_size(128));
 
     size_t test_alloc_size = (multi_heap_free_size(heap) + 4) / 2;
 
@@ -59,8 +86,8 @@ TEST_CASE("multi_heap simple allocations", "[multi_heap]")
 
 TEST_CASE("multi_heap fragmentation", "[multi_heap]")
 {
-    uint8_t small_heap[256];
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    uint8_t small_heap[test_heap_size(256)];
+    multi_heap_handle_t heap = multi_heap_register(small_heap, test_heap_used_size(256));
 
     const size_t alloc_size = 24;
 
@@ -391,8 +418,8 @@ TEST_CASE("multi_heap minimum-size allocations", "[multi_heap]")
 TEST_CASE("multi_heap_realloc()", "[multi_heap]")
 {
     const uint32_t PATTERN = 0xABABDADA;
-    uint8_t small_heap[300];
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    uint8_t small_heap[test_heap_size(300)];
+    multi_heap_handle_t heap = multi_heap_register(small_heap, test_heap_used_size(300));
 
     uint32_t *a = (uint32_t *)multi_heap_malloc(heap, 64);
     uint32_t *b = (uint32_t *)multi_heap_malloc(heap, 32);
@@ -445,8 +472,8 @@ TEST_CASE("multi_heap_realloc()", "[multi_heap]")
 
 TEST_CASE("corrupt heap block", "[multi_heap]")
 {
-    uint8_t small_heap[256];
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    uint8_t small_heap[test_heap_size(256)];
+    multi_heap_handle_t heap = multi_heap_register(small_heap, test_heap_used_size(256));
 
     void *a = multi_heap_malloc(heap, 32);
     REQUIRE( multi_heap_check(heap, true) );
@@ -456,10 +483,11 @@ TEST_CASE("corrupt heap block", "[multi_heap]")
 
 TEST_CASE("unaligned heaps", "[multi_heap]")
 {
-    const size_t CHUNK_LEN = 256;
+    const size_t HEAP_SIZE = 256;
+    const size_t CHUNK_LEN = test_heap_used_size(HEAP_SIZE);
     const size_t CANARY_LEN = 16;
     const uint8_t CANARY_BYTE = 0x3E;
-    uint8_t heap_chunk[CHUNK_LEN + CANARY_LEN * 2];
+    uint8_t heap_chunk[test_heap_size(HEAP_SIZE) + CANARY_LEN * 2];
 
     /* Put some canary bytes before and after the bytes we intend to use for
        the heap, make sure they aren't ever overwritten */
@@ -475,8 +503,8 @@ TEST_CASE("unaligned heaps", "[multi_heap]")
 
         multi_heap_get_info(heap, &info);
 
-        REQUIRE( info.total_free_bytes > CHUNK_LEN - 64 - i );
-        REQUIRE( info.largest_free_block > CHUNK_LEN - 64 - i );
+        REQUIRE( info.total_free_bytes > HEAP_SIZE - 64 - i );
+        REQUIRE( info.largest_free_block > HEAP_SIZE - 64 - i );
 
         void *a = multi_heap_malloc(heap, info.largest_free_block);
         REQUIRE( a != NULL );
@@ -494,3 +522,74 @@ TEST_CASE("unaligned heaps", "[multi_heap]")
         }
     }
 }
+
+/* Compare the engines with "make benchmark".
+
+   Many small and some bigger allocations are freed and replaced in random order, until the heap is as fragmented as
+   after running for hours. Prints the malloc & free times, and how fragmented the free space is at the end.
+*/
+TEST_CASE("multi_heap fragmentation benchmark", "[multi_heap][benchmark][.]")
+{
+    static uint8_t heap_mem[128 * 1024];
+    const int NUM_POINTERS = 512;
+    const int ITERATIONS = 200000;
+    void *p[NUM_POINTERS] = { 0 };
+    multi_heap_handle_t heap = multi_heap_register(heap_mem, sizeof(heap_mem));
+    uint32_t rand_state = 0x12345678;
+    size_t mallocs = 0, frees = 0, failed = 0;
+    std::chrono::nanoseconds malloc_time(0), malloc_max(0), free_time(0), free_max(0);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        /* xorshift, so the sequence is the same for both engines */
+        rand_state ^= rand_state << 13;
+        rand_state ^= rand_state >> 17;
+        rand_state ^= rand_state << 5;
+        int n = rand_state % NUM_POINTERS;
+
+        if (p[n] != NULL) {
+            auto start = std::chrono::steady_clock::now();
+            multi_heap_free(heap, p[n]);
+            auto t = std::chrono::steady_clock::now() - start;
+            free_time += t;
+            free_max = std::max(free_max, std::chrono::duration_cast<std::chrono::nanoseconds>(t));
+            frees++;
+        }
+
+        /* 4 of 5 allocations are small */
+        size_t size = (rand_state >> 16) % 5 ? 8 + (rand_state >> 8) % 120 : 128 + (rand_state >> 8) % 896;
+        auto start = std::chrono::steady_clock::now();
+        p[n] = multi_heap_malloc(heap, size);
+        auto t = std::chrono::steady_clock::now() - start;
+        malloc_time += t;
+        malloc_max = std::max(malloc_max, std::chrono::duration_cast<std::chrono::nanoseconds>(t));
+        mallocs++;
+        if (p[n] == NULL) {
+            failed++;
+        } else {
+            memset(p[n], n, size);
+        }
+    }
+
+    REQUIRE( multi_heap_check(heap, true) );
+
+    multi_heap_info_t info;
+    multi_heap_get_info(heap, &info);
+#ifdef MULTI_HEAP_TLSF
+    printf("Engine: TLSF\n");
+#else
+    printf("Engine: best fit\n");
+#endif
+    printf("malloc: %zu calls, avg %lld ns, max %lld ns, %zu failed\n", mallocs,
+           (long long)(malloc_time.count() / mallocs), (long long)malloc_max.count(), failed);
+    printf("free: %zu calls, avg %lld ns, max %lld ns\n", frees,
+           (long long)(free_time.count() / frees), (long long)free_max.count());
+    printf("at the end: %zu bytes allocated in %zu blocks, %zu bytes free in %zu blocks, largest free block %zu bytes\n",
+           info.total_allocated_bytes, info.allocated_blocks, info.total_free_bytes, info.free_blocks,
+           info.largest_free_block);
+
+    for (int i = 0; i < NUM_POINTERS; i++) {
+        multi_heap_free(heap, p[i]);
+    }
+    multi_heap_get_info(heap, &info);
+    REQUIRE( 1 == info.free_blocks );
+}
@@ -0,0 +1,228 @@
+#include "catch.hpp"
+#include "multi_heap.h"
+#include "../heap_small_cache.h"
+
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+TEST_CASE("small_cache size classes", "[small_cache]")
+{
+    REQUIRE( 0 == small_cache_class(1) );
+    REQUIRE( 0 == small_cache_class(16) );
+    REQUIRE( 1 == small_cache_class(17) );
+    REQUIRE( SMALL_CACHE_CLASSES - 1 == small_cache_class(256) );
+    REQUIRE( -1 == small_cache_class(257) );
+
+    REQUIRE( -1 == small_cache_block_class(15) );
+    REQUIRE( 0 == small_cache_block_class(16) );
+    REQUIRE( 0 == small_cache_block_class(23) );
+    REQUIRE( 1 == small_cache_block_class(24) );
+    REQUIRE( SMALL_CACHE_CLASSES - 1 == small_cache_block_class(256) );
+    REQUIRE( SMALL_CACHE_CLASSES - 1 == small_cache_block_class(383) );
+    REQUIRE( -1 == small_cache_block_class(384) );
+
+    for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+        size_t size = small_cache_class_size(cls);
+        REQUIRE( cls == small_cache_class(size) );
+        REQUIRE( cls == small_cache_block_class(size) );
+        REQUIRE( (cls == SMALL_CACHE_CLASSES - 1 ? -1 : cls + 1) == small_cache_class(size + 1) );
+    }
+}
+
+TEST_CASE("small_cache get & put", "[small_cache]")
+{
+    small_cache_t cache = { };
+    int blocks[SMALL_CACHE_DEPTH + 1];
+
+    REQUIRE( NULL == small_cache_get(&cache, 3) );
+    for (int i = 0; i < SMALL_CACHE_DEPTH; i++) {
+        REQUIRE( small_cache_put(&cache, 3, &blocks[i]) );
+    }
+    REQUIRE( !small_cache_put(&cache, 3, &blocks[SMALL_CACHE_DEPTH]) );
+    REQUIRE( NULL == small_cache_get(&cache, 2) );
+
+    /* most recently freed block comes back first, as it's most likely still in the CPU cache */
+    for (int i = SMALL_CACHE_DEPTH - 1; i >= 0; i--) {
+        REQUIRE( &blocks[i] == small_cache_get(&cache, 3) );
+    }
+    REQUIRE( NULL == small_cache_get(&cache, 3) );
+}
+
+TEST_CASE("small_cache doesn't cache a block freed twice", "[small_cache]")
+{
+    small_cache_t cache = { };
+    int blocks[2];
+
+    REQUIRE( small_cache_put(&cache, 3, &blocks[0]) );
+    REQUIRE( small_cache_put(&cache, 3, &blocks[1]) );
+    REQUIRE( small_cache_put(&cache, 3, &blocks[0]) );
+    REQUIRE( 2 == cache.magazines[3].count );
+
+    REQUIRE( &blocks[1] == small_cache_get(&cache, 3) );
+    REQUIRE( &blocks[0] == small_cache_get(&cache, 3) );
+    REQUIRE( NULL == small_cache_get(&cache, 3) );
+}
+
+/* heap_caps_malloc() allocates the class size on a cache miss, the block it gets must be cached for the same class
+   (or a bigger one) when it's freed */
+TEST_CASE("small_cache classes of heap blocks", "[small_cache]")
+{
+    static uint8_t heap_mem[4096];
+    multi_heap_handle_t heap = multi_heap_register(heap_mem, sizeof(heap_mem));
+    void *p[SMALL_CACHE_CLASSES];
+
+    for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+        p[cls] = multi_heap_malloc(heap, small_cache_class_size(cls));
+        REQUIRE( p[cls] != NULL );
+        size_t block_size = multi_heap_get_allocated_size(heap, p[cls]);
+        int block_cls = small_cache_block_class(block_size);
+        REQUIRE( block_cls >= cls );
+        REQUIRE( small_cache_class_size(block_cls) <= block_size );
+    }
+    for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+        multi_heap_free(heap, p[cls]);
+    }
+    REQUIRE( multi_heap_check(heap, true) );
+}
+
+/* Compare small allocations from two threads with "make benchmark".
+
+   Each thread plays one CPU. Without the cache, each malloc & free takes the lock of the shared heap. With it, each
+   thread uses its own cache (with its own, uncontended lock like the per-CPU mux in heap_caps.c) and only takes the
+   heap lock on a miss. Some blocks are freed by the other thread, like buffers passed between tasks on both CPUs.
+*/
+namespace {
+
+const int BENCH_THREADS = 2;
+const int BENCH_POINTERS = 64;
+const int BENCH_ITERATIONS = 500000;
+
+struct bench_state {
+    multi_heap_handle_t heap;
+    std::mutex heap_lock;
+    bool use_cache;
+    small_cache_t caches[BENCH_THREADS];
+    std::mutex cache_lock[BENCH_THREADS];
+    std::atomic<void *> handover[BENCH_THREADS];
+    std::atomic<size_t> failed;
+};
+
+void *bench_malloc(bench_state *s, int thread, size_t size)
+{
+    if (s->use_cache) {
+        int cls = small_cache_class(size);
+        s->cache_lock[thread].lock();
+        void *p = small_cache_get(&s->caches[thread], cls);
+        s->cache_lock[thread].unlock();
+        if (p != NULL) {
+            return p;
+        }
+        size = small_cache_class_size(cls);
+    }
+    std::lock_guard<std::mutex> guard(s->heap_lock);
+    return multi_heap_malloc(s->heap, size);
+}
+
+void bench_free(bench_state *s, int thread, void *p)
+{
+    if (s->use_cache) {
+        s->cache_lock[thread].lock();
+        int cls = small_cache_block_class(multi_heap_get_allocated_size(s->heap, p));
+        bool cached = small_cache_put(&s->caches[thread], cls, p);
+        s->cache_lock[thread].unlock();
+        if (cached) {
+            return;
+        }
+    }
+    std::lock_guard<std::mutex> guard(s->heap_lock);
+    multi_heap_free(s->heap, p);
+}
+
+void bench_thread(bench_state *s, int thread)
+{
+    void *p[BENCH_POINTERS] = { 0 };
+    uint32_t rand_state = 0x12345678 + thread;
+
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        rand_state ^= rand_state << 13;
+        rand_state ^= rand_state >> 17;
+        rand_state ^= rand_state << 5;
+        int n = rand_state % BENCH_POINTERS;
+
+        if (p[n] != NULL) {
+            if ((rand_state >> 24) % 8 == 0) {
+                /* pass the block to the other thread (freeing the last one if it hasn't taken it yet),
+                   and free the one it passed to us */
+                void *last = s->handover[(thread + 1) % BENCH_THREADS].exchange(p[n]);
+                if (last != NULL) {
+                    bench_free(s, thread, last);
+                }
+                void *other = s->handover[thread].exchange(NULL);
+                if (other != NULL) {
+                    bench_free(s, thread, other);
+                }
+            } else {
+                bench_free(s, thread, p[n]);
+            }
+        }
+        size_t size = 4 + (rand_state >> 8) % 252;
+        p[n] = bench_malloc(s, thread, size);
+        if (p[n] == NULL) {
+            s->failed++;
+        } else {
+            memset(p[n], n, size);
+        }
+    }
+    for (int n = 0; n < BENCH_POINTERS; n++) {
+        if (p[n] != NULL) {
+            bench_free(s, thread, p[n]);
+        }
+    }
+}
+
+}
+
+TEST_CASE("small_cache benchmark", "[small_cache][benchmark][.]")
+{
+    static uint8_t heap_mem[64 * 1024];
+
+    for (int use_cache = 0; use_cache < 2; use_cache++) {
+        bench_state *s = new bench_state();
+        s->heap = multi_heap_register(heap_mem, sizeof(heap_mem));
+        s->use_cache = use_cache;
+        const size_t free_before = multi_heap_free_size(s->heap);
+
+        auto start = std::chrono::steady_clock::now();
+        std::thread threads[BENCH_THREADS];
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            threads[t] = std::thread(bench_thread, s, t);
+        }
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            threads[t].join();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+        /* free whatever was left in the handover slots and caches, the heap must be back to how it started */
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            void *p = s->handover[t].exchange(NULL);
+            if (p != NULL) {
+                multi_heap_free(s->heap, p);
+            }
+            for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+                while ((p = small_cache_get(&s->caches[t], cls)) != NULL) {
+                    multi_heap_free(s->heap, p);
+                }
+            }
+        }
+        REQUIRE( multi_heap_check(s->heap, true) );
+        REQUIRE( free_before == multi_heap_free_size(s->heap) );
+
+        printf("%s: %d threads, avg %lld ns per malloc & free, %zu failed\n",
+               use_cache ? "small_cache + multi_heap" : "multi_heap", BENCH_THREADS,
+               (long long)(elapsed.count() / BENCH_ITERATIONS), s->failed.load());
+        delete s;
+    }
+}
@@ -56,6 +56,8 @@ typedef uint32_t nvs_handle;
 
 
 #define NVS_DEFAULT_PART_NAME           "nvs"   /*!< Default partition name of the NVS partition in the partition table */
+
+#define NVS_STATS_LATENCY_BUCKETS       8       /*!< Number of buckets in the write latency histogram of nvs_stats_t */
 /**
  * @brief Mode of opening the non-volatile storage
  *
@@ -65,6 +67,16 @@ typedef enum {
 	NVS_READWRITE  /*!< Read and write */
 } nvs_open_mode;
 
+/**
+ * @brief Opaque handle of a blob being written in parts, see nvs_blob_writer_open
+ */
+typedef struct nvs_blob_writer* nvs_blob_writer_t;
+
+/**
+ * @brief Opaque handle of a value mapped into memory, see nvs_get_str_mmap
+ */
+typedef struct nvs_mmap* nvs_mmap_handle_t;
+
 typedef enum {
     NVS_TYPE_U8    = 0x01,
     NVS_TYPE_I8    = 0x11,
@@ -79,6 +91,20 @@ typedef enum {
     NVS_TYPE_ANY   = 0xff // Must be last
 } nvs_type_t;
 
+/**
+ * @brief information about entry obtained from nvs_entry_info function
+ */
+typedef struct {
+    char namespace_name[16];    /*!< Namespace to which key-value belong */
+    char key[16];               /*!< Key of stored key-value pair */
+    nvs_type_t type;            /*!< Type of stored key-value pair */
+} nvs_entry_info_t;
+
+/**
+ * Opaque pointer type representing iterator to nvs entries
+ */
+typedef struct nvs_iterator* nvs_iterator_t;
+
 /**
  * @brief      Open non-volatile storage with a given namespace from the default NVS partition
  *
@@ -202,9 +228,89 @@ esp_err_t nvs_set_str (nvs_handle handle, const char* key, const char* value);
  *               update will be finished after re-initialization of nvs, provided that
  *               flash operation doesn't fail again.
  *             - ESP_ERR_NVS_VALUE_TOO_LONG if the value is too long
+ *             - ESP_ERR_NOT_SUPPORTED if a transaction is open on the handle
  */
 esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length);
 
+/**
+ * @brief      Start writing a blob in parts
+ *
+ * Together with nvs_blob_writer_append and nvs_blob_writer_close, this allows
+ * storing a blob without holding all of it in RAM. Data is buffered until
+ * one chunk (up to 4000 bytes) is collected, then written to flash.
+ * The previous value of the key stays readable until nvs_blob_writer_close
+ * succeeds, and is replaced by the new value at that point.
+ *
+ * The key should not be modified by other means while the writer is open.
+ *
+ * @param[in]  handle      Handle obtained from nvs_open function.
+ *                         Handles that were opened read only cannot be used.
+ * @param[in]  key         Key name. Maximal length is 15 characters. Shouldn't be empty.
+ * @param[out] out_writer  If ok, will be set to the handle of the writer.
+ *
+ * @return
+ *             - ESP_OK if the writer has been opened
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_READ_ONLY if storage handle was opened as read only
+ *             - ESP_ERR_NVS_KEY_TOO_LONG if key name is too long
+ *             - ESP_ERR_NO_MEM if memory could not be allocated
+ *             - ESP_ERR_NOT_SUPPORTED if a transaction is open on the handle
+ */
+esp_err_t nvs_blob_writer_open(nvs_handle handle, const char* key, nvs_blob_writer_t* out_writer);
+
+/**
+ * @brief      Append data to a blob opened with nvs_blob_writer_open
+ *
+ * If this function fails, data written so far is erased, and the writer
+ * can only be closed.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_writer_open.
+ * @param[in]  data    Data to append.
+ * @param[in]  length  Length of data, in bytes. Total length of the blob is
+ *                     limited in the same way as for nvs_set_blob.
+ *
+ * @return
+ *             - ESP_OK if data was appended successfully
+ *             - ESP_ERR_NVS_INVALID_HANDLE if the handle used to open the writer
+ *               has been closed
+ *             - ESP_ERR_NVS_INVALID_STATE if a previous call has failed
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space in the
+ *               underlying storage to save the value
+ *             - ESP_ERR_NVS_VALUE_TOO_LONG if the blob becomes too long
+ */
+esp_err_t nvs_blob_writer_append(nvs_blob_writer_t writer, const void* data, size_t length);
+
+/**
+ * @brief      Finish writing the blob and free the writer
+ *
+ * Writes remaining data and the blob index, then erases the previous value.
+ * The writer can't be used after this call, regardless of the result.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_writer_open.
+ *
+ * @return
+ *             - ESP_OK if the value was set successfully
+ *             - ESP_ERR_NVS_INVALID_HANDLE if the handle used to open the writer
+ *               has been closed
+ *             - ESP_ERR_NVS_INVALID_STATE if a previous call to
+ *               nvs_blob_writer_append has failed
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space in the
+ *               underlying storage to save the value
+ *             - ESP_ERR_NVS_REMOVE_FAILED if the value was written, but the
+ *               previous value could not be erased. It will be erased after
+ *               re-initialization of nvs.
+ */
+esp_err_t nvs_blob_writer_close(nvs_blob_writer_t writer);
+
+/**
+ * @brief      Discard the blob being written and free the writer
+ *
+ * Data written so far is erased, and the previous value of the key is kept.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_writer_open.
+ */
+void nvs_blob_writer_abort(nvs_blob_writer_t writer);
+
 /**@{*/
 /**
  * @brief      get value for given key
@@ -314,6 +420,74 @@ esp_err_t nvs_get_str (nvs_handle handle, const char* key, char* out_value, size
 esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_value, size_t* length);
 /**@}*/
 
+/**
+ * @brief      Read part of a blob
+ *
+ * Reads length bytes of the blob, starting at the given offset. Only the
+ * chunks holding the requested range are read, so a large blob can be
+ * processed in small pieces. Use nvs_get_blob with zero out_value to get the
+ * total length of the blob.
+ *
+ * @param[in]  handle     Handle obtained from nvs_open function.
+ * @param[in]  key        Key name. Maximal length is 15 characters. Shouldn't be empty.
+ * @param[out] out_value  Pointer to the buffer of at least length bytes.
+ * @param[in]  offset     Offset within the blob, in bytes.
+ * @param[in]  length     Number of bytes to read.
+ *
+ * @return
+ *             - ESP_OK if the data was retrieved successfully
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_NAME if key name doesn't satisfy constraints
+ *             - ESP_ERR_NVS_INVALID_LENGTH if offset and length are outside of the blob
+ */
+esp_err_t nvs_get_blob_partial(nvs_handle handle, const char* key, void* out_value, size_t offset, size_t length);
+
+/**@{*/
+/**
+ * @brief      get pointer to the value for given key, without copying it
+ *
+ * These functions map data of a string or blob value into the data address
+ * space of the CPU using spi_flash_mmap, and return a pointer to it. The value
+ * stays valid until nvs_munmap is called with the returned handle, even if the
+ * key is modified or erased in the meantime. Pages holding mapped values are
+ * not reclaimed by garbage collection, so mapped values should be released
+ * when not needed any more.
+ *
+ * Data is copied into a heap buffer instead of being mapped if the partition
+ * is encrypted, or if a blob is split into chunks stored on different pages.
+ *
+ * @param[in]  handle     Handle obtained from nvs_open function.
+ * @param[in]  key        Key name. Maximal length is 15 characters. Shouldn't be empty.
+ * @param[out] out_value  Set to point to the value. For strings, this includes
+ *                        the zero terminator.
+ * @param[out] length     (nvs_get_blob_mmap only) Set to the length of the blob.
+ *                        May be NULL.
+ * @param[out] out_mmap   Set to the handle which has to be passed to nvs_munmap.
+ *
+ * @return
+ *             - ESP_OK if the value was mapped successfully
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_NAME if key name doesn't satisfy constraints
+ *             - ESP_ERR_NO_MEM if memory could not be allocated, or no MMU
+ *               pages are available to map the value
+ */
+esp_err_t nvs_get_str_mmap(nvs_handle handle, const char* key, const char** out_value, nvs_mmap_handle_t* out_mmap);
+esp_err_t nvs_get_blob_mmap(nvs_handle handle, const char* key, const void** out_value, size_t* length, nvs_mmap_handle_t* out_mmap);
+/**@}*/
+
+/**
+ * @brief      Release value obtained with nvs_get_str_mmap or nvs_get_blob_mmap
+ *
+ * The pointer to the value must not be used after this call.
+ * If the partition has been deinitialized, the value has already been
+ * released, and this function only frees the handle.
+ *
+ * @param[in]  mmap  Handle obtained with nvs_get_str_mmap or nvs_get_blob_mmap.
+ */
+void nvs_munmap(nvs_mmap_handle_t mmap);
+
 /**
  * @brief      Erase key-value pair with given key name.
  *
@@ -331,6 +505,7 @@ esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_value, size
  *              - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
  *              - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
  *              - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *              - ESP_ERR_NOT_SUPPORTED if a transaction is open on the handle
  *              - other error codes from the underlying storage driver
  */
 esp_err_t nvs_erase_key(nvs_handle handle, const char* key);
@@ -347,6 +522,7 @@ esp_err_t nvs_erase_key(nvs_handle handle, const char* key);
  *              - ESP_OK if erase operation was successful
  *              - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
  *              - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
+ *              - ESP_ERR_NOT_SUPPORTED if a transaction is open on the handle
  *              - other error codes from the underlying storage driver
  */
 esp_err_t nvs_erase_all(nvs_handle handle);
@@ -368,6 +544,66 @@ esp_err_t nvs_erase_all(nvs_handle handle);
  */
 esp_err_t nvs_commit(nvs_handle handle);
 
+/**
+ * @brief      Start staging writes made through the handle as one transaction
+ *
+ * After this call, values set with nvs_set_X functions on this handle are kept
+ * in RAM until nvs_transaction_commit is called. The commit writes all of them
+ * to a single page, so that after a power loss either all of the values are
+ * present in storage, or none of them. Reads made through any handle keep
+ * returning previously committed values until the transaction is committed.
+ *
+ * Blobs can't be written as part of a transaction, and keys can't be erased
+ * while it is open: nvs_set_blob, nvs_blob_writer_open, nvs_erase_key and
+ * nvs_erase_all return ESP_ERR_NOT_SUPPORTED on this handle until the
+ * transaction is committed or aborted. All staged values
+ * together with one additional marker entry must fit into a single page
+ * (126 entries).
+ *
+ * @param[in]  handle  Storage handle obtained with nvs_open.
+ *                     Handles that were opened read only cannot be used.
+ *
+ * @return
+ *             - ESP_OK if the transaction has been started
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
+ *             - ESP_ERR_NVS_INVALID_STATE if a transaction is already open on the handle
+ *             - ESP_ERR_NO_MEM if memory could not be allocated
+ */
+esp_err_t nvs_transaction_begin(nvs_handle handle);
+
+/**
+ * @brief      Atomically write all values staged since nvs_transaction_begin
+ *
+ * The transaction is closed after this call, regardless of the result.
+ *
+ * @param[in]  handle  Storage handle with an open transaction.
+ *
+ * @return
+ *             - ESP_OK if all values have been written successfully
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_STATE if no transaction is open on the handle
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space to
+ *               write the values to a single page
+ *             - ESP_ERR_NVS_REMOVE_FAILED if the values have been written, but
+ *               older copies of them could not be removed. Old copies will be
+ *               removed during the next initialization of the storage.
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_transaction_commit(nvs_handle handle);
+
+/**
+ * @brief      Discard all values staged since nvs_transaction_begin
+ *
+ * @param[in]  handle  Storage handle with an open transaction.
+ *
+ * @return
+ *             - ESP_OK if the transaction has been discarded
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_STATE if no transaction is open on the handle
+ */
+esp_err_t nvs_transaction_abort(nvs_handle handle);
+
 /**
  * @brief      Close the storage handle and free any allocated resources
  *
@@ -383,19 +619,31 @@ void nvs_close(nvs_handle handle);
 
 /**
  * @note Info about storage space NVS.
+ *
+ * @note Fields after namespace_count were added in this release, which changed
+ *       the size of the structure. Code passing it to nvs_get_stats, including
+ *       prebuilt libraries, has to be compiled against this header.
  */
 typedef struct {
     size_t used_entries;      /**< Amount of used entries. */
     size_t free_entries;      /**< Amount of free entries. */
     size_t total_entries;     /**< Amount all available entries. */
     size_t namespace_count;   /**< Amount name space. */
+    size_t write_latency[NVS_STATS_LATENCY_BUCKETS]; /**< Number of write operations by duration: bucket 0 is below 1 ms,
+                                                          bucket N is from 2^(N-1) to 2^N ms, the last one has no upper limit. */
+    uint32_t write_latency_max; /**< Duration of the longest write operation, in microseconds. */
+    size_t read_cache_hits;   /**< Number of reads served from the read cache, see CONFIG_NVS_READ_CACHE. */
+    size_t read_cache_misses; /**< Number of reads for which the value was not in the read cache. */
 } nvs_stats_t;
 
 /**
  * @brief      Fill structure nvs_stats_t. It provides info about used memory the partition.
  *
  * This function calculates to runtime the number of used entries, free entries, total entries,
- * and amount namespace in partition.
+ * and amount namespace in partition. It also reports how long write operations
+ * (set, erase and commit of a transaction or a blob writer) took since the
+ * partition was initialized, including any garbage collection they caused,
+ * and how many reads were served from the read cache.
  *
  * \code{c}
  * // Example of nvs_get_stats() to get the number of used entries and free entries:
@@ -464,6 +712,71 @@ esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats);
  */
 esp_err_t nvs_get_used_entry_count(nvs_handle handle, size_t* used_entries);
 
+/**
+ * @brief       Create an iterator to enumerate NVS entries based on one or more parameters
+ *
+ * \code{c}
+ * // Example of listing all the key-value pairs of any type under specified partition and namespace
+ * nvs_iterator_t it = nvs_entry_find(partition, namespace, NVS_TYPE_ANY);
+ * while (it != NULL) {
+ *         nvs_entry_info_t info;
+ *         nvs_entry_info(it, &info);
+ *         it = nvs_entry_next(it);
+ *         printf("key '%s', type '%d' \n", info.key, info.type);
+ * }
+ * // Note: no need to release iterator obtained from nvs_entry_find function when
+ * //       nvs_entry_find or nvs_entry_next function return NULL, indicating no other
+ * //       element for specified criteria was found.
+ * \endcode
+ *
+ * Each step continues from the position of the previous entry, so walking
+ * over all entries reads each page only once. The iterator has to be
+ * released and obtained again if the partition is modified in the meantime.
+ *
+ * @param[in]   part_name       Partition name
+ *
+ * @param[in]   namespace_name  Set this value if looking for entries with
+ *                              a specific namespace. Pass NULL otherwise.
+ *
+ * @param[in]   type            One of nvs_type_t values.
+ *
+ * @return
+ *          Iterator used to enumerate all the entries found,
+ *          or NULL if no entry satisfying criteria was found.
+ *          Iterator obtained through this function has to be released
+ *          using nvs_release_iterator when not used any more.
+ */
+nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type);
+
+/**
+ * @brief       Returns next item matching the iterator criteria, NULL if no such item exists.
+ *
+ * Note that any copies of the iterator will be invalid after this call.
+ *
+ * @param[in]   iterator     Iterator obtained from nvs_entry_find function. Must be non-NULL.
+ *
+ * @return
+ *          NULL if no entry was found, valid nvs_iterator_t otherwise.
+ */
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator);
+
+/**
+ * @brief       Fills nvs_entry_info_t structure with information about entry pointed to by the iterator.
+ *
+ * @param[in]   iterator     Iterator obtained from nvs_entry_find or nvs_entry_next function. Must be non-NULL.
+ *
+ * @param[out]  out_info     Structure to which entry information is copied.
+ */
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t *out_info);
+
+/**
+ * @brief       Release iterator
+ *
+ * @param[in]   iterator    Release iterator obtained from nvs_entry_find function. NULL argument is allowed.
+ *
+ */
+void nvs_release_iterator(nvs_iterator_t iterator);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -85,6 +85,31 @@ esp_err_t nvs_flash_deinit(void);
  */
 esp_err_t nvs_flash_deinit_partition(const char* partition_label);
 
+/**
+ * @brief Do a part of the garbage collection work of an NVS partition
+ *
+ * When only few free pages are left, writing a value may require a page to
+ * be reclaimed, which means copying all its remaining items and erasing it.
+ * This function does a bounded part of that work ahead of time, so it can be
+ * called from a low priority task whenever the application is idle. Items are
+ * moved out of the page which is going to be reclaimed next, and the page is
+ * erased once it is empty, until CONFIG_NVS_GC_FREE_PAGES pages are free.
+ *
+ * @param[in]  partition_label  Label of the partition. If NULL, the default
+ *                              NVS partition is used.
+ * @param[in]  max_entries      Maximum number of entries to move. One item
+ *                              which spans several entries is always moved
+ *                              as a whole, so this may be exceeded.
+ *
+ * @return
+ *      - ESP_OK if some work has been done, and the function may be called again
+ *      - ESP_ERR_NVS_NOT_FOUND if there is nothing to do at the moment
+ *      - ESP_ERR_NVS_NOT_INITIALIZED if the storage for given partition was not
+ *        initialized prior to this call
+ *      - one of the error codes from the underlying flash storage driver
+ */
+esp_err_t nvs_flash_collect_garbage(const char* partition_label, size_t max_entries);
+
 /**
  * @brief Erase the default NVS partition
  *
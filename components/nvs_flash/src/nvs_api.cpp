@@ -41,14 +41,13 @@ extern "C" esp_err_t nvs_flash_init_custom(const char *partName, uint32_t baseSe
 extern "C" esp_err_t nvs_flash_secure_init_custom(const char *partName, uint32_t baseSector, uint32_t sectorCount, nvs_sec_cfg_t* cfg);
 #endif
 
-class HandleEntry : public intrusive_list_node<HandleEntry>
+class HandleEntry
 {
-    static uint32_t s_nvs_next_handle;
 public:
     HandleEntry() {}
 
     HandleEntry(bool readOnly, uint8_t nsIndex, nvs::Storage* StoragePtr) :
-        mHandle(++s_nvs_next_handle),  // Begin the handle value with 1
+        mHandle(0),  // assigned by HandleTable::add
         mReadOnly(readOnly),
         mNsIndex(nsIndex),
         mStoragePtr(StoragePtr)
@@ -59,6 +58,131 @@ public:
     uint8_t mReadOnly;
     uint8_t mNsIndex;
     nvs::Storage* mStoragePtr;
+    nvs::Transaction* mTransaction = nullptr;
+};
+
+/* Open handles, indexed by slot. The low 16 bits of a handle hold the slot
+ * index plus one, so that 0 is never a valid handle, and the high 16 bits hold
+ * the generation of the slot. The generation changes each time the slot is
+ * released, so a closed handle is rejected even after its slot is reused. */
+class HandleTable
+{
+public:
+    ~HandleTable()
+    {
+        delete[] mSlots;
+    }
+
+    esp_err_t add(HandleEntry* entry)
+    {
+        if (mFreeHead == NO_SLOT && !grow()) {
+            return ESP_ERR_NO_MEM;
+        }
+        size_t index = mFreeHead;
+        Slot& slot = mSlots[index];
+        mFreeHead = slot.mNextFree;
+        slot.mEntry = entry;
+        entry->mHandle = (static_cast<uint32_t>(slot.mGeneration) << 16) | (index + 1);
+        return ESP_OK;
+    }
+
+    HandleEntry* find(nvs_handle handle) const
+    {
+        size_t index = (handle & 0xffff) - 1;
+        if (index >= mCapacity) {
+            return nullptr;
+        }
+        const Slot& slot = mSlots[index];
+        if (slot.mEntry == nullptr || slot.mGeneration != (handle >> 16)) {
+            return nullptr;
+        }
+        return slot.mEntry;
+    }
+
+    /* Releases the slot of the handle and returns its entry, which the caller deletes */
+    HandleEntry* remove(nvs_handle handle)
+    {
+        HandleEntry* entry = find(handle);
+        if (entry != nullptr) {
+            release((handle & 0xffff) - 1);
+        }
+        return entry;
+    }
+
+    /* Calls func(entry) for each open handle; func may remove the handle */
+    template<typename TFunc>
+    void forEach(TFunc func)
+    {
+        for (size_t i = 0; i < mCapacity; ++i) {
+            if (mSlots[i].mEntry != nullptr) {
+                func(mSlots[i].mEntry);
+            }
+        }
+    }
+
+protected:
+    struct Slot {
+        HandleEntry* mEntry;
+        uint16_t mGeneration;
+        uint16_t mNextFree;
+    };
+
+    static const size_t NO_SLOT = 0xffff;
+    static const size_t MIN_CAPACITY = 8;
+
+    void release(size_t index)
+    {
+        Slot& slot = mSlots[index];
+        slot.mEntry = nullptr;
+        ++slot.mGeneration;
+        slot.mNextFree = static_cast<uint16_t>(mFreeHead);
+        mFreeHead = index;
+    }
+
+    bool grow()
+    {
+        size_t capacity = (mCapacity == 0) ? MIN_CAPACITY : mCapacity * 2;
+        if (capacity > NO_SLOT) {
+            capacity = NO_SLOT;
+        }
+        if (capacity <= mCapacity) {
+            return false;
+        }
+        Slot* slots = new (std::nothrow) Slot[capacity];
+        if (slots == nullptr) {
+            return false;
+        }
+        std::copy(mSlots, mSlots + mCapacity, slots);
+        for (size_t i = capacity; i > mCapacity; --i) {
+            slots[i - 1].mEntry = nullptr;
+            slots[i - 1].mGeneration = 0;
+            slots[i - 1].mNextFree = static_cast<uint16_t>(mFreeHead);
+            mFreeHead = i - 1;
+        }
+        delete[] mSlots;
+        mSlots = slots;
+        mCapacity = capacity;
+        return true;
+    }
+
+    Slot* mSlots = nullptr;
+    size_t mCapacity = 0;
+    size_t mFreeHead = NO_SLOT;
+};
+
+struct nvs_blob_writer {
+    nvs_handle mHandle;
+    nvs::Storage::BlobWriter mWriter;
+};
+
+struct nvs_iterator {
+    nvs::Storage* mStoragePtr;
+    nvs::Storage::EntryIterator mIt;
+};
+
+struct nvs_mmap : public intrusive_list_node<nvs_mmap> {
+    nvs::Storage* mStoragePtr;
+    nvs::Storage::MappedItem mItem;
 };
 
 #ifdef ESP_PLATFORM
@@ -68,10 +192,11 @@ SemaphoreHandle_t nvs::Lock::mSemaphore = NULL;
 using namespace std;
 using namespace nvs;
 
-static intrusive_list<HandleEntry> s_nvs_handles;
-uint32_t HandleEntry::s_nvs_next_handle;
+static HandleTable s_nvs_handles;
 static intrusive_list<nvs::Storage> s_nvs_storage_list;
 
+static intrusive_list<nvs_mmap> s_nvs_mmaps;
+
 static nvs::Storage* lookup_storage_from_name(const char *name)
 {
     auto it = find_if(begin(s_nvs_storage_list), end(s_nvs_storage_list), [=](Storage& e) -> bool {
@@ -228,17 +353,26 @@ extern "C" esp_err_t nvs_flash_deinit_partition(const char* partition_name)
 #endif
 
     /* Clean up handles related to the storage being deinitialized */
-    auto it = s_nvs_handles.begin();
-    auto next = it;
-    while(it != s_nvs_handles.end()) {
-        next++;
-        if (it->mStoragePtr == storage) {
+    s_nvs_handles.forEach([=](HandleEntry* entry) {
+        if (entry->mStoragePtr == storage) {
             ESP_LOGD(TAG, "Deleting handle %d (ns=%d) related to partition \"%s\" (missing call to nvs_close?)",
-                     it->mHandle, it->mNsIndex, partition_name);
-            s_nvs_handles.erase(it);
-            delete static_cast<HandleEntry*>(it);
+                     entry->mHandle, entry->mNsIndex, partition_name);
+            s_nvs_handles.remove(entry->mHandle);
+            delete entry->mTransaction;
+            delete entry;
+        }
+    });
+
+    /* Release mappings of the storage; the handles stay valid until nvs_munmap */
+    for (auto mit = s_nvs_mmaps.begin(); mit != s_nvs_mmaps.end(); ) {
+        auto mnext = mit;
+        ++mnext;
+        if (mit->mStoragePtr == storage) {
+            storage->munmapItem(mit->mItem);
+            mit->mStoragePtr = nullptr;
+            s_nvs_mmaps.erase(mit);
         }
-        it = next;
+        mit = mnext;
     }
 
     /* Finally delete the storage itself */
@@ -253,15 +387,25 @@ extern "C" esp_err_t nvs_flash_deinit(void)
     return nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME);
 }
 
+extern "C" esp_err_t nvs_flash_collect_garbage(const char* partition_name, size_t max_entries)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s %d", __func__, partition_name, max_entries);
+
+    nvs::Storage* storage = lookup_storage_from_name((partition_name == NULL) ? NVS_DEFAULT_PART_NAME : partition_name);
+    if (!storage) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    return storage->collectGarbage(max_entries);
+}
+
 static esp_err_t nvs_find_ns_handle(nvs_handle handle, HandleEntry& entry)
 {
-    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
-        return e.mHandle == handle;
-    });
-    if (it == end(s_nvs_handles)) {
+    HandleEntry* found = s_nvs_handles.find(handle);
+    if (found == nullptr) {
         return ESP_ERR_NVS_INVALID_HANDLE;
     }
-    entry = *it;
+    entry = *found;
     return ESP_OK;
 }
 
@@ -282,8 +426,15 @@ extern "C" esp_err_t nvs_open_from_partition(const char *part_name, const char*
         return err;
     }
 
-    HandleEntry *handle_entry = new HandleEntry(open_mode==NVS_READONLY, nsIndex, sHandle);
-    s_nvs_handles.push_back(handle_entry);
+    HandleEntry *handle_entry = new (std::nothrow) HandleEntry(open_mode==NVS_READONLY, nsIndex, sHandle);
+    if (handle_entry == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = s_nvs_handles.add(handle_entry);
+    if (err != ESP_OK) {
+        delete handle_entry;
+        return err;
+    }
 
     *out_handle = handle_entry->mHandle;
 
@@ -303,14 +454,12 @@ extern "C" void nvs_close(nvs_handle handle)
 {
     Lock lock;
     ESP_LOGD(TAG, "%s %d", __func__, handle);
-    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
-        return e.mHandle == handle;
-    });
-    if (it == end(s_nvs_handles)) {
+    HandleEntry* entry = s_nvs_handles.remove(handle);
+    if (entry == nullptr) {
         return;
     }
-    s_nvs_handles.erase(it);
-    delete static_cast<HandleEntry*>(it);
+    delete entry->mTransaction;
+    delete entry;
 }
 
 extern "C" esp_err_t nvs_erase_key(nvs_handle handle, const char* key)
@@ -325,6 +474,9 @@ extern "C" esp_err_t nvs_erase_key(nvs_handle handle, const char* key)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
     return entry.mStoragePtr->eraseItem(entry.mNsIndex, key);
 }
 
@@ -340,6 +492,9 @@ extern "C" esp_err_t nvs_erase_all(nvs_handle handle)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
     return entry.mStoragePtr->eraseNamespace(entry.mNsIndex);
 }
 
@@ -356,6 +511,9 @@ static esp_err_t nvs_set(nvs_handle handle, const char* key, T value)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return entry.mTransaction->add(entry.mNsIndex, key, value);
+    }
     return entry.mStoragePtr->writeItem(entry.mNsIndex, key, value);
 }
 
@@ -416,6 +574,9 @@ extern "C" esp_err_t nvs_set_str(nvs_handle handle, const char* key, const char*
     if (err != ESP_OK) {
         return err;
     }
+    if (entry.mTransaction) {
+        return entry.mTransaction->add(entry.mNsIndex, nvs::ItemType::SZ, key, value, strlen(value) + 1);
+    }
     return entry.mStoragePtr->writeItem(entry.mNsIndex, nvs::ItemType::SZ, key, value, strlen(value) + 1);
 }
 
@@ -428,9 +589,71 @@ extern "C" esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void
     if (err != ESP_OK) {
         return err;
     }
+    if (entry.mTransaction) {
+        return entry.mTransaction->add(entry.mNsIndex, nvs::ItemType::BLOB, key, value, length);
+    }
     return entry.mStoragePtr->writeItem(entry.mNsIndex, nvs::ItemType::BLOB, key, value, length);
 }
 
+static HandleEntry* nvs_find_ns_handle_entry(nvs_handle handle)
+{
+    return s_nvs_handles.find(handle);
+}
+
+extern "C" esp_err_t nvs_transaction_begin(nvs_handle handle)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    HandleEntry* entry = nvs_find_ns_handle_entry(handle);
+    if (entry == nullptr) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (entry->mReadOnly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (entry->mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    entry->mTransaction = new (std::nothrow) nvs::Transaction;
+    if (entry->mTransaction == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_transaction_commit(nvs_handle handle)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    HandleEntry* entry = nvs_find_ns_handle_entry(handle);
+    if (entry == nullptr) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (entry->mTransaction == nullptr) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    auto err = entry->mStoragePtr->writeTransaction(*entry->mTransaction);
+    delete entry->mTransaction;
+    entry->mTransaction = nullptr;
+    return err;
+}
+
+extern "C" esp_err_t nvs_transaction_abort(nvs_handle handle)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    HandleEntry* entry = nvs_find_ns_handle_entry(handle);
+    if (entry == nullptr) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (entry->mTransaction == nullptr) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    delete entry->mTransaction;
+    entry->mTransaction = nullptr;
+    return ESP_OK;
+}
+
 
 template<typename T>
 static esp_err_t nvs_get(nvs_handle handle, const char* key, T* out_value)
@@ -525,6 +748,134 @@ extern "C" esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_
     return nvs_get_str_or_blob(handle, nvs::ItemType::BLOB, key, out_value, length);
 }
 
+static esp_err_t nvs_get_str_or_blob_mmap(nvs_handle handle, nvs::ItemType type, const char* key, const void** out_value, size_t* length, nvs_mmap_handle_t* out_mmap)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    HandleEntry entry;
+    auto err = nvs_find_ns_handle(handle, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    nvs_mmap* mmap = new (std::nothrow) nvs_mmap;
+    if (mmap == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = entry.mStoragePtr->mmapItem(entry.mNsIndex, type, key, mmap->mItem);
+    if (err != ESP_OK) {
+        delete mmap;
+        return err;
+    }
+    mmap->mStoragePtr = entry.mStoragePtr;
+    s_nvs_mmaps.push_back(mmap);
+
+    *out_value = mmap->mItem.mData;
+    if (length) {
+        *length = mmap->mItem.mSize;
+    }
+    *out_mmap = mmap;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_get_str_mmap(nvs_handle handle, const char* key, const char** out_value, nvs_mmap_handle_t* out_mmap)
+{
+    return nvs_get_str_or_blob_mmap(handle, nvs::ItemType::SZ, key, reinterpret_cast<const void**>(out_value), nullptr, out_mmap);
+}
+
+extern "C" esp_err_t nvs_get_blob_mmap(nvs_handle handle, const char* key, const void** out_value, size_t* length, nvs_mmap_handle_t* out_mmap)
+{
+    return nvs_get_str_or_blob_mmap(handle, nvs::ItemType::BLOB, key, out_value, length, out_mmap);
+}
+
+extern "C" void nvs_munmap(nvs_mmap_handle_t mmap)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s", __func__);
+    if (mmap->mStoragePtr) {
+        mmap->mStoragePtr->munmapItem(mmap->mItem);
+        s_nvs_mmaps.erase(mmap);
+    }
+    delete mmap;
+}
+
+extern "C" esp_err_t nvs_get_blob_partial(nvs_handle handle, const char* key, void* out_value, size_t offset, size_t length)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s %d %d", __func__, key, offset, length);
+    HandleEntry entry;
+    auto err = nvs_find_ns_handle(handle, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return entry.mStoragePtr->readBlobPartial(entry.mNsIndex, key, out_value, offset, length);
+}
+
+extern "C" esp_err_t nvs_blob_writer_open(nvs_handle handle, const char* key, nvs_blob_writer_t* out_writer)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    HandleEntry entry;
+    auto err = nvs_find_ns_handle(handle, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (entry.mReadOnly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (entry.mTransaction) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    nvs_blob_writer* writer = new (std::nothrow) nvs_blob_writer;
+    if (writer == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = entry.mStoragePtr->openBlobWriter(entry.mNsIndex, key, writer->mWriter);
+    if (err != ESP_OK) {
+        delete writer;
+        return err;
+    }
+    writer->mHandle = handle;
+    *out_writer = writer;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_blob_writer_append(nvs_blob_writer_t writer, const void* data, size_t length)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, length);
+    HandleEntry entry;
+    auto err = nvs_find_ns_handle(writer->mHandle, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return entry.mStoragePtr->appendBlobWriter(writer->mWriter, data, length);
+}
+
+extern "C" esp_err_t nvs_blob_writer_close(nvs_blob_writer_t writer)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s", __func__);
+    HandleEntry entry;
+    auto err = nvs_find_ns_handle(writer->mHandle, entry);
+    if (err == ESP_OK) {
+        err = entry.mStoragePtr->closeBlobWriter(writer->mWriter);
+    }
+    delete writer;
+    return err;
+}
+
+extern "C" void nvs_blob_writer_abort(nvs_blob_writer_t writer)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s", __func__);
+    HandleEntry entry;
+    if (nvs_find_ns_handle(writer->mHandle, entry) == ESP_OK) {
+        entry.mStoragePtr->abortBlobWriter(writer->mWriter);
+    }
+    delete writer;
+}
+
 extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats)
 {
     Lock lock;
@@ -537,6 +888,10 @@ extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats
     nvs_stats->free_entries     = 0;
     nvs_stats->total_entries    = 0;
     nvs_stats->namespace_count  = 0;
+    std::fill_n(nvs_stats->write_latency, NVS_STATS_LATENCY_BUCKETS, 0);
+    nvs_stats->write_latency_max = 0;
+    nvs_stats->read_cache_hits = 0;
+    nvs_stats->read_cache_misses = 0;
 
     pStorage = lookup_storage_from_name((part_name == NULL) ? NVS_DEFAULT_PART_NAME : part_name);
     if (pStorage == NULL) {
@@ -572,6 +927,52 @@ extern "C" esp_err_t nvs_get_used_entry_count(nvs_handle handle, size_t* used_en
     return err;
 }
 
+extern "C" nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, (namespace_name == NULL) ? "" : namespace_name);
+    nvs::Storage* pStorage = lookup_storage_from_name(part_name);
+    if (pStorage == nullptr) {
+        return nullptr;
+    }
+
+    nvs_iterator* it = new (std::nothrow) nvs_iterator;
+    if (it == nullptr) {
+        return nullptr;
+    }
+    // NVS_TYPE_BLOB matches both blob formats
+    nvs::ItemType datatype = (type == NVS_TYPE_BLOB) ? nvs::ItemType::BLOB : static_cast<nvs::ItemType>(type);
+    if (pStorage->findEntry(it->mIt, namespace_name, datatype) != ESP_OK) {
+        delete it;
+        return nullptr;
+    }
+    it->mStoragePtr = pStorage;
+    return it;
+}
+
+extern "C" nvs_iterator_t nvs_entry_next(nvs_iterator_t it)
+{
+    Lock lock;
+    assert(it);
+    if (it->mStoragePtr->nextEntry(it->mIt) != ESP_OK) {
+        delete it;
+        return nullptr;
+    }
+    return it;
+}
+
+extern "C" void nvs_entry_info(nvs_iterator_t it, nvs_entry_info_t *out_info)
+{
+    Lock lock;
+    assert(it);
+    it->mStoragePtr->fillEntryInfo(it->mIt, *out_info);
+}
+
+extern "C" void nvs_release_iterator(nvs_iterator_t it)
+{
+    delete it;
+}
+
 #if (defined CONFIG_NVS_ENCRYPTION) && (defined ESP_PLATFORM)
 
 extern "C" esp_err_t nvs_flash_generate_keys(const esp_partition_t* partition, nvs_sec_cfg_t* cfg)
@@ -48,13 +48,18 @@ namespace nvs
 
     XtsCtxt* EncrMgr::findXtsCtxtFromAddr(uint32_t addr) {
 
+        /* Consecutive accesses are almost always to the same partition */
+        if (lastXtsCtxt && isInXtsCtxt(*lastXtsCtxt, addr)) {
+            return lastXtsCtxt;
+        }
+
         auto it = find_if(std::begin(xtsCtxtList), std::end(xtsCtxtList), [=](XtsCtxt& ctx) -> bool
-                { return (ctx.baseSector * SPI_FLASH_SEC_SIZE  <= addr)
-                && (addr < (ctx.baseSector + ctx.sectorCount) * SPI_FLASH_SEC_SIZE); });
+                { return isInXtsCtxt(ctx, addr); });
 
         if (it == std::end(xtsCtxtList)) {
             return nullptr;
         }
+        lastXtsCtxt = it;
         return it;
     }
 
@@ -88,6 +93,9 @@ namespace nvs
         if(!xtsCtxt) {
             return ESP_ERR_NVS_XTS_CFG_NOT_FOUND;
         }
+        if (lastXtsCtxt == xtsCtxt) {
+            lastXtsCtxt = nullptr;
+        }
         xtsCtxtList.erase(xtsCtxt);
         delete xtsCtxt;
 
@@ -98,54 +106,42 @@ namespace nvs
     }
 
 
-    esp_err_t EncrMgr::encryptNvsData(uint8_t* ptxt, uint32_t addr, uint32_t ptxtLen, XtsCtxt* xtsCtxt) {
+    esp_err_t EncrMgr::cryptNvsEntries(int mode, uint8_t* buf, uint32_t addr, uint32_t len, XtsCtxt* xtsCtxt) {
 
-        uint8_t entrySize = sizeof(Item);
+        const uint32_t entrySize = sizeof(Item);
 
         //sector num required as an arr by mbedtls. Should have been just uint64/32.
         uint8_t data_unit[16];
 
-        assert(ptxtLen % entrySize == 0);
+        assert(len % entrySize == 0);
 
         /* Use relative address instead of absolute address (relocatable), so that host-generated
          * encrypted nvs images can be used*/
         uint32_t relAddr = addr - (xtsCtxt->baseSector * SPI_FLASH_SEC_SIZE);
 
-        memset(data_unit, 0, sizeof(data_unit));
+        mbedtls_aes_xts_context* ctx = (mode == MBEDTLS_AES_ENCRYPT) ? xtsCtxt->ectxt : xtsCtxt->dctxt;
 
-        for(uint8_t entry = 0; entry < (ptxtLen/entrySize); entry++)
-        {
-            uint32_t offset = entry * entrySize;
-            uint32_t *addr_loc = (uint32_t*) &data_unit[0];
+        memset(data_unit, 0, sizeof(data_unit));
 
-            *addr_loc = relAddr + offset;
-            if(mbedtls_aes_crypt_xts(xtsCtxt->ectxt, MBEDTLS_AES_ENCRYPT, entrySize, data_unit, ptxt + offset, ptxt + offset))  {
-                return ESP_ERR_NVS_XTS_ENCR_FAILED;
+        /* Every entry is a separate data unit, tweaked with its own address, so that
+         * entries can be read and written individually. A run of entries is processed
+         * in one call with the context looked up once. */
+        for (uint32_t offset = 0; offset < len; offset += entrySize) {
+            uint32_t unit = relAddr + offset;
+            memcpy(data_unit, &unit, sizeof(unit));
+            if (mbedtls_aes_crypt_xts(ctx, mode, entrySize, data_unit, buf + offset, buf + offset)) {
+                return (mode == MBEDTLS_AES_ENCRYPT) ? ESP_ERR_NVS_XTS_ENCR_FAILED : ESP_ERR_NVS_XTS_DECR_FAILED;
             }
         }
         return ESP_OK;
     }
 
-    esp_err_t EncrMgr::decryptNvsData(uint8_t* ctxt, uint32_t addr, uint32_t ctxtLen, XtsCtxt* xtsCtxt) {
-
-        //sector num required as an arr by mbedtls. Should have been just uint64/32.
-        uint8_t data_unit[16];
-
-
-        /** Currently upper layer of NVS reads entries one by one even for variable size
-        * multi-entry data types. So length should always be equal to size of an entry.*/
-        assert(ctxtLen == sizeof(Item));
-
-        uint32_t relAddr = addr - (xtsCtxt->baseSector * SPI_FLASH_SEC_SIZE);
-
-        memset(data_unit, 0, sizeof(data_unit));
-
-        memcpy(data_unit, &relAddr, sizeof(relAddr));
+    esp_err_t EncrMgr::encryptNvsData(uint8_t* ptxt, uint32_t addr, uint32_t ptxtLen, XtsCtxt* xtsCtxt) {
+        return cryptNvsEntries(MBEDTLS_AES_ENCRYPT, ptxt, addr, ptxtLen, xtsCtxt);
+    }
 
-        if(mbedtls_aes_crypt_xts(xtsCtxt->dctxt, MBEDTLS_AES_DECRYPT, ctxtLen, data_unit, ctxt, ctxt))  {
-            return ESP_ERR_NVS_XTS_DECR_FAILED;
-        }
-        return ESP_OK;
+    esp_err_t EncrMgr::decryptNvsData(uint8_t* ctxt, uint32_t addr, uint32_t ctxtLen, XtsCtxt* xtsCtxt) {
+        return cryptNvsEntries(MBEDTLS_AES_DECRYPT, ctxt, addr, ctxtLen, xtsCtxt);
     }
 
 } // namespace nvs
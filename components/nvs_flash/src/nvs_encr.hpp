@@ -15,6 +15,7 @@
 #define nvs_encr_hpp
 
 #include "esp_err.h"
+#include "esp_spi_flash.h"
 #include "mbedtls/aes.h"
 #include "intrusive_list.h"
 #include "nvs_flash.h"
@@ -40,6 +41,8 @@ class EncrMgr
         static bool isEncrActive();
         esp_err_t setSecurityContext(uint32_t baseSector, uint32_t sectorCount, nvs_sec_cfg_t* cfg);
         esp_err_t removeSecurityContext(uint32_t baseSector);
+        /* Both process a run of whole entries starting at addr, ptxtLen/ctxtLen
+         * must be a multiple of the entry size */
         esp_err_t encryptNvsData(uint8_t* ptxt, uint32_t addr, uint32_t ptxtLen, XtsCtxt* xtsCtxt);
         esp_err_t decryptNvsData(uint8_t* ctxt, uint32_t addr, uint32_t ctxtLen, XtsCtxt* xtsCtxt);
         XtsCtxt* findXtsCtxtFromAddr(uint32_t addr);
@@ -49,8 +52,17 @@ class EncrMgr
         static bool isActive;
         static EncrMgr* instance;
         intrusive_list<XtsCtxt> xtsCtxtList;
+        XtsCtxt* lastXtsCtxt = nullptr;
         EncrMgr() {}
 
+        static bool isInXtsCtxt(const XtsCtxt& ctx, uint32_t addr)
+        {
+            return (ctx.baseSector * SPI_FLASH_SEC_SIZE <= addr)
+                && (addr < (ctx.baseSector + ctx.sectorCount) * SPI_FLASH_SEC_SIZE);
+        }
+
+        esp_err_t cryptNvsEntries(int mode, uint8_t* buf, uint32_t addr, uint32_t len, XtsCtxt* xtsCtxt);
+
 }; // class EncrMgr
 
 esp_err_t nvs_flash_write(size_t destAddr, const void *srcAddr, size_t size);
@@ -0,0 +1,137 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_item_cache.hpp"
+#include <cstring>
+#include <new>
+
+namespace nvs
+{
+
+ItemCache::ItemCache()
+{
+}
+
+ItemCache::~ItemCache()
+{
+    init(0);
+}
+
+void ItemCache::init(size_t entryCount)
+{
+    mUsed.clear();
+    mFree.clear();
+    delete[] mEntries;
+    mEntries = nullptr;
+    if (entryCount == 0) {
+        return;
+    }
+    mEntries = new (std::nothrow) Entry[entryCount];
+    if (!mEntries) {
+        return;
+    }
+    for (size_t i = 0; i < entryCount; ++i) {
+        mFree.push_back(&mEntries[i]);
+    }
+}
+
+void ItemCache::clear()
+{
+    while (!mUsed.empty()) {
+        release(&mUsed.front());
+    }
+}
+
+ItemCache::Entry* ItemCache::lookup(uint8_t nsIndex, const char* key)
+{
+    for (auto it = mUsed.begin(); it != mUsed.end(); ++it) {
+        if (it->mNsIndex == nsIndex && strncmp(it->mKey, key, sizeof(it->mKey) - 1) == 0) {
+            return it;
+        }
+    }
+    return nullptr;
+}
+
+void ItemCache::release(Entry* entry)
+{
+    mUsed.erase(entry);
+    mFree.push_back(entry);
+}
+
+const ItemCache::Entry* ItemCache::find(uint8_t nsIndex, ItemType datatype, const char* key)
+{
+    if (!isEnabled()) {
+        return nullptr;
+    }
+    Entry* entry = lookup(nsIndex, key);
+    if (entry == nullptr || entry->mDatatype != datatype) {
+        ++mMisses;
+        return nullptr;
+    }
+    ++mHits;
+    if (entry != &mUsed.front()) {
+        mUsed.erase(entry);
+        mUsed.push_front(entry);
+    }
+    return entry;
+}
+
+void ItemCache::insert(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize)
+{
+    if (!isEnabled() || !isCacheable(datatype, dataSize)) {
+        return;
+    }
+    Entry* entry = lookup(nsIndex, key);
+    if (entry != nullptr) {
+        mUsed.erase(entry);
+    } else if (!mFree.empty()) {
+        entry = &mFree.front();
+        mFree.erase(entry);
+    } else {
+        // evict the least recently used value
+        entry = &mUsed.back();
+        mUsed.erase(entry);
+    }
+    entry->mNsIndex = nsIndex;
+    entry->mDatatype = datatype;
+    entry->mDataSize = static_cast<uint8_t>(dataSize);
+    strncpy(entry->mKey, key, sizeof(entry->mKey) - 1);
+    entry->mKey[sizeof(entry->mKey) - 1] = 0;
+    memcpy(entry->mData, data, dataSize);
+    mUsed.push_front(entry);
+}
+
+void ItemCache::invalidate(uint8_t nsIndex, const char* key)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    Entry* entry = lookup(nsIndex, key);
+    if (entry != nullptr) {
+        release(entry);
+    }
+}
+
+void ItemCache::invalidateNamespace(uint8_t nsIndex)
+{
+    for (auto it = mUsed.begin(); it != mUsed.end();) {
+        Entry* entry = it;
+        ++it;
+        if (entry->mNsIndex == nsIndex) {
+            release(entry);
+        }
+    }
+}
+
+} // namespace nvs
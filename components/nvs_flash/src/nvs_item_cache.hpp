@@ -0,0 +1,107 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_item_cache_h
+#define nvs_item_cache_h
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+#include "intrusive_list.h"
+
+namespace nvs
+{
+
+/**
+ * Small cache of recently read values, most recently used first.
+ *
+ * Holds values of integer types and strings of up to MAX_DATA_SIZE bytes,
+ * identified by namespace index and key. Storage removes the value of a key
+ * from the cache whenever it writes or erases that key, so a cached value is
+ * always the same as the one stored in flash.
+ */
+class ItemCache
+{
+public:
+    static const size_t MAX_DATA_SIZE = 32;
+
+    struct Entry : public intrusive_list_node<Entry> {
+    public:
+        uint8_t mNsIndex;
+        ItemType mDatatype;
+        uint8_t mDataSize;
+        char mKey[Item::MAX_KEY_LENGTH + 1];
+        uint8_t mData[MAX_DATA_SIZE];
+    };
+
+    ItemCache();
+    ~ItemCache();
+
+    /* Allocates space for entryCount values, 0 disables the cache */
+    void init(size_t entryCount);
+
+    /* Drops all cached values, hit and miss counters are kept */
+    void clear();
+
+    bool isEnabled() const
+    {
+        return mEntries != nullptr;
+    }
+
+    static bool isCacheable(ItemType datatype, size_t dataSize)
+    {
+        return datatype != ItemType::BLOB && datatype != ItemType::BLOB_DATA &&
+               datatype != ItemType::BLOB_IDX && dataSize <= MAX_DATA_SIZE;
+    }
+
+    /* Returns the cached value of the key if its type is datatype, and
+     * counts a hit or a miss */
+    const Entry* find(uint8_t nsIndex, ItemType datatype, const char* key);
+
+    void insert(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize);
+
+    void invalidate(uint8_t nsIndex, const char* key);
+
+    void invalidateNamespace(uint8_t nsIndex);
+
+    size_t getHits() const
+    {
+        return mHits;
+    }
+
+    size_t getMisses() const
+    {
+        return mMisses;
+    }
+
+private:
+    ItemCache(const ItemCache& other);
+    const ItemCache& operator= (const ItemCache& rhs);
+
+protected:
+    Entry* lookup(uint8_t nsIndex, const char* key);
+
+    void release(Entry* entry);
+
+    typedef intrusive_list<Entry> TEntryList;
+    TEntryList mUsed; // most recently used first
+    TEntryList mFree;
+    Entry* mEntries = nullptr;
+    size_t mHits = 0;
+    size_t mMisses = 0;
+}; // class ItemCache
+
+} // namespace nvs
+
+
+#endif /* nvs_item_cache_h */
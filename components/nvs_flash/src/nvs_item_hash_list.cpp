@@ -24,6 +24,13 @@ HashList::HashList()
 void HashList::clear()
 {
     for (auto it = mBlockList.begin(); it != mBlockList.end();) {
+        if (mItemIndex) {
+            for (size_t i = 0; i < it->mCount; ++i) {
+                if (it->mNodes[i].mIndex != 0xff) {
+                    mItemIndex->erase(it->mNodes[i].mHash, mPage, it->mNodes[i].mIndex);
+                }
+            }
+        }
         auto tmp = it;
         ++it;
         mBlockList.erase(tmp);
@@ -42,9 +49,32 @@ HashList::HashListBlock::HashListBlock()
                   "cache block size calculation incorrect");
 }
 
+void HashList::setItemIndex(ItemIndex* itemIndex, Page* page)
+{
+    mItemIndex = itemIndex;
+    mPage = page;
+    if (!mItemIndex) {
+        return;
+    }
+    for (auto it = mBlockList.begin(); it != mBlockList.end(); ++it) {
+        for (size_t i = 0; i < it->mCount; ++i) {
+            if (it->mNodes[i].mIndex != 0xff) {
+                mItemIndex->insert(it->mNodes[i].mHash, mPage, it->mNodes[i].mIndex);
+            }
+        }
+    }
+}
+
 void HashList::insert(const Item& item, size_t index)
 {
-    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
+    insert(item.calculateCrc32WithoutValue() & 0xffffff, index);
+}
+
+void HashList::insert(uint32_t hash_24, size_t index)
+{
+    if (mItemIndex) {
+        mItemIndex->insert(hash_24, mPage, index);
+    }
     // add entry to the end of last block if possible
     if (mBlockList.size()) {
         auto& block = mBlockList.back();
@@ -66,6 +96,9 @@ void HashList::erase(size_t index, bool itemShouldExist)
         bool haveEntries = false;
         for (size_t i = 0; i < it->mCount; ++i) {
             if (it->mNodes[i].mIndex == index) {
+                if (mItemIndex) {
+                    mItemIndex->erase(it->mNodes[i].mHash, mPage, index);
+                }
                 it->mNodes[i].mIndex = 0xff;
                 return;
             }
@@ -18,10 +18,13 @@
 #include "nvs.h"
 #include "nvs_types.hpp"
 #include "intrusive_list.h"
+#include "nvs_item_index.hpp"
 
 namespace nvs
 {
 
+class Page;
+
 class HashList
 {
 public:
@@ -29,9 +32,26 @@ public:
     ~HashList();
     
     void insert(const Item& item, size_t index);
+    void insert(uint32_t hash, size_t index);
     void erase(const size_t index, bool itemShouldExist=true);
     size_t find(size_t start, const Item& item);
     void clear();
+
+    /* Mirror all current and future entries of this list into a partition-wide index */
+    void setItemIndex(ItemIndex* itemIndex, Page* page);
+
+    /* Call func(index, hash) for every entry of the list */
+    template<typename TFunc>
+    void forEach(TFunc func)
+    {
+        for (auto it = mBlockList.begin(); it != mBlockList.end(); ++it) {
+            for (size_t i = 0; i < it->mCount; ++i) {
+                if (it->mNodes[i].mIndex != 0xff) {
+                    func(static_cast<size_t>(it->mNodes[i].mIndex), static_cast<uint32_t>(it->mNodes[i].mHash));
+                }
+            }
+        }
+    }
     
 private:
     HashList(const HashList& other);
@@ -66,6 +86,8 @@ protected:
 
     typedef intrusive_list<HashListBlock> TBlockList;
     TBlockList mBlockList;
+    ItemIndex* mItemIndex = nullptr;
+    Page* mPage = nullptr;
 }; // class HashList
 
 } // namespace nvs
@@ -0,0 +1,146 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_item_index.hpp"
+#include <new>
+
+namespace nvs
+{
+
+ItemIndex::ItemIndex()
+{
+}
+
+ItemIndex::~ItemIndex()
+{
+    clear();
+}
+
+void ItemIndex::clear()
+{
+    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
+        auto tmp = it;
+        ++it;
+        mBlockList.erase(tmp);
+        delete static_cast<NodeBlock*>(tmp);
+    }
+    delete[] mBuckets;
+    mBuckets = nullptr;
+    mFreeNodes = nullptr;
+    mBucketCount = 0;
+    mSize = 0;
+}
+
+void ItemIndex::init(size_t pageCount, size_t maxSize)
+{
+    clear();
+    mMaxSize = maxSize;
+
+    // aim for about 16 buckets per page, so that chains stay short
+    // regardless of the partition size
+    size_t bucketCount = 1;
+    while (bucketCount < pageCount * 16) {
+        bucketCount <<= 1;
+    }
+
+    size_t size = bucketCount * sizeof(Node*);
+    if (size > mMaxSize) {
+        return;
+    }
+    mBuckets = new (std::nothrow) Node*[bucketCount];
+    if (!mBuckets) {
+        return;
+    }
+    std::fill_n(mBuckets, bucketCount, nullptr);
+    mBucketCount = bucketCount;
+    mSize = size;
+}
+
+bool ItemIndex::allocateBlock()
+{
+    if (mSize + sizeof(NodeBlock) > mMaxSize) {
+        return false;
+    }
+    NodeBlock* block = new (std::nothrow) NodeBlock;
+    if (!block) {
+        return false;
+    }
+    mBlockList.push_back(block);
+    mSize += sizeof(NodeBlock);
+    for (size_t i = 0; i < NodeBlock::ENTRY_COUNT; ++i) {
+        block->mNodes[i].mNext = mFreeNodes;
+        mFreeNodes = &block->mNodes[i];
+    }
+    return true;
+}
+
+void ItemIndex::insert(uint32_t hash, Page* page, size_t index)
+{
+    if (!isValid()) {
+        return;
+    }
+    if (!mFreeNodes && !allocateBlock()) {
+        // out of memory budget, stop indexing until next init
+        clear();
+        return;
+    }
+    Node* node = mFreeNodes;
+    mFreeNodes = node->mNext;
+
+    node->mPage = page;
+    node->mIndex = (uint32_t) index;
+    node->mHash = hash;
+
+    Node** bucket = bucketFor(hash);
+    node->mNext = *bucket;
+    *bucket = node;
+}
+
+void ItemIndex::erase(uint32_t hash, Page* page, size_t index)
+{
+    if (!isValid()) {
+        return;
+    }
+    for (Node** prev = bucketFor(hash); *prev != nullptr; prev = &(*prev)->mNext) {
+        Node* node = *prev;
+        if (node->mPage == page && node->mIndex == index) {
+            *prev = node->mNext;
+            node->mNext = mFreeNodes;
+            mFreeNodes = node;
+            return;
+        }
+    }
+}
+
+size_t ItemIndex::find(const Item& item, Entry* dst, size_t maxCount) const
+{
+    if (!isValid()) {
+        return 0;
+    }
+    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
+    size_t count = 0;
+    for (Node* node = *bucketFor(hash_24); node != nullptr; node = node->mNext) {
+        if (node->mHash != hash_24) {
+            continue;
+        }
+        if (count < maxCount) {
+            dst[count].mPage = node->mPage;
+            dst[count].mIndex = node->mIndex;
+        }
+        ++count;
+    }
+    return count;
+}
+
+} // namespace nvs
@@ -0,0 +1,109 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_item_index_h
+#define nvs_item_index_h
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+#include "intrusive_list.h"
+
+namespace nvs
+{
+
+class Page;
+
+/**
+ * Partition-wide index of the items stored in all pages of a Storage.
+ *
+ * Maps the 24-bit item hash (namespace, key and chunk index, same as HashList)
+ * to the page and entry index where the item header is located. Individual
+ * page hash lists keep this index up to date as they change, so a lookup only
+ * has to verify a few candidate entries instead of probing every page.
+ *
+ * Memory used by the index is limited. If the limit is exceeded, the index
+ * drops all its entries and becomes invalid until the next call to init.
+ */
+class ItemIndex
+{
+public:
+    struct Entry {
+        Page* mPage;
+        size_t mIndex;
+    };
+
+    /* Maximum number of candidates returned by a single call to find */
+    static const size_t MAX_CANDIDATES = 8;
+
+    ItemIndex();
+    ~ItemIndex();
+
+    void init(size_t pageCount, size_t maxSize);
+    void clear();
+
+    bool isValid() const
+    {
+        return mBuckets != nullptr;
+    }
+
+    size_t getSize() const
+    {
+        return mSize;
+    }
+
+    void insert(uint32_t hash, Page* page, size_t index);
+    void erase(uint32_t hash, Page* page, size_t index);
+
+    /* Returns the number of candidates for the item, which may be larger than
+     * maxCount; in that case only the first maxCount are stored in dst. */
+    size_t find(const Item& item, Entry* dst, size_t maxCount) const;
+
+private:
+    ItemIndex(const ItemIndex& other);
+    const ItemIndex& operator= (const ItemIndex& rhs);
+
+protected:
+    struct Node {
+        Node* mNext;
+        Page* mPage;
+        uint32_t mIndex : 8;
+        uint32_t mHash  : 24;
+    };
+
+    struct NodeBlock : public intrusive_list_node<NodeBlock> {
+        static const size_t ENTRY_COUNT = 32;
+
+        Node mNodes[ENTRY_COUNT];
+    };
+
+    Node** bucketFor(uint32_t hash) const
+    {
+        return &mBuckets[hash & (mBucketCount - 1)];
+    }
+
+    bool allocateBlock();
+
+    typedef intrusive_list<NodeBlock> TBlockList;
+    TBlockList mBlockList;
+    Node** mBuckets = nullptr;
+    Node* mFreeNodes = nullptr;
+    size_t mBucketCount = 0;
+    size_t mSize = 0;
+    size_t mMaxSize = 0;
+}; // class ItemIndex
+
+} // namespace nvs
+
+
+#endif /* nvs_item_index_h */
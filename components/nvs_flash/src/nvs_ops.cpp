@@ -16,11 +16,24 @@
 #include "nvs_ops.hpp"
 #ifdef CONFIG_NVS_ENCRYPTION
 #include "nvs_encr.hpp"
+#include <stdlib.h>
 #include <string.h>
 #endif
 
 namespace nvs
 {
+/* spi_flash_mmap requires the address to be aligned to MMU page size */
+static esp_err_t spi_flash_mmap_offset(size_t srcAddr, size_t size, const void** outPtr, spi_flash_mmap_handle_t* outHandle) {
+    size_t mapAddr = srcAddr & ~(SPI_FLASH_MMU_PAGE_SIZE - 1);
+    const void* ptr;
+    auto err = spi_flash_mmap(mapAddr, srcAddr - mapAddr + size, SPI_FLASH_MMAP_DATA, &ptr, outHandle);
+    if(err != ESP_OK) {
+        return err;
+    }
+    *outPtr = static_cast<const uint8_t*>(ptr) + (srcAddr - mapAddr);
+    return ESP_OK;
+}
+
 #ifdef CONFIG_NVS_ENCRYPTION
 esp_err_t nvs_flash_write(size_t destAddr, const void *srcAddr, size_t size) {
 
@@ -30,13 +43,15 @@ esp_err_t nvs_flash_write(size_t destAddr, const void *srcAddr, size_t size) {
 
         if(xtsCtxt) {
             uint8_t* buf = static_cast<uint8_t*>(malloc(size));
+            if (!buf) {
+                return ESP_ERR_NO_MEM;
+            }
             memcpy(buf, srcAddr, size);
             auto err = encrMgr->encryptNvsData(buf, destAddr, size, xtsCtxt);
-            if( err != ESP_OK) {
-                return err;
+            if (err == ESP_OK) {
+                err = spi_flash_write(destAddr, buf, size);
             }
-            err = spi_flash_write(destAddr, buf, size);
-            delete buf;
+            free(buf);
             return err;
         }
     }
@@ -61,6 +76,14 @@ esp_err_t nvs_flash_read(size_t srcAddr, void *destAddr, size_t size) {
     }
     return ESP_OK;
 }
+
+esp_err_t nvs_flash_mmap(size_t srcAddr, size_t size, const void** outPtr, spi_flash_mmap_handle_t* outHandle) {
+
+    if(EncrMgr::isEncrActive() && EncrMgr::getInstance()->findXtsCtxtFromAddr(srcAddr)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return spi_flash_mmap_offset(srcAddr, size, outPtr, outHandle);
+}
 #else
 esp_err_t nvs_flash_write(size_t destAddr, const void *srcAddr, size_t size) {
     return spi_flash_write(destAddr, srcAddr, size);
@@ -69,5 +92,9 @@ esp_err_t nvs_flash_write(size_t destAddr, const void *srcAddr, size_t size) {
 esp_err_t nvs_flash_read(size_t srcAddr, void *destAddr, size_t size) {
     return spi_flash_read(srcAddr, destAddr, size);
 }
+
+esp_err_t nvs_flash_mmap(size_t srcAddr, size_t size, const void** outPtr, spi_flash_mmap_handle_t* outHandle) {
+    return spi_flash_mmap_offset(srcAddr, size, outPtr, outHandle);
+}
 #endif
 }
@@ -15,11 +15,14 @@
 #define nvs_ops_hpp
 
 #include "esp_err.h"
+#include "esp_spi_flash.h"
 
 namespace nvs
 {
     esp_err_t nvs_flash_write(size_t destAddr, const void *srcAddr, size_t size);
     esp_err_t nvs_flash_read(size_t srcAddr, void *destAddr, size_t size);
+    /* Returns ESP_ERR_NOT_SUPPORTED if data at srcAddr is encrypted */
+    esp_err_t nvs_flash_mmap(size_t srcAddr, size_t size, const void** outPtr, spi_flash_mmap_handle_t* outHandle);
 
 } // namespace nvs
 
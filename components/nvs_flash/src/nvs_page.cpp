@@ -19,6 +19,7 @@
 #endif
 #include <cstdio>
 #include <cstring>
+#include <new>
 
 #include "nvs_ops.hpp"
 
@@ -32,11 +33,13 @@ uint32_t Page::Header::calculateCrc32()
                     offsetof(Header, mCrc32) - offsetof(Header, mSeqNumber));
 }
 
-esp_err_t Page::load(uint32_t sectorNumber)
+esp_err_t Page::load(uint32_t sectorNumber, bool deferItems)
 {
     mBaseAddress = sectorNumber * SEC_SIZE;
     mUsedEntryCount = 0;
     mErasedEntryCount = 0;
+    mDeferredItems = false;
+    std::fill_n(mSpecialEntries.data(), mSpecialEntries.byteSize() / 4, 0);
 
     Header header;
     auto rc = spi_flash_read(mBaseAddress, &header, sizeof(header));
@@ -81,6 +84,14 @@ esp_err_t Page::load(uint32_t sectorNumber)
         break;
 
     case PageState::FULL:
+        if (deferItems) {
+            mDeferredItems = true;
+            mLoadEntryStates();
+            break;
+        }
+        mLoadEntryTable();
+        break;
+
     case PageState::ACTIVE:
     case PageState::FREEING:
         mLoadEntryTable();
@@ -215,7 +226,7 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
     // write first item
     size_t span = (totalSize + ENTRY_SIZE - 1) / ENTRY_SIZE;
     item = Item(nsIndex, datatype, span, key, chunkIdx);
-    mHashList.insert(item, mNextFreeEntry);
+    indexItem(item, mNextFreeEntry);
 
     if (!isVariableLengthType(datatype)) {
         memcpy(item.data, data, dataSize);
@@ -257,6 +268,124 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
     return ESP_OK;
 }
 
+esp_err_t Page::writeTransaction(Transaction& txn)
+{
+    esp_err_t err;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    if (mState == PageState::UNINITIALIZED) {
+        err = initialize();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (mState == PageState::FULL) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    const size_t entriesCount = txn.getEntryCount() + 1;
+    if (mNextFreeEntry == INVALID_ENTRY || mNextFreeEntry + entriesCount > ENTRY_COUNT) {
+        // page will not fit this amount of data
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    // pack the marker and all items into consecutive entries
+    Item* entries = new (std::nothrow) Item[entriesCount];
+    if (!entries) {
+        return ESP_ERR_NO_MEM;
+    }
+    entries[0] = Item(NS_ANY, ItemType::TXN_MARKER, 1, nullptr);
+    entries[0].txnMarker.entryCount = static_cast<uint8_t>(txn.getEntryCount());
+    entries[0].crc32 = entries[0].calculateCrc32();
+
+    size_t pos = 1;
+    for (auto it = txn.begin(); it != txn.end(); ++it) {
+        Item& item = entries[pos];
+        item = Item(it->nsIndex, it->datatype, it->span, it->key);
+        if (!isVariableLengthType(it->datatype)) {
+            memcpy(item.data, it->data, it->dataSize);
+        } else {
+            item.varLength.dataCrc32 = Item::calculateCrc32(it->data, it->dataSize);
+            item.varLength.dataSize = it->dataSize;
+            item.varLength.reserved = 0xffff;
+            uint8_t* dst = entries[pos + 1].rawData;
+            std::fill_n(dst, (it->span - 1) * ENTRY_SIZE, 0xff);
+            memcpy(dst, it->data, it->dataSize);
+        }
+        item.crc32 = item.calculateCrc32();
+        pos += it->span;
+    }
+    assert(pos == entriesCount);
+
+    const size_t first = mNextFreeEntry;
+    err = nvs_flash_write(getEntryAddress(first), entries, entriesCount * ENTRY_SIZE);
+    if (err != ESP_OK) {
+        delete[] entries;
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    // mark all items as written, then the marker. Until the marker is written,
+    // mLoadEntryTable will drop the whole transaction.
+    if (entriesCount > 1) {
+        err = alterEntryRangeState(first + 1, first + entriesCount, EntryState::WRITTEN);
+        if (err != ESP_OK) {
+            delete[] entries;
+            mState = PageState::INVALID;
+            return err;
+        }
+    }
+    err = alterEntryState(first, EntryState::WRITTEN);
+    if (err != ESP_OK) {
+        delete[] entries;
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    for (size_t i = 0; i < entriesCount; i += entries[i].span) {
+        indexItem(entries[i], first + i);
+    }
+    delete[] entries;
+
+    if (mFirstUsedEntry == INVALID_ENTRY) {
+        mFirstUsedEntry = first;
+    }
+    mTxnMarkerIndex = first;
+    mUsedEntryCount += entriesCount;
+    mNextFreeEntry += entriesCount;
+    return ESP_OK;
+}
+
+esp_err_t Page::findTransaction(size_t& begin, size_t& end)
+{
+    if (mTxnMarkerIndex == INVALID_ENTRY) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    Item marker;
+    auto rc = readEntry(mTxnMarkerIndex, marker);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    begin = mTxnMarkerIndex + 1;
+    end = begin + marker.txnMarker.entryCount;
+    if (end > ENTRY_COUNT) {
+        end = ENTRY_COUNT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t Page::eraseTransactionMarker()
+{
+    if (mTxnMarkerIndex == INVALID_ENTRY) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return eraseEntryAndSpan(mTxnMarkerIndex);
+}
+
 esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -286,7 +415,20 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
 
     uint8_t* dst = reinterpret_cast<uint8_t*>(data);
     size_t left = item.varLength.dataSize;
-    for (size_t i = index + 1; i < index + item.span; ++i) {
+    // entries completely filled with data are read straight into the destination
+    size_t fullEntries = left / ENTRY_SIZE;
+    if (fullEntries > static_cast<size_t>(item.span - 1)) {
+        fullEntries = item.span - 1;
+    }
+    if (fullEntries > 0) {
+        rc = readEntries(index + 1, fullEntries, dst);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        left -= fullEntries * ENTRY_SIZE;
+        dst += fullEntries * ENTRY_SIZE;
+    }
+    for (size_t i = index + 1 + fullEntries; i < index + item.span; ++i) {
         Item ditem;
         rc = readEntry(i, ditem);
         if (rc != ESP_OK) {
@@ -308,6 +450,101 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
     return ESP_OK;
 }
 
+esp_err_t Page::readItemRange(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t offset, size_t size, uint8_t chunkIdx, VerOffset chunkStart)
+{
+    size_t index = 0;
+    Item item;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    esp_err_t rc = findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+
+    if (!isVariableLengthType(datatype)) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    const size_t dataSize = item.varLength.dataSize;
+    if (offset > dataSize || size > dataSize - offset) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    // Data is read a few entries at a time, so that CRC of the whole item can be
+    // checked without a buffer for all of it. Only the requested range is copied.
+    uint8_t* dst = reinterpret_cast<uint8_t*>(data);
+    uint32_t crc32 = 0xffffffff;
+    size_t pos = 0;
+    Item ditems[ENTRY_RUN_SIZE];
+    for (size_t i = index + 1; i < index + item.span; i += ENTRY_RUN_SIZE) {
+        size_t count = index + item.span - i;
+        count = (count < ENTRY_RUN_SIZE)?count:ENTRY_RUN_SIZE;
+        rc = readEntries(i, count, ditems);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(ditems);
+        size_t willRead = count * ENTRY_SIZE;
+        willRead = (dataSize - pos < willRead)?(dataSize - pos):willRead;
+        crc32 = Item::calculateCrc32(src, willRead, crc32);
+
+        size_t from = (offset > pos)?offset:pos;
+        size_t to = (offset + size < pos + willRead)?(offset + size):(pos + willRead);
+        if (from < to) {
+            memcpy(dst + (from - offset), src + (from - pos), to - from);
+        }
+        pos += willRead;
+    }
+    if (crc32 != item.varLength.dataCrc32) {
+        rc = eraseEntryAndSpan(index);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t Page::mmapItem(uint8_t nsIndex, ItemType datatype, const char* key, const void** outPtr, size_t& dataSize, spi_flash_mmap_handle_t& handle, uint8_t chunkIdx, VerOffset chunkStart)
+{
+    size_t index = 0;
+    Item item;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    esp_err_t rc = findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+
+    if (!isVariableLengthType(datatype)) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    // data entries of an item are stored contiguously right after its header
+    const void* ptr;
+    rc = nvs_flash_mmap(getEntryAddress(index) + ENTRY_SIZE, item.varLength.dataSize, &ptr, &handle);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    if (Item::calculateCrc32(static_cast<const uint8_t*>(ptr), item.varLength.dataSize) != item.varLength.dataCrc32) {
+        spi_flash_munmap(handle);
+        rc = eraseEntryAndSpan(index);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *outPtr = ptr;
+    dataSize = item.varLength.dataSize;
+    return ESP_OK;
+}
+
 esp_err_t Page::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -328,6 +565,9 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, ui
 
 esp_err_t Page::eraseEntryAndSpan(size_t index)
 {
+    if (index == mTxnMarkerIndex) {
+        mTxnMarkerIndex = INVALID_ENTRY;
+    }
     auto state = mEntryTable.get(index);
     assert(state == EntryState::WRITTEN || state == EntryState::EMPTY);
 
@@ -398,6 +638,33 @@ void Page::updateFirstUsedEntry(size_t index, size_t span)
     }
 }
 
+esp_err_t Page::eraseUncommittedTransaction(size_t index, const Item& marker)
+{
+    size_t end = index + 1 + marker.txnMarker.entryCount;
+    if (end > ENTRY_COUNT) {
+        end = ENTRY_COUNT;
+    }
+    for (size_t i = index; i < end; ++i) {
+        auto state = mEntryTable.get(i);
+        if (state == EntryState::WRITTEN) {
+            --mUsedEntryCount;
+        }
+        if (state != EntryState::ERASED) {
+            ++mErasedEntryCount;
+        }
+    }
+    auto rc = alterEntryRangeState(index, end, EntryState::ERASED);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    // nothing was written after the transaction
+    if (mFirstUsedEntry >= index && mFirstUsedEntry < end) {
+        mFirstUsedEntry = INVALID_ENTRY;
+    }
+    mNextFreeEntry = end;
+    return ESP_OK;
+}
+
 esp_err_t Page::copyItems(Page& other)
 {
     if (mFirstUsedEntry == INVALID_ENTRY) {
@@ -426,7 +693,15 @@ esp_err_t Page::copyItems(Page& other)
             return err;
         }
 
-        other.mHashList.insert(entry, other.mNextFreeEntry);
+        if (entry.datatype == ItemType::TXN_MARKER) {
+            // Erased entries are skipped below, so the entries following the
+            // marker on the new page would not be the ones of the transaction.
+            // Pages with a transaction are not freed before Storage completes
+            // it, so the marker is not needed any more and is dropped.
+            readEntryIndex += entry.span;
+            continue;
+        }
+        other.indexItem(entry, other.mNextFreeEntry);
         err = other.writeEntry(entry);
         if (err != ESP_OK) {
             return err;
@@ -436,12 +711,9 @@ esp_err_t Page::copyItems(Page& other)
 
         assert(end <= ENTRY_COUNT);
 
-        for (size_t i = readEntryIndex + 1; i < end; ++i) {
-            readEntry(i, entry);
-            err = other.writeEntry(entry);
-            if (err != ESP_OK) {
-                return err;
-            }
+        err = copyEntries(other, readEntryIndex + 1, span - 1);
+        if (err != ESP_OK) {
+            return err;
         }
         readEntryIndex = end;
 
@@ -449,7 +721,59 @@ esp_err_t Page::copyItems(Page& other)
     return ESP_OK;
 }
 
-esp_err_t Page::mLoadEntryTable()
+esp_err_t Page::moveItems(Page& other, size_t maxEntries, size_t& movedEntries)
+{
+    movedEntries = 0;
+
+    if (other.mState == PageState::UNINITIALIZED) {
+        auto err = other.initialize();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (other.mState != PageState::ACTIVE) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    Item entry;
+    while (mFirstUsedEntry != INVALID_ENTRY && movedEntries < maxEntries) {
+        const size_t index = mFirstUsedEntry;
+        assert(mEntryTable.get(index) == EntryState::WRITTEN);
+
+        auto err = readEntry(index, entry);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        const size_t span = entry.span;
+        assert(index + span <= ENTRY_COUNT);
+        if (other.mNextFreeEntry + span > ENTRY_COUNT) {
+            return ESP_ERR_NVS_PAGE_FULL;
+        }
+
+        other.indexItem(entry, other.mNextFreeEntry);
+        err = other.writeEntry(entry);
+        if (err != ESP_OK) {
+            return err;
+        }
+        err = copyEntries(other, index + 1, span - 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        // if power goes off before this, PageManager::load will find
+        // the copy as the last item of the last page and erase this one
+        err = eraseEntryAndSpan(index);
+        if (err != ESP_OK) {
+            return err;
+        }
+        movedEntries += span;
+    }
+    return ESP_OK;
+}
+
+esp_err_t Page::mLoadEntryStates()
 {
     // for states where we actually care about data in the page, read entry state table
     if (mState == PageState::ACTIVE ||
@@ -477,6 +801,16 @@ esp_err_t Page::mLoadEntryTable()
         }
     }
 
+    return ESP_OK;
+}
+
+esp_err_t Page::mLoadEntryTable()
+{
+    auto rc = mLoadEntryStates();
+    if (rc != ESP_OK) {
+        return rc;
+    }
+
     // for PageState::ACTIVE, we may have more data written to this page
     // as such, we need to figure out where the first unused entry is
     if (mState == PageState::ACTIVE) {
@@ -500,8 +834,24 @@ esp_err_t Page::mLoadEntryTable()
                 return rc;
             }
             if (header != 0xffffffff) {
+                // power went off before the transaction was committed, drop all of it
+                Item marker;
+                auto err = readEntry(mNextFreeEntry, marker);
+                if (err != ESP_OK) {
+                    mState = PageState::INVALID;
+                    return err;
+                }
+                if (marker.datatype == ItemType::TXN_MARKER && marker.crc32 == marker.calculateCrc32()) {
+                    err = eraseUncommittedTransaction(mNextFreeEntry, marker);
+                    if (err != ESP_OK) {
+                        mState = PageState::INVALID;
+                        return err;
+                    }
+                    continue;
+                }
+
                 auto oldState = mEntryTable.get(mNextFreeEntry);
-                auto err = alterEntryState(mNextFreeEntry, EntryState::ERASED);
+                err = alterEntryState(mNextFreeEntry, EntryState::ERASED);
                 if (err != ESP_OK) {
                     mState = PageState::INVALID;
                     return err;
@@ -519,6 +869,9 @@ esp_err_t Page::mLoadEntryTable()
 
         // check that all variable-length items are written or erased fully
         Item item;
+        Item run[ENTRY_RUN_SIZE];
+        size_t runStart = 0;
+        size_t runCount = 0;
         size_t lastItemIndex = INVALID_ENTRY;
         size_t end = mNextFreeEntry;
         if (end > ENTRY_COUNT) {
@@ -534,14 +887,18 @@ esp_err_t Page::mLoadEntryTable()
 
             lastItemIndex = i;
 
-            auto err = readEntry(i, item);
-            if (err != ESP_OK) {
-                mState = PageState::INVALID;
-                return err;
+            if (i >= runStart + runCount) {
+                auto err = readEntryRun(i, run, runCount);
+                if (err != ESP_OK) {
+                    mState = PageState::INVALID;
+                    return err;
+                }
+                runStart = i;
             }
+            item = run[i - runStart];
 
             if (item.crc32 != item.calculateCrc32()) {
-                err = eraseEntryAndSpan(i);
+                auto err = eraseEntryAndSpan(i);
                 if (err != ESP_OK) {
                     mState = PageState::INVALID;
                     return err;
@@ -549,7 +906,11 @@ esp_err_t Page::mLoadEntryTable()
                 continue;
             }
 
-            mHashList.insert(item, i);
+            indexItem(item, i);
+
+            if (item.datatype == ItemType::TXN_MARKER) {
+                mTxnMarkerIndex = i;
+            }
 
             // search for potential duplicate item
             size_t duplicateIndex = mHashList.find(0, item);
@@ -594,52 +955,207 @@ esp_err_t Page::mLoadEntryTable()
             }
         }
     } else if (mState == PageState::FULL || mState == PageState::FREEING) {
-        // We have already filled mHashList for page in active state.
-        // Do the same for the case when page is in full or freeing state.
-        Item item;
-        for (size_t i = mFirstUsedEntry; i < ENTRY_COUNT; ++i) {
-            if (mEntryTable.get(i) != EntryState::WRITTEN) {
-                continue;
-            }
+        auto err = mLoadItems();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    return ESP_OK;
+}
 
-            auto err = readEntry(i, item);
+esp_err_t Page::mLoadItems()
+{
+    // mLoadEntryTable fills mHashList for page in active state while checking
+    // it for incomplete writes, do the same for page in full or freeing state.
+    // Runs of written entries are read at once, item headers are picked from them.
+    Item run[ENTRY_RUN_SIZE];
+    size_t runStart = 0;
+    size_t runCount = 0;
+    for (size_t i = mFirstUsedEntry; i < ENTRY_COUNT; ++i) {
+        if (mEntryTable.get(i) != EntryState::WRITTEN) {
+            continue;
+        }
+
+        if (i >= runStart + runCount) {
+            auto err = readEntryRun(i, run, runCount);
             if (err != ESP_OK) {
                 mState = PageState::INVALID;
                 return err;
             }
+            runStart = i;
+        }
+        const Item& item = run[i - runStart];
 
-            if (item.crc32 != item.calculateCrc32()) {
-                err = eraseEntryAndSpan(i);
-                if (err != ESP_OK) {
-                    mState = PageState::INVALID;
-                    return err;
-                }
-                continue;
+        if (item.crc32 != item.calculateCrc32()) {
+            auto err = eraseEntryAndSpan(i);
+            if (err != ESP_OK) {
+                mState = PageState::INVALID;
+                return err;
             }
+            continue;
+        }
 
-            assert(item.span > 0);
+        assert(item.span > 0);
 
-            mHashList.insert(item, i);
+        indexItem(item, i);
 
-            size_t span = item.span;
+        if (item.datatype == ItemType::TXN_MARKER) {
+            mTxnMarkerIndex = i;
+        }
 
-            if (isVariableLengthType(item.datatype)) {
-                for (size_t j = i + 1; j < i + span; ++j) {
-                    if (mEntryTable.get(j) != EntryState::WRITTEN) {
-                        eraseEntryAndSpan(i);
-                        break;
-                    }
+        size_t span = item.span;
+
+        if (isVariableLengthType(item.datatype)) {
+            for (size_t j = i + 1; j < i + span; ++j) {
+                if (mEntryTable.get(j) != EntryState::WRITTEN) {
+                    eraseEntryAndSpan(i);
+                    break;
                 }
             }
-
-            i += span - 1;
         }
 
+        i += span - 1;
     }
 
     return ESP_OK;
 }
 
+esp_err_t Page::loadDeferredItems(const uint8_t* summary, size_t summarySize)
+{
+    assert(mDeferredItems);
+    mDeferredItems = false;
+    if (summary != nullptr && mLoadSummary(summary, summarySize)) {
+        return ESP_OK;
+    }
+    return mLoadItems();
+}
+
+bool Page::mLoadSummary(const uint8_t* summary, size_t summarySize)
+{
+    SummaryHeader header;
+    if (summarySize < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, summary, sizeof(header));
+    const size_t count = header.mItemCount;
+    if (header.mSeqNumber != mSeqNumber || count > ENTRY_COUNT ||
+            summarySize != sizeof(header) + count * (sizeof(uint32_t) + 1)) {
+        return false;
+    }
+    const uint8_t* records = summary + sizeof(header);
+    const uint8_t* spans = records + count * sizeof(uint32_t);
+
+    // every written entry has to belong to one of the items in the summary,
+    // otherwise the page has changed in a way the summary doesn't describe
+    CompressedEnumTable<bool, 1, ENTRY_COUNT> covered = CompressedEnumTable<bool, 1, ENTRY_COUNT>();
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t record;
+        memcpy(&record, records + i * sizeof(record), sizeof(record));
+        const size_t index = record & 0xff;
+        const size_t span = spans[i] & ~SUMMARY_SPECIAL_FLAG;
+        if (span == 0 || index + span > ENTRY_COUNT) {
+            return false;
+        }
+        for (size_t j = index; j < index + span; ++j) {
+            covered.set(j, true);
+        }
+    }
+    for (size_t i = 0; i < ENTRY_COUNT; ++i) {
+        if (mEntryTable.get(i) == EntryState::WRITTEN && !covered.get(i)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t record;
+        memcpy(&record, records + i * sizeof(record), sizeof(record));
+        const size_t index = record & 0xff;
+        const size_t span = spans[i] & ~SUMMARY_SPECIAL_FLAG;
+        if (mEntryTable.get(index) != EntryState::WRITTEN) {
+            continue;
+        }
+        mHashList.insert(record >> 8, index);
+        mSpecialEntries.set(index, (spans[i] & SUMMARY_SPECIAL_FLAG) != 0);
+
+        // same check as in mLoadItems, in case power went off while the item was erased
+        for (size_t j = index + 1; j < index + span; ++j) {
+            if (mEntryTable.get(j) != EntryState::WRITTEN) {
+                eraseEntryAndSpan(index);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+esp_err_t Page::writeSummary(Page& other, size_t reserveEntries)
+{
+    if (mState != PageState::FULL || mDeferredItems || mTxnMarkerIndex != INVALID_ENTRY) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    CompressedEnumTable<bool, 1, ENTRY_COUNT> isItem = CompressedEnumTable<bool, 1, ENTRY_COUNT>();
+    size_t count = 0;
+    mHashList.forEach([&](size_t index, uint32_t) {
+        isItem.set(index, true);
+        ++count;
+    });
+
+    SummaryHeader header;
+    header.mSeqNumber = mSeqNumber;
+    header.mItemCount = static_cast<uint16_t>(count);
+    header.mReserved = 0xffff;
+
+    const size_t size = sizeof(header) + count * (sizeof(uint32_t) + 1);
+    const size_t summaryEntries = 1 + (size + ENTRY_SIZE - 1) / ENTRY_SIZE;
+    // the tailroom doesn't include the header entry of an item
+    if (summaryEntries + reserveEntries > other.getVarDataTailroom() / ENTRY_SIZE + 1) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    uint8_t* summary = new (std::nothrow) uint8_t[size];
+    if (!summary) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(summary, &header, sizeof(header));
+    uint8_t* records = summary + sizeof(header);
+    uint8_t* spans = records + count * sizeof(uint32_t);
+
+    size_t pos = 0;
+    mHashList.forEach([&](size_t index, uint32_t hash) {
+        uint32_t record = static_cast<uint32_t>(index) | (hash << 8);
+        memcpy(records + pos * sizeof(record), &record, sizeof(record));
+        // data entries of an item are the written entries which follow it
+        size_t end = index + 1;
+        while (end < ENTRY_COUNT && mEntryTable.get(end) == EntryState::WRITTEN && !isItem.get(end)) {
+            ++end;
+        }
+        spans[pos] = static_cast<uint8_t>(end - index);
+        if (mSpecialEntries.get(index)) {
+            spans[pos] |= SUMMARY_SPECIAL_FLAG;
+        }
+        ++pos;
+    });
+
+    char key[Item::MAX_KEY_LENGTH + 1];
+    getSummaryKey(mSeqNumber, key, sizeof(key));
+    auto err = other.writeItem(NS_SUMMARY, ItemType::BLOB, key, summary, size);
+    delete[] summary;
+    return err;
+}
+
+void Page::getSummaryKey(uint32_t seqNumber, char* key, size_t keySize)
+{
+    snprintf(key, keySize, "%08x", static_cast<unsigned>(seqNumber));
+}
+
+void Page::indexItem(const Item& item, size_t index)
+{
+    mHashList.insert(item, index);
+    mSpecialEntries.set(index, isSpecialItem(item));
+}
+
 
 esp_err_t Page::initialize()
 {
@@ -724,6 +1240,41 @@ esp_err_t Page::readEntry(size_t index, Item& dst) const
     return ESP_OK;
 }
 
+esp_err_t Page::readEntries(size_t index, size_t count, void* dst) const
+{
+    assert(index + count <= ENTRY_COUNT);
+    return nvs_flash_read(getEntryAddress(index), dst, count * ENTRY_SIZE);
+}
+
+esp_err_t Page::readEntryRun(size_t index, Item* dst, size_t& count) const
+{
+    count = 1;
+    while (count < ENTRY_RUN_SIZE && index + count < ENTRY_COUNT &&
+            mEntryTable.get(index + count) == EntryState::WRITTEN) {
+        ++count;
+    }
+    return readEntries(index, count, dst);
+}
+
+esp_err_t Page::copyEntries(Page& other, size_t index, size_t count)
+{
+    Item entries[ENTRY_RUN_SIZE];
+    while (count > 0) {
+        size_t n = (count < ENTRY_RUN_SIZE) ? count : ENTRY_RUN_SIZE;
+        auto err = readEntries(index, n, entries);
+        if (err != ESP_OK) {
+            return err;
+        }
+        err = other.writeEntryData(reinterpret_cast<const uint8_t*>(entries), n * ENTRY_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+        index += n;
+        count -= n;
+    }
+    return ESP_OK;
+}
+
 esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
 {
     if (mState == PageState::CORRUPT || mState == PageState::INVALID || mState == PageState::UNINITIALIZED) {
@@ -754,6 +1305,12 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
         }
     }
 
+    // items searched for by namespace or type when storage is initialized
+    // are marked in mSpecialEntries, other entries don't have to be read
+    const bool specialOnly = key == nullptr &&
+            (nsIndex == NS_INDEX || nsIndex == NS_SUMMARY ||
+             (nsIndex == NS_ANY && (datatype == ItemType::BLOB_IDX || datatype == ItemType::BLOB_DATA)));
+
     size_t next;
     for (size_t i = start; i < end; i = next) {
         next = i + 1;
@@ -761,6 +1318,10 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
             continue;
         }
 
+        if (specialOnly && !mSpecialEntries.get(i)) {
+            continue;
+        }
+
         auto rc = readEntry(i, item);
         if (rc != ESP_OK) {
             mState = PageState::INVALID;
@@ -853,6 +1414,7 @@ esp_err_t Page::setVersion(uint8_t ver)
 
 esp_err_t Page::erase()
 {
+    assert(!isPinned());
     auto sector = mBaseAddress / SPI_FLASH_SEC_SIZE;
     auto rc = spi_flash_erase_sector(sector);
     if (rc != ESP_OK) {
@@ -863,8 +1425,10 @@ esp_err_t Page::erase()
     mErasedEntryCount = 0;
     mFirstUsedEntry = INVALID_ENTRY;
     mNextFreeEntry = INVALID_ENTRY;
+    mTxnMarkerIndex = INVALID_ENTRY;
     mState = PageState::UNINITIALIZED;
     mHashList.clear();
+    std::fill_n(mSpecialEntries.data(), mSpecialEntries.byteSize() / 4, 0);
     return ESP_OK;
 }
 
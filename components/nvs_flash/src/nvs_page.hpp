@@ -24,6 +24,7 @@
 #include "compressed_enum_table.hpp"
 #include "intrusive_list.h"
 #include "nvs_item_hash_list.hpp"
+#include "nvs_transaction.hpp"
 
 namespace nvs
 {
@@ -48,7 +49,12 @@ public:
 
     static const size_t CHUNK_MAX_SIZE = ENTRY_SIZE * (ENTRY_COUNT - 1);
 
+    /* Maximum number of entries read with one flash (and decryption) operation
+     * when loading, reading or copying items */
+    static const size_t ENTRY_RUN_SIZE = 8;
+
     static const uint8_t NS_INDEX = 0;
+    static const uint8_t NS_SUMMARY = 254;
     static const uint8_t NS_ANY = 255;
 
     static const uint8_t CHUNK_ANY = Item::CHUNK_ANY;
@@ -82,7 +88,23 @@ public:
         return mState;
     }
 
-    esp_err_t load(uint32_t sectorNumber);
+    esp_err_t load(uint32_t sectorNumber, bool deferItems = false);
+
+    /* For a full page loaded with deferItems set, fill the hash list using the
+     * summary written by writeSummary, or by reading all items if summary is
+     * null or doesn't match the page */
+    esp_err_t loadDeferredItems(const uint8_t* summary, size_t summarySize);
+
+    bool hasDeferredItems() const
+    {
+        return mDeferredItems;
+    }
+
+    /* Write the list of items of this full page into the other page, unless
+     * fewer than reserveEntries entries of the other page would be left free */
+    esp_err_t writeSummary(Page& other, size_t reserveEntries = 0);
+
+    static void getSummaryKey(uint32_t seqNumber, char* key, size_t keySize);
 
     esp_err_t getSeqNumber(uint32_t& seqNumber) const;
 
@@ -92,8 +114,16 @@ public:
 
     esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY);
 
+    esp_err_t writeTransaction(Transaction& txn);
+
     esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    /* Reads size bytes starting at offset from a variable length item, verifying CRC of the whole item */
+    esp_err_t readItemRange(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t offset, size_t size, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+
+    /* Maps data of a variable length item into address space instead of copying it */
+    esp_err_t mmapItem(uint8_t nsIndex, ItemType datatype, const char* key, const void** outPtr, size_t& dataSize, spi_flash_mmap_handle_t& handle, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
@@ -129,18 +159,54 @@ public:
     }
     size_t getVarDataTailroom() const ;
 
+    esp_err_t findTransaction(size_t& begin, size_t& end);
+
+    esp_err_t eraseTransactionMarker();
+
+    bool hasTransaction() const
+    {
+        return mTxnMarkerIndex != INVALID_ENTRY;
+    }
+
     esp_err_t markFull();
 
     esp_err_t markFreeing();
 
     esp_err_t copyItems(Page& other);
 
+    /* Moves items to the other page one by one, each item being written before
+     * it is erased from this page. Stops once at least maxEntries entries are
+     * moved, and returns ESP_ERR_NVS_PAGE_FULL if the next item doesn't fit. */
+    esp_err_t moveItems(Page& other, size_t maxEntries, size_t& movedEntries);
+
     esp_err_t erase();
 
+    /* Pinned page is not erased during garbage collection, so mapped item data stays valid */
+    void pin()
+    {
+        ++mPinCount;
+    }
+
+    void unpin()
+    {
+        assert(mPinCount > 0);
+        --mPinCount;
+    }
+
+    bool isPinned() const
+    {
+        return mPinCount > 0;
+    }
+
     void debugDump() const;
 
     esp_err_t calcEntries(nvs_stats_t &nvsStats);
 
+    void setItemIndex(ItemIndex* itemIndex)
+    {
+        mHashList.setItemIndex(itemIndex, this);
+    }
+
 protected:
 
     class Header
@@ -169,6 +235,22 @@ protected:
 
     esp_err_t mLoadEntryTable();
 
+    esp_err_t mLoadEntryStates();
+
+    esp_err_t mLoadItems();
+
+    bool mLoadSummary(const uint8_t* summary, size_t summarySize);
+
+    void indexItem(const Item& item, size_t index);
+
+    /* Items which Storage looks up by namespace or type rather than by key */
+    static bool isSpecialItem(const Item& item)
+    {
+        return item.nsIndex == NS_INDEX || item.nsIndex == NS_SUMMARY ||
+               item.datatype == ItemType::BLOB_IDX || item.datatype == ItemType::BLOB_DATA ||
+               item.datatype == ItemType::TXN_MARKER;
+    }
+
     esp_err_t initialize();
 
     esp_err_t alterEntryState(size_t index, EntryState state);
@@ -179,12 +261,23 @@ protected:
 
     esp_err_t readEntry(size_t index, Item& dst) const;
 
+    esp_err_t readEntries(size_t index, size_t count, void* dst) const;
+
+    /* Reads entry at index, followed by as many of the written entries right after
+     * it as fit into dst (up to ENTRY_RUN_SIZE entries) */
+    esp_err_t readEntryRun(size_t index, Item* dst, size_t& count) const;
+
+    /* Appends count entries starting at index to the other page */
+    esp_err_t copyEntries(Page& other, size_t index, size_t count);
+
     esp_err_t writeEntry(const Item& item);
     
     esp_err_t writeEntryData(const uint8_t* data, size_t size);
 
     esp_err_t eraseEntryAndSpan(size_t index);
 
+    esp_err_t eraseUncommittedTransaction(size_t index, const Item& marker);
+
     void updateFirstUsedEntry(size_t index, size_t span);
 
     static constexpr size_t getAlignmentForType(ItemType type)
@@ -210,11 +303,27 @@ protected:
     TEntryTable mEntryTable;
     size_t mNextFreeEntry = INVALID_ENTRY;
     size_t mFirstUsedEntry = INVALID_ENTRY;
+    size_t mTxnMarkerIndex = INVALID_ENTRY;
     uint16_t mUsedEntryCount = 0;
     uint16_t mErasedEntryCount = 0;
+    uint16_t mPinCount = 0;
+    bool mDeferredItems = false;
 
     HashList mHashList;
 
+    typedef CompressedEnumTable<bool, 1, ENTRY_COUNT> TSpecialTable;
+    TSpecialTable mSpecialEntries = TSpecialTable(); // entries holding items for which isSpecialItem is true
+
+    /* Layout of the summary item data: header, followed by one record and
+     * one span byte for each item of the page */
+    struct SummaryHeader {
+        uint32_t mSeqNumber;
+        uint16_t mItemCount;
+        uint16_t mReserved;
+    };
+
+    static const uint8_t SUMMARY_SPECIAL_FLAG = 0x80;
+
     static const uint32_t HEADER_OFFSET = 0;
     static const uint32_t ENTRY_TABLE_OFFSET = HEADER_OFFSET + 32;
     static const uint32_t ENTRY_DATA_OFFSET = ENTRY_TABLE_OFFSET + 32;
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "nvs_pagemanager.hpp"
+#include <cstring>
+#include <new>
 
 namespace nvs
 {
@@ -24,7 +26,7 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
     mPages.reset(new Page[sectorCount]);
 
     for (uint32_t i = 0; i < sectorCount; ++i) {
-        auto err = mPages[i].load(baseSector + i);
+        auto err = mPages[i].load(baseSector + i, mSummaryEnabled);
         if (err != ESP_OK) {
             return err;
         }
@@ -53,6 +55,11 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
         mSeqNumber = lastSeqNo + 1;
     }
 
+    auto err = loadSummaries();
+    if (err != ESP_OK) {
+        return err;
+    }
+
     // if power went out after a new item for the given key was written,
     // but before the old one was erased, we end up with a duplicate item
     Page& lastPage = back();
@@ -131,21 +138,32 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
     return ESP_OK;
 }
 
-esp_err_t PageManager::requestNewPage()
+esp_err_t PageManager::requestNewPage(size_t reserveEntries)
 {
     if (mFreePageList.empty()) {
         return ESP_ERR_NVS_INVALID_STATE;
     }
 
+    Page* lastPage = mPageList.empty() ? nullptr : &back();
+
     // do we have at least two free pages? in that case no erasing is required
     if (mFreePageList.size() >= 2) {
-        return activatePage();
+        esp_err_t err = activatePage();
+        if (err != ESP_OK) {
+            return err;
+        }
+        return writeSummary(lastPage, reserveEntries);
     }
 
     // find the page with the higest number of erased items
     TPageListIterator maxUnusedItemsPageIt;
     size_t maxUnusedItems = 0;
     for (auto it = begin(); it != end(); ++it) {
+        // pages with mapped items can't be erased, and pages with a
+        // transaction are kept until Storage has completed it
+        if (it->isPinned() || it->hasTransaction()) {
+            continue;
+        }
 
         auto unused =  Page::ENTRY_COUNT - it->getUsedEntryCount();
         if (unused > maxUnusedItems) {
@@ -170,6 +188,10 @@ esp_err_t PageManager::requestNewPage()
 #ifndef NDEBUG
     size_t usedEntries = erasedPage->getUsedEntryCount();
 #endif
+    err = eraseSummary(*erasedPage);
+    if (err != ESP_OK) {
+        return err;
+    }
     err = erasedPage->markFreeing();
     if (err != ESP_OK) {
         return err;
@@ -191,6 +213,212 @@ esp_err_t PageManager::requestNewPage()
     mPageList.erase(maxUnusedItemsPageIt);
     mFreePageList.push_back(erasedPage);
 
+    if (lastPage == erasedPage) {
+        return ESP_OK;
+    }
+    return writeSummary(lastPage, reserveEntries);
+}
+
+/* Does a bounded part of the work requestNewPage would do when the second to
+ * last free page is taken, so that the work is spread over several calls.
+ * Items are moved from the page with the highest number of unused entries
+ * to the current page, and the page is erased once it is empty. If canErase
+ * is false, an empty page is left for a later call or for requestNewPage. */
+esp_err_t PageManager::collectGarbage(size_t maxEntries, size_t reservePages, bool canErase)
+{
+    if (mFreePageList.size() >= reservePages) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    // same choice as in requestNewPage. A page which is partially moved
+    // has the highest number of unused entries, so it is picked again.
+    Page* victim = nullptr;
+    size_t maxUnusedItems = 0;
+    for (auto it = begin(); it != end(); ++it) {
+        if (&*it == &back() || it->state() != Page::PageState::FULL ||
+                it->isPinned() || it->hasTransaction()) {
+            continue;
+        }
+
+        auto unused = Page::ENTRY_COUNT - it->getUsedEntryCount();
+        if (unused > maxUnusedItems) {
+            victim = it;
+            maxUnusedItems = unused;
+        }
+    }
+
+    if (victim == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    bool moved = false;
+    size_t budget = maxEntries;
+    while (victim->getUsedEntryCount() > 0) {
+        if (budget == 0) {
+            return ESP_OK;
+        }
+
+        size_t movedEntries;
+        auto err = victim->moveItems(back(), budget, movedEntries);
+        moved = moved || movedEntries > 0;
+        budget = (movedEntries < budget) ? budget - movedEntries : 0;
+        if (err == ESP_ERR_NVS_PAGE_FULL) {
+            // the last free page is kept for requestNewPage
+            if (mFreePageList.size() < 2) {
+                return moved ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+            }
+            Page& lastPage = back();
+            err = lastPage.markFull();
+            if (err != ESP_OK) {
+                return err;
+            }
+            err = activatePage();
+            if (err == ESP_OK) {
+                err = writeSummary(&lastPage);
+            }
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (!canErase) {
+        return moved ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    auto err = eraseSummary(*victim);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = victim->erase();
+    if (err != ESP_OK) {
+        return err;
+    }
+    mPageList.erase(victim);
+    mFreePageList.push_back(victim);
+    return ESP_OK;
+}
+
+/* Fills hash lists of the pages for which load was deferred. The summary of
+ * a page is stored in a newer page, so pages are processed from the newest one. */
+esp_err_t PageManager::loadSummaries()
+{
+    if (!mSummaryEnabled) {
+        return ESP_OK;
+    }
+
+    char key[Item::MAX_KEY_LENGTH + 1];
+    auto it = TPageListIterator(&back());
+    while (true) {
+        if (it->hasDeferredItems()) {
+            uint32_t seqNumber;
+            it->getSeqNumber(seqNumber);
+            Page::getSummaryKey(seqNumber, key, sizeof(key));
+
+            uint8_t* summary = nullptr;
+            size_t summarySize = 0;
+            auto next = it;
+            for (++next; next != end(); ++next) {
+                size_t itemIndex = 0;
+                Item item;
+                if (next->findItem(Page::NS_SUMMARY, ItemType::BLOB, key, itemIndex, item) != ESP_OK) {
+                    continue;
+                }
+                summary = new (std::nothrow) uint8_t[item.varLength.dataSize];
+                if (summary && next->readItem(Page::NS_SUMMARY, ItemType::BLOB, key, summary, item.varLength.dataSize) == ESP_OK) {
+                    summarySize = item.varLength.dataSize;
+                }
+                break;
+            }
+
+            auto err = it->loadDeferredItems(summarySize ? summary : nullptr, summarySize);
+            delete[] summary;
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        if (it == begin()) {
+            break;
+        }
+        --it;
+    }
+    return ESP_OK;
+}
+
+/* Summaries of pages which no longer exist are erased. This is done by Storage
+ * once it knows that no namespace uses the index of summary items. */
+esp_err_t PageManager::eraseStaleSummaries()
+{
+    char key[Item::MAX_KEY_LENGTH + 1];
+    for (auto page = begin(); page != end(); ++page) {
+        size_t itemIndex = 0;
+        Item item;
+        while (page->findItem(Page::NS_SUMMARY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
+            bool found = false;
+            for (auto other = begin(); other != end(); ++other) {
+                uint32_t seqNumber;
+                other->getSeqNumber(seqNumber);
+                Page::getSummaryKey(seqNumber, key, sizeof(key));
+                if (strncmp(key, item.key, sizeof(key)) == 0) {
+                    found = true;
+                    break;
+                }
+            }
+            itemIndex += item.span;
+            if (!found) {
+                auto err = page->eraseItem(Page::NS_SUMMARY, item.datatype, item.key);
+                if (err != ESP_OK) {
+                    return err;
+                }
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+/* Writes the summary of the given page, which was current before the last
+ * call to activatePage. Not having enough space for it is not an error. */
+esp_err_t PageManager::writeSummary(Page* page, size_t reserveEntries)
+{
+    if (!mSummaryEnabled || page == nullptr || page->state() != Page::PageState::FULL) {
+        return ESP_OK;
+    }
+    auto err = page->writeSummary(back(), reserveEntries);
+    if (err == ESP_ERR_NVS_PAGE_FULL || err == ESP_ERR_NVS_INVALID_STATE) {
+        return ESP_OK;
+    }
+    return err;
+}
+
+bool PageManager::hasSummaries()
+{
+    for (auto page = begin(); page != end(); ++page) {
+        size_t itemIndex = 0;
+        Item item;
+        if (page->findItem(Page::NS_SUMMARY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t PageManager::eraseSummary(Page& page)
+{
+    uint32_t seqNumber;
+    if (page.getSeqNumber(seqNumber) != ESP_OK) {
+        return ESP_OK;
+    }
+    char key[Item::MAX_KEY_LENGTH + 1];
+    Page::getSummaryKey(seqNumber, key, sizeof(key));
+    for (auto it = begin(); it != end(); ++it) {
+        auto err = it->eraseItem(Page::NS_SUMMARY, ItemType::BLOB, key);
+        if (err == ESP_OK) {
+            break;
+        }
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            return err;
+        }
+    }
     return ESP_OK;
 }
 
@@ -213,6 +441,13 @@ esp_err_t PageManager::activatePage()
     return ESP_OK;
 }
 
+void PageManager::setItemIndex(ItemIndex* itemIndex)
+{
+    for (uint32_t i = 0; i < mPageCount; ++i) {
+        mPages[i].setItemIndex(itemIndex);
+    }
+}
+
 esp_err_t PageManager::fillStats(nvs_stats_t& nvsStats)
 {
     nvsStats.used_entries      = 0;
@@ -52,7 +52,12 @@ public:
         return mPageCount;
     }
 
-    esp_err_t requestNewPage();
+    /* Activates a new page. The summary of the previous page is only written
+     * if reserveEntries entries of the new page stay free after it, so that
+     * the item for which the new page was requested still fits. */
+    esp_err_t requestNewPage(size_t reserveEntries = 0);
+
+    esp_err_t collectGarbage(size_t maxEntries, size_t reservePages, bool canErase);
 
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
@@ -61,17 +66,43 @@ public:
         return mBaseSector;
     }
 
+    void setItemIndex(ItemIndex* itemIndex);
+
+    /* When enabled, a summary of each page which becomes full is written into
+     * the next page, so that load doesn't have to read all entries of full pages */
+    void setSummaryEnabled(bool enabled)
+    {
+        mSummaryEnabled = enabled;
+    }
+
+    bool isSummaryEnabled() const
+    {
+        return mSummaryEnabled;
+    }
+
+    esp_err_t eraseStaleSummaries();
+
+    /* True if any page holds summary items, e.g. written while summaries were enabled */
+    bool hasSummaries();
+
 protected:
     friend class Iterator;
 
     esp_err_t activatePage();
 
+    esp_err_t loadSummaries();
+
+    esp_err_t writeSummary(Page* page, size_t reserveEntries = 0);
+
+    esp_err_t eraseSummary(Page& page);
+
     TPageList mPageList;
     TPageList mFreePageList;
     std::unique_ptr<Page[]> mPages;
     uint32_t mBaseSector;
     uint32_t mPageCount;
     uint32_t mSeqNumber;
+    bool mSummaryEnabled = false;
 }; // class PageManager
 
 
@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "nvs_storage.hpp"
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include <new>
 
 #ifndef ESP_PLATFORM
 #include <map>
@@ -21,6 +24,28 @@
 namespace nvs
 {
 
+/* Measures the duration of a write operation. Once the operation is done,
+ * a garbage collection step is made, and counted as part of the operation. */
+struct Storage::WriteScope {
+public:
+    WriteScope(Storage& storage) : mStorage(storage), mStart(esp_timer_get_time())
+    {
+    }
+
+    ~WriteScope()
+    {
+        if (mStorage.mGcStepEntries > 0 && mStorage.mState == StorageState::ACTIVE) {
+            // erasing a page takes longer than the write itself, leave it to
+            // collectGarbage calls made when idle, or to requestNewPage
+            mStorage.mPageManager.collectGarbage(mStorage.mGcStepEntries, mStorage.mGcReservePages, false);
+        }
+        mStorage.recordWriteLatency(esp_timer_get_time() - mStart);
+    }
+
+    Storage& mStorage;
+    int64_t mStart;
+};
+
 Storage::~Storage()
 {
     clearNamespaces();
@@ -86,6 +111,9 @@ void Storage::eraseOrphanDataBlobs(TBlobIndexList& blobIdxList)
 
 esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount)
 {
+#ifdef CONFIG_NVS_PAGE_SUMMARY
+    mPageManager.setSummaryEnabled(true);
+#endif
     auto err = mPageManager.load(baseSector, sectorCount);
     if (err != ESP_OK) {
         mState = StorageState::INVALID;
@@ -110,8 +138,57 @@ esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount)
     }
     mNamespaceUsage.set(0, true);
     mNamespaceUsage.set(255, true);
+
+    // Page summaries are items in namespace index NS_SUMMARY. A partition written
+    // without them may have a namespace with that index; its items are kept,
+    // and summaries are not used for this partition.
+    mSummaryNamespace = false;
+    if (!mNamespaceUsage.get(Page::NS_SUMMARY)) {
+        if (mPageManager.isSummaryEnabled()) {
+            err = mPageManager.eraseStaleSummaries();
+            if (err != ESP_OK) {
+                mState = StorageState::INVALID;
+                return err;
+            }
+            mSummaryNamespace = true;
+        } else {
+            // summaries left from a build which used them are not reclaimed,
+            // but no namespace may get their index
+            mSummaryNamespace = mPageManager.hasSummaries();
+        }
+        mNamespaceUsage.set(Page::NS_SUMMARY, mSummaryNamespace);
+    } else {
+        mPageManager.setSummaryEnabled(false);
+    }
     mState = StorageState::ACTIVE;
 
+#ifdef CONFIG_NVS_GC_FREE_PAGES
+    mGcReservePages = CONFIG_NVS_GC_FREE_PAGES;
+#endif
+#ifdef CONFIG_NVS_INCREMENTAL_GC
+    mGcStepEntries = CONFIG_NVS_GC_STEP_ENTRIES;
+#endif
+
+#ifdef CONFIG_NVS_READ_CACHE
+    mItemCache.init(CONFIG_NVS_READ_CACHE_ENTRIES);
+#endif
+
+#ifdef CONFIG_NVS_ITEM_INDEX
+    // Build the partition-wide index from per-page hash lists
+    mItemIndex.init(sectorCount, CONFIG_NVS_ITEM_INDEX_MAX_SIZE * 1024);
+    mPageManager.setItemIndex(&mItemIndex);
+#endif
+
+    // Complete transactions which were committed before a power loss,
+    // but whose old values were not erased yet.
+    for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
+        err = finishTransaction(*it);
+        if (err != ESP_OK) {
+            mState = StorageState::INVALID;
+            return err;
+        }
+    }
+
     // Populate list of multi-page index entries.
     TBlobIndexList blobIdxList;
     populateBlobIndices(blobIdxList);
@@ -135,6 +212,40 @@ bool Storage::isValid() const
 
 esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
 {
+    if (mItemIndex.isValid() && nsIndex != Page::NS_ANY && datatype != ItemType::ANY && key != nullptr) {
+        ItemIndex::Entry candidates[ItemIndex::MAX_CANDIDATES];
+        size_t count = mItemIndex.find(Item(nsIndex, datatype, 0, key, chunkIdx), candidates, ItemIndex::MAX_CANDIDATES);
+        // with too many hash collisions, fall back to the page by page search below
+        if (count <= ItemIndex::MAX_CANDIDATES) {
+            // candidates are copied out because findItem may erase corrupt entries;
+            // if the item is present on several pages, pick the oldest one as the
+            // page by page search would
+            Page* foundPage = nullptr;
+            uint32_t foundSeqNumber = UINT32_MAX;
+            size_t foundIndex = SIZE_MAX;
+            for (size_t i = 0; i < count; ++i) {
+                Page* p = candidates[i].mPage;
+                size_t itemIndex = candidates[i].mIndex;
+                Item foundItem;
+                uint32_t seqNumber;
+                if (p->findItem(nsIndex, datatype, key, itemIndex, foundItem, chunkIdx, chunkStart) == ESP_OK
+                        && p->getSeqNumber(seqNumber) == ESP_OK
+                        && (foundPage == nullptr || seqNumber < foundSeqNumber
+                            || (seqNumber == foundSeqNumber && itemIndex < foundIndex))) {
+                    foundPage = p;
+                    foundSeqNumber = seqNumber;
+                    foundIndex = itemIndex;
+                    item = foundItem;
+                }
+            }
+            if (foundPage == nullptr) {
+                return ESP_ERR_NVS_NOT_FOUND;
+            }
+            page = foundPage;
+            return ESP_OK;
+        }
+    }
+
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         size_t itemIndex = 0;
         auto err = it->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart);
@@ -146,6 +257,16 @@ esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key,
     return ESP_ERR_NVS_NOT_FOUND;
 }
 
+size_t Storage::getMaxBlobSize()
+{
+    uint32_t max_pages = mPageManager.getPageCount() - 1;
+
+    if(max_pages > (Page::CHUNK_ANY-1)/2) {
+       max_pages = (Page::CHUNK_ANY-1)/2;
+    }
+    return max_pages * Page::CHUNK_MAX_SIZE;
+}
+
 esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const void* data, size_t dataSize, VerOffset chunkStart)
 {
     uint8_t chunkCount = 0;
@@ -155,13 +276,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
     esp_err_t err = ESP_OK;
 
     /* Check how much maximum data can be accommodated**/
-    uint32_t max_pages = mPageManager.getPageCount() - 1;
-
-    if(max_pages > (Page::CHUNK_ANY-1)/2) {
-       max_pages = (Page::CHUNK_ANY-1)/2;
-    }
-
-    if (dataSize > max_pages * Page::CHUNK_MAX_SIZE) {
+    if (dataSize > getMaxBlobSize()) {
         return ESP_ERR_NVS_VALUE_TOO_LONG;
     }
 
@@ -251,6 +366,9 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    WriteScope scope(*this);
+    mItemCache.invalidate(nsIndex, key);
+
     Page* findPage = nullptr;
     Item item;
 
@@ -321,7 +439,12 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
                     return err;
                 }
             }
-            err = mPageManager.requestNewPage();
+            // keep room for the item in the new page
+            size_t entryCount = 1;
+            if (isVariableLengthType(datatype)) {
+                entryCount += (dataSize + Page::ENTRY_SIZE - 1) / Page::ENTRY_SIZE;
+            }
+            err = mPageManager.requestNewPage(entryCount);
             if (err != ESP_OK) {
                 return err;
             }
@@ -357,6 +480,97 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
     return ESP_OK;
 }
 
+esp_err_t Storage::writeTransaction(Transaction& txn)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    WriteScope scope(*this);
+
+    if (txn.getEntryCount() == 0) {
+        return ESP_OK;
+    }
+
+    for (auto it = txn.begin(); it != txn.end(); ++it) {
+        mItemCache.invalidate(it->nsIndex, it->key);
+    }
+
+    esp_err_t err;
+    for (size_t attempt = 0; ; ++attempt) {
+        Page& page = getCurrentPage();
+        err = page.writeTransaction(txn);
+        if (err != ESP_ERR_NVS_PAGE_FULL) {
+            break;
+        }
+        if (attempt == mPageManager.getPageCount()) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        if (page.state() != Page::PageState::FULL) {
+            err = page.markFull();
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        // the marker and all items of the transaction have to fit after the summary
+        err = mPageManager.requestNewPage(txn.getEntryCount() + 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = finishTransaction(getCurrentPage());
+    if (err == ESP_ERR_FLASH_OP_FAIL) {
+        return ESP_ERR_NVS_REMOVE_FAILED;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+#ifndef ESP_PLATFORM
+    debugCheck();
+#endif
+    return ESP_OK;
+}
+
+esp_err_t Storage::finishTransaction(Page& page)
+{
+    size_t begin, end;
+    auto err = page.findTransaction(begin, end);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t itemIndex = begin;
+    Item item;
+    while (page.findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK && itemIndex < end) {
+        // older copies are always found first, erase them until the new one is reached
+        Page* findPage = nullptr;
+        Item oldItem;
+        while (findItem(item.nsIndex, item.datatype, item.key, findPage, oldItem) == ESP_OK) {
+            if (findPage == &page) {
+                size_t oldIndex = 0;
+                if (page.findItem(item.nsIndex, item.datatype, item.key, oldIndex, oldItem) != ESP_OK
+                        || oldIndex >= begin) {
+                    break;
+                }
+            }
+            err = findPage->eraseItem(item.nsIndex, item.datatype, item.key);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        itemIndex += item.span;
+    }
+
+    return page.eraseTransactionMarker();
+}
+
 esp_err_t Storage::createOrOpenNamespace(const char* nsName, bool canCreate, uint8_t& nsIndex)
 {
     if (mState != StorageState::ACTIVE) {
@@ -443,6 +657,367 @@ esp_err_t Storage::readMultiPageBlob(uint8_t nsIndex, const char* key, void* dat
     return err;
 }
 
+esp_err_t Storage::readBlobPartial(uint8_t nsIndex, const char* key, void* data, size_t offset, size_t size)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+
+    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        /* Support for earlier versions where BLOBS were stored without index */
+        err = findItem(nsIndex, ItemType::BLOB, key, findPage, item);
+        if (err != ESP_OK) {
+            return err;
+        }
+        return findPage->readItemRange(nsIndex, ItemType::BLOB, key, data, offset, size);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t chunkCount = item.blobIndex.chunkCount;
+    VerOffset chunkStart = item.blobIndex.chunkStart;
+    size_t dataSize = item.blobIndex.dataSize;
+
+    if (offset > dataSize || size > dataSize - offset) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    /* Only chunks overlapping with the requested range are read */
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    size_t chunkOffset = 0;
+    for (uint8_t chunkNum = 0; chunkNum < chunkCount && size > 0; chunkNum++) {
+        uint8_t chunkIdx = static_cast<uint8_t> (chunkStart) + chunkNum;
+        err = findItem(nsIndex, ItemType::BLOB_DATA, key, findPage, item, chunkIdx);
+        if (err != ESP_OK) {
+            break;
+        }
+        size_t chunkSize = item.varLength.dataSize;
+        if (offset < chunkOffset + chunkSize) {
+            size_t readOffset = offset - chunkOffset;
+            size_t readSize = (size < chunkSize - readOffset) ? size : chunkSize - readOffset;
+            err = findPage->readItemRange(nsIndex, ItemType::BLOB_DATA, key, dst, readOffset, readSize, chunkIdx);
+            if (err != ESP_OK) {
+                break;
+            }
+            dst += readSize;
+            offset += readSize;
+            size -= readSize;
+        }
+        chunkOffset += chunkSize;
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        eraseMultiPageBlob(nsIndex, key); // cleanup if a chunk is not found
+    }
+    return err;
+}
+
+esp_err_t Storage::mmapItem(uint8_t nsIndex, ItemType datatype, const char* key, MappedItem& mapped)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    uint8_t chunkIdx = Page::CHUNK_ANY;
+    size_t dataSize;
+    esp_err_t err;
+
+    if (datatype == ItemType::BLOB) {
+        err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+        if (err == ESP_OK) {
+            dataSize = item.blobIndex.dataSize;
+            if (item.blobIndex.chunkCount != 1) {
+                /* Chunks are on different pages, so data has to be copied */
+                mapped.mBuffer = new (std::nothrow) uint8_t[dataSize ? dataSize : 1];
+                if (!mapped.mBuffer) {
+                    return ESP_ERR_NO_MEM;
+                }
+                err = readMultiPageBlob(nsIndex, key, mapped.mBuffer, dataSize);
+                if (err != ESP_OK) {
+                    delete[] mapped.mBuffer;
+                    mapped.mBuffer = nullptr;
+                    return err;
+                }
+                mapped.mData = mapped.mBuffer;
+                mapped.mSize = dataSize;
+                return ESP_OK;
+            }
+            datatype = ItemType::BLOB_DATA;
+            chunkIdx = static_cast<uint8_t> (item.blobIndex.chunkStart);
+        } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+            return err;
+        } // else check if the blob is stored with earlier version format without index
+    }
+
+    err = findItem(nsIndex, datatype, key, findPage, item, chunkIdx);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = findPage->mmapItem(nsIndex, datatype, key, &mapped.mData, mapped.mSize, mapped.mHandle, chunkIdx);
+    if (err == ESP_OK) {
+        mapped.mPage = findPage;
+        findPage->pin();
+        return ESP_OK;
+    }
+    if (err != ESP_ERR_NOT_SUPPORTED) {
+        return err;
+    }
+
+    /* Encrypted data can't be mapped, copy it */
+    dataSize = item.varLength.dataSize;
+    mapped.mBuffer = new (std::nothrow) uint8_t[dataSize ? dataSize : 1];
+    if (!mapped.mBuffer) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = findPage->readItem(nsIndex, datatype, key, mapped.mBuffer, dataSize, chunkIdx);
+    if (err != ESP_OK) {
+        delete[] mapped.mBuffer;
+        mapped.mBuffer = nullptr;
+        return err;
+    }
+    mapped.mData = mapped.mBuffer;
+    mapped.mSize = dataSize;
+    return ESP_OK;
+}
+
+void Storage::munmapItem(MappedItem& mapped)
+{
+    if (mapped.mPage) {
+        spi_flash_munmap(mapped.mHandle);
+        mapped.mPage->unpin();
+        mapped.mPage = nullptr;
+    }
+    delete[] mapped.mBuffer;
+    mapped.mBuffer = nullptr;
+    mapped.mData = nullptr;
+    mapped.mSize = 0;
+}
+
+esp_err_t Storage::openBlobWriter(uint8_t nsIndex, const char* key, BlobWriter& writer)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+
+    writer.mBuffer = new (std::nothrow) uint8_t[Page::CHUNK_MAX_SIZE];
+    if (!writer.mBuffer) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Chunks are written with the other version, as done by writeItem */
+    writer.mHasPrevious = (err == ESP_OK);
+    writer.mPrevStart = writer.mHasPrevious ? item.blobIndex.chunkStart : VerOffset::VER_0_OFFSET;
+    writer.mChunkStart = (writer.mHasPrevious && writer.mPrevStart == VerOffset::VER_0_OFFSET) ?
+                         VerOffset::VER_1_OFFSET : VerOffset::VER_0_OFFSET;
+    writer.mNsIndex = nsIndex;
+    strncpy(writer.mKey, key, sizeof(writer.mKey) - 1);
+    writer.mKey[sizeof(writer.mKey) - 1] = 0;
+    writer.mChunkCount = 0;
+    writer.mDataSize = 0;
+    writer.mBufferedSize = 0;
+    writer.mFailed = false;
+    return ESP_OK;
+}
+
+esp_err_t Storage::writeBlobChunks(BlobWriter& writer, bool final)
+{
+    const uint8_t* data = writer.mBuffer;
+    size_t remainingSize = writer.mBufferedSize;
+    esp_err_t err;
+
+    /* Same placement rules as in writeMultiPageBlob; an empty blob gets one empty chunk */
+    while (remainingSize > 0 || (final && writer.mChunkCount == 0)) {
+        if (writer.mChunkCount >= (Page::CHUNK_ANY - 1) / 2) {
+            return ESP_ERR_NVS_VALUE_TOO_LONG;
+        }
+
+        Page& page = getCurrentPage();
+        size_t tailroom = page.getVarDataTailroom();
+        if (tailroom == 0 || (tailroom < remainingSize && tailroom < Page::CHUNK_MAX_SIZE / 10)) {
+            /* Tailroom is too small, continue on a new page */
+            if (page.state() != Page::PageState::FULL) {
+                err = page.markFull();
+                if (err != ESP_OK) {
+                    return err;
+                }
+            }
+            err = mPageManager.requestNewPage();
+            if (err != ESP_OK) {
+                return err;
+            }
+            if (getCurrentPage().getVarDataTailroom() == tailroom) {
+                /* We got the same page or we are not improving.*/
+                return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+            }
+            continue;
+        }
+
+        size_t chunkSize = (remainingSize > tailroom) ? tailroom : remainingSize;
+        err = page.writeItem(writer.mNsIndex, ItemType::BLOB_DATA, writer.mKey, data, chunkSize,
+                             static_cast<uint8_t> (writer.mChunkStart) + writer.mChunkCount);
+        assert(err != ESP_ERR_NVS_PAGE_FULL);
+        if (err != ESP_OK) {
+            return err;
+        }
+        writer.mChunkCount++;
+        data += chunkSize;
+        remainingSize -= chunkSize;
+
+        if (remainingSize || (tailroom - chunkSize) < Page::ENTRY_SIZE) {
+            if (page.state() != Page::PageState::FULL) {
+                err = page.markFull();
+                if (err != ESP_OK) {
+                    return err;
+                }
+            }
+            err = mPageManager.requestNewPage();
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    writer.mBufferedSize = 0;
+    return ESP_OK;
+}
+
+esp_err_t Storage::appendBlobWriter(BlobWriter& writer, const void* data, size_t size)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    WriteScope scope(*this);
+
+    if (writer.mFailed) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    if (size > getMaxBlobSize() - writer.mDataSize) {
+        abortBlobWriter(writer);
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        size_t copySize = Page::CHUNK_MAX_SIZE - writer.mBufferedSize;
+        copySize = (size < copySize) ? size : copySize;
+        memcpy(writer.mBuffer + writer.mBufferedSize, src, copySize);
+        writer.mBufferedSize += copySize;
+        writer.mDataSize += copySize;
+        src += copySize;
+        size -= copySize;
+
+        if (writer.mBufferedSize == Page::CHUNK_MAX_SIZE) {
+            auto err = writeBlobChunks(writer, false);
+            if (err != ESP_OK) {
+                abortBlobWriter(writer);
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t Storage::closeBlobWriter(BlobWriter& writer)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    WriteScope scope(*this);
+
+    if (writer.mFailed) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    Item item;
+    auto err = writeBlobChunks(writer, true);
+    if (err == ESP_OK) {
+        /* All chunks are stored. Now store the index.*/
+        std::fill_n(item.data, sizeof(item.data), 0xff);
+        item.blobIndex.dataSize = writer.mDataSize;
+        item.blobIndex.chunkCount = writer.mChunkCount;
+        item.blobIndex.chunkStart = writer.mChunkStart;
+
+        Page& page = getCurrentPage();
+        err = page.writeItem(writer.mNsIndex, ItemType::BLOB_IDX, writer.mKey, item.data, sizeof(item.data));
+        if (err == ESP_ERR_NVS_PAGE_FULL) {
+            if (page.state() != Page::PageState::FULL) {
+                err = page.markFull();
+            }
+            if (err == ESP_OK) {
+                err = mPageManager.requestNewPage();
+            }
+            if (err == ESP_OK) {
+                err = getCurrentPage().writeItem(writer.mNsIndex, ItemType::BLOB_IDX, writer.mKey, item.data, sizeof(item.data));
+            }
+            if (err == ESP_ERR_NVS_PAGE_FULL) {
+                err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+            }
+        }
+    }
+    if (err != ESP_OK) {
+        abortBlobWriter(writer);
+        return err;
+    }
+
+    /* Erase the blob with earlier version, or the blob stored without index */
+    if (writer.mHasPrevious) {
+        err = eraseMultiPageBlob(writer.mNsIndex, writer.mKey, writer.mPrevStart);
+    } else {
+        Page* findPage = nullptr;
+        err = findItem(writer.mNsIndex, ItemType::BLOB, writer.mKey, findPage, item);
+        if (err == ESP_OK) {
+            err = findPage->eraseItem(writer.mNsIndex, ItemType::BLOB, writer.mKey);
+        } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err == ESP_ERR_FLASH_OP_FAIL) {
+        return ESP_ERR_NVS_REMOVE_FAILED;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+#ifndef ESP_PLATFORM
+    debugCheck();
+#endif
+    return ESP_OK;
+}
+
+void Storage::abortBlobWriter(BlobWriter& writer)
+{
+    /* Erase the chunks written so far, the index was not written yet */
+    for (uint8_t chunkNum = 0; chunkNum < writer.mChunkCount; chunkNum++) {
+        Item item;
+        Page* findPage = nullptr;
+        uint8_t chunkIdx = static_cast<uint8_t> (writer.mChunkStart) + chunkNum;
+        if (findItem(writer.mNsIndex, ItemType::BLOB_DATA, writer.mKey, findPage, item, chunkIdx) == ESP_OK) {
+            findPage->eraseItem(writer.mNsIndex, ItemType::BLOB_DATA, writer.mKey, chunkIdx);
+        }
+    }
+    writer.mChunkCount = 0;
+    writer.mBufferedSize = 0;
+    writer.mFailed = true;
+}
+
 esp_err_t Storage::readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize)
 {
     if (mState != StorageState::ACTIVE) {
@@ -456,14 +1031,25 @@ esp_err_t Storage::readItem(uint8_t nsIndex, ItemType datatype, const char* key,
         if (err != ESP_ERR_NVS_NOT_FOUND) {
             return err;
         } // else check if the blob is stored with earlier version format without index
-    } 
+    } else if (mItemCache.isEnabled()) {
+        auto cached = mItemCache.find(nsIndex, datatype, key);
+        if (cached != nullptr && (isVariableLengthType(datatype) ?
+                                  dataSize >= cached->mDataSize : dataSize == cached->mDataSize)) {
+            memcpy(data, cached->mData, cached->mDataSize);
+            return ESP_OK;
+        }
+    }
 
     auto err = findItem(nsIndex, datatype, key, findPage, item);
     if (err != ESP_OK) {
         return err;
     }
-    return findPage->readItem(nsIndex, datatype, key, data, dataSize);
-    
+    err = findPage->readItem(nsIndex, datatype, key, data, dataSize);
+    if (err == ESP_OK && datatype != ItemType::BLOB) {
+        mItemCache.insert(nsIndex, datatype, key, data,
+                          isVariableLengthType(datatype) ? item.varLength.dataSize : dataSize);
+    }
+    return err;
 }
 
 esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffset chunkStart)
@@ -517,6 +1103,9 @@ esp_err_t Storage::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    WriteScope scope(*this);
+    mItemCache.invalidate(nsIndex, key);
+
     if (datatype == ItemType::BLOB) {
         return eraseMultiPageBlob(nsIndex, key);
     }
@@ -537,6 +1126,9 @@ esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    WriteScope scope(*this);
+    mItemCache.invalidateNamespace(nsIndex);
+
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         while (true) {
             auto err = it->eraseItem(nsIndex, ItemType::ANY, nullptr);
@@ -558,6 +1150,14 @@ esp_err_t Storage::getItemDataSize(uint8_t nsIndex, ItemType datatype, const cha
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    if (datatype == ItemType::SZ && mItemCache.isEnabled()) {
+        auto cached = mItemCache.find(nsIndex, datatype, key);
+        if (cached != nullptr) {
+            dataSize = cached->mDataSize;
+            return ESP_OK;
+        }
+    }
+
     Item item;
     Page* findPage = nullptr;
     auto err = findItem(nsIndex, datatype, key, findPage, item);
@@ -577,6 +1177,78 @@ esp_err_t Storage::getItemDataSize(uint8_t nsIndex, ItemType datatype, const cha
     return ESP_OK;
 }
 
+esp_err_t Storage::findEntry(EntryIterator& it, const char* nsName, ItemType datatype)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    it.mNsIndex = Page::NS_ANY;
+    if (nsName != nullptr) {
+        auto err = createOrOpenNamespace(nsName, false, it.mNsIndex);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    it.mDatatype = datatype;
+    it.mPage = mPageManager.begin();
+    it.mEntryIndex = 0;
+    return nextEntry(it);
+}
+
+esp_err_t Storage::nextEntry(EntryIterator& it)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    /* Search resumes right after the previous entry */
+    for (; it.mPage != mPageManager.end(); ++it.mPage, it.mEntryIndex = 0) {
+        Item& item = it.mItem;
+        while (it.mEntryIndex < Page::ENTRY_COUNT) {
+            auto err = it.mPage->findItem(it.mNsIndex, ItemType::ANY, nullptr, it.mEntryIndex, item);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                break;
+            } else if (err != ESP_OK) {
+                return err;
+            }
+            it.mEntryIndex += item.span;
+
+            /* Namespace entries, page summaries, transaction markers and blob chunks are not reported */
+            if (item.nsIndex == Page::NS_INDEX || (item.nsIndex == Page::NS_SUMMARY && mSummaryNamespace)
+                    || item.nsIndex == Page::NS_ANY || item.datatype == ItemType::BLOB_DATA) {
+                continue;
+            }
+            ItemType datatype = (item.datatype == ItemType::BLOB_IDX) ? ItemType::BLOB : item.datatype;
+            if (it.mDatatype != ItemType::ANY && datatype != it.mDatatype) {
+                continue;
+            }
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+void Storage::fillEntryInfo(const EntryIterator& it, nvs_entry_info_t& info)
+{
+    auto ns = std::find_if(mNamespaces.begin(), mNamespaces.end(), [&] (const NamespaceEntry& e) -> bool {
+        return e.mIndex == it.mItem.nsIndex;
+    });
+    if (ns != mNamespaces.end()) {
+        strncpy(info.namespace_name, ns->mName, sizeof(info.namespace_name) - 1);
+    } else {
+        info.namespace_name[0] = 0;
+    }
+    info.namespace_name[sizeof(info.namespace_name) - 1] = 0;
+    strncpy(info.key, it.mItem.key, sizeof(info.key) - 1);
+    info.key[sizeof(info.key) - 1] = 0;
+    if (it.mItem.datatype == ItemType::BLOB || it.mItem.datatype == ItemType::BLOB_IDX) {
+        info.type = NVS_TYPE_BLOB;
+    } else {
+        info.type = static_cast<nvs_type_t>(it.mItem.datatype);
+    }
+}
+
 void Storage::debugDump()
 {
     for (auto p = mPageManager.begin(); p != mPageManager.end(); ++p) {
@@ -603,6 +1275,18 @@ void Storage::debugCheck()
                 assert(0);
             }
             keys.insert(std::make_pair(keystr, static_cast<Page*>(p)));
+            if (mItemIndex.isValid()) {
+                ItemIndex::Entry candidates[ItemIndex::MAX_CANDIDATES];
+                size_t count = mItemIndex.find(item, candidates, ItemIndex::MAX_CANDIDATES);
+                assert(count > 0);
+                bool indexed = count > ItemIndex::MAX_CANDIDATES;
+                for (size_t i = 0; i < count && i < ItemIndex::MAX_CANDIDATES; ++i) {
+                    if (candidates[i].mPage == static_cast<Page*>(p) && candidates[i].mIndex == itemIndex) {
+                        indexed = true;
+                    }
+                }
+                assert(indexed && "item missing from the item index");
+            }
             itemIndex += item.span;
             usedCount += item.span;
         }
@@ -611,9 +1295,39 @@ void Storage::debugCheck()
 }
 #endif //ESP_PLATFORM
 
+esp_err_t Storage::collectGarbage(size_t maxEntries)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    // reclaimed pages may hold items which are read rarely, start over
+    mItemCache.clear();
+    return mPageManager.collectGarbage(maxEntries, mGcReservePages, true);
+}
+
+void Storage::recordWriteLatency(int64_t duration)
+{
+    if (duration < 0) {
+        duration = 0;
+    }
+    const uint32_t us = static_cast<uint32_t>(duration);
+    size_t bucket = 0;
+    for (uint32_t ms = us / 1000; ms > 0 && bucket < NVS_STATS_LATENCY_BUCKETS - 1; ms >>= 1) {
+        ++bucket;
+    }
+    ++mWriteLatency[bucket];
+    if (us > mWriteLatencyMax) {
+        mWriteLatencyMax = us;
+    }
+}
+
 esp_err_t Storage::fillStats(nvs_stats_t& nvsStats)
 {
     nvsStats.namespace_count = mNamespaces.size();
+    std::copy(mWriteLatency, mWriteLatency + NVS_STATS_LATENCY_BUCKETS, nvsStats.write_latency);
+    nvsStats.write_latency_max = mWriteLatencyMax;
+    nvsStats.read_cache_hits = mItemCache.getHits();
+    nvsStats.read_cache_misses = mItemCache.getMisses();
     return mPageManager.fillStats(nvsStats);
 }
 
@@ -21,6 +21,9 @@
 #include "nvs_types.hpp"
 #include "nvs_page.hpp"
 #include "nvs_pagemanager.hpp"
+#include "nvs_item_index.hpp"
+#include "nvs_item_cache.hpp"
+#include "nvs_transaction.hpp"
 
 //extern void dumpBytes(const uint8_t* data, size_t count);
 
@@ -59,6 +62,46 @@ class Storage : public intrusive_list_node<Storage>
     typedef intrusive_list<BlobIndexNode> TBlobIndexList;
 
 public:
+    /* State of a blob being written in chunks, see openBlobWriter */
+    struct BlobWriter {
+    public:
+        ~BlobWriter()
+        {
+            delete[] mBuffer;
+        }
+
+        uint8_t mNsIndex;
+        char mKey[Item::MAX_KEY_LENGTH + 1];
+        bool mHasPrevious;
+        VerOffset mPrevStart;
+        VerOffset mChunkStart;
+        uint8_t mChunkCount = 0;
+        size_t mDataSize = 0;
+        uint8_t* mBuffer = nullptr; // holds at most one chunk
+        size_t mBufferedSize = 0;
+        bool mFailed = false;
+    };
+
+    /* Position of an iteration over entries, see findEntry */
+    struct EntryIterator {
+    public:
+        uint8_t mNsIndex;
+        ItemType mDatatype;
+        intrusive_list<Page>::iterator mPage;
+        size_t mEntryIndex;
+        Item mItem;
+    };
+
+    /* Item data mapped into address space, or copied if it can't be mapped */
+    struct MappedItem {
+    public:
+        const void* mData = nullptr;
+        size_t mSize = 0;
+        Page* mPage = nullptr; // pinned while mapped
+        spi_flash_mmap_handle_t mHandle = 0;
+        uint8_t* mBuffer = nullptr;
+    };
+
     ~Storage();
 
     Storage(const char *pName = NVS_DEFAULT_PART_NAME) : mPartitionName(pName) { };
@@ -77,6 +120,22 @@ public:
 
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key);
 
+    esp_err_t writeTransaction(Transaction& txn);
+
+    esp_err_t readBlobPartial(uint8_t nsIndex, const char* key, void* data, size_t offset, size_t size);
+
+    esp_err_t mmapItem(uint8_t nsIndex, ItemType datatype, const char* key, MappedItem& mapped);
+
+    void munmapItem(MappedItem& mapped);
+
+    esp_err_t openBlobWriter(uint8_t nsIndex, const char* key, BlobWriter& writer);
+
+    esp_err_t appendBlobWriter(BlobWriter& writer, const void* data, size_t size);
+
+    esp_err_t closeBlobWriter(BlobWriter& writer);
+
+    void abortBlobWriter(BlobWriter& writer);
+
     template<typename T>
     esp_err_t writeItem(uint8_t nsIndex, const char* key, const T& value)
     {
@@ -117,8 +176,39 @@ public:
 
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
+    esp_err_t collectGarbage(size_t maxEntries);
+
+    /* Sets the number of entries moved by the garbage collection step which
+     * follows each write operation (0 to disable), and the number of free
+     * pages garbage collection steps try to keep */
+    void setIncrementalGc(size_t stepEntries, size_t reservePages)
+    {
+        mGcStepEntries = stepEntries;
+        mGcReservePages = reservePages;
+    }
+
+    /* Enables writing and using page summaries, see PageManager::setSummaryEnabled.
+     * Has to be called before init */
+    void setPageSummary(bool enabled)
+    {
+        mPageManager.setSummaryEnabled(enabled);
+    }
+
+    /* Sets the number of values kept in the read cache, 0 disables it.
+     * Cached values are dropped. */
+    void setReadCacheSize(size_t entryCount)
+    {
+        mItemCache.init(entryCount);
+    }
+
     esp_err_t calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries);
 
+    esp_err_t findEntry(EntryIterator& it, const char* nsName, ItemType datatype);
+
+    esp_err_t nextEntry(EntryIterator& it);
+
+    void fillEntryInfo(const EntryIterator& it, nvs_entry_info_t& info);
+
 protected:
 
     Page& getCurrentPage()
@@ -132,16 +222,33 @@ protected:
 
     void eraseOrphanDataBlobs(TBlobIndexList&);
 
+    esp_err_t finishTransaction(Page& page);
+
+    size_t getMaxBlobSize();
+
+    esp_err_t writeBlobChunks(BlobWriter& writer, bool final);
+
 
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    struct WriteScope;
+
+    void recordWriteLatency(int64_t duration);
+
 protected:
     const char *mPartitionName;
     size_t mPageCount;
+    ItemIndex mItemIndex; // must outlive pages of mPageManager
+    ItemCache mItemCache;
     PageManager mPageManager;
     TNamespaces mNamespaces;
     CompressedEnumTable<bool, 1, 256> mNamespaceUsage;
+    bool mSummaryNamespace = false; // index NS_SUMMARY holds page summaries rather than a namespace
     StorageState mState = StorageState::INVALID;
+    size_t mGcStepEntries = 0;
+    size_t mGcReservePages = 2;
+    size_t mWriteLatency[NVS_STATS_LATENCY_BUCKETS] = {};
+    uint32_t mWriteLatencyMax = 0;
 };
 
 } // namespace nvs
@@ -0,0 +1,96 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "nvs_transaction.hpp"
+#include "nvs_page.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace nvs
+{
+
+esp_err_t Transaction::add(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize)
+{
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    // multi-page blobs can't be written to a single page
+    if (datatype == ItemType::BLOB) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    size_t span = 1;
+    if (isVariableLengthType(datatype)) {
+        if (dataSize > Page::CHUNK_MAX_SIZE) {
+            return ESP_ERR_NVS_VALUE_TOO_LONG;
+        }
+        span += (dataSize + Page::ENTRY_SIZE - 1) / Page::ENTRY_SIZE;
+    }
+
+    // a later value for the same key replaces the staged one
+    auto it = std::find_if(mItems.begin(), mItems.end(), [=] (const StagedItem& e) -> bool {
+        return e.nsIndex == nsIndex && strncmp(key, e.key, sizeof(e.key) - 1) == 0;
+    });
+    size_t replacedSpan = (it == mItems.end()) ? 0 : it->span;
+
+    // all entries and the marker have to fit into one page
+    if (mEntryCount - replacedSpan + span + 1 > Page::ENTRY_COUNT) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    uint8_t* buf = new (std::nothrow) uint8_t[dataSize];
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(buf, data, dataSize);
+
+    if (it != mItems.end()) {
+        StagedItem* replaced = it;
+        mItems.erase(it);
+        delete[] replaced->data;
+        delete replaced;
+        mEntryCount -= replacedSpan;
+    }
+
+    StagedItem* item = new (std::nothrow) StagedItem;
+    if (!item) {
+        delete[] buf;
+        return ESP_ERR_NO_MEM;
+    }
+    item->nsIndex = nsIndex;
+    item->datatype = datatype;
+    strncpy(item->key, key, sizeof(item->key) - 1);
+    item->key[sizeof(item->key) - 1] = 0;
+    item->data = buf;
+    item->dataSize = dataSize;
+    item->span = span;
+    mItems.push_back(item);
+    mEntryCount += span;
+    return ESP_OK;
+}
+
+void Transaction::clear()
+{
+    for (auto it = mItems.begin(); it != mItems.end();) {
+        StagedItem* item = it;
+        ++it;
+        mItems.erase(item);
+        delete[] item->data;
+        delete item;
+    }
+    mEntryCount = 0;
+}
+
+} // namespace nvs
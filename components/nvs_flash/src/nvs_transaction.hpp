@@ -0,0 +1,85 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef nvs_transaction_hpp
+#define nvs_transaction_hpp
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+#include "intrusive_list.h"
+
+namespace nvs
+{
+
+/**
+ * Set of items staged in RAM, to be written to a single page at once.
+ *
+ * Items are written by Storage::writeTransaction as one contiguous run of
+ * entries preceded by a TXN_MARKER entry. The marker is the last entry to be
+ * marked as written, so after a power loss either all items of the
+ * transaction are present, or none of them.
+ */
+class Transaction
+{
+public:
+    struct StagedItem : public intrusive_list_node<StagedItem> {
+    public:
+        uint8_t nsIndex;
+        ItemType datatype;
+        char key[Item::MAX_KEY_LENGTH + 1];
+        size_t dataSize;
+        uint8_t* data;
+        size_t span;
+    };
+
+    typedef intrusive_list<StagedItem> TItemList;
+
+    ~Transaction()
+    {
+        clear();
+    }
+
+    esp_err_t add(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize);
+
+    template<typename T>
+    esp_err_t add(uint8_t nsIndex, const char* key, const T& value)
+    {
+        return add(nsIndex, itemTypeOf(value), key, &value, sizeof(value));
+    }
+
+    void clear();
+
+    /* Number of entries needed to write all items, excluding the marker */
+    size_t getEntryCount() const
+    {
+        return mEntryCount;
+    }
+
+    TItemList::iterator begin()
+    {
+        return mItems.begin();
+    }
+
+    TItemList::iterator end()
+    {
+        return mItems.end();
+    }
+
+protected:
+    TItemList mItems;
+    size_t mEntryCount = 0;
+}; // class Transaction
+
+} // namespace nvs
+
+#endif /* nvs_transaction_hpp */
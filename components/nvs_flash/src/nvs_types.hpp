@@ -39,6 +39,7 @@ enum class ItemType : uint8_t {
     BLOB = 0x41,
     BLOB_DATA = 0x42,
     BLOB_IDX  = 0x48,
+    TXN_MARKER = 0x80,
     ANY  = 0xff
 };
 
@@ -90,6 +91,10 @@ public:
                     VerOffset  chunkStart; // Offset from which the chunkIndex for children blobs starts
                     uint16_t   reserved;
                 } blobIndex;
+                struct {
+                    uint8_t    entryCount; // Number of entries written by the transaction after this one
+                    uint8_t    reserved[7];
+                } txnMarker;
                 uint8_t data[8];
             };
         };
@@ -121,7 +126,7 @@ public:
 
     uint32_t calculateCrc32() const;
     uint32_t calculateCrc32WithoutValue() const;
-    static uint32_t calculateCrc32(const uint8_t* data, size_t size);
+    static uint32_t calculateCrc32(const uint8_t* data, size_t size, uint32_t crc = 0xffffffff);
 
     void getKey(char* dst, size_t dstSize)
     {
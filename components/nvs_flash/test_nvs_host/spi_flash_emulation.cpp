@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "esp_spi_flash.h"
+#include "esp_timer.h"
 #include "spi_flash_emulation.h"
 
 
@@ -22,6 +23,15 @@ void spi_flash_emulator_set(SpiFlashEmulator* e)
     s_emulator = e;
 }
 
+/* Time passes only while flash operations are running */
+int64_t esp_timer_get_time()
+{
+    if (!s_emulator) {
+        return 0;
+    }
+    return s_emulator->getTotalTime();
+}
+
 esp_err_t spi_flash_erase_sector(size_t sec)
 {
     if (!s_emulator) {
@@ -61,6 +71,28 @@ esp_err_t spi_flash_read(size_t src_addr, void *des_addr, size_t size)
     return ESP_OK;
 }
 
+esp_err_t spi_flash_mmap(size_t src_addr, size_t size, spi_flash_mmap_memory_t memory,
+                         const void** out_ptr, spi_flash_mmap_handle_t* out_handle)
+{
+    if (!s_emulator) {
+        return ESP_ERR_FLASH_OP_TIMEOUT;
+    }
+
+    if (!s_emulator->mmap(src_addr, size, out_ptr)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out_handle = static_cast<spi_flash_mmap_handle_t>(src_addr / SPI_FLASH_MMU_PAGE_SIZE);
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+    if (s_emulator) {
+        s_emulator->munmap();
+    }
+}
+
 // timing data for ESP8266, 160MHz CPU frequency, 80MHz flash requency
 // all values in microseconds
 // values are for block sizes starting at 4 bytes and going up to 4096 bytes
@@ -150,6 +150,29 @@ public:
     {
         return reinterpret_cast<const uint8_t*>(mData.data());
     }
+
+    /* Memory mapping is emulated by pointing directly into the emulated flash contents */
+    bool mmap(size_t srcAddr, size_t size, const void** outPtr)
+    {
+        if (srcAddr % SPI_FLASH_MMU_PAGE_SIZE != 0 ||
+                srcAddr + size > mData.size() * 4) {
+            return false;
+        }
+        *outPtr = words() + srcAddr / 4;
+        ++mMmapCount;
+        return true;
+    }
+
+    void munmap()
+    {
+        assert(mMmapCount > 0);
+        --mMmapCount;
+    }
+
+    size_t getMmapCount() const
+    {
+        return mMmapCount;
+    }
     
     void load(const char* filename)
     {
@@ -235,6 +258,7 @@ protected:
     size_t mUpperSectorBound = 0;
     
     size_t mFailCountdown = SIZE_MAX;
+    size_t mMmapCount = 0;
 
 };
 
@@ -23,6 +23,7 @@
 #include <fstream>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <chrono>
 
 #define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
 #define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
@@ -2396,6 +2397,1274 @@ TEST_CASE("test nvs apis for nvs partition generator utility with encryption ena
 }
 #endif
 
+#ifdef CONFIG_NVS_ITEM_INDEX
+TEST_CASE("item lookup time doesn't depend on the number of pages", "[nvs][bench]")
+{
+    const size_t pageCounts[] = {4, 16, 64};
+    const size_t itemsPerPage = 16;
+    const size_t lookupCount = 100000;
+    static uint8_t filler[Page::CHUNK_MAX_SIZE / 2];
+
+    for (auto pageCount : pageCounts) {
+        SpiFlashEmulator emu(pageCount);
+        Storage storage;
+        REQUIRE(storage.init(0, pageCount) == ESP_OK);
+
+        const size_t itemCount = (pageCount - 1) * itemsPerPage;
+        char key[16];
+        for (size_t i = 0; i < itemCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            REQUIRE(storage.writeItem(1, key, static_cast<uint32_t>(i)) == ESP_OK);
+            // spread items over all pages
+            if ((i + 1) % itemsPerPage == 0) {
+                REQUIRE(storage.writeItem(1, ItemType::BLOB, "filler", filler, sizeof(filler)) == ESP_OK);
+            }
+        }
+
+        // the most recently written key lives on the last page
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(itemCount - 1));
+        uint32_t value;
+        emu.clearStats();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookupCount; ++i) {
+            CHECK(storage.readItem(1, key, value) == ESP_OK);
+        }
+        auto hitTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookupCount;
+        CHECK(value == itemCount - 1);
+        CHECK(emu.getReadOps() <= 2 * lookupCount);
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookupCount; ++i) {
+            CHECK(storage.readItem(1, "missing", value) == ESP_ERR_NVS_NOT_FOUND);
+        }
+        auto missTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookupCount;
+
+        s_perf << "Item lookup with " << pageCount << " pages: hit " << hitTime << " ns, miss " << missTime << " ns" << std::endl;
+    }
+}
+#endif
+
+TEST_CASE("values written in a transaction become visible on commit", "[nvs][transaction]")
+{
+    SpiFlashEmulator emu(10);
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+    emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+
+    nvs_handle handle;
+    TEST_ESP_OK(nvs_open("namespace1", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_set_i32(handle, "foo", 1));
+
+    CHECK(nvs_transaction_commit(handle) == ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_OK(nvs_transaction_begin(handle));
+    CHECK(nvs_transaction_begin(handle) == ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_OK(nvs_set_i32(handle, "foo", 2));
+    TEST_ESP_OK(nvs_set_i32(handle, "foo", 3));
+    TEST_ESP_OK(nvs_set_str(handle, "bar", "value"));
+    CHECK(nvs_set_blob(handle, "blob", "data", 4) == ESP_ERR_NOT_SUPPORTED);
+    CHECK(nvs_erase_key(handle, "foo") == ESP_ERR_NOT_SUPPORTED);
+    CHECK(nvs_erase_all(handle) == ESP_ERR_NOT_SUPPORTED);
+    nvs_blob_writer_t writer;
+    CHECK(nvs_blob_writer_open(handle, "blob", &writer) == ESP_ERR_NOT_SUPPORTED);
+
+    int32_t v;
+    char buf[16];
+    size_t len = sizeof(buf);
+    TEST_ESP_OK(nvs_get_i32(handle, "foo", &v));
+    CHECK(v == 1);
+    CHECK(nvs_get_str(handle, "bar", buf, &len) == ESP_ERR_NVS_NOT_FOUND);
+
+    TEST_ESP_OK(nvs_transaction_abort(handle));
+    TEST_ESP_OK(nvs_get_i32(handle, "foo", &v));
+    CHECK(v == 1);
+
+    TEST_ESP_OK(nvs_transaction_begin(handle));
+    TEST_ESP_OK(nvs_set_i32(handle, "foo", 4));
+    TEST_ESP_OK(nvs_set_str(handle, "bar", "value"));
+    TEST_ESP_OK(nvs_transaction_commit(handle));
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+    TEST_ESP_OK(nvs_open("namespace1", NVS_READONLY, &handle));
+    CHECK(nvs_transaction_begin(handle) == ESP_ERR_NVS_READ_ONLY);
+    TEST_ESP_OK(nvs_get_i32(handle, "foo", &v));
+    CHECK(v == 4);
+    TEST_ESP_OK(nvs_get_str(handle, "bar", buf, &len));
+    CHECK(strcmp(buf, "value") == 0);
+    nvs_close(handle);
+
+    Storage storage;
+    TEST_ESP_OK(storage.init(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+    nvs_stats_t stat;
+    TEST_ESP_OK(storage.fillStats(stat));
+    // namespace entry, foo, bar (2 entries); the marker has been erased
+    CHECK(stat.used_entries == 4);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("transaction takes fewer flash writes than individual updates", "[nvs][transaction][bench]")
+{
+    const size_t keyCount = 40;
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+    char key[16];
+    size_t writeOps[2];
+
+    for (int useTransaction = 0; useTransaction < 2; ++useTransaction) {
+        SpiFlashEmulator emu(10);
+        emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+        TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+        nvs_handle handle;
+        TEST_ESP_OK(nvs_open("namespace1", NVS_READWRITE, &handle));
+
+        emu.clearStats();
+        if (useTransaction) {
+            TEST_ESP_OK(nvs_transaction_begin(handle));
+        }
+        for (size_t i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            TEST_ESP_OK(nvs_set_u32(handle, key, i));
+        }
+        if (useTransaction) {
+            TEST_ESP_OK(nvs_transaction_commit(handle));
+        }
+        TEST_ESP_OK(nvs_commit(handle));
+        writeOps[useTransaction] = emu.getWriteOps();
+
+        for (size_t i = 0; i < keyCount; ++i) {
+            uint32_t v;
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            TEST_ESP_OK(nvs_get_u32(handle, key, &v));
+            CHECK(v == i);
+        }
+        nvs_close(handle);
+        TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    }
+
+    CHECK(writeOps[1] < writeOps[0]);
+    s_perf << "Writing " << keyCount << " keys: individually " << writeOps[0] << " write ops, in a transaction " << writeOps[1] << " write ops" << std::endl;
+}
+
+TEST_CASE("transaction is atomic in case of power loss", "[nvs][transaction][recovery]")
+{
+    const size_t keyCount = 20;
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+    char key[16];
+
+    for (uint32_t errDelay = 0; ; ++errDelay) {
+        INFO(errDelay);
+        SpiFlashEmulator emu(10);
+        emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+        TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+        nvs_handle handle;
+        TEST_ESP_OK(nvs_open("namespace1", NVS_READWRITE, &handle));
+        for (size_t i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            TEST_ESP_OK(nvs_set_u32(handle, key, 1));
+        }
+
+        TEST_ESP_OK(nvs_transaction_begin(handle));
+        for (size_t i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            TEST_ESP_OK(nvs_set_u32(handle, key, 2));
+        }
+        emu.failAfter(errDelay);
+        auto err = nvs_transaction_commit(handle);
+        emu.failAfter(UINT32_MAX);
+        nvs_close(handle);
+
+        TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+        TEST_ESP_OK(nvs_open("namespace1", NVS_READONLY, &handle));
+        uint32_t expected = 0;
+        for (size_t i = 0; i < keyCount; ++i) {
+            uint32_t v;
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            TEST_ESP_OK(nvs_get_u32(handle, key, &v));
+            if (i == 0) {
+                expected = v;
+                CHECK((v == 1 || v == 2));
+            }
+            CHECK(v == expected);
+        }
+        nvs_close(handle);
+        if (err == ESP_OK) {
+            CHECK(expected == 2);
+            break;
+        }
+    }
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("transaction marker is not copied when a page is compacted", "[nvs][transaction]")
+{
+    SpiFlashEmulator emu(4);
+    Page src;
+    TEST_ESP_OK(src.load(0));
+    TEST_ESP_OK(src.writeItem<uint32_t>(1, "before", 1));
+
+    Transaction txn;
+    TEST_ESP_OK(txn.add<uint32_t>(1, "a", 2));
+    TEST_ESP_OK(txn.add<uint32_t>(1, "b", 3));
+    TEST_ESP_OK(src.writeTransaction(txn));
+    CHECK(src.hasTransaction());
+
+    // erase the first item of the transaction, so that on the compacted
+    // page the marker would cover an entry which is not part of it
+    TEST_ESP_OK(src.eraseItem<uint32_t>(1, "a"));
+    TEST_ESP_OK(src.writeItem<uint32_t>(1, "after", 4));
+
+    Page dst;
+    TEST_ESP_OK(dst.load(1));
+    TEST_ESP_OK(src.copyItems(dst));
+    CHECK(!dst.hasTransaction());
+    CHECK(dst.getUsedEntryCount() == 3);
+
+    uint32_t v;
+    TEST_ESP_OK(dst.readItem<uint32_t>(1, "before", v));
+    CHECK(v == 1);
+    TEST_ESP_OK(dst.readItem<uint32_t>(1, "b", v));
+    CHECK(v == 3);
+    TEST_ESP_OK(dst.readItem<uint32_t>(1, "after", v));
+    CHECK(v == 4);
+    CHECK(dst.readItem<uint32_t>(1, "a", v) == ESP_ERR_NVS_NOT_FOUND);
+}
+
+TEST_CASE("parts of multi-page blobs can be read", "[nvs][blob]")
+{
+    const size_t blob_size = Page::CHUNK_MAX_SIZE * 3 + 100;
+    static uint8_t blob[blob_size];
+    uint8_t buf[1000];
+    SpiFlashEmulator emu(6);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, 6));
+    nvs_handle handle;
+    TEST_ESP_OK(nvs_open("test", NVS_READWRITE, &handle));
+    for (size_t i = 0; i < blob_size; ++i) {
+        blob[i] = static_cast<uint8_t>(i * 7);
+    }
+    TEST_ESP_OK(nvs_set_blob(handle, "abc", blob, blob_size));
+
+    for (size_t offset = 0; offset < blob_size; offset += sizeof(buf) - 13) {
+        size_t length = (blob_size - offset < sizeof(buf)) ? blob_size - offset : sizeof(buf);
+        memset(buf, 0xee, sizeof(buf));
+        TEST_ESP_OK(nvs_get_blob_partial(handle, "abc", buf, offset, length));
+        CHECK(memcmp(buf, blob + offset, length) == 0);
+    }
+    TEST_ESP_OK(nvs_get_blob_partial(handle, "abc", buf, blob_size, 0));
+    CHECK(nvs_get_blob_partial(handle, "abc", buf, blob_size - 10, 11) == ESP_ERR_NVS_INVALID_LENGTH);
+    CHECK(nvs_get_blob_partial(handle, "abc", buf, blob_size + 1, 0) == ESP_ERR_NVS_INVALID_LENGTH);
+    CHECK(nvs_get_blob_partial(handle, "xyz", buf, 0, 1) == ESP_ERR_NVS_NOT_FOUND);
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("parts of blobs in old format can be read", "[nvs][blob]")
+{
+    SpiFlashEmulator emu("../nvs_partition_generator/part_old_blob_format.bin");
+    nvs_handle handle;
+    TEST_ESP_OK(nvs_flash_init_custom("test", 0, 2));
+    TEST_ESP_OK(nvs_open_from_partition("test", "dummyNamespace", NVS_READONLY, &handle));
+
+    uint8_t buf[3];
+    uint8_t hexdata[] = {0xab, 0xcd, 0xef};
+    TEST_ESP_OK(nvs_get_blob_partial(handle, "dummyHex2BinKey", buf, 3, 3));
+    CHECK(memcmp(buf, hexdata, sizeof(hexdata)) == 0);
+    CHECK(nvs_get_blob_partial(handle, "dummyHex2BinKey", buf, 4, 3) == ESP_ERR_NVS_INVALID_LENGTH);
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition("test"));
+}
+
+TEST_CASE("blobs can be written in parts", "[nvs][blob]")
+{
+    const size_t blob_size = 40 * 1024;
+    const size_t part_size = 1000;
+    static uint8_t blob[blob_size];
+    static uint8_t blob_read[blob_size];
+    SpiFlashEmulator emu(32);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, 32));
+    nvs_handle handle;
+    TEST_ESP_OK(nvs_open("test", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_set_blob(handle, "abc", "old", 3));
+
+    for (int pass = 0; pass < 3; ++pass) {
+        for (size_t i = 0; i < blob_size; ++i) {
+            blob[i] = static_cast<uint8_t>(i * 7 + pass);
+        }
+        nvs_blob_writer_t writer;
+        TEST_ESP_OK(nvs_blob_writer_open(handle, "abc", &writer));
+        for (size_t offset = 0; offset < blob_size; offset += part_size) {
+            size_t length = (blob_size - offset < part_size) ? blob_size - offset : part_size;
+            TEST_ESP_OK(nvs_blob_writer_append(writer, blob + offset, length));
+        }
+        // previous value is still there until the writer is closed
+        size_t read_size = 0;
+        TEST_ESP_OK(nvs_get_blob(handle, "abc", NULL, &read_size));
+        CHECK(read_size == (pass == 0 ? 3 : blob_size));
+        TEST_ESP_OK(nvs_blob_writer_close(writer));
+
+        read_size = blob_size;
+        TEST_ESP_OK(nvs_get_blob(handle, "abc", blob_read, &read_size));
+        CHECK(read_size == blob_size);
+        CHECK(memcmp(blob, blob_read, blob_size) == 0);
+    }
+
+    // aborted writer doesn't change the value
+    nvs_blob_writer_t writer;
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "abc", &writer));
+    TEST_ESP_OK(nvs_blob_writer_append(writer, "new", 3));
+    TEST_ESP_OK(nvs_blob_writer_append(writer, blob, Page::CHUNK_MAX_SIZE * 2));
+    nvs_blob_writer_abort(writer);
+
+    // empty blob
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "empty", &writer));
+    TEST_ESP_OK(nvs_blob_writer_close(writer));
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, 32));
+    TEST_ESP_OK(nvs_open("test", NVS_READONLY, &handle));
+    CHECK(nvs_blob_writer_open(handle, "abc", &writer) == ESP_ERR_NVS_READ_ONLY);
+    size_t read_size = blob_size;
+    TEST_ESP_OK(nvs_get_blob(handle, "abc", blob_read, &read_size));
+    CHECK(read_size == blob_size);
+    CHECK(memcmp(blob, blob_read, blob_size) == 0);
+    read_size = 1;
+    TEST_ESP_OK(nvs_get_blob(handle, "empty", blob_read, &read_size));
+    CHECK(read_size == 0);
+    nvs_close(handle);
+
+    Storage storage;
+    TEST_ESP_OK(storage.init(0, 32));
+    nvs_stats_t stat;
+    TEST_ESP_OK(storage.fillStats(stat));
+    // namespace entry, empty blob (index, one chunk), and a 40 kB blob
+    size_t chunkCount = (blob_size + Page::CHUNK_MAX_SIZE - 1) / Page::CHUNK_MAX_SIZE;
+    CHECK(stat.used_entries <= 4 + (blob_size / Page::ENTRY_SIZE) + 2 * chunkCount + 2);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("blob writer fails if blob doesn't fit", "[nvs][blob]")
+{
+    // with 4 pages, up to 3 chunks can be stored
+    static uint8_t blob[Page::CHUNK_MAX_SIZE * 3 + 1];
+    SpiFlashEmulator emu(4);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, 4));
+    nvs_handle handle;
+    TEST_ESP_OK(nvs_open("test", NVS_READWRITE, &handle));
+    nvs_blob_writer_t writer;
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "abc", &writer));
+    TEST_ESP_OK(nvs_blob_writer_append(writer, blob, Page::CHUNK_MAX_SIZE));
+    CHECK(nvs_blob_writer_append(writer, blob, sizeof(blob) - Page::CHUNK_MAX_SIZE) == ESP_ERR_NVS_VALUE_TOO_LONG);
+    CHECK(nvs_blob_writer_append(writer, blob, 1) == ESP_ERR_NVS_INVALID_STATE);
+    CHECK(nvs_blob_writer_close(writer) == ESP_ERR_NVS_INVALID_STATE);
+    size_t read_size;
+    CHECK(nvs_get_blob(handle, "abc", NULL, &read_size) == ESP_ERR_NVS_NOT_FOUND);
+
+    Storage storage;
+    TEST_ESP_OK(storage.init(0, 4));
+    nvs_stats_t stat;
+    TEST_ESP_OK(storage.fillStats(stat));
+    // only the namespace entry is left
+    CHECK(stat.used_entries == 1);
+
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "abc", &writer));
+    nvs_close(handle);
+    CHECK(nvs_blob_writer_close(writer) == ESP_ERR_NVS_INVALID_HANDLE);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("strings and blobs can be read without copying", "[nvs][mmap]")
+{
+    SpiFlashEmulator emu(10);
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 4;
+    emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+
+    nvs_handle handle;
+    TEST_ESP_OK(nvs_open("namespace1", NVS_READWRITE, &handle));
+    char str[1000];
+    for (size_t i = 0; i < sizeof(str) - 1; ++i) {
+        str[i] = 'a' + i % 26;
+    }
+    str[sizeof(str) - 1] = 0;
+    TEST_ESP_OK(nvs_set_str(handle, "str", str));
+    uint8_t blob[100];
+    memset(blob, 0x5a, sizeof(blob));
+    TEST_ESP_OK(nvs_set_blob(handle, "blob", blob, sizeof(blob)));
+    static uint8_t bigBlob[Page::CHUNK_MAX_SIZE + 100];
+    memset(bigBlob, 0xa5, sizeof(bigBlob));
+    TEST_ESP_OK(nvs_set_blob(handle, "bigBlob", bigBlob, sizeof(bigBlob)));
+
+    auto inFlash = [&](const void* p) -> bool {
+        return p >= emu.bytes() && p < emu.bytes() + emu.size();
+    };
+
+    const char* mappedStr;
+    nvs_mmap_handle_t strMmap;
+    emu.clearStats();
+    TEST_ESP_OK(nvs_get_str_mmap(handle, "str", &mappedStr, &strMmap));
+    CHECK(inFlash(mappedStr));
+    CHECK(strcmp(mappedStr, str) == 0);
+    // only entry headers have been read
+    CHECK(emu.getReadBytes() < sizeof(str));
+    s_perf << "Mapping a " << sizeof(str) << " byte string: " << emu.getReadOps() << " read ops, " << emu.getReadBytes() << " bytes read" << std::endl;
+
+    const void* mappedBlob;
+    size_t length = 0;
+    nvs_mmap_handle_t blobMmap;
+    TEST_ESP_OK(nvs_get_blob_mmap(handle, "blob", &mappedBlob, &length, &blobMmap));
+    CHECK(inFlash(mappedBlob));
+    CHECK(length == sizeof(blob));
+    CHECK(memcmp(mappedBlob, blob, sizeof(blob)) == 0);
+
+    // blob split over two pages is copied
+    nvs_mmap_handle_t bigBlobMmap;
+    TEST_ESP_OK(nvs_get_blob_mmap(handle, "bigBlob", &mappedBlob, &length, &bigBlobMmap));
+    CHECK(!inFlash(mappedBlob));
+    CHECK(length == sizeof(bigBlob));
+    CHECK(memcmp(mappedBlob, bigBlob, sizeof(bigBlob)) == 0);
+    nvs_munmap(bigBlobMmap);
+    CHECK(emu.getMmapCount() == 2);
+
+    CHECK(nvs_get_str_mmap(handle, "missing", &mappedStr, &strMmap) == ESP_ERR_NVS_NOT_FOUND);
+
+    // mapped value stays the same while the key is modified, and the page holding it is not reclaimed
+    TEST_ESP_OK(nvs_get_blob_mmap(handle, "blob", &mappedBlob, &length, &blobMmap));
+    for (int i = 0; i < 200; ++i) {
+        char newStr[sizeof(str)];
+        memset(newStr, 'A' + i % 26, sizeof(newStr) - 1);
+        newStr[sizeof(newStr) - 1] = 0;
+        TEST_ESP_OK(nvs_set_str(handle, "str", newStr));
+        TEST_ESP_OK(nvs_set_blob(handle, "blob", newStr, 100));
+    }
+    CHECK(emu.getEraseOps() > 0);
+    CHECK(strcmp(mappedStr, str) == 0);
+    CHECK(memcmp(mappedBlob, blob, sizeof(blob)) == 0);
+    nvs_munmap(strMmap);
+    nvs_munmap(blobMmap);
+
+    // deinit releases all mappings
+    TEST_ESP_OK(nvs_get_str_mmap(handle, "str", &mappedStr, &strMmap));
+    CHECK(emu.getMmapCount() == 2);
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    CHECK(emu.getMmapCount() == 0);
+    nvs_munmap(strMmap);
+}
+
+#ifdef CONFIG_NVS_ENCRYPTION
+TEST_CASE("values of encrypted partition are copied when mapped", "[nvs][mmap]")
+{
+    SpiFlashEmulator emu(10);
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+    emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+
+    nvs_sec_cfg_t xts_cfg;
+    for(int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+    TEST_ESP_OK(nvs_flash_secure_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN, &xts_cfg));
+
+    nvs_handle handle;
+    TEST_ESP_OK(nvs_open("namespace1", NVS_READWRITE, &handle));
+    const char* str = "value 0123456789abcdef0123456789abcdef";
+    TEST_ESP_OK(nvs_set_str(handle, "key", str));
+
+    const char* mappedStr;
+    nvs_mmap_handle_t strMmap;
+    TEST_ESP_OK(nvs_get_str_mmap(handle, "key", &mappedStr, &strMmap));
+    CHECK(strcmp(mappedStr, str) == 0);
+    CHECK(emu.getMmapCount() == 0);
+    nvs_munmap(strMmap);
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+#endif
+
+TEST_CASE("nvs iterators enumerate entries by namespace and type", "[nvs][iterator]")
+{
+    SpiFlashEmulator emu(10);
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 10;
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+
+    nvs_handle handle_1, handle_2;
+    TEST_ESP_OK(nvs_open("namespace1", NVS_READWRITE, &handle_1));
+    TEST_ESP_OK(nvs_open("namespace2", NVS_READWRITE, &handle_2));
+    TEST_ESP_OK(nvs_set_i8(handle_1, "value1", -11));
+    TEST_ESP_OK(nvs_set_u8(handle_1, "value2", 11));
+    TEST_ESP_OK(nvs_set_i32(handle_1, "value3", -1234));
+    TEST_ESP_OK(nvs_set_str(handle_1, "value4", "text"));
+    static uint8_t blob[Page::CHUNK_MAX_SIZE * 2];
+    TEST_ESP_OK(nvs_set_blob(handle_1, "value5", blob, sizeof(blob)));
+    TEST_ESP_OK(nvs_set_blob(handle_1, "value6", blob, 10));
+    TEST_ESP_OK(nvs_set_i32(handle_2, "value1", 1));
+    TEST_ESP_OK(nvs_set_str(handle_2, "value2", "text"));
+    TEST_ESP_OK(nvs_transaction_begin(handle_2));
+    TEST_ESP_OK(nvs_set_u64(handle_2, "value3", 3));
+    TEST_ESP_OK(nvs_transaction_commit(handle_2));
+
+    auto count = [](const char* ns, nvs_type_t type) -> int {
+        int n = 0;
+        nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, ns, type);
+        while (it != NULL) {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+            if (ns) {
+                CHECK(strcmp(info.namespace_name, ns) == 0);
+            }
+            if (type != NVS_TYPE_ANY) {
+                CHECK(info.type == type);
+            }
+            ++n;
+            it = nvs_entry_next(it);
+        }
+        return n;
+    };
+
+    CHECK(count(NULL, NVS_TYPE_ANY) == 9);
+    CHECK(count("namespace1", NVS_TYPE_ANY) == 6);
+    CHECK(count("namespace2", NVS_TYPE_ANY) == 3);
+    CHECK(count(NULL, NVS_TYPE_STR) == 2);
+    CHECK(count(NULL, NVS_TYPE_BLOB) == 2);
+    CHECK(count("namespace1", NVS_TYPE_I32) == 1);
+    CHECK(count("namespace2", NVS_TYPE_U64) == 1);
+    CHECK(count("namespace2", NVS_TYPE_BLOB) == 0);
+    CHECK(nvs_entry_find(NVS_DEFAULT_PART_NAME, "missing", NVS_TYPE_ANY) == NULL);
+    CHECK(nvs_entry_find("missing_part", NULL, NVS_TYPE_ANY) == NULL);
+
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, "namespace1", NVS_TYPE_BLOB);
+    REQUIRE(it != NULL);
+    nvs_entry_info_t info;
+    nvs_entry_info(it, &info);
+    CHECK(strcmp(info.key, "value5") == 0);
+    nvs_release_iterator(it);
+
+    nvs_close(handle_1);
+    nvs_close(handle_2);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("walking over all entries with an iterator takes linear time", "[nvs][iterator][bench]")
+{
+    const size_t entryCounts[] = {100, 400, 1600};
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 20;
+    char key[16];
+    double readsPerEntry[3];
+
+    for (int n = 0; n < 3; ++n) {
+        const size_t entryCount = entryCounts[n];
+        SpiFlashEmulator emu(NVS_FLASH_SECTOR_COUNT_MIN);
+        TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, NVS_FLASH_SECTOR_COUNT_MIN));
+        nvs_handle handle;
+        TEST_ESP_OK(nvs_open("namespace1", NVS_READWRITE, &handle));
+        for (size_t i = 0; i < entryCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            TEST_ESP_OK(nvs_set_u32(handle, key, i));
+        }
+
+        emu.clearStats();
+        size_t found = 0;
+        nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, "namespace1", NVS_TYPE_ANY);
+        while (it != NULL) {
+            ++found;
+            it = nvs_entry_next(it);
+        }
+        CHECK(found == entryCount);
+        readsPerEntry[n] = static_cast<double>(emu.getReadOps()) / entryCount;
+        // every entry is read once, plus a constant amount per step
+        CHECK(emu.getReadOps() <= 2 * entryCount);
+        s_perf << "Iterating over " << entryCount << " entries: " << emu.getReadOps() << " read ops" << std::endl;
+
+        nvs_close(handle);
+        TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    }
+    CHECK(readsPerEntry[2] <= readsPerEntry[0] * 1.1);
+}
+
+TEST_CASE("incremental garbage collection bounds write latency", "[nvs][gc][bench]")
+{
+    const size_t keyCount = 40;
+    const size_t writeCount = 3000;
+    const char* modes[] = {"on demand", "incremental"};
+    uint32_t maxLatency[2];
+    char key[16];
+
+    for (int mode = 0; mode < 2; ++mode) {
+        SpiFlashEmulator emu(6);
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, 6));
+        if (mode == 1) {
+            storage.setIncrementalGc(16, 2);
+        }
+
+        uint32_t values[keyCount] = {};
+        uint32_t seed = 1;
+        for (uint32_t i = 1; i <= writeCount; ++i) {
+            // a few keys are updated much more often than the others
+            seed = seed * 1103515245 + 12345;
+            size_t k = (seed >> 16) % keyCount;
+            if (k >= keyCount / 4 && (i % 4) != 0) {
+                k %= keyCount / 4;
+            }
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(k));
+            REQUIRE(storage.writeItem(1, key, i) == ESP_OK);
+            values[k] = i;
+
+            if (mode == 1) {
+                // application is idle between writes
+                while (storage.collectGarbage(32) == ESP_OK) {
+                }
+            }
+        }
+
+        for (size_t k = 0; k < keyCount; ++k) {
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(k));
+            uint32_t v = 0;
+            if (values[k] == 0) {
+                CHECK(storage.readItem(1, key, v) == ESP_ERR_NVS_NOT_FOUND);
+            } else {
+                TEST_ESP_OK(storage.readItem(1, key, v));
+                CHECK(v == values[k]);
+            }
+        }
+        storage.debugCheck();
+
+        nvs_stats_t stats;
+        TEST_ESP_OK(storage.fillStats(stats));
+        size_t total = 0;
+        for (size_t b = 0; b < NVS_STATS_LATENCY_BUCKETS; ++b) {
+            total += stats.write_latency[b];
+        }
+        CHECK(total == writeCount);
+        maxLatency[mode] = stats.write_latency_max;
+        s_perf << "Write latency with " << modes[mode] << " garbage collection: max " << stats.write_latency_max << " us, histogram";
+        for (size_t b = 0; b < NVS_STATS_LATENCY_BUCKETS; ++b) {
+            s_perf << " " << stats.write_latency[b];
+        }
+        s_perf << std::endl;
+        if (mode == 1) {
+            // no write has to wait for a sector erase
+            for (size_t b = 5; b < NVS_STATS_LATENCY_BUCKETS; ++b) {
+                CHECK(stats.write_latency[b] == 0);
+            }
+        }
+    }
+    CHECK(maxLatency[1] * 4 < maxLatency[0]);
+}
+
+TEST_CASE("incremental garbage collection recovers from power loss", "[nvs][gc][recovery]")
+{
+    const size_t stableCount = 60;
+    const size_t hotCount = 20;
+    const uint32_t hotWrites = 2 * Page::ENTRY_COUNT - stableCount + 10;
+    char key[16];
+
+    for (uint32_t errDelay = 0; ; ++errDelay) {
+        INFO(errDelay);
+        SpiFlashEmulator emu(4);
+        {
+            Storage storage;
+            TEST_ESP_OK(storage.init(0, 4));
+            for (size_t i = 0; i < stableCount; ++i) {
+                snprintf(key, sizeof(key), "s%d", static_cast<int>(i));
+                TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i)));
+            }
+            // leaves one free page and a full page with a few values to move
+            for (uint32_t i = 0; i < hotWrites; ++i) {
+                snprintf(key, sizeof(key), "h%d", static_cast<int>(i % hotCount));
+                TEST_ESP_OK(storage.writeItem(1, key, i));
+            }
+        }
+
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, 4));
+        emu.failAfter(errDelay);
+        esp_err_t err;
+        size_t steps = 0;
+        while ((err = storage.collectGarbage(3)) == ESP_OK) {
+            ++steps;
+        }
+        emu.failAfter(UINT32_MAX);
+
+        Storage check;
+        TEST_ESP_OK(check.init(0, 4));
+        for (size_t i = 0; i < stableCount; ++i) {
+            uint32_t v;
+            snprintf(key, sizeof(key), "s%d", static_cast<int>(i));
+            TEST_ESP_OK(check.readItem(1, key, v));
+            CHECK(v == i);
+        }
+        for (uint32_t i = hotWrites - hotCount; i < hotWrites; ++i) {
+            uint32_t v;
+            snprintf(key, sizeof(key), "h%d", static_cast<int>(i % hotCount));
+            TEST_ESP_OK(check.readItem(1, key, v));
+            CHECK(v == i);
+        }
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            // all work is done, in more than one step
+            CHECK(steps > 1);
+            break;
+        }
+    }
+}
+
+static void fillWithSummaryTestData(Storage& storage, size_t count)
+{
+    // written in small transactions, as host build of Storage checks all items after each write
+    const size_t batchSize = 16;
+    char key[16];
+    char str[48];
+    Transaction txn;
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+        if (i % 4 == 0) {
+            snprintf(str, sizeof(str), "value of key number %d", static_cast<int>(i));
+            TEST_ESP_OK(txn.add(1, ItemType::SZ, key, str, strlen(str) + 1));
+        } else {
+            TEST_ESP_OK(txn.add(1, key, static_cast<uint32_t>(i)));
+        }
+        if ((i + 1) % batchSize == 0 || i + 1 == count) {
+            TEST_ESP_OK(storage.writeTransaction(txn));
+            txn.clear();
+        }
+    }
+}
+
+static void checkSummaryTestData(Storage& storage, size_t count)
+{
+    char key[16];
+    char str[48];
+    char expected[48];
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+        if (i % 4 == 0) {
+            snprintf(expected, sizeof(expected), "value of key number %d", static_cast<int>(i));
+            TEST_ESP_OK(storage.readItem(1, ItemType::SZ, key, str, sizeof(str)));
+            CHECK(strcmp(str, expected) == 0);
+        } else {
+            uint32_t v;
+            TEST_ESP_OK(storage.readItem(1, key, v));
+            CHECK(v == i);
+        }
+    }
+}
+
+TEST_CASE("page summaries reduce mount time", "[nvs][summary][bench]")
+{
+    const size_t pageCounts[] = {8, 32, 128};
+    for (size_t pageCount : pageCounts) {
+        // each item takes 1.25 entries on average, about two thirds of pages are used
+        const size_t itemCount = (pageCount - 2) * Page::ENTRY_COUNT / 2;
+        size_t mountTime[2];
+        size_t mountReads[2];
+        for (int summary = 0; summary < 2; ++summary) {
+            SpiFlashEmulator emu(pageCount);
+            {
+                Storage storage;
+                storage.setPageSummary(summary);
+                TEST_ESP_OK(storage.init(0, pageCount));
+                fillWithSummaryTestData(storage, itemCount);
+            }
+
+            Storage storage;
+            storage.setPageSummary(summary);
+            emu.clearStats();
+            TEST_ESP_OK(storage.init(0, pageCount));
+            size_t time = emu.getTotalTime();
+            size_t reads = emu.getReadOps();
+            // host build of Storage::init runs debugCheck, which reads all items
+            emu.clearStats();
+            storage.debugCheck();
+            mountTime[summary] = time - emu.getTotalTime();
+            mountReads[summary] = reads - emu.getReadOps();
+
+            checkSummaryTestData(storage, itemCount);
+        }
+        s_perf << "Mount time of " << pageCount << " pages: " << mountTime[0] << " us ("
+               << mountReads[0] << " reads) without summaries, " << mountTime[1] << " us ("
+               << mountReads[1] << " reads) with summaries" << std::endl;
+        CHECK(mountReads[1] < mountReads[0]);
+        if (pageCount >= 32) {
+            CHECK(mountTime[1] * 2 < mountTime[0]);
+        }
+    }
+}
+
+TEST_CASE("page summaries are used and kept consistent across updates", "[nvs][summary]")
+{
+    const size_t pageCount = 8;
+    const size_t itemCount = 300;
+    SpiFlashEmulator emu(pageCount);
+    {
+        Storage storage;
+        storage.setPageSummary(true);
+        TEST_ESP_OK(storage.init(0, pageCount));
+        fillWithSummaryTestData(storage, itemCount);
+        // update and erase some of the values, which also makes pages get reclaimed
+        char key[16];
+        for (size_t n = 0; n < 4; ++n) {
+            for (size_t i = 1; i < itemCount; i += 4) {
+                snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+                TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i + n + 1)));
+                TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i)));
+            }
+        }
+        TEST_ESP_OK(storage.eraseItem(1, "k2"));
+    }
+
+    Storage storage;
+    storage.setPageSummary(true);
+    TEST_ESP_OK(storage.init(0, pageCount));
+    uint32_t v;
+    CHECK(storage.readItem(1, "k2", v) == ESP_ERR_NVS_NOT_FOUND);
+    TEST_ESP_OK(storage.writeItem(1, "k2", static_cast<uint32_t>(2)));
+    checkSummaryTestData(storage, itemCount);
+
+    // summaries are internal items, not visible to iteration
+    Storage::EntryIterator it;
+    size_t count = 0;
+    for (esp_err_t err = storage.findEntry(it, nullptr, ItemType::ANY); err == ESP_OK; err = storage.nextEntry(it)) {
+        CHECK(it.mItem.nsIndex == 1);
+        ++count;
+    }
+    CHECK(count == itemCount);
+
+    // same data can be loaded without summaries
+    Storage plain;
+    TEST_ESP_OK(plain.init(0, pageCount));
+    checkSummaryTestData(plain, itemCount);
+}
+
+TEST_CASE("page summaries recover from power loss", "[nvs][summary][recovery]")
+{
+    const size_t pageCount = 4;
+    const size_t itemCount = 80;
+    char key[16];
+
+    for (uint32_t errDelay = 0; ; ++errDelay) {
+        INFO(errDelay);
+        SpiFlashEmulator emu(pageCount);
+        {
+            Storage storage;
+            storage.setPageSummary(true);
+            TEST_ESP_OK(storage.init(0, pageCount));
+            fillWithSummaryTestData(storage, itemCount);
+        }
+
+        size_t lastWritten = 0;
+        bool failed = false;
+        {
+            Storage storage;
+            storage.setPageSummary(true);
+            TEST_ESP_OK(storage.init(0, pageCount));
+            emu.failAfter(errDelay);
+            // rewrites values until pages are switched and reclaimed
+            for (uint32_t n = 0; n < Page::ENTRY_COUNT; ++n) {
+                size_t i = 1 + (n * 4) % itemCount;
+                snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+                if (storage.writeItem(1, key, static_cast<uint32_t>(i + 1000)) != ESP_OK ||
+                        storage.writeItem(1, key, static_cast<uint32_t>(i)) != ESP_OK) {
+                    failed = true;
+                    lastWritten = i;
+                    break;
+                }
+            }
+            emu.failAfter(UINT32_MAX);
+        }
+
+        Storage storage;
+        storage.setPageSummary(true);
+        TEST_ESP_OK(storage.init(0, pageCount));
+        if (failed) {
+            // the interrupted value may be the temporary one
+            snprintf(key, sizeof(key), "k%d", static_cast<int>(lastWritten));
+            uint32_t v;
+            TEST_ESP_OK(storage.readItem(1, key, v));
+            CHECK((v == lastWritten || v == lastWritten + 1000));
+            TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(lastWritten)));
+        }
+        checkSummaryTestData(storage, itemCount);
+        if (!failed) {
+            break;
+        }
+    }
+}
+
+TEST_CASE("page summaries leave room for the item which needs a new page", "[nvs][summary]")
+{
+    const size_t pageCount = 4;
+    SpiFlashEmulator emu(pageCount);
+    // largest string which fits into a page, taking all of its entries
+    static char str[Page::CHUNK_MAX_SIZE];
+    memset(str, 'a', sizeof(str) - 1);
+    str[sizeof(str) - 1] = 0;
+    char key[16];
+    {
+        Storage storage;
+        storage.setPageSummary(true);
+        TEST_ESP_OK(storage.init(0, pageCount));
+        for (size_t i = 0; i < Page::ENTRY_COUNT / 2; ++i) {
+            snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+            TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i)));
+        }
+        TEST_ESP_OK(storage.writeItem(1, ItemType::SZ, "long", str, sizeof(str)));
+    }
+
+    Storage storage;
+    storage.setPageSummary(true);
+    TEST_ESP_OK(storage.init(0, pageCount));
+    static char buf[Page::CHUNK_MAX_SIZE];
+    TEST_ESP_OK(storage.readItem(1, ItemType::SZ, "long", buf, sizeof(buf)));
+    CHECK(strcmp(buf, str) == 0);
+    for (size_t i = 0; i < Page::ENTRY_COUNT / 2; ++i) {
+        uint32_t v;
+        snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+        TEST_ESP_OK(storage.readItem(1, key, v));
+        CHECK(v == i);
+    }
+}
+
+TEST_CASE("page summaries keep items of a namespace with their index", "[nvs][summary]")
+{
+    const size_t pageCount = 6;
+    const uint8_t summaryNs = Page::NS_SUMMARY;
+    SpiFlashEmulator emu(pageCount);
+    char name[16];
+    uint8_t nsIndex = 0;
+    {
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, pageCount));
+        while (nsIndex != summaryNs) {
+            snprintf(name, sizeof(name), "ns%d", static_cast<int>(nsIndex + 1));
+            REQUIRE(storage.createOrOpenNamespace(name, true, nsIndex) == ESP_OK);
+        }
+        TEST_ESP_OK(storage.writeItem(nsIndex, "key", static_cast<uint32_t>(42)));
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        Storage storage;
+        storage.setPageSummary(true);
+        TEST_ESP_OK(storage.init(0, pageCount));
+        TEST_ESP_OK(storage.createOrOpenNamespace(name, false, nsIndex));
+        CHECK(nsIndex == summaryNs);
+        uint32_t v;
+        TEST_ESP_OK(storage.readItem(nsIndex, "key", v));
+        CHECK(v == 42);
+
+        Storage::EntryIterator it;
+        TEST_ESP_OK(storage.findEntry(it, name, ItemType::ANY));
+        CHECK(strcmp(it.mItem.key, "key") == 0);
+        CHECK(storage.nextEntry(it) == ESP_ERR_NVS_NOT_FOUND);
+
+        // switch pages, which would write summaries
+        for (uint32_t i = 0; i < Page::ENTRY_COUNT * 2; ++i) {
+            TEST_ESP_OK(storage.writeItem(1, "counter", i));
+        }
+    }
+}
+
+TEST_CASE("read cache returns values which are written and erased", "[nvs][cache]")
+{
+    SpiFlashEmulator emu(4);
+    Storage storage;
+    TEST_ESP_OK(storage.init(0, 4));
+    storage.setReadCacheSize(4);
+
+    TEST_ESP_OK(storage.writeItem(1, "flag", static_cast<uint8_t>(1)));
+    TEST_ESP_OK(storage.writeItem(1, ItemType::SZ, "name", "first", 6));
+    uint8_t flag = 0;
+    char name[16];
+    size_t size = 0;
+    for (int i = 0; i < 3; ++i) {
+        TEST_ESP_OK(storage.readItem(1, "flag", flag));
+        CHECK(flag == 1);
+        TEST_ESP_OK(storage.getItemDataSize(1, ItemType::SZ, "name", size));
+        CHECK(size == 6);
+        TEST_ESP_OK(storage.readItem(1, ItemType::SZ, "name", name, sizeof(name)));
+        CHECK(strcmp(name, "first") == 0);
+    }
+    nvs_stats_t stats;
+    TEST_ESP_OK(storage.fillStats(stats));
+    CHECK(stats.read_cache_misses == 3);
+    CHECK(stats.read_cache_hits == 6);
+
+    // cached reads don't access flash
+    emu.clearStats();
+    TEST_ESP_OK(storage.readItem(1, "flag", flag));
+    TEST_ESP_OK(storage.readItem(1, ItemType::SZ, "name", name, sizeof(name)));
+    CHECK(emu.getReadOps() == 0);
+
+    // same key with another type or in another namespace is not served from the cache
+    uint16_t flag16;
+    CHECK(storage.readItem(1, "flag", flag16) == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(storage.readItem(2, "flag", flag) == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(storage.readItem(1, ItemType::SZ, "name", name, 3) == ESP_ERR_NVS_INVALID_LENGTH);
+
+    TEST_ESP_OK(storage.writeItem(1, "flag", static_cast<uint8_t>(2)));
+    TEST_ESP_OK(storage.readItem(1, "flag", flag));
+    CHECK(flag == 2);
+    TEST_ESP_OK(storage.writeItem(1, ItemType::SZ, "name", "second", 7));
+    TEST_ESP_OK(storage.readItem(1, ItemType::SZ, "name", name, sizeof(name)));
+    CHECK(strcmp(name, "second") == 0);
+
+    TEST_ESP_OK(storage.eraseItem(1, "flag"));
+    CHECK(storage.readItem(1, "flag", flag) == ESP_ERR_NVS_NOT_FOUND);
+
+    Transaction txn;
+    TEST_ESP_OK(txn.add(1, ItemType::SZ, "name", "third", 6));
+    TEST_ESP_OK(storage.writeTransaction(txn));
+    TEST_ESP_OK(storage.readItem(1, ItemType::SZ, "name", name, sizeof(name)));
+    CHECK(strcmp(name, "third") == 0);
+
+    TEST_ESP_OK(storage.eraseNamespace(1));
+    CHECK(storage.readItem(1, ItemType::SZ, "name", name, sizeof(name)) == ESP_ERR_NVS_NOT_FOUND);
+
+    // least recently read values are dropped when the cache is full
+    char key[16];
+    for (uint32_t i = 0; i < 6; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        TEST_ESP_OK(storage.writeItem(1, key, i));
+    }
+    uint32_t v;
+    for (uint32_t i = 0; i < 6; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        TEST_ESP_OK(storage.readItem(1, key, v));
+    }
+    emu.clearStats();
+    for (uint32_t i = 2; i < 6; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        TEST_ESP_OK(storage.readItem(1, key, v));
+        CHECK(v == i);
+    }
+    CHECK(emu.getReadOps() == 0);
+    TEST_ESP_OK(storage.readItem(1, "key0", v));
+    CHECK(v == 0);
+    CHECK(emu.getReadOps() > 0);
+}
+
+TEST_CASE("read cache speeds up polling of a few keys", "[nvs][cache][bench]")
+{
+    const size_t keyCount = 6; // each with an integer and a string value
+    const size_t pollCount = 1000;
+    const char* modes[] = {"without", "with"};
+    size_t pollTime[2];
+    char key[16];
+
+    for (int mode = 0; mode < 2; ++mode) {
+        SpiFlashEmulator emu(8);
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, 8));
+        storage.setReadCacheSize(mode ? 16 : 0);
+        // keys to poll are surrounded by other values
+        for (uint32_t i = 0; i < 400; ++i) {
+            snprintf(key, sizeof(key), "other%d", static_cast<int>(i));
+            TEST_ESP_OK(storage.writeItem(1, key, i));
+            if (i % 32 == 0 && i / 32 < keyCount) {
+                snprintf(key, sizeof(key), "flag%d", static_cast<int>(i / 32));
+                TEST_ESP_OK(storage.writeItem(1, key, i));
+                snprintf(key, sizeof(key), "cal%d", static_cast<int>(i / 32));
+                TEST_ESP_OK(storage.writeItem(1, ItemType::SZ, key, "0.9985", 7));
+            }
+        }
+
+        emu.clearStats();
+        for (size_t n = 0; n < pollCount; ++n) {
+            for (size_t k = 0; k < keyCount; ++k) {
+                uint32_t v;
+                snprintf(key, sizeof(key), "flag%d", static_cast<int>(k));
+                TEST_ESP_OK(storage.readItem(1, key, v));
+                CHECK(v == k * 32);
+                char str[8];
+                snprintf(key, sizeof(key), "cal%d", static_cast<int>(k));
+                TEST_ESP_OK(storage.readItem(1, ItemType::SZ, key, str, sizeof(str)));
+                CHECK(strcmp(str, "0.9985") == 0);
+            }
+        }
+        pollTime[mode] = emu.getTotalTime();
+
+        nvs_stats_t stats;
+        TEST_ESP_OK(storage.fillStats(stats));
+        s_perf << "Polling " << keyCount * 2 << " keys " << pollCount << " times " << modes[mode]
+               << " read cache: " << emu.getReadOps() << " reads, " << pollTime[mode] << " us, "
+               << stats.read_cache_hits << " hits, " << stats.read_cache_misses << " misses" << std::endl;
+        if (mode == 1) {
+            CHECK(stats.read_cache_misses == keyCount * 2);
+        }
+    }
+    CHECK(pollTime[1] * 10 < pollTime[0]);
+}
+
+TEST_CASE("closed handles are rejected after their slot is reused", "[nvs][handle]")
+{
+    SpiFlashEmulator emu(10);
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 4;
+    emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+
+    nvs_handle first, second;
+    TEST_ESP_OK(nvs_open("first", NVS_READWRITE, &first));
+    CHECK(first != 0);
+    TEST_ESP_OK(nvs_set_u32(first, "value", 1));
+    nvs_close(first);
+
+    TEST_ESP_OK(nvs_open("second", NVS_READWRITE, &second));
+    CHECK(second != first);
+    uint32_t v;
+    CHECK(nvs_get_u32(first, "value", &v) == ESP_ERR_NVS_INVALID_HANDLE);
+    CHECK(nvs_set_u32(first, "value", 2) == ESP_ERR_NVS_INVALID_HANDLE);
+    nvs_close(first); // closing a stale handle has no effect
+    TEST_ESP_OK(nvs_set_u32(second, "value", 3));
+    TEST_ESP_OK(nvs_get_u32(second, "value", &v));
+    CHECK(v == 3);
+    CHECK(nvs_get_u32(0, "value", &v) == ESP_ERR_NVS_INVALID_HANDLE);
+    CHECK(nvs_get_u32(0xffff, "value", &v) == ESP_ERR_NVS_INVALID_HANDLE);
+
+    // handles are released when their partition is deinitialized
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    CHECK(nvs_get_u32(second, "value", &v) == ESP_ERR_NVS_INVALID_HANDLE);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+    nvs_handle third;
+    TEST_ESP_OK(nvs_open("first", NVS_READONLY, &third));
+    CHECK(nvs_get_u32(second, "value", &v) == ESP_ERR_NVS_INVALID_HANDLE);
+    TEST_ESP_OK(nvs_get_u32(third, "value", &v));
+    CHECK(v == 1);
+    nvs_close(third);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("handle lookup time doesn't depend on the number of open handles", "[nvs][handle][bench]")
+{
+    SpiFlashEmulator emu(10);
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 4;
+    const size_t handleCounts[] = {1, 16, 128};
+    const size_t lookupCount = 100000;
+    emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+
+    for (auto handleCount : handleCounts) {
+        nvs_handle handles[128];
+        char name[16];
+        for (size_t i = 0; i < handleCount; ++i) {
+            // a few handles per namespace, like components sharing one
+            snprintf(name, sizeof(name), "ns%d", static_cast<int>(i / 4));
+            TEST_ESP_OK(nvs_open(name, NVS_READWRITE, &handles[i]));
+        }
+        nvs_handle last = handles[handleCount - 1];
+        TEST_ESP_OK(nvs_set_u32(last, "flag", static_cast<uint32_t>(handleCount)));
+
+        uint32_t v = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookupCount; ++i) {
+            nvs_get_u32(last, "flag", &v);
+        }
+        auto getTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookupCount;
+        CHECK(v == handleCount);
+
+        esp_err_t err = ESP_OK;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookupCount; ++i) {
+            err = nvs_get_u32(0x7fff0001, "flag", &v);
+        }
+        CHECK(err == ESP_ERR_NVS_INVALID_HANDLE);
+        auto invalidTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookupCount;
+
+        s_perf << "Handle lookup with " << handleCount << " open handles: get " << getTime << " ns, invalid handle " << invalidTime << " ns" << std::endl;
+
+        for (size_t i = 0; i < handleCount; ++i) {
+            nvs_close(handles[i]);
+        }
+    }
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("encrypted pages are loaded and copied in runs of entries", "[nvs][encr][bench]")
+{
+    // storage uses the first sectors, the last two are for copying one page
+    const size_t pageCount = 16;
+    const size_t srcSector = pageCount;
+    const size_t dstSector = pageCount + 1;
+    SpiFlashEmulator emu(pageCount + 2);
+
+    nvs_sec_cfg_t xts_cfg;
+    for (int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+    TEST_ESP_OK(EncrMgr::getInstance()->setSecurityContext(0, pageCount + 2, &xts_cfg));
+
+    const size_t itemCount = (pageCount - 2) * Page::ENTRY_COUNT / 2;
+    {
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, pageCount));
+        fillWithSummaryTestData(storage, itemCount);
+    }
+
+    Storage storage;
+    emu.clearStats();
+    auto start = std::chrono::steady_clock::now();
+    TEST_ESP_OK(storage.init(0, pageCount));
+    auto mountWall = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    size_t mountTime = emu.getTotalTime();
+    size_t mountReads = emu.getReadOps();
+    // host build of Storage::init runs debugCheck, which reads all items
+    emu.clearStats();
+    start = std::chrono::steady_clock::now();
+    storage.debugCheck();
+    mountWall -= std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    mountTime -= emu.getTotalTime();
+    mountReads -= emu.getReadOps();
+    checkSummaryTestData(storage, itemCount);
+
+    // garbage collection copies all written entries of a page to another one
+    Page src;
+    TEST_ESP_OK(src.load(srcSector));
+    char key[16];
+    char str[100];
+    size_t strCount = 0;
+    for (esp_err_t err = ESP_OK; err == ESP_OK; ++strCount) {
+        snprintf(key, sizeof(key), "s%d", static_cast<int>(strCount));
+        snprintf(str, sizeof(str), "%-90d", static_cast<int>(strCount));
+        err = src.writeItem(1, ItemType::SZ, key, str, strlen(str) + 1);
+        if (err != ESP_OK) {
+            CHECK(err == ESP_ERR_NVS_PAGE_FULL);
+            break;
+        }
+    }
+    Page dst;
+    TEST_ESP_OK(dst.load(dstSector));
+    emu.clearStats();
+    start = std::chrono::steady_clock::now();
+    TEST_ESP_OK(src.copyItems(dst));
+    auto copyWall = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    size_t copyTime = emu.getTotalTime();
+    size_t copyReads = emu.getReadOps();
+    size_t copyWrites = emu.getWriteOps();
+    CHECK(dst.getUsedEntryCount() == src.getUsedEntryCount());
+    for (size_t i = 0; i < strCount; ++i) {
+        char expected[100];
+        snprintf(key, sizeof(key), "s%d", static_cast<int>(i));
+        snprintf(expected, sizeof(expected), "%-90d", static_cast<int>(i));
+        TEST_ESP_OK(dst.readItem(1, ItemType::SZ, key, str, sizeof(str)));
+        CHECK(strcmp(str, expected) == 0);
+    }
+
+    s_perf << "Encrypted mount of " << pageCount << " pages: " << mountTime << " us (" << mountReads
+           << " reads), " << mountWall << " us wall clock" << std::endl;
+    s_perf << "Copying an encrypted page of " << src.getUsedEntryCount() << " entries: " << copyTime << " us ("
+           << copyReads << " reads, " << copyWrites << " writes), " << copyWall << " us wall clock" << std::endl;
+    CHECK(copyReads * 2 <= src.getUsedEntryCount());
+
+    TEST_ESP_OK(EncrMgr::getInstance()->removeSecurityContext(0));
+}
+
 /* Add new tests above */
 /* This test has to be the final one */
 
@@ -29,6 +29,12 @@ using namespace std;
 
 #define DIV_AND_CEIL(x, y)              ((x) / (y) + ((x) % (y) > 0))
 
+// Typical latencies of SPI flash chips used with ESP32, in microseconds.
+// Reading a page takes about 26us at 40MHz in DIO mode.
+#define DEFAULT_PAGE_PROGRAM_TIME       600
+#define DEFAULT_SECTOR_ERASE_TIME       50000
+#define DEFAULT_PAGE_READ_TIME          26
+
 SpiFlash::SpiFlash()
 {
     return;
@@ -63,6 +69,11 @@ void SpiFlash::init(uint32_t chip_size, uint32_t block_size, uint32_t sector_siz
 
     this->total_erase_cycles = 0;
 
+    this->set_timing(DEFAULT_PAGE_PROGRAM_TIME, DEFAULT_SECTOR_ERASE_TIME, DEFAULT_PAGE_READ_TIME);
+    this->reset_stats();
+    this->set_power_cut(0, 0);
+    this->power_on();
+
     // Load partitions table bin
     this->memory = (uint8_t *) malloc(this->chip_size);
     memset(this->memory, 0xFF, this->chip_size);
@@ -135,6 +146,22 @@ esp_rom_spiflash_result_t SpiFlash::erase_sector(uint32_t sector)
 
     uint32_t pages_per_sector = (this->sector_size / this->page_size);
     uint32_t start_page = sector * pages_per_sector;
+    uint32_t torn_bits = 0;
+
+    if (this->power_cut(&torn_bits)) {
+        // Interrupted erase sets only the first bits of the sector
+        uint8_t* data = &this->memory[sector * this->sector_size];
+        for (uint32_t i = 0; i < torn_bits && i < this->sector_size * 8; i++) {
+            data[i / 8] |= (1 << (i % 8));
+        }
+        if (torn_bits > 0) {
+            this->erase_states[sector] = false;
+        }
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
+    this->erase_ops++;
+    this->time += this->sector_erase_time;
 
     if (this->erase_states[sector]) {
         goto out;
@@ -170,6 +197,12 @@ esp_rom_spiflash_result_t SpiFlash::write(uint32_t dest_addr, const void *src, u
         return ESP_ROM_SPIFLASH_RESULT_ERR;
     }
 
+    uint32_t torn_bits = 0;
+    bool interrupted = this->power_cut(&torn_bits);
+    if (interrupted && torn_bits == 0) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     start = dest_addr / this->get_sector_size();
     end = size > 0 ? (dest_addr + size - 1) / this->get_sector_size() : start;
 
@@ -182,6 +215,17 @@ esp_rom_spiflash_result_t SpiFlash::write(uint32_t dest_addr, const void *src, u
         this->erase_states[i] = false;
     }
 
+    if (interrupted && torn_bits < size * 8) {
+        // Interrupted program clears only the first bits of the data
+        for (uint32_t i = 0; i < torn_bits; i++) {
+            uint8_t mask = (1 << (i % 8));
+            if ((((uint8_t*)src)[i / 8] & mask) == 0) {
+                this->memory[dest_addr + i / 8] &= ~mask;
+            }
+        }
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     // Do the write
     for(uint32_t ctr = 0; ctr < size; ctr++)
     {
@@ -194,6 +238,17 @@ esp_rom_spiflash_result_t SpiFlash::write(uint32_t dest_addr, const void *src, u
         this->memory[dest_addr + ctr] = data;
     }
 
+    if (interrupted) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
+    // Every page touched by the write costs one program operation
+    if (size > 0) {
+        this->time += (uint64_t)((dest_addr + size - 1) / this->page_size - dest_addr / this->page_size + 1) * this->page_program_time;
+    }
+    this->write_ops++;
+    this->write_bytes += size;
+
     return ESP_ROM_SPIFLASH_RESULT_OK;
 }
 
@@ -218,8 +273,17 @@ esp_rom_spiflash_result_t SpiFlash::read(uint32_t src_addr, void *dest, uint32_t
         }
     }
 
+    if (this->power_off) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     // Do the read
     memcpy(dest, &this->memory[src_addr], size);
+
+    this->time += DIV_AND_CEIL((uint64_t)size * this->page_read_time, this->page_size);
+    this->read_ops++;
+    this->read_bytes += size;
+
     return ESP_ROM_SPIFLASH_RESULT_OK;
 }
 
@@ -256,4 +320,81 @@ void SpiFlash::reset_erase_cycles()
 void SpiFlash::reset_total_erase_cycles()
 {
     this->total_erase_cycles = 0;
-}
\ No newline at end of file
+}
+
+void SpiFlash::set_timing(uint32_t page_program_time, uint32_t sector_erase_time, uint32_t page_read_time)
+{
+    this->page_program_time = page_program_time;
+    this->sector_erase_time = sector_erase_time;
+    this->page_read_time = page_read_time;
+}
+
+uint64_t SpiFlash::get_time()
+{
+    return this->time;
+}
+
+uint32_t SpiFlash::get_read_ops()
+{
+    return this->read_ops;
+}
+
+uint64_t SpiFlash::get_read_bytes()
+{
+    return this->read_bytes;
+}
+
+uint32_t SpiFlash::get_write_ops()
+{
+    return this->write_ops;
+}
+
+uint64_t SpiFlash::get_write_bytes()
+{
+    return this->write_bytes;
+}
+
+uint32_t SpiFlash::get_erase_ops()
+{
+    return this->erase_ops;
+}
+
+void SpiFlash::reset_stats()
+{
+    this->time = 0;
+    this->read_ops = 0;
+    this->read_bytes = 0;
+    this->write_ops = 0;
+    this->write_bytes = 0;
+    this->erase_ops = 0;
+}
+
+void SpiFlash::set_power_cut(uint32_t ops, uint32_t torn_bits)
+{
+    this->power_cut_ops = ops;
+    this->power_cut_torn_bits = torn_bits;
+}
+
+void SpiFlash::power_on()
+{
+    this->power_off = false;
+}
+
+bool SpiFlash::is_power_off()
+{
+    return this->power_off;
+}
+
+bool SpiFlash::power_cut(uint32_t *torn_bits)
+{
+    *torn_bits = 0;
+    if (this->power_off) {
+        return true;
+    }
+    if (this->power_cut_ops == 0 || --this->power_cut_ops > 0) {
+        return false;
+    }
+    this->power_off = true;
+    *torn_bits = this->power_cut_torn_bits;
+    return true;
+}
@@ -56,6 +56,27 @@ public:
 
     uint8_t* get_memory_ptr(uint32_t src_address);
 
+    // Latencies in microseconds of programming a page, erasing a sector and reading a page.
+    // Operations advance a virtual clock instead of taking real time.
+    void set_timing(uint32_t page_program_time, uint32_t sector_erase_time, uint32_t page_read_time);
+    uint64_t get_time();
+
+    uint32_t get_read_ops();
+    uint64_t get_read_bytes();
+    uint32_t get_write_ops();
+    uint64_t get_write_bytes();
+    uint32_t get_erase_ops();
+
+    // Reset the virtual clock and operation counters
+    void reset_stats();
+
+    // Cut power during the ops-th program or erase operation from now. The interrupted operation
+    // changes only the first torn_bits bits it would change, and every following operation
+    // fails until power_on() is called. ops = 0 disables the power cut.
+    void set_power_cut(uint32_t ops, uint32_t torn_bits);
+    void power_on();
+    bool is_power_off();
+
 private:
     uint32_t chip_size;
     uint32_t block_size;
@@ -75,6 +96,22 @@ private:
     uint32_t total_erase_cycles;
     uint32_t total_erase_cycles_limit;
 
+    uint32_t page_program_time;
+    uint32_t sector_erase_time;
+    uint32_t page_read_time;
+    uint64_t time;
+
+    uint32_t read_ops;
+    uint64_t read_bytes;
+    uint32_t write_ops;
+    uint64_t write_bytes;
+    uint32_t erase_ops;
+
+    uint32_t power_cut_ops;
+    uint32_t power_cut_torn_bits;
+    bool power_off;
+
+    bool power_cut(uint32_t *torn_bits);
     void deinit();
 };
 
@@ -5,6 +5,7 @@ extern "C" {
 #endif
 
 typedef int sdmmc_card_t;
+typedef int sdmmc_host_t;
 
 #if defined(__cplusplus)
 }
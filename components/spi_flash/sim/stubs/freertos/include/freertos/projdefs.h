@@ -1,11 +1,20 @@
 #pragma once
 
+#include <stdint.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+#define pdFALSE             0
 #define pdTRUE              1
 
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define portMAX_DELAY       ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS  1
+
 #if defined(__cplusplus)
 }
 #endif
@@ -1,16 +1,23 @@
 #pragma once
 
+#include "projdefs.h"
+#include "task.h"
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
-#define vSemaphoreDelete( xSemaphore )
-#define xSemaphoreCreateMutex()                     ((void*)(1))
-#define xSemaphoreGive( xSemaphore )
-#define xSemaphoreTake( xSemaphore, xBlockTime )    pdTRUE
-
+// Semaphores are backed by pthreads, so that code which runs in several
+// threads of a host test is serialized the same way as on the target.
 typedef void* SemaphoreHandle_t;
 
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t xSemaphore);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -1 +1,14 @@
-#pragma once
\ No newline at end of file
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef void* TaskHandle_t;
+
+// Every host thread is a task
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool is_mutex;
+    int count;
+    TaskHandle_t holder;
+} sim_semaphore_t;
+
+static SemaphoreHandle_t create(bool is_mutex, int count)
+{
+    sim_semaphore_t *sem = (sim_semaphore_t *) calloc(1, sizeof(sim_semaphore_t));
+    if (sem == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&sem->mutex, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->is_mutex = is_mutex;
+    sem->count = count;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return create(true, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return create(false, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+    sim_semaphore_t *sem = (sim_semaphore_t *) xSemaphore;
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+    sim_semaphore_t *sem = (sim_semaphore_t *) xSemaphore;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += xBlockTime * portTICK_PERIOD_MS / 1000;
+    deadline.tv_nsec += (long) (xBlockTime * portTICK_PERIOD_MS % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    BaseType_t result = pdTRUE;
+    pthread_mutex_lock(&sem->mutex);
+    while (sem->count == 0) {
+        if (xBlockTime == portMAX_DELAY) {
+            pthread_cond_wait(&sem->cond, &sem->mutex);
+        } else if (pthread_cond_timedwait(&sem->cond, &sem->mutex, &deadline) == ETIMEDOUT) {
+            result = pdFALSE;
+            break;
+        }
+    }
+    if (result == pdTRUE) {
+        sem->count--;
+        if (sem->is_mutex) {
+            sem->holder = xTaskGetCurrentTaskHandle();
+        }
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return result;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+    sim_semaphore_t *sem = (sim_semaphore_t *) xSemaphore;
+    BaseType_t result = pdFALSE;
+    pthread_mutex_lock(&sem->mutex);
+    if (sem->count == 0) {
+        sem->count = 1;
+        sem->holder = NULL;
+        pthread_cond_signal(&sem->cond);
+        result = pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return result;
+}
+
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t xSemaphore)
+{
+    sim_semaphore_t *sem = (sim_semaphore_t *) xSemaphore;
+    pthread_mutex_lock(&sem->mutex);
+    TaskHandle_t holder = sem->holder;
+    pthread_mutex_unlock(&sem->mutex);
+    return holder;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return (TaskHandle_t) pthread_self();
+}
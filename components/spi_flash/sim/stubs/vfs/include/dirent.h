@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Same as vfs/include/sys/dirent.h, used instead of the dirent.h of the host */
+
+typedef struct {
+    uint16_t dd_vfs_idx;
+    uint16_t dd_rsv;
+} DIR;
+
+struct dirent {
+    int d_ino;
+    uint8_t d_type;
+#define DT_UNKNOWN  0
+#define DT_REG      1
+#define DT_DIR      2
+    char d_name[256];
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,110 @@
+#include <string.h>
+#include <errno.h>
+#include "esp_vfs.h"
+
+/* Calls functions of registered file systems directly, without translating file descriptors.
+ * Only one file system can have open files at a time.
+ */
+
+#define VFS_MAX_COUNT   2
+
+typedef struct {
+    char path_prefix[ESP_VFS_PATH_MAX + 1];
+    esp_vfs_t vfs;
+    void* ctx;
+} vfs_entry_t;
+
+static vfs_entry_t s_vfs[VFS_MAX_COUNT];
+static vfs_entry_t* s_fd_vfs = NULL;
+
+esp_err_t esp_vfs_register(const char* base_path, const esp_vfs_t* vfs, void* ctx)
+{
+    if (strlen(base_path) > ESP_VFS_PATH_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < VFS_MAX_COUNT; i++) {
+        if (s_vfs[i].path_prefix[0] == 0) {
+            strcpy(s_vfs[i].path_prefix, base_path);
+            s_vfs[i].vfs = *vfs;
+            s_vfs[i].ctx = ctx;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_vfs_unregister(const char* base_path)
+{
+    for (int i = 0; i < VFS_MAX_COUNT; i++) {
+        if (strcmp(s_vfs[i].path_prefix, base_path) == 0) {
+            if (s_fd_vfs == &s_vfs[i]) {
+                s_fd_vfs = NULL;
+            }
+            memset(&s_vfs[i], 0, sizeof(vfs_entry_t));
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_STATE;
+}
+
+int esp_vfs_open(struct _reent *r, const char * path, int flags, int mode)
+{
+    for (int i = 0; i < VFS_MAX_COUNT; i++) {
+        size_t len = strlen(s_vfs[i].path_prefix);
+        if (len > 0 && strncmp(path, s_vfs[i].path_prefix, len) == 0 && path[len] == '/') {
+            int fd = s_vfs[i].vfs.open_p(s_vfs[i].ctx, path + len, flags, mode);
+            if (fd >= 0) {
+                s_fd_vfs = &s_vfs[i];
+            }
+            return fd;
+        }
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+ssize_t esp_vfs_write(struct _reent *r, int fd, const void * data, size_t size)
+{
+    return s_fd_vfs->vfs.write_p(s_fd_vfs->ctx, fd, data, size);
+}
+
+off_t esp_vfs_lseek(struct _reent *r, int fd, off_t size, int mode)
+{
+    return s_fd_vfs->vfs.lseek_p(s_fd_vfs->ctx, fd, size, mode);
+}
+
+ssize_t esp_vfs_read(struct _reent *r, int fd, void * dst, size_t size)
+{
+    return s_fd_vfs->vfs.read_p(s_fd_vfs->ctx, fd, dst, size);
+}
+
+int esp_vfs_close(struct _reent *r, int fd)
+{
+    return s_fd_vfs->vfs.close_p(s_fd_vfs->ctx, fd);
+}
+
+int esp_vfs_fstat(struct _reent *r, int fd, struct stat * st)
+{
+    return s_fd_vfs->vfs.fstat_p(s_fd_vfs->ctx, fd, st);
+}
+
+int esp_vfs_stat(struct _reent *r, const char * path, struct stat * st)
+{
+    for (int i = 0; i < VFS_MAX_COUNT; i++) {
+        size_t len = strlen(s_vfs[i].path_prefix);
+        if (len > 0 && strncmp(path, s_vfs[i].path_prefix, len) == 0 && path[len] == '/') {
+            return s_vfs[i].vfs.stat_p(s_vfs[i].ctx, path + len, st);
+        }
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+int esp_vfs_ioctl(int fd, int cmd, ...)
+{
+    va_list args;
+    va_start(args, cmd);
+    int ret = s_fd_vfs->vfs.ioctl_p(s_fd_vfs->ctx, fd, cmd, args);
+    va_end(args);
+    return ret;
+}
@@ -75,6 +75,9 @@ static int vfs_spiffs_utime(void *ctx, const char *path, const struct utimbuf *t
 
 static esp_spiffs_t * _efs[CONFIG_SPIFFS_MAX_PARTITIONS];
 
+/* SPIFFS keeps a bit mask of used cache pages in a 32-bit word */
+#define SPIFFS_MAX_CACHE_PAGES 32
+
 static void esp_spiffs_free(esp_spiffs_t ** efs)
 {
     esp_spiffs_t * e = *efs;
@@ -137,6 +140,11 @@ static esp_err_t esp_spiffs_init(const esp_vfs_spiffs_conf_t* conf)
         return ESP_ERR_INVALID_STATE;
     }
 
+    if (conf->gc_threshold > 100) {
+        ESP_LOGE(TAG, "gc_threshold is a percentage, %d is invalid", conf->gc_threshold);
+        return ESP_ERR_INVALID_ARG;
+    }
+
     uint32_t flash_page_size = g_rom_flashchip.page_size;
     uint32_t log_page_size = CONFIG_SPIFFS_PAGE_SIZE;
     if (log_page_size % flash_page_size != 0) {
@@ -176,6 +184,7 @@ static esp_err_t esp_spiffs_init(const esp_vfs_spiffs_conf_t* conf)
     efs->cfg.phys_size         = partition->size;
 
     efs->by_label = conf->partition_label != NULL;
+    efs->gc_threshold = conf->gc_threshold;
 
     efs->lock = xSemaphoreCreateMutex();
     if (efs->lock == NULL) {
@@ -194,7 +203,12 @@ static esp_err_t esp_spiffs_init(const esp_vfs_spiffs_conf_t* conf)
     memset(efs->fds, 0, efs->fds_sz);
 
 #if SPIFFS_CACHE
-    efs->cache_sz = sizeof(spiffs_cache) + conf->max_files * (sizeof(spiffs_cache_page)
+    efs->cache_pages = conf->cache_pages ? conf->cache_pages : conf->max_files;
+    if (efs->cache_pages > SPIFFS_MAX_CACHE_PAGES) {
+        ESP_LOGW(TAG, "cache is limited to %d pages", SPIFFS_MAX_CACHE_PAGES);
+        efs->cache_pages = SPIFFS_MAX_CACHE_PAGES;
+    }
+    efs->cache_sz = sizeof(spiffs_cache) + efs->cache_pages * (sizeof(spiffs_cache_page)
                           + efs->cfg.log_page_size);
     efs->cache = malloc(efs->cache_sz);
     if (efs->cache == NULL) {
@@ -270,6 +284,67 @@ esp_err_t esp_spiffs_info(const char* partition_label, size_t *total_bytes, size
     return ESP_OK;
 }
 
+esp_err_t esp_spiffs_get_stats(const char* partition_label, esp_spiffs_stats_t *stats)
+{
+    int index;
+    if (esp_spiffs_by_label(partition_label, &index) != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_spiffs_t * efs = _efs[index];
+    memset(stats, 0, sizeof(*stats));
+    xSemaphoreTake(efs->lock, portMAX_DELAY);
+    stats->cache_pages = efs->cache_pages;
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+    stats->cache_hits = efs->fs->cache_hits;
+    stats->cache_misses = efs->fs->cache_misses;
+#endif
+#if SPIFFS_GC_STATS
+    stats->gc_runs = efs->fs->stats_gc_runs;
+#endif
+    stats->flash_reads = efs->flash_reads;
+    stats->flash_writes = efs->flash_writes;
+    stats->flash_erases = efs->flash_erases;
+    xSemaphoreGive(efs->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_spiffs_reset_stats(const char* partition_label)
+{
+    int index;
+    if (esp_spiffs_by_label(partition_label, &index) != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_spiffs_t * efs = _efs[index];
+    xSemaphoreTake(efs->lock, portMAX_DELAY);
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+    efs->fs->cache_hits = 0;
+    efs->fs->cache_misses = 0;
+#endif
+#if SPIFFS_GC_STATS
+    efs->fs->stats_gc_runs = 0;
+#endif
+    efs->flash_reads = 0;
+    efs->flash_writes = 0;
+    efs->flash_erases = 0;
+    xSemaphoreGive(efs->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_spiffs_gc(const char* partition_label, size_t size_to_gc)
+{
+    int index;
+    if (esp_spiffs_by_label(partition_label, &index) != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s32_t res = SPIFFS_gc(_efs[index]->fs, size_to_gc);
+    if (res != SPIFFS_OK) {
+        ESP_LOGE(TAG, "gc failed, %i", SPIFFS_errno(_efs[index]->fs));
+        SPIFFS_clearerr(_efs[index]->fs);
+        return (res == SPIFFS_ERR_FULL) ? ESP_ERR_INVALID_SIZE : ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
 esp_err_t esp_spiffs_format(const char* partition_label)
 {
     bool partition_was_mounted = false;
@@ -449,6 +524,29 @@ static int spiffs_mode_conv(int m)
     return res;
 }
 
+/* Collect garbage when less than gc_threshold percent of the partition is erased,
+ * so that later writes find erased pages
+ */
+static void vfs_spiffs_gc_check(esp_spiffs_t * efs)
+{
+    if (efs->gc_threshold == 0) {
+        return;
+    }
+    u32_t total, used;
+    if (SPIFFS_info(efs->fs, &total, &used) != SPIFFS_OK) {
+        SPIFFS_clearerr(efs->fs);
+        return;
+    }
+    /* SPIFFS_gc returns right away if this much space is already erased,
+     * or if it can't be freed because the partition is too full
+     */
+    u32_t size = (u32_t) ((uint64_t) total * efs->gc_threshold / 100);
+    if (SPIFFS_gc(efs->fs, size) != SPIFFS_OK) {
+        ESP_LOGD(TAG, "gc to %d bytes: %i", (int) size, SPIFFS_errno(efs->fs));
+        SPIFFS_clearerr(efs->fs);
+    }
+}
+
 static int vfs_spiffs_open(void* ctx, const char * path, int flags, int mode)
 {
     assert(path);
@@ -499,6 +597,7 @@ static int vfs_spiffs_close(void* ctx, int fd)
         SPIFFS_clearerr(efs->fs);
         return -1;
     }
+    vfs_spiffs_gc_check(efs);
     return res;
 }
 
@@ -579,6 +678,7 @@ static int vfs_spiffs_unlink(void* ctx, const char *path)
         SPIFFS_clearerr(efs->fs);
         return -1;
     }
+    vfs_spiffs_gc_check(efs);
     return res;
 }
 
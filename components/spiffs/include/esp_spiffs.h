@@ -30,8 +30,23 @@ typedef struct {
         const char* partition_label;    /*!< Optional, label of SPIFFS partition to use. If set to NULL, first partition with subtype=spiffs will be used. */
         size_t max_files;               /*!< Maximum files that could be open at the same time. */
         bool format_if_mount_failed;    /*!< If true, it will format the file system if it fails to mount. */
+        size_t cache_pages;             /*!< Optional, number of logical pages in the SPIFFS cache, at most 32. If set to 0, max_files pages are used. */
+        uint8_t gc_threshold;           /*!< Optional, percentage of the partition which is kept erased: when less space is erased after a file is closed or removed, garbage is collected right away rather than during later writes. If set to 0, garbage is only collected when writes need space. */
 } esp_vfs_spiffs_conf_t;
 
+/**
+ * @brief SPIFFS statistics, counted since the partition was mounted or since esp_spiffs_reset_stats was called
+ */
+typedef struct {
+        size_t cache_pages;             /*!< Number of logical pages in the SPIFFS cache */
+        uint32_t cache_hits;            /*!< Page accesses served from the cache, only counted if CONFIG_SPIFFS_CACHE_STATS is enabled */
+        uint32_t cache_misses;          /*!< Page accesses which missed the cache, only counted if CONFIG_SPIFFS_CACHE_STATS is enabled */
+        uint32_t gc_runs;               /*!< Garbage collection runs, only counted if CONFIG_SPIFFS_GC_STATS is enabled */
+        uint32_t flash_reads;           /*!< Read operations on the partition */
+        uint32_t flash_writes;          /*!< Write operations on the partition */
+        uint32_t flash_erases;          /*!< Erase operations on the partition */
+} esp_spiffs_stats_t;
+
 /**
  * Register and mount SPIFFS to VFS with given path prefix.
  *
@@ -95,6 +110,53 @@ esp_err_t esp_spiffs_format(const char* partition_label);
  */
 esp_err_t esp_spiffs_info(const char* partition_label, size_t *total_bytes, size_t *used_bytes);
 
+/**
+ * Get cache and flash statistics of SPIFFS
+ *
+ * Statistics help to size the cache (esp_vfs_spiffs_conf_t::cache_pages),
+ * for example for directories with many files, where looking up a file
+ * reads many pages.
+ *
+ * @param partition_label           Optional, label of the partition to get statistics for.
+ *                                  If not specified, first partition with subtype=spiffs is used.
+ * @param[out] stats                Statistics of the partition
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ */
+esp_err_t esp_spiffs_get_stats(const char* partition_label, esp_spiffs_stats_t *stats);
+
+/**
+ * Reset statistics of SPIFFS to zero
+ *
+ * @param partition_label           Optional, label of the partition to reset statistics for.
+ *                                  If not specified, first partition with subtype=spiffs is used.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ */
+esp_err_t esp_spiffs_reset_stats(const char* partition_label);
+
+/**
+ * Collect garbage until the given number of bytes is erased
+ *
+ * Can be called when the application is idle, so that later writes don't
+ * have to collect garbage.
+ *
+ * @param partition_label           Optional, label of the partition.
+ *                                  If not specified, first partition with subtype=spiffs is used.
+ * @param size_to_gc                Number of bytes which should be erased and ready for writing
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_INVALID_SIZE    if this much space can't be freed
+ *          - ESP_FAIL                on other errors
+ */
+esp_err_t esp_spiffs_gc(const char* partition_label, size_t size_to_gc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,6 +33,7 @@ void spiffs_api_unlock(spiffs *fs)
 
 s32_t spiffs_api_read(spiffs *fs, uint32_t addr, uint32_t size, uint8_t *dst)
 {
+    ((esp_spiffs_t *)(fs->user_data))->flash_reads++;
     esp_err_t err = esp_partition_read(((esp_spiffs_t *)(fs->user_data))->partition, 
                                         addr, dst, size);
     if (err) {
@@ -44,6 +45,7 @@ s32_t spiffs_api_read(spiffs *fs, uint32_t addr, uint32_t size, uint8_t *dst)
 
 s32_t spiffs_api_write(spiffs *fs, uint32_t addr, uint32_t size, uint8_t *src)
 {
+    ((esp_spiffs_t *)(fs->user_data))->flash_writes++;
     esp_err_t err = esp_partition_write(((esp_spiffs_t *)(fs->user_data))->partition, 
                                         addr, src, size);
     if (err) {
@@ -55,6 +57,7 @@ s32_t spiffs_api_write(spiffs *fs, uint32_t addr, uint32_t size, uint8_t *src)
 
 s32_t spiffs_api_erase(spiffs *fs, uint32_t addr, uint32_t size)
 {
+    ((esp_spiffs_t *)(fs->user_data))->flash_erases++;
     esp_err_t err = esp_partition_erase_range(((esp_spiffs_t *)(fs->user_data))->partition, 
                                         addr, size);
     if (err) {
@@ -41,6 +41,11 @@ typedef struct {
     uint32_t fds_sz;                        /*!< File Descriptor Buffer Length */
     uint8_t *cache;                         /*!< Cache Buffer */
     uint32_t cache_sz;                      /*!< Cache Buffer Length */
+    size_t cache_pages;                     /*!< Number of pages in the cache */
+    uint8_t gc_threshold;                   /*!< Percentage of the partition kept erased after close and unlink */
+    uint32_t flash_reads;                   /*!< Read operations since mount or stats reset */
+    uint32_t flash_writes;                  /*!< Write operations since mount or stats reset */
+    uint32_t flash_erases;                  /*!< Erase operations since mount or stats reset */
 } esp_spiffs_t;
 
 s32_t spiffs_api_read(spiffs *fs, uint32_t addr, uint32_t size, uint8_t *dst);
@@ -609,6 +609,75 @@ TEST_CASE("multiple tasks can use same volume", "[spiffs]")
     test_teardown();
 }
 
+TEST_CASE("cache size, gc threshold and statistics", "[spiffs]")
+{
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = "/spiffs",
+        .partition_label = spiffs_test_partition_label,
+        .max_files = 5,
+        .format_if_mount_failed = true,
+        .gc_threshold = 101
+    };
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_vfs_spiffs_register(&conf));
+
+    // Without cache_pages, the cache has max_files pages
+    conf.gc_threshold = 0;
+    TEST_ESP_OK(esp_vfs_spiffs_register(&conf));
+    esp_spiffs_stats_t stats;
+    TEST_ESP_OK(esp_spiffs_get_stats(spiffs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(5, stats.cache_pages);
+    test_teardown();
+
+    // The cache is limited to 32 pages
+    conf.cache_pages = 64;
+    conf.gc_threshold = 25;
+    TEST_ESP_OK(esp_vfs_spiffs_register(&conf));
+    TEST_ESP_OK(esp_spiffs_get_stats(spiffs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(32, stats.cache_pages);
+
+    TEST_ESP_OK(esp_spiffs_reset_stats(spiffs_test_partition_label));
+    TEST_ESP_OK(esp_spiffs_get_stats(spiffs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(0, stats.flash_reads);
+    TEST_ASSERT_EQUAL(0, stats.flash_writes);
+    TEST_ASSERT_EQUAL(0, stats.flash_erases);
+    TEST_ASSERT_EQUAL(0, stats.cache_hits);
+    TEST_ASSERT_EQUAL(0, stats.cache_misses);
+    TEST_ASSERT_EQUAL(0, stats.gc_runs);
+
+    // Files which are closed and removed are checked against gc_threshold
+    char text[1024];
+    memset(text, 'a', sizeof(text) - 1);
+    text[sizeof(text) - 1] = 0;
+    char name[32];
+    for (int i = 0; i < 16; i++) {
+        snprintf(name, sizeof(name), "/spiffs/gc%d.txt", i);
+        test_spiffs_create_file_with_text(name, text);
+    }
+    for (int i = 0; i < 16; i++) {
+        snprintf(name, sizeof(name), "/spiffs/gc%d.txt", i);
+        TEST_ASSERT_EQUAL(0, unlink(name));
+    }
+    TEST_ESP_OK(esp_spiffs_get_stats(spiffs_test_partition_label, &stats));
+    printf("reads: %d, writes: %d, erases: %d, cache hits: %d, misses: %d, gc runs: %d\n",
+           stats.flash_reads, stats.flash_writes, stats.flash_erases,
+           stats.cache_hits, stats.cache_misses, stats.gc_runs);
+    TEST_ASSERT(stats.flash_reads > 0);
+    TEST_ASSERT(stats.flash_writes > 0);
+#if CONFIG_SPIFFS_CACHE_STATS
+    TEST_ASSERT(stats.cache_hits > 0);
+#endif
+
+    size_t total = 0, used = 0;
+    TEST_ESP_OK(esp_spiffs_info(spiffs_test_partition_label, &total, &used));
+    TEST_ESP_OK(esp_spiffs_gc(spiffs_test_partition_label, total / 4));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, esp_spiffs_gc(spiffs_test_partition_label, total * 2));
+    test_teardown();
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_spiffs_get_stats(spiffs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_spiffs_reset_stats(spiffs_test_partition_label));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_spiffs_gc(spiffs_test_partition_label, 0));
+}
+
 #ifdef CONFIG_SPIFFS_USE_MTIME
 TEST_CASE("mtime is updated when file is opened", "[spiffs]")
 {
@@ -7,6 +7,8 @@
 #define CONFIG_SPIFFS_GC_MAX_RUNS 10
 #define CONFIG_SPIFFS_CACHE_WR 1
 #define CONFIG_SPIFFS_CACHE 1
+#define CONFIG_SPIFFS_CACHE_STATS 1
+#define CONFIG_SPIFFS_GC_STATS 1
 #define CONFIG_SPIFFS_META_LENGTH 4
 #define CONFIG_SPIFFS_USE_MAGIC 1
 #define CONFIG_SPIFFS_PAGE_CHECK 1
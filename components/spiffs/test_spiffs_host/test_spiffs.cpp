@@ -6,10 +6,12 @@
 #include "spiffs.h"
 #include "spiffs_nucleus.h"
 #include "spiffs_api.h"
+#include "SpiFlash.h"
 
 #include "catch.hpp"
 
 extern "C" void init_spi_flash(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin);
+extern SpiFlash spiflash;
 
 TEST_CASE("format disk, open file, write and read file", "[spiffs]")
 {
@@ -23,6 +25,7 @@ TEST_CASE("format disk, open file, write and read file", "[spiffs]")
     // Configure objects needed by SPIFFS
     esp_spiffs_t esp_user_data;
     esp_user_data.partition = partition;
+    esp_user_data.lock = xSemaphoreCreateMutex();
     fs.user_data = (void*)&esp_user_data;
 
     cfg.hal_erase_f = spiffs_api_erase;
@@ -101,7 +104,177 @@ TEST_CASE("format disk, open file, write and read file", "[spiffs]")
 
     // Unmount
     SPIFFS_unmount(&fs);
+    vSemaphoreDelete(esp_user_data.lock);
 
     free(read);
     free(data);
 }
+
+typedef struct {
+    spiffs fs;
+    spiffs_config cfg;
+    esp_spiffs_t user_data;
+    uint8_t* work;
+    uint8_t* fds;
+    uint8_t* cache;
+} test_spiffs_t;
+
+static const uint32_t s_max_files = 5;
+
+// Format the storage partition on a new flash, and mount it with a cache of the given number of pages
+static void test_mount(test_spiffs_t* t, size_t cache_pages)
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    memset(t, 0, sizeof(*t));
+    t->user_data.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, "storage");
+    REQUIRE(t->user_data.partition != NULL);
+    t->user_data.lock = xSemaphoreCreateMutex();
+    t->user_data.cache_pages = cache_pages;
+    t->fs.user_data = (void*)&t->user_data;
+
+    t->cfg.hal_erase_f = spiffs_api_erase;
+    t->cfg.hal_read_f = spiffs_api_read;
+    t->cfg.hal_write_f = spiffs_api_write;
+    t->cfg.log_block_size = CONFIG_WL_SECTOR_SIZE;
+    t->cfg.log_page_size = CONFIG_SPIFFS_PAGE_SIZE;
+    t->cfg.phys_addr = 0;
+    t->cfg.phys_erase_block = CONFIG_WL_SECTOR_SIZE;
+    t->cfg.phys_size = t->user_data.partition->size;
+
+    uint32_t fds_sz = s_max_files * sizeof(spiffs_fd);
+    uint32_t work_sz = t->cfg.log_page_size * 2;
+    uint32_t cache_sz = sizeof(spiffs_cache) + cache_pages * (sizeof(spiffs_cache_page) + t->cfg.log_page_size);
+    t->work = (uint8_t*) malloc(work_sz);
+    t->fds = (uint8_t*) malloc(fds_sz);
+    t->cache = (uint8_t*) malloc(cache_sz);
+
+    REQUIRE(SPIFFS_mount(&t->fs, &t->cfg, t->work, t->fds, fds_sz, t->cache, cache_sz, spiffs_api_check) == SPIFFS_ERR_NOT_A_FS);
+    REQUIRE(SPIFFS_format(&t->fs) >= SPIFFS_OK);
+    REQUIRE(SPIFFS_mount(&t->fs, &t->cfg, t->work, t->fds, fds_sz, t->cache, cache_sz, spiffs_api_check) >= SPIFFS_OK);
+}
+
+static void test_unmount(test_spiffs_t* t)
+{
+    SPIFFS_unmount(&t->fs);
+    vSemaphoreDelete(t->user_data.lock);
+    free(t->work);
+    free(t->fds);
+    free(t->cache);
+}
+
+static void test_reset_stats(test_spiffs_t* t)
+{
+    spiflash.reset_stats();
+    t->fs.cache_hits = 0;
+    t->fs.cache_misses = 0;
+    t->fs.stats_gc_runs = 0;
+    t->user_data.flash_reads = 0;
+    t->user_data.flash_writes = 0;
+    t->user_data.flash_erases = 0;
+}
+
+static void test_write_file(test_spiffs_t* t, const char* name, const uint8_t* data, size_t size)
+{
+    spiffs_file file = SPIFFS_open(&t->fs, name, SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_RDWR, 0);
+    REQUIRE(file >= SPIFFS_OK);
+    REQUIRE(SPIFFS_write(&t->fs, file, (void*)data, size) == (s32_t) size);
+    REQUIRE(SPIFFS_close(&t->fs, file) >= SPIFFS_OK);
+}
+
+TEST_CASE("open and read throughput against file count and cache size", "[spiffs][benchmark][.]")
+{
+    const size_t cache_pages[] = {s_max_files, 32};
+    const int file_counts[] = {10, 100, 500};
+    const int opens = 100;
+    const size_t file_size = 64;
+    uint8_t data[file_size];
+    char name[SPIFFS_OBJ_NAME_LEN];
+
+    printf("cache pages | files | create: flash ms/file | open+read: flash ms/file, flash reads/file, cache hits\n");
+    for (size_t pages : cache_pages) {
+        for (int files : file_counts) {
+            test_spiffs_t t;
+            test_mount(&t, pages);
+            memset(data, 0x5a, sizeof(data));
+
+            test_reset_stats(&t);
+            for (int i = 0; i < files; i++) {
+                snprintf(name, sizeof(name), "dir/file%d", i);
+                test_write_file(&t, name, data, file_size);
+            }
+            double create_ms = spiflash.get_time() / 1000.0 / files;
+
+            // Open files in an order which doesn't follow their order in flash
+            test_reset_stats(&t);
+            for (int i = 0; i < opens; i++) {
+                snprintf(name, sizeof(name), "dir/file%d", (i * 7919) % files);
+                spiffs_file file = SPIFFS_open(&t.fs, name, SPIFFS_O_RDONLY, 0);
+                REQUIRE(file >= SPIFFS_OK);
+                REQUIRE(SPIFFS_read(&t.fs, file, data, file_size) == (s32_t) file_size);
+                REQUIRE(SPIFFS_close(&t.fs, file) >= SPIFFS_OK);
+            }
+            double open_ms = spiflash.get_time() / 1000.0 / opens;
+            uint32_t accesses = t.fs.cache_hits + t.fs.cache_misses;
+            printf("%11d | %5d | %21.2f | %18.2f, %16d, %3d%%\n", (int) pages, files, create_ms,
+                   open_ms, (int) (t.user_data.flash_reads / opens),
+                   accesses ? (int) (t.fs.cache_hits * 100 / accesses) : 0);
+
+            test_unmount(&t);
+        }
+    }
+}
+
+TEST_CASE("write and gc throughput against fill level", "[spiffs][benchmark][.]")
+{
+    const int fill_levels[] = {0, 50, 90};
+    const size_t file_size = 16 * 1024;
+    const int rewrites = 50;
+    uint8_t* data = (uint8_t*) malloc(file_size);
+    memset(data, 0xa5, file_size);
+
+    printf("fill %% | gc after close | write: kB/s of flash time, worst write ms | gc runs | erases\n");
+    for (int fill : fill_levels) {
+        for (int gc_after_close = 0; gc_after_close < 2; gc_after_close++) {
+            test_spiffs_t t;
+            test_mount(&t, s_max_files);
+
+            // Fill the partition with files which stay
+            u32_t total, used;
+            REQUIRE(SPIFFS_info(&t.fs, &total, &used) >= SPIFFS_OK);
+            char name[SPIFFS_OBJ_NAME_LEN];
+            for (int i = 0; used + file_size < (uint64_t) total * fill / 100; i++) {
+                snprintf(name, sizeof(name), "fill%d", i);
+                test_write_file(&t, name, data, file_size);
+                REQUIRE(SPIFFS_info(&t.fs, &total, &used) >= SPIFFS_OK);
+            }
+
+            // Keep rewriting a few files, which leaves deleted pages for the gc. With gc after close,
+            // 10% of the partition is kept erased the same way as esp_vfs_spiffs_conf_t::gc_threshold does.
+            test_reset_stats(&t);
+            uint64_t worst_us = 0;
+            for (int i = 0; i < rewrites; i++) {
+                snprintf(name, sizeof(name), "log%d", i % 3);
+                uint64_t start_us = spiflash.get_time();
+                test_write_file(&t, name, data, file_size);
+                uint64_t write_us = spiflash.get_time() - start_us;
+                if (write_us > worst_us) {
+                    worst_us = write_us;
+                }
+                if (gc_after_close) {
+                    REQUIRE(SPIFFS_info(&t.fs, &total, &used) >= SPIFFS_OK);
+                    if (SPIFFS_gc(&t.fs, total / 10) != SPIFFS_OK) {
+                        SPIFFS_clearerr(&t.fs);
+                    }
+                }
+            }
+            double total_ms = spiflash.get_time() / 1000.0;
+            printf("%6d | %14s | %28.1f, %15.1f | %7d | %6d\n", fill, gc_after_close ? "yes" : "no",
+                   (double) rewrites * file_size / 1024 / (total_ms / 1000), worst_us / 1000.0,
+                   (int) t.fs.stats_gc_runs, (int) t.user_data.flash_erases);
+
+            test_unmount(&t);
+        }
+    }
+    free(data);
+}
@@ -62,6 +62,11 @@ size_t Partition::sector_size()
     return SPI_FLASH_SEC_SIZE;
 }
 
+bool Partition::is_encrypted()
+{
+    return this->partition->encrypted;
+}
+
 Partition::~Partition()
 {
 
@@ -0,0 +1,230 @@
+// Copyright 2015-2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "WL_Cache.h"
+
+static const char *TAG = "wl_cache";
+
+#define WL_CACHE_RESULT_CHECK(result) \
+    if (result != ESP_OK) { \
+        ESP_LOGE(TAG,"%s(%d): result = 0x%08x", __FUNCTION__, __LINE__, result); \
+        return (result); \
+    }
+
+WL_Cache::WL_Cache()
+{
+}
+
+WL_Cache::~WL_Cache()
+{
+    if (this->lines != NULL) {
+        for (size_t i = 0; i < this->line_count; i++) {
+            free(this->lines[i].data);
+        }
+    }
+    free(this->lines);
+}
+
+esp_err_t WL_Cache::config(Flash_Access *flash_drv, size_t line_size, size_t line_count)
+{
+    ESP_LOGV(TAG, "%s line_size=0x%08x, line_count=%i", __func__, (uint32_t) line_size, (int) line_count);
+    if ((flash_drv == NULL) || (line_size == 0) || (line_count == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (((line_size % flash_drv->sector_size()) != 0) || ((flash_drv->chip_size() % line_size) != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    this->flash_drv = flash_drv;
+    this->line_size = line_size;
+
+    this->lines = (wl_cache_line_t *)calloc(line_count, sizeof(wl_cache_line_t));
+    if (this->lines == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    this->line_count = line_count;
+    for (size_t i = 0; i < line_count; i++) {
+        this->lines[i].data = (uint8_t *)malloc(line_size);
+        if (this->lines[i].data == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+size_t WL_Cache::chip_size()
+{
+    return this->flash_drv->chip_size();
+}
+
+size_t WL_Cache::sector_size()
+{
+    return this->flash_drv->sector_size();
+}
+
+WL_Cache::wl_cache_line_t *WL_Cache::findLine(size_t addr)
+{
+    for (size_t i = 0; i < this->line_count; i++) {
+        if (this->lines[i].valid && this->lines[i].addr == addr) {
+            return &this->lines[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t WL_Cache::getLine(size_t addr, bool load, wl_cache_line_t **out_line)
+{
+    esp_err_t result = ESP_OK;
+    wl_cache_line_t *line = this->findLine(addr);
+    if (line == NULL) {
+        // take a free line, or the least recently used one
+        line = &this->lines[0];
+        for (size_t i = 0; i < this->line_count; i++) {
+            if (!this->lines[i].valid) {
+                line = &this->lines[i];
+                break;
+            }
+            if (this->lines[i].last_access < line->last_access) {
+                line = &this->lines[i];
+            }
+        }
+        result = this->flushLine(line);
+        WL_CACHE_RESULT_CHECK(result);
+        line->valid = false;
+        if (load) {
+            result = this->flash_drv->read(addr, line->data, this->line_size);
+            WL_CACHE_RESULT_CHECK(result);
+        }
+        line->addr = addr;
+        line->valid = true;
+    }
+    line->last_access = ++this->access_count;
+    *out_line = line;
+    return ESP_OK;
+}
+
+esp_err_t WL_Cache::flushLine(wl_cache_line_t *line)
+{
+    esp_err_t result = ESP_OK;
+    if (!line->valid || !line->dirty) {
+        return ESP_OK;
+    }
+    ESP_LOGV(TAG, "%s - addr= 0x%08x", __func__, (uint32_t) line->addr);
+    // the whole sector is held in RAM, so it is written without reading anything back
+    result = this->flash_drv->write_sectors(line->addr / this->sector_size(), line->data, this->line_size / this->sector_size());
+    WL_CACHE_RESULT_CHECK(result);
+    line->dirty = false;
+    return ESP_OK;
+}
+
+esp_err_t WL_Cache::erase_sector(size_t sector)
+{
+    return this->erase_range(sector * this->sector_size(), this->sector_size());
+}
+
+esp_err_t WL_Cache::erase_range(size_t start_address, size_t size)
+{
+    esp_err_t result = ESP_OK;
+    if (((start_address % this->sector_size()) != 0) || ((size % this->sector_size()) != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGD(TAG, "%s - start_address= 0x%08x, size= 0x%08x", __func__, (uint32_t) start_address, (uint32_t) size);
+    while (size > 0) {
+        size_t line_addr = start_address - start_address % this->line_size;
+        size_t offset = start_address - line_addr;
+        size_t count = this->line_size - offset;
+        if (count > size) {
+            count = size;
+        }
+        wl_cache_line_t *line;
+        // a line which is erased completely doesn't have to be read first
+        result = this->getLine(line_addr, count != this->line_size, &line);
+        WL_CACHE_RESULT_CHECK(result);
+        memset(&line->data[offset], 0xff, count);
+        line->dirty = true;
+        start_address += count;
+        size -= count;
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Cache::write(size_t dest_addr, const void *src, size_t size)
+{
+    esp_err_t result = ESP_OK;
+    ESP_LOGD(TAG, "%s - dest_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) dest_addr, (uint32_t) size);
+    const uint8_t *src_data = (const uint8_t *)src;
+    while (size > 0) {
+        size_t line_addr = dest_addr - dest_addr % this->line_size;
+        size_t offset = dest_addr - line_addr;
+        size_t count = this->line_size - offset;
+        if (count > size) {
+            count = size;
+        }
+        wl_cache_line_t *line;
+        result = this->getLine(line_addr, true, &line);
+        WL_CACHE_RESULT_CHECK(result);
+        // same as in flash, a write can only clear bits
+        for (size_t i = 0; i < count; i++) {
+            line->data[offset + i] &= src_data[i];
+        }
+        line->dirty = true;
+        dest_addr += count;
+        src_data += count;
+        size -= count;
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Cache::read(size_t src_addr, void *dest, size_t size)
+{
+    esp_err_t result = ESP_OK;
+    ESP_LOGD(TAG, "%s - src_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) src_addr, (uint32_t) size);
+    uint8_t *dest_data = (uint8_t *)dest;
+    while (size > 0) {
+        size_t line_addr = src_addr - src_addr % this->line_size;
+        size_t offset = src_addr - line_addr;
+        size_t count = this->line_size - offset;
+        if (count > size) {
+            count = size;
+        }
+        // sectors which are only read are not put into the cache
+        wl_cache_line_t *line = this->findLine(line_addr);
+        if (line != NULL) {
+            memcpy(dest_data, &line->data[offset], count);
+        } else {
+            result = this->flash_drv->read(src_addr, dest_data, count);
+            WL_CACHE_RESULT_CHECK(result);
+        }
+        src_addr += count;
+        dest_data += count;
+        size -= count;
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Cache::flush()
+{
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < this->line_count; i++) {
+        result = this->flushLine(&this->lines[i]);
+        WL_CACHE_RESULT_CHECK(result);
+    }
+    return ESP_OK;
+}
+
+Flash_Access *WL_Cache::get_drv()
+{
+    return this->flash_drv;
+}
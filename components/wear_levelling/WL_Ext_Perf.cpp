@@ -13,6 +13,7 @@
 
 #include "WL_Ext_Perf.h"
 #include <stdlib.h>
+#include <string.h>
 #include "esp_log.h"
 
 static const char *TAG = "wl_ext_perf";
@@ -154,11 +155,8 @@ esp_err_t WL_Ext_Perf::erase_range(size_t start_address, size_t size)
     ESP_LOGV(TAG, "%s rest_check_start = %i, pre_check_count=%i, rest_check_count=%i, post_check_count=%i\n", __func__, rest_check_start, pre_check_count, rest_check_count, post_check_count);
     if (rest_check_count > 0) {
         rest_check_count = rest_check_count / this->size_factor;
-        size_t start_sector = rest_check_start / this->flash_sector_size;
-        for (size_t i = 0; i < rest_check_count; i++) {
-            result = WL_Flash::erase_sector(start_sector + i);
-            WL_EXT_RESULT_CHECK(result);
-        }
+        result = WL_Flash::erase_range(rest_check_start, rest_check_count * this->flash_sector_size);
+        WL_EXT_RESULT_CHECK(result);
     }
     if (post_check_count != 0) {
         result = this->erase_sector_fit(post_check_start, post_check_count);
@@ -166,3 +164,58 @@ esp_err_t WL_Ext_Perf::erase_range(size_t start_address, size_t size)
     }
     return ESP_OK;
 }
+
+esp_err_t WL_Ext_Perf::write_sectors(size_t sector, const void *src, size_t count)
+{
+    esp_err_t result = ESP_OK;
+    ESP_LOGV(TAG, "%s begin, sector = 0x%08x, count = %i", __func__, sector, count);
+    size_t sectors = this->chip_size() / this->fat_sector_size;
+    if ((count > sectors) || (sector > sectors - count)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Every flash device sector is read once. If the new data can't be programmed over the old one
+    // (always on an encrypted partition), it is merged with the rest of the old data in sector_buffer,
+    // and the sector is erased and written once.
+    const uint8_t *src_data = (const uint8_t *)src;
+    uint8_t *buffer = (uint8_t *)this->sector_buffer;
+    size_t addr = sector * this->fat_sector_size;
+    size_t size = count * this->fat_sector_size;
+    while (size > 0) {
+        size_t flash_addr = addr - addr % this->flash_sector_size;
+        size_t offset = addr - flash_addr;
+        size_t fit_size = this->flash_sector_size - offset;
+        if (fit_size > size) {
+            fit_size = size;
+        }
+        result = this->read(flash_addr, buffer, this->flash_sector_size);
+        WL_EXT_RESULT_CHECK(result);
+        if (!this->flash_drv->is_encrypted() && canProgram(&buffer[offset], src_data, fit_size)) {
+            result = this->write(addr, src_data, fit_size);
+            WL_EXT_RESULT_CHECK(result);
+        } else if (fit_size == this->flash_sector_size) {
+            result = WL_Flash::erase_sector(flash_addr / this->flash_sector_size);
+            WL_EXT_RESULT_CHECK(result);
+            result = this->write(addr, src_data, fit_size);
+            WL_EXT_RESULT_CHECK(result);
+        } else {
+            memcpy(&buffer[offset], src_data, fit_size);
+            result = this->write_sector_fit(flash_addr / this->flash_sector_size);
+            WL_EXT_RESULT_CHECK(result);
+        }
+        addr += fit_size;
+        src_data += fit_size;
+        size -= fit_size;
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Ext_Perf::write_sector_fit(uint32_t flash_sector)
+{
+    esp_err_t result = ESP_OK;
+    ESP_LOGV(TAG, "%s flash_sector = 0x%08x", __func__, flash_sector);
+    result = WL_Flash::erase_sector(flash_sector);
+    WL_EXT_RESULT_CHECK(result);
+    result = this->write(flash_sector * this->flash_sector_size, this->sector_buffer, this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    return ESP_OK;
+}
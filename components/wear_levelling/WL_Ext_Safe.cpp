@@ -159,3 +159,35 @@ esp_err_t WL_Ext_Safe::erase_sector_fit(uint32_t start_sector, uint32_t count)
 
     return ESP_OK;
 }
+
+esp_err_t WL_Ext_Safe::write_sector_fit(uint32_t flash_sector)
+{
+    esp_err_t result = ESP_OK;
+    ESP_LOGV(TAG, "%s flash_sector=0x%08x", __func__, flash_sector);
+
+    // sector_buffer holds the complete new contents of the sector, so the transaction
+    // restores all of it (count = 0)
+    result = WL_Flash::erase_sector(this->dump_addr / this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    result = WL_Flash::write(this->dump_addr, this->sector_buffer, this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+
+    WL_Ext_Safe_State state;
+    state.erase_begin = WL_EXT_SAFE_OK;
+    state.local_addr_base = flash_sector;
+    state.local_addr_shift = 0;
+    state.count = 0;
+
+    result = WL_Flash::erase_sector(this->state_addr / this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    result = WL_Flash::write(this->state_addr + 0, &state, sizeof(WL_Ext_Safe_State));
+    WL_EXT_RESULT_CHECK(result);
+
+    result = WL_Ext_Perf::write_sector_fit(flash_sector);
+    WL_EXT_RESULT_CHECK(result);
+
+    result = WL_Flash::erase_sector(this->state_addr / this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+
+    return ESP_OK;
+}
@@ -25,6 +25,28 @@ static const char *TAG = "wl_flash";
 #define WL_CFG_CRC_CONST UINT32_MAX
 #endif // WL_CFG_CRC_CONST 
 
+// With deferred moves, a page is moved synchronously once this many times max_count sectors
+// were erased without maintenance() completing the pending move
+#ifndef WL_DEFERRED_MOVE_LIMIT
+#define WL_DEFERRED_MOVE_LIMIT 4
+#endif // WL_DEFERRED_MOVE_LIMIT
+
+// With the hot/cold policy, pages are moved in turn only every WL_COLD_MOVE_FACTOR times max_count
+// erased sectors. A page is moved out of turn, to the dummy page, when WL_HOT_PAGE_FACTOR times
+// max_count sectors were erased in it since it was moved last time, and WL_HOT_PAGE_RATIO times
+// more than in an average page, if the dummy page was erased less than the average page.
+#ifndef WL_COLD_MOVE_FACTOR
+#define WL_COLD_MOVE_FACTOR 4
+#endif // WL_COLD_MOVE_FACTOR
+
+#ifndef WL_HOT_PAGE_FACTOR
+#define WL_HOT_PAGE_FACTOR 4
+#endif // WL_HOT_PAGE_FACTOR
+
+#ifndef WL_HOT_PAGE_RATIO
+#define WL_HOT_PAGE_RATIO 8
+#endif // WL_HOT_PAGE_RATIO
+
 #define WL_RESULT_CHECK(result) \
     if (result != ESP_OK) { \
         ESP_LOGE(TAG,"%s(%d): result = 0x%08x", __FUNCTION__, __LINE__, result); \
@@ -43,6 +65,9 @@ WL_Flash::WL_Flash()
 WL_Flash::~WL_Flash()
 {
     free(this->temp_buff);
+    free(this->page_map);
+    free(this->pos_stats);
+    free(this->page_erases);
 }
 
 esp_err_t WL_Flash::config(wl_config_t *cfg, Flash_Access *flash_drv)
@@ -125,6 +150,13 @@ esp_err_t WL_Flash::init()
     }
     // If flow will be interrupted by error, then this flag will be false
     this->initialized = false;
+    this->move_step = WL_MOVE_IDLE;
+    free(this->page_map);
+    this->page_map = NULL;
+    free(this->pos_stats);
+    this->pos_stats = NULL;
+    free(this->page_erases);
+    this->page_erases = NULL;
     // Init states if it is first time...
     this->flash_drv->read(this->addr_state1, &this->state, sizeof(wl_state_t));
     wl_state_t sa_copy;
@@ -150,7 +182,7 @@ esp_err_t WL_Flash::init()
     ESP_LOGD(TAG, "%s starts: crc1= 0x%08x, crc2 = 0x%08x, this->state.crc= 0x%08x, state_copy->crc= 0x%08x, version=%i, read_version=%i", __func__, crc1, crc2, this->state.crc, state_copy->crc, this->cfg.version, this->state.version);
     if ((crc1 == this->state.crc) && (crc2 == state_copy->crc)) {
         // The state is OK. Check the ID
-        if (this->state.version != this->cfg.version) {
+        if (!this->versionSupported(this->state.version)) {
             result = this->initSections();
             WL_RESULT_CHECK(result);
             result = this->recoverPos();
@@ -165,13 +197,15 @@ esp_err_t WL_Flash::init()
                     bool pos_bits;
                     result = this->flash_drv->read(this->addr_state1 + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
                     WL_RESULT_CHECK(result);
-                    pos_bits = this->OkBuffSet(i);
+                    pos_bits = this->OkBuffSet(i) || this->RelocBuffSet(i, NULL);
                     if (pos_bits == true) {
                         //this->fillOkBuff(i);
                         result = this->flash_drv->write(this->addr_state2 + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
                         WL_RESULT_CHECK(result);
                     }
                 }
+                result = this->copyPageMap(this->addr_state1, this->addr_state2);
+                WL_RESULT_CHECK(result);
             }
             ESP_LOGD(TAG, "%s: crc1=0x%08x, crc2 = 0x%08x, result= 0x%08x", __func__, crc1, crc2, (uint32_t)result);
             result = this->recoverPos();
@@ -199,14 +233,18 @@ esp_err_t WL_Flash::init()
                 bool pos_bits;
                 result = this->flash_drv->read(this->addr_state1 + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
                 WL_RESULT_CHECK(result);
-                pos_bits = this->OkBuffSet(i);
+                pos_bits = this->OkBuffSet(i) || this->RelocBuffSet(i, NULL);
                 if (pos_bits == true) {
                     result = this->flash_drv->write(this->addr_state2 + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
                     WL_RESULT_CHECK(result);
                 }
             }
+            result = this->copyPageMap(this->addr_state1, this->addr_state2);
+            WL_RESULT_CHECK(result);
             result = this->flash_drv->read(this->addr_state2, &this->state, sizeof(wl_state_t));
             WL_RESULT_CHECK(result);
+            result = this->readPageMap(this->addr_state2, this->state.pos);
+            WL_RESULT_CHECK(result);
         } else { // we have to recover state 1
             result = this->flash_drv->erase_range(this->addr_state1, this->state_size);
             WL_RESULT_CHECK(result);
@@ -217,19 +255,23 @@ esp_err_t WL_Flash::init()
                 result = this->flash_drv->read(this->addr_state2 + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
 
                 WL_RESULT_CHECK(result);
-                pos_bits = this->OkBuffSet(i);
+                pos_bits = this->OkBuffSet(i) || this->RelocBuffSet(i, NULL);
                 if (pos_bits == true) {
                     result = this->flash_drv->write(this->addr_state1 + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
                     WL_RESULT_CHECK(result);
                 }
             }
+            result = this->copyPageMap(this->addr_state2, this->addr_state1);
+            WL_RESULT_CHECK(result);
             result = this->flash_drv->read(this->addr_state1, &this->state, sizeof(wl_state_t));
             WL_RESULT_CHECK(result);
             this->state.pos = this->state.max_pos - 1;
+            result = this->readPageMap(this->addr_state1, this->state.pos);
+            WL_RESULT_CHECK(result);
         }
         // done. We have recovered the state
         // If we have a new configuration, we will overwrite it
-        if (this->state.version != this->cfg.version) {
+        if (!this->versionSupported(this->state.version)) {
             result = this->initSections();
             WL_RESULT_CHECK(result);
         }
@@ -253,7 +295,7 @@ esp_err_t WL_Flash::recoverPos()
         bool pos_bits;
         position = i;
         result = this->flash_drv->read(this->addr_state1 + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
-        pos_bits = this->OkBuffSet(i);
+        pos_bits = this->OkBuffSet(i) || this->RelocBuffSet(i, NULL);
         WL_RESULT_CHECK(result);
         ESP_LOGV(TAG, "%s - check pos: result=0x%08x, position= %i, pos_bits= 0x%08x", __func__, (uint32_t)result, (uint32_t)position, (uint32_t)pos_bits);
         if (pos_bits == false) {
@@ -266,6 +308,8 @@ esp_err_t WL_Flash::recoverPos()
         this->state.pos--;
     }
     ESP_LOGD(TAG, "%s - this->state.pos= 0x%08x, position= 0x%08x, result= 0x%08x, max_pos= 0x%08x", __func__, (uint32_t)this->state.pos, (uint32_t)position, (uint32_t)result, (uint32_t)this->state.max_pos);
+    result = this->readPageMap(this->addr_state1, this->state.pos);
+    WL_RESULT_CHECK(result);
     ESP_LOGV(TAG, "%s done", __func__);
     return result;
 }
@@ -322,6 +366,32 @@ esp_err_t WL_Flash::updateVersion()
     return result;
 }
 
+esp_err_t WL_Flash::updateV2_V3()
+{
+    esp_err_t result = ESP_OK;
+    // Pages may be moved out of turn only when the state has the version V2 code does not accept.
+    // Both copies are rewritten with the page map and the position records of the current round,
+    // the header is written last, so a power-off leaves at least one valid copy.
+    ESP_LOGI(TAG, "%s Update from V2 to V3, pos=%i", __func__, (uint32_t)this->state.pos);
+    this->state.version = WL_STATE_VERSION_PAGE_MAP;
+    this->state.crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&this->state, WL_STATE_CRC_LEN_V2);
+    size_t state_addr[2] = {this->addr_state1, this->addr_state2};
+    for (size_t n = 0; n < 2; n++) {
+        result = this->flash_drv->erase_range(state_addr[n], this->state_size);
+        WL_RESULT_CHECK(result);
+        result = this->writePageMap(state_addr[n]);
+        WL_RESULT_CHECK(result);
+        for (uint32_t i = 0 ; i < this->state.pos; i++) {
+            this->fillOkBuff(i);
+            result = this->flash_drv->write(state_addr[n] + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
+            WL_RESULT_CHECK(result);
+        }
+        result = this->flash_drv->write(state_addr[n], &this->state, sizeof(wl_state_t));
+        WL_RESULT_CHECK(result);
+    }
+    return result;
+}
+
 esp_err_t WL_Flash::updateV1_V2()
 {
     esp_err_t result = ESP_OK;
@@ -410,6 +480,37 @@ void WL_Flash::fillOkBuff(int n)
     }
 }
 
+void WL_Flash::fillRelocBuff(int n, uint32_t src_pos)
+{
+    // Position record of a page moved out of turn: the first half is the same as
+    // in fillOkBuff, the second half holds the position the page was moved from
+    uint32_t *buff = (uint32_t *)this->temp_buff;
+    this->fillOkBuff(n);
+    buff[2] = src_pos;
+    buff[3] = this->state.device_id + n * 4 + 3 + src_pos;
+    buff[3] = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&buff[2], 2 * sizeof(uint32_t));
+}
+
+bool WL_Flash::RelocBuffSet(int n, uint32_t *src_pos)
+{
+    uint32_t *data_buff = (uint32_t *)this->temp_buff;
+    for (int i = 0 ; i < 2 ; i++) {
+        uint32_t data = this->state.device_id + n * 4 + i;
+        uint32_t crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&data, sizeof(uint32_t));
+        if (crc != data_buff[i]) {
+            return false;
+        }
+    }
+    uint32_t check[2] = {data_buff[2], this->state.device_id + n * 4 + 3 + data_buff[2]};
+    if ((crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)check, sizeof(check)) != data_buff[3]) || (data_buff[2] >= this->state.max_pos)) {
+        return false;
+    }
+    if (src_pos != NULL) {
+        *src_pos = data_buff[2];
+    }
+    return true;
+}
+
 bool WL_Flash::OkBuffSet(int n)
 {
     bool result = true;
@@ -429,60 +530,129 @@ esp_err_t WL_Flash::updateWL()
 {
     esp_err_t result = ESP_OK;
     this->state.access_count++;
-    if (this->state.access_count < this->state.max_count) {
+    if (!this->moveDue()) {
+        return result;
+    }
+    if (this->move_step == WL_MOVE_IDLE) {
+        this->move_step = WL_MOVE_ERASE;
+    }
+    // With deferred moves the page is moved by maintenance(), unless it falls too far behind
+    if (this->deferred_moves && (this->state.access_count < this->moveThreshold() * WL_DEFERRED_MOVE_LIMIT)) {
         return result;
     }
     // Here we have to move the block and increase the state
-    this->state.access_count = 0;
     ESP_LOGV(TAG, "%s - access_count= 0x%08x, pos= 0x%08x", __func__, this->state.access_count, this->state.pos);
-    // copy data to dummy block
-    size_t data_addr = this->state.pos + 1; // next block, [pos+1] copy to [pos]
-    if (data_addr >= this->state.max_pos) {
-        data_addr = 0;
-    }
-    data_addr = this->cfg.start_addr + data_addr * this->cfg.page_size;
-    this->dummy_addr = this->cfg.start_addr + this->state.pos * this->cfg.page_size;
-    result = this->flash_drv->erase_range(this->dummy_addr, this->cfg.page_size);
-    if (result != ESP_OK) {
-        ESP_LOGE(TAG, "%s - erase wl dummy sector result= 0x%08x", __func__, result);
-        this->state.access_count = this->state.max_count - 1; // we will update next time
-        return result;
+    while (this->move_step != WL_MOVE_IDLE) {
+        result = this->moveStep();
+        if (result != ESP_OK) {
+            this->move_step = WL_MOVE_IDLE;
+            this->state.access_count = this->moveThreshold() - 1; // we will update next time
+            return result;
+        }
     }
+    return result;
+}
 
-    size_t copy_count = this->cfg.page_size / this->cfg.temp_buff_size;
-    for (size_t i = 0; i < copy_count; i++) {
-        result = this->flash_drv->read(data_addr + i * this->cfg.temp_buff_size, this->temp_buff, this->cfg.temp_buff_size);
+esp_err_t WL_Flash::moveStep()
+{
+    esp_err_t result = ESP_OK;
+    // The dummy page is not mapped to any virtual address until the position bits are written,
+    // so a power-off before that point leaves the old mapping and data in place.
+    switch (this->move_step) {
+    case WL_MOVE_ERASE: {
+        // copy data to dummy block
+        size_t data_pos = this->state.pos + 1; // next block, [pos+1] copy to [pos]
+        if (data_pos >= this->state.max_pos) {
+            data_pos = 0;
+        }
+        // a hot page is copied instead, except by the last move of the round which updates the main state
+        this->move_relocate = false;
+        // and only once the main state has the version V2 code does not accept
+        if ((this->state.version == WL_STATE_VERSION_PAGE_MAP) && this->hotPageReady() && this->dummyPageCold()
+                && (data_pos != 0) && (this->hot_pos != data_pos)) {
+            data_pos = this->hot_pos;
+            this->move_relocate = true;
+        }
+        this->move_src_pos = data_pos;
+        this->countPageErases(this->mapPos(this->state.pos), this->cfg.page_size / this->cfg.sector_size);
+        this->move_src_addr = this->cfg.start_addr + this->mapPos(data_pos) * this->cfg.page_size;
+        this->dummy_addr = this->cfg.start_addr + this->mapPos(this->state.pos) * this->cfg.page_size;
+        result = this->flash_drv->erase_range(this->dummy_addr, this->cfg.page_size);
+        if (result != ESP_OK) {
+            ESP_LOGE(TAG, "%s - erase wl dummy sector result= 0x%08x", __func__, result);
+            return result;
+        }
+        this->move_offset = 0;
+        this->move_step = WL_MOVE_COPY;
+        break;
+    }
+    case WL_MOVE_COPY:
+        result = this->flash_drv->read(this->move_src_addr + this->move_offset, this->temp_buff, this->cfg.temp_buff_size);
         if (result != ESP_OK) {
             ESP_LOGE(TAG, "%s - not possible to read buffer, will try next time, result= 0x%08x", __func__, result);
-            this->state.access_count = this->state.max_count - 1; // we will update next time
             return result;
         }
-        result = this->flash_drv->write(this->dummy_addr + i * this->cfg.temp_buff_size, this->temp_buff, this->cfg.temp_buff_size);
+        result = this->flash_drv->write(this->dummy_addr + this->move_offset, this->temp_buff, this->cfg.temp_buff_size);
         if (result != ESP_OK) {
             ESP_LOGE(TAG, "%s - not possible to write buffer, will try next time, result= 0x%08x", __func__, result);
-            this->state.access_count = this->state.max_count - 1; // we will update next time
             return result;
         }
+        this->move_offset += this->cfg.temp_buff_size;
+        if (this->move_offset >= this->cfg.page_size) {
+            this->move_step = WL_MOVE_COMMIT;
+        }
+        break;
+    case WL_MOVE_COMMIT:
+        result = this->commitMove();
+        if (result != ESP_OK) {
+            return result;
+        }
+        this->move_step = WL_MOVE_IDLE;
+        break;
+    default:
+        break;
     }
+    return result;
+}
+
+esp_err_t WL_Flash::commitMove()
+{
+    esp_err_t result = ESP_OK;
     // done... block moved.
     // Here we will update structures...
     // Update bits and save to flash:
     uint32_t byte_pos = this->state.pos * this->cfg.wr_size;
-    this->fillOkBuff(this->state.pos);
+    if (this->move_relocate) {
+        this->fillRelocBuff(this->state.pos, this->move_src_pos);
+    } else {
+        this->fillOkBuff(this->state.pos);
+    }
     // write state to mem. We updating only affected bits
     result |= this->flash_drv->write(this->addr_state1 + sizeof(wl_state_t) + byte_pos, this->temp_buff, this->cfg.wr_size);
     if (result != ESP_OK) {
         ESP_LOGE(TAG, "%s - update position 1 result= 0x%08x", __func__, result);
-        this->state.access_count = this->state.max_count - 1; // we will update next time
         return result;
     }
-    this->fillOkBuff(this->state.pos);
     result |= this->flash_drv->write(this->addr_state2 + sizeof(wl_state_t) + byte_pos, this->temp_buff, this->cfg.wr_size);
     if (result != ESP_OK) {
         ESP_LOGE(TAG, "%s - update position 2 result= 0x%08x", __func__, result);
-        this->state.access_count = this->state.max_count - 1; // we will update next time
         return result;
     }
+    // accesses counted while a deferred move was pending go to the next one
+    size_t move_accesses = this->move_relocate ? this->state.max_count : this->moveThreshold();
+    if (this->state.access_count >= move_accesses) {
+        this->state.access_count -= move_accesses;
+    } else {
+        this->state.access_count = 0;
+    }
+
+    if (this->move_relocate) {
+        this->relocatePage(this->state.pos, this->move_src_pos);
+    } else if (this->pos_stats != NULL) {
+        // data of the next position is in a new page now, and the next position is the dummy
+        this->resetPosStat(this->state.pos);
+        this->resetPosStat(this->move_src_pos);
+    }
 
     this->state.pos++;
     if (this->state.pos >= this->state.max_pos) {
@@ -493,15 +663,7 @@ esp_err_t WL_Flash::updateWL()
             this->state.move_count = 0;
         }
         // write main state
-        this->state.crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&this->state, WL_STATE_CRC_LEN_V2);
-
-        result = this->flash_drv->erase_range(this->addr_state1, this->state_size);
-        WL_RESULT_CHECK(result);
-        result = this->flash_drv->write(this->addr_state1, &this->state, sizeof(wl_state_t));
-        WL_RESULT_CHECK(result);
-        result = this->flash_drv->erase_range(this->addr_state2, this->state_size);
-        WL_RESULT_CHECK(result);
-        result = this->flash_drv->write(this->addr_state2, &this->state, sizeof(wl_state_t));
+        result = this->writeMainState();
         WL_RESULT_CHECK(result);
         ESP_LOGD(TAG, "%s - move_count= 0x%08x, pos= 0x%08x, ", __func__, this->state.move_count, this->state.pos);
     }
@@ -514,7 +676,309 @@ esp_err_t WL_Flash::updateWL()
     return result;
 }
 
-size_t WL_Flash::calcAddr(size_t addr)
+esp_err_t WL_Flash::writeMainState()
+{
+    esp_err_t result = ESP_OK;
+    if (this->page_map != NULL) {
+        // V2 code would ignore the page map and the relocation records
+        this->state.version = WL_STATE_VERSION_PAGE_MAP;
+    }
+    this->state.crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&this->state, WL_STATE_CRC_LEN_V2);
+
+    // the page map is written first, a copy of the state with valid CRC always has its page map
+    result = this->flash_drv->erase_range(this->addr_state1, this->state_size);
+    WL_RESULT_CHECK(result);
+    result = this->writePageMap(this->addr_state1);
+    WL_RESULT_CHECK(result);
+    result = this->flash_drv->write(this->addr_state1, &this->state, sizeof(wl_state_t));
+    WL_RESULT_CHECK(result);
+    result = this->flash_drv->erase_range(this->addr_state2, this->state_size);
+    WL_RESULT_CHECK(result);
+    result = this->writePageMap(this->addr_state2);
+    WL_RESULT_CHECK(result);
+    result = this->flash_drv->write(this->addr_state2, &this->state, sizeof(wl_state_t));
+    WL_RESULT_CHECK(result);
+    return result;
+}
+
+void WL_Flash::relocatePage(size_t pos, size_t src_pos)
+{
+    // The page of src_pos was copied to the dummy page at pos. Data of the next position stays
+    // in its page, which becomes the page of pos, and the old page of src_pos becomes the dummy.
+    uint16_t dummy_page = this->page_map[pos];
+    this->page_map[pos] = this->page_map[pos + 1];
+    this->page_map[pos + 1] = this->page_map[src_pos];
+    this->page_map[src_pos] = dummy_page;
+    if (this->pos_stats != NULL) {
+        this->pos_stats[pos] = this->pos_stats[pos + 1];
+        this->resetPosStat(pos + 1);
+        this->resetPosStat(src_pos);
+    }
+}
+
+bool WL_Flash::versionSupported(uint32_t version)
+{
+    // a state with the page map is read by the same configuration
+    return (version == this->cfg.version) || ((this->cfg.version == 2) && (version == WL_STATE_VERSION_PAGE_MAP));
+}
+
+size_t WL_Flash::moveThreshold()
+{
+    if (this->pos_stats != NULL) {
+        return this->state.max_count * WL_COLD_MOVE_FACTOR;
+    }
+    return this->state.max_count;
+}
+
+bool WL_Flash::moveDue()
+{
+    if (this->state.access_count >= this->moveThreshold()) {
+        return true;
+    }
+    // while a hot page waits for a dummy page which is erased less than average,
+    // pages are moved at the usual rate
+    return (this->state.access_count >= this->state.max_count) && this->hotPageReady();
+}
+
+bool WL_Flash::dummyPageCold()
+{
+    return (this->page_erases != NULL)
+           && ((uint64_t) this->page_erases[this->mapPos(this->state.pos)] * this->state.max_pos <= this->page_erases_total);
+}
+
+void WL_Flash::countPageErases(size_t page, size_t count)
+{
+    if (this->page_erases != NULL) {
+        this->page_erases[page] += count;
+        this->page_erases_total += count;
+    }
+}
+
+bool WL_Flash::posHot(size_t pos)
+{
+    // erased often enough, and more often than other positions since its data came to this page
+    uint32_t erases = this->pos_stats[pos].erases;
+    uint32_t all_erases = (uint32_t)this->page_erases_total - this->pos_stats[pos].since;
+    return (erases >= this->state.max_count * WL_HOT_PAGE_FACTOR)
+           && ((uint64_t) erases * this->state.max_pos >= (uint64_t) all_erases * WL_HOT_PAGE_RATIO);
+}
+
+bool WL_Flash::hotPageReady()
+{
+    return (this->pos_stats != NULL) && this->posHot(this->hot_pos);
+}
+
+void WL_Flash::resetPosStat(size_t pos)
+{
+    this->pos_stats[pos].erases = 0;
+    this->pos_stats[pos].since = (uint32_t)this->page_erases_total;
+}
+
+void WL_Flash::countErases(size_t addr, size_t size)
+{
+    if (this->pos_stats == NULL) {
+        return;
+    }
+    for (size_t offset = 0; offset < size; offset += this->cfg.sector_size) {
+        size_t pos = this->calcPosAddr(addr + offset) / this->cfg.page_size;
+        this->pos_stats[pos].erases++;
+        this->countPageErases(this->mapPos(pos), 1);
+        if ((pos != this->hot_pos) && this->posHot(pos)) {
+            this->hot_pos = pos;
+        }
+    }
+}
+
+esp_err_t WL_Flash::set_hot_cold_policy(bool enable)
+{
+    esp_err_t result = ESP_OK;
+    if (!this->initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!enable) {
+        // the page map stays, it is needed to find the data
+        free(this->pos_stats);
+        this->pos_stats = NULL;
+        free(this->page_erases);
+        this->page_erases = NULL;
+        return ESP_OK;
+    }
+    if (this->pageMapAddr(0) + this->pageMapSize() > this->state_size) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (this->pos_stats == NULL) {
+        this->pos_stats = (wl_pos_stat_t *)calloc(this->state.max_pos, sizeof(wl_pos_stat_t));
+        this->page_erases = (uint32_t *)calloc(this->state.max_pos, sizeof(uint32_t));
+        this->hot_pos = 0;
+        this->page_erases_total = 0;
+    }
+    result = ESP_ERR_NO_MEM;
+    if ((this->pos_stats != NULL) && (this->page_erases != NULL)) {
+        result = this->allocPageMap();
+    }
+    if ((result == ESP_OK) && (this->state.version != WL_STATE_VERSION_PAGE_MAP)) {
+        result = this->updateV2_V3();
+    }
+    if (result != ESP_OK) {
+        free(this->pos_stats);
+        this->pos_stats = NULL;
+        free(this->page_erases);
+        this->page_erases = NULL;
+    }
+    return result;
+}
+
+size_t WL_Flash::mapPos(size_t pos)
+{
+    if (this->page_map == NULL) {
+        return pos;
+    }
+    return this->page_map[pos];
+}
+
+size_t WL_Flash::pageMapAddr(size_t state_addr)
+{
+    // after the space reserved for position records
+    return state_addr + sizeof(wl_state_t) + (this->cfg.full_mem_size / this->cfg.sector_size) * this->cfg.wr_size;
+}
+
+size_t WL_Flash::pageMapSize()
+{
+    // entries are padded to the flash encryption unit size
+    size_t entries_size = (this->state.max_pos * sizeof(uint16_t) + 31) / 32 * 32;
+    return sizeof(wl_page_map_t) + entries_size;
+}
+
+esp_err_t WL_Flash::allocPageMap()
+{
+    if (this->page_map != NULL) {
+        return ESP_OK;
+    }
+    size_t size = this->pageMapSize() - sizeof(wl_page_map_t);
+    this->page_map = (uint16_t *)malloc(size);
+    if (this->page_map == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memset(this->page_map, 0xff, size);
+    for (size_t i = 0; i < this->state.max_pos; i++) {
+        this->page_map[i] = i;
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Flash::readPageMap(size_t state_addr, size_t pos)
+{
+    esp_err_t result = ESP_OK;
+    free(this->page_map);
+    this->page_map = NULL;
+    if ((this->state.version != WL_STATE_VERSION_PAGE_MAP)
+            || (this->pageMapAddr(0) + this->pageMapSize() > this->state_size) || (this->state.max_pos > UINT16_MAX)) {
+        // no page map in V2 state or no room for it, pages are never moved out of turn
+        return ESP_OK;
+    }
+    wl_page_map_t header;
+    result = this->flash_drv->read(this->pageMapAddr(state_addr), &header, sizeof(wl_page_map_t));
+    WL_RESULT_CHECK(result);
+    if ((header.magic == WL_PAGE_MAP_MAGIC) && (header.count == this->state.max_pos)) {
+        result = this->allocPageMap();
+        WL_RESULT_CHECK(result);
+        size_t size = this->pageMapSize() - sizeof(wl_page_map_t);
+        result = this->flash_drv->read(this->pageMapAddr(state_addr) + sizeof(wl_page_map_t), this->page_map, size);
+        WL_RESULT_CHECK(result);
+        if (crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)this->page_map, size) != header.crc) {
+            ESP_LOGE(TAG, "%s - page map CRC error", __func__);
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+    // apply pages moved out of turn since the main state was written
+    for (size_t i = 0; i < pos; i++) {
+        uint32_t src_pos;
+        result = this->flash_drv->read(state_addr + sizeof(wl_state_t) + i * this->cfg.wr_size, this->temp_buff, this->cfg.wr_size);
+        WL_RESULT_CHECK(result);
+        if (this->RelocBuffSet(i, &src_pos)) {
+            result = this->allocPageMap();
+            WL_RESULT_CHECK(result);
+            this->relocatePage(i, src_pos);
+        }
+    }
+    return result;
+}
+
+esp_err_t WL_Flash::writePageMap(size_t state_addr)
+{
+    esp_err_t result = ESP_OK;
+    if (this->page_map == NULL) {
+        return result;
+    }
+    wl_page_map_t header;
+    size_t size = this->pageMapSize() - sizeof(wl_page_map_t);
+    header.magic = WL_PAGE_MAP_MAGIC;
+    header.count = this->state.max_pos;
+    header.crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)this->page_map, size);
+    header.reserved = UINT32_MAX;
+    result = this->flash_drv->write(this->pageMapAddr(state_addr) + sizeof(wl_page_map_t), this->page_map, size);
+    WL_RESULT_CHECK(result);
+    result = this->flash_drv->write(this->pageMapAddr(state_addr), &header, sizeof(wl_page_map_t));
+    WL_RESULT_CHECK(result);
+    return result;
+}
+
+esp_err_t WL_Flash::copyPageMap(size_t src_state_addr, size_t dest_state_addr)
+{
+    esp_err_t result = ESP_OK;
+    if (this->pageMapAddr(0) + this->pageMapSize() > this->state_size) {
+        return result;
+    }
+    for (size_t offset = 0; offset < this->pageMapSize(); offset += this->cfg.temp_buff_size) {
+        size_t size = this->pageMapSize() - offset;
+        if (size > this->cfg.temp_buff_size) {
+            size = this->cfg.temp_buff_size;
+        }
+        result = this->flash_drv->read(this->pageMapAddr(src_state_addr) + offset, this->temp_buff, size);
+        WL_RESULT_CHECK(result);
+        result = this->flash_drv->write(this->pageMapAddr(dest_state_addr) + offset, this->temp_buff, size);
+        WL_RESULT_CHECK(result);
+    }
+    return result;
+}
+
+void WL_Flash::checkMoveSource(size_t addr, size_t size)
+{
+    // data of the source page which was already copied to the dummy page has changed,
+    // changes of the rest of the page are picked up by the copy
+    if ((this->move_step == WL_MOVE_COPY || this->move_step == WL_MOVE_COMMIT)
+            && (addr < this->move_src_addr + this->move_offset) && (this->move_src_addr < addr + size)) {
+        this->move_step = WL_MOVE_ERASE;
+    }
+}
+
+void WL_Flash::set_deferred_moves(bool deferred)
+{
+    this->deferred_moves = deferred;
+}
+
+esp_err_t WL_Flash::maintenance(size_t budget)
+{
+    esp_err_t result = ESP_OK;
+    if (!this->initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (this->move_step == WL_MOVE_IDLE) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGV(TAG, "%s - budget= %i, step= %i, offset= 0x%08x", __func__, (int) budget, (int) this->move_step, (uint32_t) this->move_offset);
+    while ((budget > 0) && (this->move_step != WL_MOVE_IDLE)) {
+        result = this->moveStep();
+        if (result != ESP_OK) {
+            this->move_step = WL_MOVE_ERASE; // start over next time
+            return result;
+        }
+        budget--;
+    }
+    return result;
+}
+
+size_t WL_Flash::calcPosAddr(size_t addr)
 {
     size_t result = (this->flash_size - this->state.move_count * this->cfg.page_size + addr) % this->flash_size;
     size_t dummy_addr = this->state.pos * this->cfg.page_size;
@@ -526,6 +990,45 @@ size_t WL_Flash::calcAddr(size_t addr)
     return result;
 }
 
+size_t WL_Flash::calcAddr(size_t addr)
+{
+    size_t result = this->calcPosAddr(addr);
+    return this->mapPos(result / this->cfg.page_size) * this->cfg.page_size + result % this->cfg.page_size;
+}
+
+size_t WL_Flash::calcAddrRun(size_t addr, size_t size, size_t *run_size)
+{
+    // Same mapping as calcAddr. Physical addresses stay contiguous until the virtual
+    // address wraps around the end of the memory or reaches the dummy page.
+    size_t result = (this->flash_size - this->state.move_count * this->cfg.page_size + addr) % this->flash_size;
+    size_t dummy_addr = this->state.pos * this->cfg.page_size;
+    size_t run = this->flash_size - result;
+    if (result < dummy_addr) {
+        if (dummy_addr - result < run) {
+            run = dummy_addr - result;
+        }
+    } else {
+        result += this->cfg.page_size;
+    }
+    if (size < run) {
+        run = size;
+    }
+    if (this->page_map != NULL) {
+        // the run ends where positions are not in consecutive pages
+        size_t pos = result / this->cfg.page_size;
+        size_t end = (pos + 1) * this->cfg.page_size;
+        while ((end < result + run) && (this->page_map[end / this->cfg.page_size] == this->page_map[pos] + end / this->cfg.page_size - pos)) {
+            end += this->cfg.page_size;
+        }
+        if (end - result < run) {
+            run = end - result;
+        }
+        result = this->page_map[pos] * this->cfg.page_size + result % this->cfg.page_size;
+    }
+    *run_size = run;
+    ESP_LOGV(TAG, "%s - addr= 0x%08x -> result= 0x%08x, run_size= 0x%08x", __func__, (uint32_t) addr, (uint32_t) result, (uint32_t) run);
+    return result;
+}
 
 size_t WL_Flash::chip_size()
 {
@@ -552,7 +1055,9 @@ esp_err_t WL_Flash::erase_sector(size_t sector)
     ESP_LOGD(TAG, "%s - sector= 0x%08x", __func__, (uint32_t) sector);
     result = this->updateWL();
     WL_RESULT_CHECK(result);
+    this->countErases(sector * this->cfg.sector_size, this->cfg.sector_size);
     size_t virt_addr = this->calcAddr(sector * this->cfg.sector_size);
+    this->checkMoveSource(this->cfg.start_addr + virt_addr, this->cfg.sector_size);
     result = this->flash_drv->erase_sector((this->cfg.start_addr + virt_addr) / this->cfg.sector_size);
     WL_RESULT_CHECK(result);
     return result;
@@ -566,9 +1071,43 @@ esp_err_t WL_Flash::erase_range(size_t start_address, size_t size)
     ESP_LOGD(TAG, "%s - start_address= 0x%08x, size= 0x%08x", __func__, (uint32_t) start_address, (uint32_t) size);
     size_t erase_count = (size + this->cfg.sector_size - 1) / this->cfg.sector_size;
     size_t start_sector = start_address / this->cfg.sector_size;
-    for (size_t i = 0; i < erase_count; i++) {
-        result = this->erase_sector(start_sector + i);
-        WL_RESULT_CHECK(result);
+    while (erase_count > 0) {
+        // Sectors erased before the next page move don't change the mapping,
+        // so the physically contiguous ones among them are erased at once
+        size_t count = 0;
+        size_t max_count = this->moveThreshold();
+        if (this->hotPageReady()) {
+            max_count = this->state.max_count;
+        }
+        if (this->deferred_moves) {
+            max_count *= WL_DEFERRED_MOVE_LIMIT;
+        }
+        if (this->state.access_count + 1 < max_count) {
+            count = max_count - 1 - this->state.access_count;
+        }
+        if (count == 0) {
+            // not virtual erase_sector, derived classes use it for their own sector size
+            result = WL_Flash::erase_sector(start_sector);
+            WL_RESULT_CHECK(result);
+            count = 1;
+        } else {
+            if (count > erase_count) {
+                count = erase_count;
+            }
+            size_t run_size;
+            size_t virt_addr = this->calcAddrRun(start_sector * this->cfg.sector_size, count * this->cfg.sector_size, &run_size);
+            count = run_size / this->cfg.sector_size;
+            this->state.access_count += count;
+            this->countErases(start_sector * this->cfg.sector_size, run_size);
+            if (this->moveDue() && (this->move_step == WL_MOVE_IDLE)) {
+                this->move_step = WL_MOVE_ERASE;
+            }
+            this->checkMoveSource(this->cfg.start_addr + virt_addr, run_size);
+            result = this->flash_drv->erase_range(this->cfg.start_addr + virt_addr, run_size);
+            WL_RESULT_CHECK(result);
+        }
+        start_sector += count;
+        erase_count -= count;
     }
     ESP_LOGV(TAG, "%s - result= 0x%08x", __func__, result);
     return result;
@@ -581,15 +1120,17 @@ esp_err_t WL_Flash::write(size_t dest_addr, const void *src, size_t size)
         return ESP_ERR_INVALID_STATE;
     }
     ESP_LOGD(TAG, "%s - dest_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) dest_addr, (uint32_t) size);
-    uint32_t count = (size - 1) / this->cfg.page_size;
-    for (size_t i = 0; i < count; i++) {
-        size_t virt_addr = this->calcAddr(dest_addr + i * this->cfg.page_size);
-        result = this->flash_drv->write(this->cfg.start_addr + virt_addr, &((uint8_t *)src)[i * this->cfg.page_size], this->cfg.page_size);
+    const uint8_t *src_data = (const uint8_t *)src;
+    while (size > 0) {
+        size_t run_size;
+        size_t virt_addr = this->calcAddrRun(dest_addr, size, &run_size);
+        this->checkMoveSource(this->cfg.start_addr + virt_addr, run_size);
+        result = this->flash_drv->write(this->cfg.start_addr + virt_addr, src_data, run_size);
         WL_RESULT_CHECK(result);
+        dest_addr += run_size;
+        src_data += run_size;
+        size -= run_size;
     }
-    size_t virt_addr_last = this->calcAddr(dest_addr + count * this->cfg.page_size);
-    result = this->flash_drv->write(this->cfg.start_addr + virt_addr_last, &((uint8_t *)src)[count * this->cfg.page_size], size - count * this->cfg.page_size);
-    WL_RESULT_CHECK(result);
     return result;
 }
 
@@ -600,19 +1141,92 @@ esp_err_t WL_Flash::read(size_t src_addr, void *dest, size_t size)
         return ESP_ERR_INVALID_STATE;
     }
     ESP_LOGD(TAG, "%s - src_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) src_addr, (uint32_t) size);
-    uint32_t count = (size - 1) / this->cfg.page_size;
-    for (size_t i = 0; i < count; i++) {
-        size_t virt_addr = this->calcAddr(src_addr + i * this->cfg.page_size);
-        ESP_LOGV(TAG, "%s - real_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) (this->cfg.start_addr + virt_addr), (uint32_t) size);
-        result = this->flash_drv->read(this->cfg.start_addr + virt_addr, &((uint8_t *)dest)[i * this->cfg.page_size], this->cfg.page_size);
+    uint8_t *dest_data = (uint8_t *)dest;
+    while (size > 0) {
+        size_t run_size;
+        size_t virt_addr = this->calcAddrRun(src_addr, size, &run_size);
+        ESP_LOGV(TAG, "%s - real_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) (this->cfg.start_addr + virt_addr), (uint32_t) run_size);
+        result = this->flash_drv->read(this->cfg.start_addr + virt_addr, dest_data, run_size);
         WL_RESULT_CHECK(result);
+        src_addr += run_size;
+        dest_data += run_size;
+        size -= run_size;
     }
-    size_t virt_addr_last = this->calcAddr(src_addr + count * this->cfg.page_size);
-    result = this->flash_drv->read(this->cfg.start_addr + virt_addr_last, &((uint8_t *)dest)[count * this->cfg.page_size], size - count * this->cfg.page_size);
-    WL_RESULT_CHECK(result);
     return result;
 }
 
+esp_err_t WL_Flash::write_sectors(size_t sector, const void *src, size_t count)
+{
+    esp_err_t result = ESP_OK;
+    if (!this->initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGD(TAG, "%s - sector= 0x%08x, count= 0x%08x", __func__, (uint32_t) sector, (uint32_t) count);
+    size_t sectors = this->chip_size() / this->cfg.sector_size;
+    if ((count > sectors) || (sector > sectors - count)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Sectors which have to be erased are collected into runs, so that erase_range can erase
+    // physically contiguous ones at once
+    const uint8_t *src_data = (const uint8_t *)src;
+    size_t erase_start = sector;
+    size_t erase_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool program = false;
+        result = this->canProgramAt((sector + i) * this->cfg.sector_size, &src_data[i * this->cfg.sector_size], this->cfg.sector_size, &program);
+        WL_RESULT_CHECK(result);
+        if (!program) {
+            if (erase_count == 0) {
+                erase_start = sector + i;
+            }
+            erase_count++;
+        }
+        if ((erase_count > 0) && (program || (i == count - 1))) {
+            result = WL_Flash::erase_range(erase_start * this->cfg.sector_size, erase_count * this->cfg.sector_size);
+            WL_RESULT_CHECK(result);
+            erase_count = 0;
+        }
+    }
+    return WL_Flash::write(sector * this->cfg.sector_size, src, count * this->cfg.sector_size);
+}
+
+bool WL_Flash::canProgram(const void *old_data, const void *new_data, size_t size)
+{
+    const uint8_t *old_bytes = (const uint8_t *)old_data;
+    const uint8_t *new_bytes = (const uint8_t *)new_data;
+    for (size_t i = 0; i < size; i++) {
+        if ((old_bytes[i] & new_bytes[i]) != new_bytes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t WL_Flash::canProgramAt(size_t addr, const void *src, size_t size, bool *out_result)
+{
+    esp_err_t result = ESP_OK;
+    const uint8_t *src_data = (const uint8_t *)src;
+    // on an encrypted partition, the decrypted data says nothing about the bits in flash
+    *out_result = false;
+    if (this->flash_drv->is_encrypted()) {
+        return ESP_OK;
+    }
+    *out_result = true;
+    for (size_t offset = 0; offset < size; offset += this->cfg.temp_buff_size) {
+        size_t chunk = size - offset;
+        if (chunk > this->cfg.temp_buff_size) {
+            chunk = this->cfg.temp_buff_size;
+        }
+        result = WL_Flash::read(addr + offset, this->temp_buff, chunk);
+        WL_RESULT_CHECK(result);
+        if (!canProgram(this->temp_buff, &src_data[offset], chunk)) {
+            *out_result = false;
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
 Flash_Access *WL_Flash::get_drv()
 {
     return this->flash_drv;
@@ -625,7 +1239,11 @@ wl_config_t *WL_Flash::get_cfg()
 esp_err_t WL_Flash::flush()
 {
     esp_err_t result = ESP_OK;
-    this->state.access_count = this->state.max_count - 1;
+    // make the next access due for a move, without lowering a count which is
+    // already past the threshold, so that a pending deferred move is forced
+    if (this->state.access_count < this->moveThreshold() - 1) {
+        this->state.access_count = this->moveThreshold() - 1;
+    }
     result = this->updateWL();
     ESP_LOGD(TAG, "%s - result= 0x%08x, move_count= 0x%08x", __func__, result, this->state.move_count);
     return result;
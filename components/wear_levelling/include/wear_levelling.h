@@ -94,6 +94,28 @@ esp_err_t wl_erase_range(wl_handle_t handle, size_t start_addr, size_t size);
 */
 esp_err_t wl_write(wl_handle_t handle, size_t dest_addr, const void *src, size_t size);
 
+/**
+* @brief Replace contents of sectors of the WL storage
+*
+* This function has the same effect as wl_erase_range followed by wl_write of
+* the same range, but it is faster. Sectors are not erased if the new data can be
+* written over the old one, and a flash sector which is only partially covered
+* by the range (if wl_sector_size is smaller than flash sector size) is read,
+* erased and written once.
+*
+* @param handle WL handle that are related to the partition
+* @param sector Index of the first sector, in units of wl_sector_size(...).
+* @param src Pointer to the source buffer. Pointer must be non-NULL and
+*            buffer must be at least count * wl_sector_size(...) bytes long.
+* @param count Number of sectors to write.
+*
+* @return
+*       - ESP_OK, if data was written successfully;
+*       - ESP_ERR_INVALID_SIZE, if write would go out of bounds of the partition;
+*       - or one of error codes from lower-level flash driver.
+*/
+esp_err_t wl_write_sectors(wl_handle_t handle, size_t sector, const void *src, size_t count);
+
 /**
 * @brief Read data from the WL storage
 *
@@ -112,6 +134,49 @@ esp_err_t wl_write(wl_handle_t handle, size_t dest_addr, const void *src, size_t
 */
 esp_err_t wl_read(wl_handle_t handle, size_t src_addr, void *dest, size_t size);
 
+/**
+* @brief Write data cached in RAM to the WL storage
+*
+* When sector cache is enabled (CONFIG_WL_CACHE_SECTORS > 0), wl_erase_range and
+* wl_write modify copies of flash sectors in RAM. Modified sectors are written to
+* flash when they are evicted from the cache, on wl_unmount, and by this function.
+* Without the cache this function does nothing.
+*
+* @param handle WL module handle that was initialized before
+*
+* @return
+*       - ESP_OK, if cached data was written successfully;
+*       - or one of error codes from lower-level flash driver.
+*/
+esp_err_t wl_flush(wl_handle_t handle);
+
+/**
+* @brief Do part of the pending background work of the WL instance
+*
+* With CONFIG_WL_DEFERRED_MOVES enabled, erase operations don't copy a flash page
+* when the page has to be moved, they leave the move to this function. Each step of
+* the move erases the free page, copies a small buffer of data, or updates the state
+* stored in flash, so the time spent in one call is limited by the budget.
+* The move is power-off safe at any step: the new page is only used after the final step.
+* If the application doesn't call this function often enough, erase operations move
+* the page themselves.
+*
+* Call it when the application is idle, e.g.:
+*
+*     while (wl_maintenance(handle, 4) == ESP_OK) {
+*         // yield to other tasks
+*     }
+*
+* @param handle WL partition handle
+* @param budget maximum number of steps to do
+*
+* @return
+*       - ESP_OK, if some work was done; more may be pending;
+*       - ESP_ERR_NOT_FOUND, if there is nothing to do;
+*       - or one of error codes from lower-level flash driver.
+*/
+esp_err_t wl_maintenance(wl_handle_t handle, size_t budget);
+
 /**
 * @brief Get size of the WL storage
 *
@@ -31,8 +31,25 @@ public:
     virtual esp_err_t write(size_t dest_addr, const void *src, size_t size) = 0;
     virtual esp_err_t read(size_t src_addr, void *dest, size_t size) = 0;
 
+    // Replace contents of count sectors, same as erase_range and write of the same range
+    virtual esp_err_t write_sectors(size_t sector, const void *src, size_t count)
+    {
+        esp_err_t result = this->erase_range(sector * this->sector_size(), count * this->sector_size());
+        if (result != ESP_OK) {
+            return result;
+        }
+        return this->write(sector * this->sector_size(), src, count * this->sector_size());
+    };
+
     virtual size_t sector_size() = 0;
 
+    // True if data is encrypted on flash. Then the bits which are programmed can't be derived
+    // from the data which is read back, so data can't be programmed over old data without an erase.
+    virtual bool is_encrypted()
+    {
+        return false;
+    };
+
     virtual esp_err_t flush()
     {
         return ESP_OK;
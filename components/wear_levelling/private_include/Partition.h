@@ -26,6 +26,8 @@ public:
 
     virtual size_t sector_size();
 
+    virtual bool is_encrypted();
+
     virtual ~Partition();
 protected:
     const esp_partition_t *partition;
@@ -0,0 +1,68 @@
+// Copyright 2015-2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _WL_Cache_H_
+#define _WL_Cache_H_
+
+#include "esp_err.h"
+#include "Flash_Access.h"
+
+/**
+* @brief Write-back cache of flash sectors. Class implements Flash_Access interface on top of another one.
+*
+* Erase and write operations are applied to copies of flash sectors in RAM. A modified sector is written
+* to the underlying driver, with one erase of the whole sector, when flush() is called or when the least
+* recently used sector has to make room for another one.
+*/
+class WL_Cache : public Flash_Access
+{
+public :
+    WL_Cache();
+    ~WL_Cache() override;
+
+    esp_err_t config(Flash_Access *flash_drv, size_t line_size, size_t line_count);
+
+    size_t chip_size() override;
+    size_t sector_size() override;
+
+    esp_err_t erase_sector(size_t sector) override;
+    esp_err_t erase_range(size_t start_address, size_t size) override;
+
+    esp_err_t write(size_t dest_addr, const void *src, size_t size) override;
+    esp_err_t read(size_t src_addr, void *dest, size_t size) override;
+
+    esp_err_t flush() override;
+
+    Flash_Access *get_drv();
+
+protected:
+    typedef struct {
+        size_t addr;
+        uint32_t last_access;
+        bool valid;
+        bool dirty;
+        uint8_t *data;
+    } wl_cache_line_t;
+
+    Flash_Access *flash_drv = NULL;
+    wl_cache_line_t *lines = NULL;
+    size_t line_count = 0;
+    size_t line_size = 0;
+    uint32_t access_count = 0;
+
+    wl_cache_line_t *findLine(size_t addr);
+    esp_err_t getLine(size_t addr, bool load, wl_cache_line_t **out_line);
+    esp_err_t flushLine(wl_cache_line_t *line);
+};
+
+#endif // _WL_Cache_H_
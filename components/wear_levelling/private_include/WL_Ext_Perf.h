@@ -32,6 +32,7 @@ public:
 
     esp_err_t erase_sector(size_t sector) override;
     esp_err_t erase_range(size_t start_address, size_t size) override;
+    esp_err_t write_sectors(size_t sector, const void *src, size_t count) override;
 
 protected:
     uint32_t flash_sector_size;
@@ -40,6 +41,8 @@ protected:
     uint32_t *sector_buffer;
 
     virtual esp_err_t erase_sector_fit(uint32_t start_sector, uint32_t count);
+    // Erase flash sector and write sector_buffer to it
+    virtual esp_err_t write_sector_fit(uint32_t flash_sector);
 
 };
 
@@ -42,11 +42,48 @@ public :
     esp_err_t write(size_t dest_addr, const void *src, size_t size) override;
     esp_err_t read(size_t src_addr, void *dest, size_t size) override;
 
+    /**
+    * @brief Replace contents of count sectors
+    *
+    * Sectors which can be programmed with the new data without erasing (the data only clears bits)
+    * are not erased.
+    */
+    esp_err_t write_sectors(size_t sector, const void *src, size_t count) override;
+
     esp_err_t flush() override;
 
     Flash_Access *get_drv();
     wl_config_t *get_cfg();
 
+    /**
+    * @brief Leave page moves to maintenance() instead of doing them inside erase operations
+    */
+    void set_deferred_moves(bool deferred);
+
+    /**
+    * @brief Continue a pending page move by at most budget steps
+    *
+    * One step erases the dummy page, copies temp_buff_size bytes of data or updates the state.
+    *
+    * @return
+    *       - ESP_OK, if some work was done; the move may need more steps
+    *       - ESP_ERR_NOT_FOUND, if no page move is pending
+    *       - error from the flash driver
+    */
+    esp_err_t maintenance(size_t budget);
+
+    /**
+    * @brief Move pages which are erased much more often than the others to other flash pages
+    *
+    * Must be called after init(). Needs free space after the position records of the state.
+    *
+    * @return
+    *       - ESP_OK, if the policy was enabled
+    *       - ESP_ERR_NOT_SUPPORTED, if the state sectors have no room for the page map
+    *       - ESP_ERR_NO_MEM, if memory for erase counters could not be allocated
+    */
+    esp_err_t set_hot_cold_policy(bool enable);
+
 protected:
     bool configured = false;
     bool initialized = false;
@@ -67,15 +104,69 @@ protected:
     size_t dummy_addr;
     uint32_t pos_data[4];
 
+    typedef enum {
+        WL_MOVE_IDLE,
+        WL_MOVE_ERASE,
+        WL_MOVE_COPY,
+        WL_MOVE_COMMIT,
+    } wl_move_step_t;
+
+    bool deferred_moves = false;
+    wl_move_step_t move_step = WL_MOVE_IDLE;
+    size_t move_src_addr = 0;
+    size_t move_offset = 0;
+    size_t move_src_pos = 0;
+    bool move_relocate = false;
+
+    uint16_t *page_map = NULL; // physical page of every position, NULL if position n is page n
+    typedef struct {
+        uint32_t erases;    // sectors erased at the position since its data was moved to the page
+        uint32_t since;     // page_erases_total when the data was moved to the page
+    } wl_pos_stat_t;
+
+    wl_pos_stat_t *pos_stats = NULL;
+    uint32_t *page_erases = NULL; // sectors erased in every page since the policy was enabled
+    uint64_t page_erases_total = 0;
+    size_t hot_pos = 0;
+
     esp_err_t initSections();
     esp_err_t updateWL();
+    esp_err_t moveStep();
+    esp_err_t commitMove();
+    void checkMoveSource(size_t addr, size_t size);
+    bool versionSupported(uint32_t version);
+    size_t moveThreshold();
+    bool moveDue();
+    bool hotPageReady();
+    bool dummyPageCold();
+    void countPageErases(size_t page, size_t count);
+    void countErases(size_t addr, size_t size);
+    bool posHot(size_t pos);
+    void resetPosStat(size_t pos);
     esp_err_t recoverPos();
+    static bool canProgram(const void *old_data, const void *new_data, size_t size);
+    esp_err_t canProgramAt(size_t addr, const void *src, size_t size, bool *out_result);
+    size_t calcPosAddr(size_t addr);
     size_t calcAddr(size_t addr);
+    size_t calcAddrRun(size_t addr, size_t size, size_t *run_size);
+    size_t mapPos(size_t pos);
+
+    size_t pageMapAddr(size_t state_addr);
+    size_t pageMapSize();
+    esp_err_t allocPageMap();
+    esp_err_t readPageMap(size_t state_addr, size_t pos);
+    esp_err_t writePageMap(size_t state_addr);
+    esp_err_t copyPageMap(size_t src_state_addr, size_t dest_state_addr);
+    esp_err_t writeMainState();
+    void relocatePage(size_t pos, size_t src_pos);
 
     esp_err_t updateVersion();
     esp_err_t updateV1_V2();
+    esp_err_t updateV2_V3();
     void fillOkBuff(int n);
     bool OkBuffSet(int n);
+    void fillRelocBuff(int n, uint32_t src_pos);
+    bool RelocBuffSet(int n, uint32_t *src_pos);
 };
 
 #endif // _WL_Flash_H_
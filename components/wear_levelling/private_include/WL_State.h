@@ -48,4 +48,27 @@ static_assert(sizeof(wl_state_t) % 16 == 0, "Size of wl_state_t structure should
 #define WL_STATE_CRC_LEN_V1 offsetof(wl_state_t, device_id)
 #define WL_STATE_CRC_LEN_V2 offsetof(wl_state_t, crc)
 
+/**
+* State version written once the page map is in use. The layout is the same as V2, but
+* positions are mapped to pages by the page map and the relocation records, which V2 code
+* does not read. V2 code finds a different version and initializes the partition again.
+*/
+#define WL_STATE_VERSION_PAGE_MAP 3
+
+/**
+* @brief Header of the page map stored after the position records of the state.
+*
+* The header is followed by count 16-bit entries, the physical page of every position.
+* Without a valid page map, position n is page n.
+*/
+typedef struct WL_Page_Map_s {
+public:
+    uint32_t magic;         /*!< WL_PAGE_MAP_MAGIC*/
+    uint32_t count;         /*!< amount of entries, equal to max_pos of the state*/
+    uint32_t crc;           /*!< CRC of the entries*/
+    uint32_t reserved;      /*!< Reserved space for future use*/
+} wl_page_map_t;
+
+#define WL_PAGE_MAP_MAGIC 0x504d4c57
+
 #endif // _WL_State_H_
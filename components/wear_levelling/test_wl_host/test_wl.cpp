@@ -1,11 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 
 #include "esp_spi_flash.h"
 #include "esp_partition.h"
 #include "wear_levelling.h"
 #include "WL_Flash.h"
+#include "WL_Ext_Perf.h"
+#include "WL_Ext_Safe.h"
+#include "WL_Cache.h"
+#include "Partition.h"
 #include "SpiFlash.h"
 
 #include "catch.hpp"
@@ -82,6 +87,11 @@ TEST_CASE("write and read back data", "[wear_levelling]")
     // Verify that written and read data match
     REQUIRE(memcmp(data, read, partition->size));
 
+    // Sectors past the end of the wear-levelled area are rejected
+    uint32_t wl_sectors = wl_size(wl_handle) / sector_size;
+    CHECK(wl_write_sectors(wl_handle, wl_sectors - 1, data, 2) == ESP_ERR_INVALID_SIZE);
+    CHECK(wl_write_sectors(wl_handle, wl_sectors, data, 0) == ESP_OK);
+
     // Unmount
     result = wl_unmount(wl_handle);
     REQUIRE(result == ESP_OK);
@@ -207,4 +217,695 @@ TEST_CASE("power down test", "[wear_levelling]")
     // Unmount
     result = wl_unmount(wl_handle);
     REQUIRE(result == ESP_OK);
-}
\ No newline at end of file
+}
+
+// Same configuration as wl_mount uses
+static void init_wl_config(wl_ext_cfg_t *cfg, const esp_partition_t *partition, size_t fat_sector_size)
+{
+    cfg->full_mem_size = partition->size;
+    cfg->start_addr = 0;
+    cfg->version = 2;
+    cfg->sector_size = SPI_FLASH_SEC_SIZE;
+    cfg->page_size = SPI_FLASH_SEC_SIZE;
+    cfg->updaterate = 16;
+    cfg->temp_buff_size = 32;
+    cfg->wr_size = 16;
+    cfg->fat_sector_size = fat_sector_size;
+}
+
+TEST_CASE("sector cache reduces erase cycles of small sequential writes", "[wear_levelling][cache]")
+{
+    const size_t fat_sector_size = 512;
+    const size_t log_size = 64 * 1024;
+    uint8_t *data = (uint8_t *) malloc(log_size);
+    uint8_t *read = (uint8_t *) malloc(log_size);
+    for (size_t i = 0; i < log_size / sizeof(uint32_t); i++) {
+        ((uint32_t *) data)[i] = i;
+    }
+
+    uint32_t erase_cycles[2];
+    for (int cached = 0; cached < 2; cached++) {
+        init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+        const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+
+        wl_ext_cfg_t cfg;
+        init_wl_config(&cfg, partition, fat_sector_size);
+
+        Partition part(partition);
+        WL_Ext_Perf wl_flash;
+        REQUIRE(wl_flash.config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash.init() == ESP_OK);
+        WL_Cache cache;
+        REQUIRE(cache.config(&wl_flash, cfg.sector_size, 2) == ESP_OK);
+        Flash_Access *access = cached ? (Flash_Access *) &cache : (Flash_Access *) &wl_flash;
+
+        // the log has been written before, so every sector has to be erased again
+        memset(read, 0, log_size);
+        REQUIRE(wl_flash.erase_range(0, log_size) == ESP_OK);
+        REQUIRE(wl_flash.write(0, read, log_size) == ESP_OK);
+
+        uint32_t start_cycles = spiflash.get_total_erase_cycles();
+        // append to the log one FAT sector at a time, the way ff_wl_write does it
+        for (size_t addr = 0; addr < log_size; addr += fat_sector_size) {
+            REQUIRE(access->erase_range(addr, fat_sector_size) == ESP_OK);
+            REQUIRE(access->write(addr, data + addr, fat_sector_size) == ESP_OK);
+        }
+        REQUIRE(cache.flush() == ESP_OK);
+        erase_cycles[cached] = spiflash.get_total_erase_cycles() - start_cycles;
+
+        REQUIRE(wl_flash.read(0, read, log_size) == ESP_OK);
+        REQUIRE(memcmp(data, read, log_size) == 0);
+    }
+
+    printf("Appending %d bytes in %d byte sectors: %d erase cycles without cache, %d with cache\n",
+           (int) log_size, (int) fat_sector_size, (int) erase_cycles[0], (int) erase_cycles[1]);
+    CHECK(erase_cycles[1] * 4 < erase_cycles[0]);
+
+    free(data);
+    free(read);
+}
+
+TEST_CASE("write_sectors erases and writes partially covered flash sectors once", "[wear_levelling][write_sectors]")
+{
+    const size_t fat_sector_size = 512;
+    const size_t file_size = 64 * 1024;
+    uint8_t *expected = (uint8_t *) malloc(file_size);
+    uint8_t *read = (uint8_t *) malloc(file_size);
+
+    // [safe mode][area holds old data][write_sectors used]
+    uint64_t flash_time[2][2][2];
+    uint32_t erase_cycles[2][2][2];
+    for (int safe = 0; safe < 2; safe++) {
+        for (int old_data = 0; old_data < 2; old_data++) {
+            for (int merged = 0; merged < 2; merged++) {
+                init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+                const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+
+                wl_ext_cfg_t cfg;
+                init_wl_config(&cfg, partition, fat_sector_size);
+
+                Partition part(partition);
+                WL_Ext_Perf *wl_flash = safe ? new WL_Ext_Safe() : new WL_Ext_Perf();
+                REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+                REQUIRE(wl_flash->init() == ESP_OK);
+
+                // the area is either erased or holds data of a deleted file
+                memset(read, old_data ? 0 : 0xff, file_size);
+                REQUIRE(wl_flash->erase_range(0, file_size) == ESP_OK);
+                REQUIRE(wl_flash->write(0, read, file_size) == ESP_OK);
+
+                for (size_t i = 0; i < file_size / sizeof(uint32_t); i++) {
+                    ((uint32_t *) expected)[i] = i;
+                }
+                uint32_t start_cycles = spiflash.get_total_erase_cycles();
+                spiflash.reset_stats();
+                // append to the file one FAT sector at a time
+                for (size_t addr = 0; addr < file_size; addr += fat_sector_size) {
+                    if (merged) {
+                        REQUIRE(wl_flash->write_sectors(addr / fat_sector_size, expected + addr, 1) == ESP_OK);
+                    } else {
+                        REQUIRE(wl_flash->erase_range(addr, fat_sector_size) == ESP_OK);
+                        REQUIRE(wl_flash->write(addr, expected + addr, fat_sector_size) == ESP_OK);
+                    }
+                }
+                flash_time[safe][old_data][merged] = spiflash.get_time();
+                erase_cycles[safe][old_data][merged] = spiflash.get_total_erase_cycles() - start_cycles;
+
+                // rewrite a range which doesn't start or end at flash sector boundary
+                const size_t first = 3;
+                const size_t count = 10;
+                for (size_t i = 0; i < count * fat_sector_size / sizeof(uint32_t); i++) {
+                    ((uint32_t *) (expected + first * fat_sector_size))[i] = 0x55aa0000 + i;
+                }
+                REQUIRE(wl_flash->write_sectors(first, expected + first * fat_sector_size, count) == ESP_OK);
+
+                REQUIRE(wl_flash->read(0, read, file_size) == ESP_OK);
+                REQUIRE(memcmp(expected, read, file_size) == 0);
+
+                // ranges past the end are rejected before the flash is accessed
+                const size_t sectors = wl_flash->chip_size() / fat_sector_size;
+                spiflash.reset_stats();
+                CHECK(wl_flash->write_sectors(sectors - 1, expected, 2) == ESP_ERR_INVALID_SIZE);
+                CHECK(wl_flash->write_sectors(1, expected, SIZE_MAX) == ESP_ERR_INVALID_SIZE);
+                CHECK(spiflash.get_read_ops() == 0);
+                CHECK(spiflash.get_time() == 0);
+                delete wl_flash;
+            }
+        }
+    }
+
+    for (int safe = 0; safe < 2; safe++) {
+        for (int old_data = 0; old_data < 2; old_data++) {
+            printf("Appending %d bytes in %d byte sectors to %s area, %s mode: erase and write %d erase cycles, %.1f ms; "
+                   "write_sectors %d erase cycles, %.1f ms\n", (int) file_size, (int) fat_sector_size,
+                   old_data ? "used" : "erased", safe ? "safe" : "performance",
+                   (int) erase_cycles[safe][old_data][0], flash_time[safe][old_data][0] / 1000.0,
+                   (int) erase_cycles[safe][old_data][1], flash_time[safe][old_data][1] / 1000.0);
+        }
+        CHECK(flash_time[safe][0][1] * 2 < flash_time[safe][0][0]);
+        CHECK(flash_time[safe][1][1] < flash_time[safe][1][0]);
+    }
+
+    free(expected);
+    free(read);
+}
+
+class CountingPartition : public Partition
+{
+public:
+    CountingPartition(const esp_partition_t *partition) : Partition(partition) {}
+
+    esp_err_t erase_range(size_t start_address, size_t size) override
+    {
+        erase_ops++;
+        return Partition::erase_range(start_address, size);
+    }
+
+    esp_err_t write(size_t dest_addr, const void *src, size_t size) override
+    {
+        write_ops++;
+        return Partition::write(dest_addr, src, size);
+    }
+
+    esp_err_t read(size_t src_addr, void *dest, size_t size) override
+    {
+        read_ops++;
+        return Partition::read(src_addr, dest, size);
+    }
+
+    void reset_ops()
+    {
+        erase_ops = write_ops = read_ops = 0;
+    }
+
+    size_t erase_ops = 0;
+    size_t write_ops = 0;
+    size_t read_ops = 0;
+};
+
+TEST_CASE("physically contiguous sectors are accessed at once", "[wear_levelling]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+
+    wl_ext_cfg_t cfg;
+    init_wl_config(&cfg, partition, SPI_FLASH_SEC_SIZE);
+    CountingPartition part(partition);
+    WL_Flash wl_flash;
+    REQUIRE(wl_flash.config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash.init() == ESP_OK);
+
+    const size_t sector_size = wl_flash.sector_size();
+    const size_t size = wl_flash.chip_size();
+    const size_t sectors = size / sector_size;
+    uint8_t *expected = (uint8_t *) malloc(size);
+    uint8_t *read = (uint8_t *) malloc(size);
+    memset(expected, 0xff, size);
+
+    part.reset_ops();
+    REQUIRE(wl_flash.erase_range(0, size) == ESP_OK);
+    size_t erase_ops = part.erase_ops;
+
+    // rewrite parts of the memory while pages are moved, the rest of it has to stay intact
+    for (size_t round = 0; round < 40; round++) {
+        size_t first = (round * 37) % sectors;
+        size_t count = sectors / 3;
+        if (first + count > sectors) {
+            count = sectors - first;
+        }
+        uint8_t *data = expected + first * sector_size;
+        for (size_t i = 0; i < count * sector_size / sizeof(uint32_t); i++) {
+            ((uint32_t *) data)[i] = (round << 24) + first * sector_size + i;
+        }
+        REQUIRE(wl_flash.erase_range(first * sector_size, count * sector_size) == ESP_OK);
+        REQUIRE(wl_flash.write(first * sector_size, data, count * sector_size) == ESP_OK);
+
+        REQUIRE(wl_flash.read(0, read, size) == ESP_OK);
+        REQUIRE(memcmp(expected, read, size) == 0);
+        for (size_t i = 0; i < sectors; i++) {
+            REQUIRE(wl_flash.read(i * sector_size, read, sector_size) == ESP_OK);
+            REQUIRE(memcmp(expected + i * sector_size, read, sector_size) == 0);
+        }
+    }
+
+    part.reset_ops();
+    REQUIRE(wl_flash.write(0, expected, size) == ESP_OK);
+    size_t write_ops = part.write_ops;
+    part.reset_ops();
+    REQUIRE(wl_flash.read(0, read, size) == ESP_OK);
+    size_t read_ops = part.read_ops;
+
+    printf("Accessing %d sectors: %d erase, %d write, %d read operations\n",
+           (int) sectors, (int) erase_ops, (int) write_ops, (int) read_ops);
+    // memory is split at the dummy page and where addresses wrap around
+    CHECK(write_ops <= 3);
+    CHECK(read_ops <= 3);
+    CHECK(erase_ops * 4 < sectors);
+
+    free(expected);
+    free(read);
+}
+
+TEST_CASE("write_sectors erases before programming on an encrypted partition", "[wear_levelling][write_sectors]")
+{
+    const size_t size = 8 * SPI_FLASH_SEC_SIZE;
+    uint8_t *pattern = (uint8_t *) malloc(size);
+    uint8_t *zeros = (uint8_t *) calloc(1, size);
+    uint8_t *read = (uint8_t *) malloc(size);
+    memset(pattern, 0x5a, size);
+
+    // [partition encrypted][WL_Ext_Perf used]
+    for (int encrypted = 0; encrypted < 2; encrypted++) {
+        for (int ext = 0; ext < 2; ext++) {
+            init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+            esp_partition_t partition = *esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+            partition.encrypted = encrypted;
+
+            const size_t fat_sector_size = ext ? 512 : SPI_FLASH_SEC_SIZE;
+            wl_ext_cfg_t cfg;
+            init_wl_config(&cfg, &partition, fat_sector_size);
+            CountingPartition part(&partition);
+            WL_Flash *wl_flash = ext ? new WL_Ext_Perf() : new WL_Flash();
+            REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+            REQUIRE(wl_flash->init() == ESP_OK);
+
+            REQUIRE(wl_flash->write_sectors(0, pattern, size / fat_sector_size) == ESP_OK);
+            // zeros could be programmed over the pattern, if only the data read back was stored in flash
+            part.reset_ops();
+            REQUIRE(wl_flash->write_sectors(0, zeros, size / fat_sector_size) == ESP_OK);
+            INFO((encrypted ? "encrypted" : "plain") << " partition, " << (ext ? "WL_Ext_Perf" : "WL_Flash"));
+            if (encrypted) {
+                CHECK(part.erase_ops > 0);
+            } else {
+                CHECK(part.erase_ops == 0);
+            }
+            REQUIRE(wl_flash->read(0, read, size) == ESP_OK);
+            REQUIRE(memcmp(zeros, read, size) == 0);
+            delete wl_flash;
+        }
+    }
+
+    free(pattern);
+    free(zeros);
+    free(read);
+}
+
+static size_t percentile(size_t *values, size_t count, size_t percent)
+{
+    std::sort(values, values + count);
+    return values[(count - 1) * percent / 100];
+}
+
+TEST_CASE("deferred page moves keep erase latency low", "[wear_levelling][maintenance]")
+{
+    const size_t op_count = 2000;
+    const size_t budget = 16;
+    size_t *latency = (size_t *) malloc(op_count * sizeof(size_t));
+    size_t p50[2], p99[2], max[2];
+
+    for (int deferred = 0; deferred < 2; deferred++) {
+        init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+        const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+
+        wl_ext_cfg_t cfg;
+        init_wl_config(&cfg, partition, SPI_FLASH_SEC_SIZE);
+        CountingPartition part(partition);
+        WL_Flash *wl_flash = new WL_Flash();
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        wl_flash->set_deferred_moves(deferred);
+
+        const size_t sector_size = wl_flash->sector_size();
+        const size_t size = wl_flash->chip_size();
+        const size_t sectors = size / sector_size;
+        uint8_t *expected = (uint8_t *) malloc(size);
+        uint8_t *read = (uint8_t *) malloc(size);
+        memset(expected, 0xff, size);
+        REQUIRE(wl_flash->erase_range(0, size) == ESP_OK);
+        while (wl_flash->maintenance(budget) == ESP_OK) {
+        }
+
+        // latency of an operation is the number of flash driver calls it makes,
+        // deferred work is done between operations, as if the application was idle
+        uint32_t seed = 1;
+        for (size_t op = 0; op < op_count; op++) {
+            seed = seed * 1103515245 + 12345;
+            size_t sector = (seed >> 16) % sectors;
+            uint8_t *data = expected + sector * sector_size;
+            for (size_t i = 0; i < sector_size / sizeof(uint32_t); i++) {
+                ((uint32_t *) data)[i] = (op << 16) + i;
+            }
+            part.reset_ops();
+            REQUIRE(wl_flash->erase_sector(sector) == ESP_OK);
+            REQUIRE(wl_flash->write(sector * sector_size, data, sector_size) == ESP_OK);
+            latency[op] = part.erase_ops + part.write_ops + part.read_ops;
+            if (deferred) {
+                esp_err_t result = wl_flash->maintenance(budget);
+                REQUIRE((result == ESP_OK || result == ESP_ERR_NOT_FOUND));
+            }
+            if (op % 100 == 0) {
+                REQUIRE(wl_flash->read(0, read, size) == ESP_OK);
+                REQUIRE(memcmp(expected, read, size) == 0);
+            }
+        }
+        p50[deferred] = percentile(latency, op_count, 50);
+        p99[deferred] = percentile(latency, op_count, 99);
+        max[deferred] = latency[op_count - 1];
+
+        if (deferred) {
+            // power off in every step of a move, the previous mapping has to be used after restart
+            for (size_t steps = 0; steps < 140; steps += 3) {
+                while (wl_flash->maintenance(budget) == ESP_OK) {
+                }
+                for (size_t i = 0; i < cfg.updaterate; i++) {
+                    REQUIRE(wl_flash->erase_sector(steps % sectors) == ESP_OK);
+                }
+                memset(expected + (steps % sectors) * sector_size, 0xff, sector_size);
+                REQUIRE(wl_flash->maintenance(steps) == ESP_OK);
+                delete wl_flash;
+                wl_flash = new WL_Flash();
+                REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+                REQUIRE(wl_flash->init() == ESP_OK);
+                wl_flash->set_deferred_moves(true);
+                REQUIRE(wl_flash->read(0, read, size) == ESP_OK);
+                REQUIRE(memcmp(expected, read, size) == 0);
+            }
+        }
+        delete wl_flash;
+        free(expected);
+        free(read);
+    }
+
+    printf("Flash operations per sector update: moves in erase p50 %d p99 %d max %d, deferred moves p50 %d p99 %d max %d\n",
+           (int) p50[0], (int) p99[0], (int) max[0], (int) p50[1], (int) p99[1], (int) max[1]);
+    CHECK(p99[1] * 10 < max[0]);
+    CHECK(max[1] * 10 < max[0]);
+
+    free(latency);
+}
+
+TEST_CASE("flush forces a deferred move which fell behind", "[wear_levelling][maintenance]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+
+    wl_ext_cfg_t cfg;
+    init_wl_config(&cfg, partition, SPI_FLASH_SEC_SIZE);
+    CountingPartition part(partition);
+    WL_Flash *wl_flash = new WL_Flash();
+    REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash->init() == ESP_OK);
+    wl_flash->set_deferred_moves(true);
+
+    // erase without maintenance until a move is done synchronously
+    do {
+        part.reset_ops();
+        REQUIRE(wl_flash->erase_sector(0) == ESP_OK);
+    } while (part.erase_ops == 1);
+
+    // the move consumed one threshold of accesses, so the next one is forced
+    // after as many accesses again; stop one access before that
+    for (size_t i = 0; i < cfg.updaterate - 1; i++) {
+        part.reset_ops();
+        REQUIRE(wl_flash->erase_sector(0) == ESP_OK);
+        REQUIRE(part.erase_ops == 1);
+    }
+    part.reset_ops();
+    REQUIRE(wl_flash->flush() == ESP_OK);
+    CHECK(part.erase_ops > 0);
+    delete wl_flash;
+}
+
+TEST_CASE("hot/cold policy spreads wear of frequently rewritten sectors", "[wear_levelling][hot_cold]")
+{
+    const size_t updates = 40000;
+    const size_t file_sectors = 64;
+    const size_t fat_sector = 1;
+    const size_t dir_sector = 2;
+    const size_t file_start = 8;
+    float wear_ratio[2];
+    float amplification[2];
+
+    for (int policy = 0; policy < 2; policy++) {
+        init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+        const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+
+        wl_ext_cfg_t cfg;
+        init_wl_config(&cfg, partition, SPI_FLASH_SEC_SIZE);
+        Partition part(partition);
+        WL_Flash *wl_flash = new WL_Flash();
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        if (policy) {
+            REQUIRE(wl_flash->set_hot_cold_policy(true) == ESP_OK);
+        }
+
+        const size_t sector_size = wl_flash->sector_size();
+        const size_t size = wl_flash->chip_size();
+        uint8_t *expected = (uint8_t *) malloc(size);
+        uint8_t *read = (uint8_t *) malloc(size);
+        for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+            ((uint32_t *) expected)[i] = i;
+        }
+        REQUIRE(wl_flash->erase_range(0, size) == ESP_OK);
+        REQUIRE(wl_flash->write(0, expected, size) == ESP_OK);
+
+        const size_t first_sector = partition->address / SPI_FLASH_SEC_SIZE;
+        const size_t sectors = partition->size / SPI_FLASH_SEC_SIZE;
+        uint32_t *start_cycles = (uint32_t *) malloc(sectors * sizeof(uint32_t));
+        for (size_t i = 0; i < sectors; i++) {
+            start_cycles[i] = spiflash.get_erase_cycles(first_sector + i);
+        }
+
+        // Access pattern of FAT appending to a file which is rewritten over and over:
+        // every cluster updates the FAT, and every few clusters the directory entry
+        size_t host_erases = 0;
+        for (size_t i = 0; i < updates; i++) {
+            size_t sectors_to_write[2] = {file_start + i % file_sectors, (i % 4 == 3) ? dir_sector : fat_sector};
+            for (size_t j = 0; j < 2; j++) {
+                uint8_t *data = expected + sectors_to_write[j] * sector_size;
+                ((uint32_t *) data)[0] = i;
+                REQUIRE(wl_flash->erase_sector(sectors_to_write[j]) == ESP_OK);
+                REQUIRE(wl_flash->write(sectors_to_write[j] * sector_size, data, sector_size) == ESP_OK);
+                host_erases++;
+            }
+        }
+        REQUIRE(wl_flash->read(0, read, size) == ESP_OK);
+        REQUIRE(memcmp(expected, read, size) == 0);
+
+        // data is found in the same place after a restart
+        delete wl_flash;
+        wl_flash = new WL_Flash();
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        REQUIRE(wl_flash->read(0, read, size) == ESP_OK);
+        REQUIRE(memcmp(expected, read, size) == 0);
+
+        // both state copies, before the config sector at the end of the partition, have the version
+        // which firmware without the page map does not accept once pages may be moved out of turn
+        const uint32_t expected_version = policy ? WL_STATE_VERSION_PAGE_MAP : 2;
+        const size_t state_size = (sizeof(wl_state_t) + sectors * cfg.wr_size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+        for (size_t copy = 0; copy < 2; copy++) {
+            wl_state_t state;
+            REQUIRE(part.read(partition->size - SPI_FLASH_SEC_SIZE - state_size * (2 - copy), &state, sizeof(state)) == ESP_OK);
+            CHECK(state.version == expected_version);
+        }
+
+        uint32_t max_cycles = 0;
+        uint32_t total_cycles = 0;
+        for (size_t i = 0; i < sectors; i++) {
+            uint32_t cycles = spiflash.get_erase_cycles(first_sector + i) - start_cycles[i];
+            max_cycles = std::max(max_cycles, cycles);
+            total_cycles += cycles;
+        }
+        wear_ratio[policy] = (float) max_cycles * sectors / total_cycles;
+        amplification[policy] = (float) total_cycles / host_erases;
+
+        delete wl_flash;
+        free(start_cycles);
+        free(expected);
+        free(read);
+    }
+
+    printf("FAT-like workload, max/mean erase cycles and write amplification: round robin %.1f %.3f, hot/cold policy %.1f %.3f\n",
+           wear_ratio[0], amplification[0], wear_ratio[1], amplification[1]);
+    CHECK(wear_ratio[1] * 2 < wear_ratio[0]);
+    CHECK(amplification[1] < amplification[0]);
+}
+
+TEST_CASE("hot/cold policy keeps data of a partition written without it", "[wear_levelling][hot_cold]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+
+    wl_ext_cfg_t cfg;
+    init_wl_config(&cfg, partition, SPI_FLASH_SEC_SIZE);
+    Partition part(partition);
+    WL_Flash *wl_flash = new WL_Flash();
+    REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash->init() == ESP_OK);
+
+    const size_t sector_size = wl_flash->sector_size();
+    const size_t size = wl_flash->chip_size();
+    uint8_t *expected = (uint8_t *) malloc(size);
+    uint8_t *read = (uint8_t *) malloc(size);
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        ((uint32_t *) expected)[i] = i;
+    }
+    REQUIRE(wl_flash->erase_range(0, size) == ESP_OK);
+    REQUIRE(wl_flash->write(0, expected, size) == ESP_OK);
+    // move some pages, the dummy page is in the middle of a round
+    for (size_t i = 0; i < cfg.updaterate * 10; i++) {
+        REQUIRE(wl_flash->erase_sector(1) == ESP_OK);
+        REQUIRE(wl_flash->write(sector_size, expected + sector_size, sector_size) == ESP_OK);
+    }
+
+    // the state is rewritten with the page map when the policy is enabled
+    delete wl_flash;
+    wl_flash = new WL_Flash();
+    REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash->init() == ESP_OK);
+    REQUIRE(wl_flash->set_hot_cold_policy(true) == ESP_OK);
+    REQUIRE(wl_flash->read(0, read, size) == ESP_OK);
+    CHECK(memcmp(expected, read, size) == 0);
+
+    delete wl_flash;
+    wl_flash = new WL_Flash();
+    REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash->init() == ESP_OK);
+    REQUIRE(wl_flash->read(0, read, size) == ESP_OK);
+    CHECK(memcmp(expected, read, size) == 0);
+
+    delete wl_flash;
+    free(expected);
+    free(read);
+}
+
+TEST_CASE("flash simulator advances virtual clock by operation latencies", "[spi_flash_sim]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, 256, "partition_table.bin");
+    spiflash.set_timing(700, 45000, 20);
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    uint8_t data[512];
+    memset(data, 0x55, sizeof(data));
+
+    spiflash.reset_stats();
+    // Unaligned write touches three pages
+    REQUIRE(esp_partition_write(partition, 128, data, sizeof(data)) == ESP_OK);
+    CHECK(spiflash.get_time() == 3 * 700);
+    REQUIRE(esp_partition_read(partition, 0, data, sizeof(data)) == ESP_OK);
+    CHECK(spiflash.get_time() == 3 * 700 + 2 * 20);
+    REQUIRE(esp_partition_erase_range(partition, 0, SPI_FLASH_SEC_SIZE) == ESP_OK);
+    CHECK(spiflash.get_time() == 3 * 700 + 2 * 20 + 45000);
+
+    CHECK(spiflash.get_write_ops() == 1);
+    CHECK(spiflash.get_write_bytes() == sizeof(data));
+    CHECK(spiflash.get_read_ops() == 1);
+    CHECK(spiflash.get_read_bytes() == sizeof(data));
+    CHECK(spiflash.get_erase_ops() == 1);
+}
+
+TEST_CASE("flash simulator tears the operation interrupted by power cut", "[spi_flash_sim]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    uint8_t data[8];
+    uint8_t read[8];
+    memset(data, 0, sizeof(data));
+
+    // Power is lost during the second write, after 12 of its bits were programmed
+    spiflash.set_power_cut(2, 12);
+    REQUIRE(esp_partition_write(partition, 0, data, sizeof(data)) == ESP_OK);
+    CHECK(esp_partition_write(partition, 16, data, sizeof(data)) != ESP_OK);
+    CHECK(spiflash.is_power_off());
+    CHECK(esp_partition_read(partition, 16, read, sizeof(read)) != ESP_OK);
+    CHECK(esp_partition_erase_range(partition, 0, SPI_FLASH_SEC_SIZE) != ESP_OK);
+
+    spiflash.power_on();
+    REQUIRE(esp_partition_read(partition, 16, read, sizeof(read)) == ESP_OK);
+    CHECK(read[0] == 0x00);
+    CHECK(read[1] == 0xf0);
+    CHECK(read[2] == 0xff);
+    REQUIRE(esp_partition_read(partition, 0, read, sizeof(read)) == ESP_OK);
+    CHECK(memcmp(read, data, sizeof(data)) == 0);
+}
+
+TEST_CASE("data survives power cut with torn flash operations", "[wear_levelling][power_cut]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    wl_handle_t wl_handle;
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    REQUIRE(wl_mount(partition, &wl_handle) == ESP_OK);
+
+    size_t sector_size = wl_sector_size(wl_handle);
+    int32_t sectors_count = wl_size(wl_handle) / sector_size;
+    uint32_t *sector_data = new uint32_t[sector_size / sizeof(uint32_t)];
+
+    for (int32_t i = 0; i < sectors_count; i++) {
+        for (uint32_t m = 0; m < sector_size / sizeof(uint32_t); m++) {
+            sector_data[m] = i * sector_size + m;
+        }
+        REQUIRE(wl_erase_range(wl_handle, i * sector_size, sector_size) == ESP_OK);
+        REQUIRE(wl_write(wl_handle, i * sector_size, sector_data, sector_size) == ESP_OK);
+    }
+    REQUIRE(wl_flush(wl_handle) == ESP_OK);
+
+    // Every pass rewrites all sectors with the next generation of data, until power is lost.
+    // Generations don't wrap, so new data can never be programmed over old data without erase.
+    // Only the sector which was written at that time may be corrupted, other sectors have to
+    // keep old or new data. With sector cache, it may be any of the sectors written back.
+    uint32_t generation = 0;
+    for (uint32_t k = 0; k < 200; k++) {
+        spiflash.set_power_cut(1 + (k * 37) % 400, (k * 13) % 256);
+        int32_t err_sector = -1;
+        generation++;
+        for (int32_t i = 0; i < sectors_count && err_sector < 0; i++) {
+            for (uint32_t m = 0; m < sector_size / sizeof(uint32_t); m++) {
+                sector_data[m] = i * sector_size + m + generation * 0x01000000;
+            }
+            if (wl_erase_range(wl_handle, i * sector_size, sector_size) != ESP_OK ||
+                    wl_write(wl_handle, i * sector_size, sector_data, sector_size) != ESP_OK) {
+                err_sector = i;
+            }
+        }
+        REQUIRE(err_sector >= 0);
+        // Data in RAM is lost, unmount only frees the instance
+        wl_unmount(wl_handle);
+        spiflash.set_power_cut(0, 0);
+        spiflash.power_on();
+
+        REQUIRE(wl_mount(partition, &wl_handle) == ESP_OK);
+        int32_t corrupted = 0;
+        for (int32_t i = 0; i < sectors_count; i++) {
+            REQUIRE(wl_read(wl_handle, i * sector_size, sector_data, sector_size) == ESP_OK);
+            uint32_t found = sector_data[0] - i * sector_size;
+            bool valid = (found == generation * 0x01000000) || (found == (generation - 1) * 0x01000000);
+            for (uint32_t m = 1; m < sector_size / sizeof(uint32_t) && valid; m++) {
+                valid = (sector_data[m] == i * sector_size + m + found);
+            }
+            if (!valid) {
+                corrupted++;
+                if (corrupted > 1) {
+                    printf("Error - sector %i is corrupted after power cut in sector %i\n", i, err_sector);
+                }
+            }
+        }
+        REQUIRE(corrupted <= 1);
+
+        // Bring all sectors to the current generation before the next pass
+        for (int32_t i = 0; i < sectors_count; i++) {
+            for (uint32_t m = 0; m < sector_size / sizeof(uint32_t); m++) {
+                sector_data[m] = i * sector_size + m + generation * 0x01000000;
+            }
+            REQUIRE(wl_erase_range(wl_handle, i * sector_size, sector_size) == ESP_OK);
+            REQUIRE(wl_write(wl_handle, i * sector_size, sector_data, sector_size) == ESP_OK);
+        }
+        REQUIRE(wl_flush(wl_handle) == ESP_OK);
+    }
+
+    delete[] sector_data;
+    REQUIRE(wl_unmount(wl_handle) == ESP_OK);
+}
@@ -21,6 +21,7 @@
 #include "WL_Flash.h"
 #include "WL_Ext_Perf.h"
 #include "WL_Ext_Safe.h"
+#include "WL_Cache.h"
 #include "SPI_Flash.h"
 #include "Partition.h"
 
@@ -44,12 +45,22 @@
 #define WL_DEFAULT_START_ADDR   0
 #endif //WL_DEFAULT_START_ADDR
 
+#ifndef WL_DEFAULT_CACHE_SECTORS
+#ifdef CONFIG_WL_CACHE_SECTORS
+#define WL_DEFAULT_CACHE_SECTORS    CONFIG_WL_CACHE_SECTORS
+#else
+#define WL_DEFAULT_CACHE_SECTORS    0
+#endif // CONFIG_WL_CACHE_SECTORS
+#endif //WL_DEFAULT_CACHE_SECTORS
+
 #ifndef WL_CURRENT_VERSION
 #define WL_CURRENT_VERSION  2
 #endif //WL_CURRENT_VERSION
 
 typedef struct {
     WL_Flash *instance;
+    WL_Cache *cache;
+    Flash_Access *access; // cache if enabled, otherwise instance
     _lock_t lock;
 } wl_instance_t;
 
@@ -66,6 +77,7 @@ esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle)
     WL_Flash *wl_flash = NULL;
     void *part_ptr = NULL;
     Partition *part = NULL;
+    WL_Cache *cache = NULL;
 
     _lock_acquire(&s_instances_lock);
     esp_err_t result = ESP_OK;
@@ -149,7 +161,35 @@ esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle)
         ESP_LOGE(TAG, "%s: init instance=0x%08x, result=0x%x", __func__, *out_handle, result);
         goto out;
     }
+#if CONFIG_WL_DEFERRED_MOVES
+    wl_flash->set_deferred_moves(true);
+#endif // CONFIG_WL_DEFERRED_MOVES
+#if CONFIG_WL_HOT_COLD_POLICY
+    if (wl_flash->set_hot_cold_policy(true) != ESP_OK) {
+        ESP_LOGW(TAG, "%s: hot/cold policy is not available for instance=0x%08x", __func__, *out_handle);
+    }
+#endif // CONFIG_WL_HOT_COLD_POLICY
+#if WL_DEFAULT_CACHE_SECTORS > 0
+    cache = (WL_Cache *)malloc(sizeof(WL_Cache));
+    if (cache == NULL) {
+        result = ESP_ERR_NO_MEM;
+        ESP_LOGE(TAG, "%s: can't allocate WL_Cache", __func__);
+        goto out;
+    }
+    cache = new (cache) WL_Cache();
+    result = cache->config(wl_flash, cfg.sector_size, WL_DEFAULT_CACHE_SECTORS);
+    if (ESP_OK != result) {
+        ESP_LOGE(TAG, "%s: config cache instance=0x%08x, result=0x%x", __func__, *out_handle, result);
+        goto out;
+    }
+#endif // WL_DEFAULT_CACHE_SECTORS
     s_instances[*out_handle].instance = wl_flash;
+    s_instances[*out_handle].cache = cache;
+    if (cache != NULL) {
+        s_instances[*out_handle].access = cache;
+    } else {
+        s_instances[*out_handle].access = wl_flash;
+    }
     _lock_init(&s_instances[*out_handle].lock);
     _lock_release(&s_instances_lock);
     return ESP_OK;
@@ -157,6 +197,10 @@ esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle)
 out:
     _lock_release(&s_instances_lock);
     *out_handle = WL_INVALID_HANDLE;
+    if (cache) {
+        cache->~WL_Cache();
+        free(cache);
+    }
     if (wl_flash) {
         wl_flash->~WL_Flash();
         free(wl_flash);
@@ -174,8 +218,18 @@ esp_err_t wl_unmount(wl_handle_t handle)
     _lock_acquire(&s_instances_lock);
     result = check_handle(handle, __func__);
     if (result == ESP_OK) {
-        // We have to flush state of the component
-        result = s_instances[handle].instance->flush();
+        // Write back cached sectors, then flush state of the component
+        WL_Cache *cache = s_instances[handle].cache;
+        if (cache != NULL) {
+            result = cache->flush();
+            cache->~WL_Cache();
+            free(cache);
+            s_instances[handle].cache = NULL;
+        }
+        esp_err_t flush_result = s_instances[handle].instance->flush();
+        if (result == ESP_OK) {
+            result = flush_result;
+        }
         // We use placement new in wl_mount, so call destructor directly
         Flash_Access *drv = s_instances[handle].instance->get_drv();
         drv->~Flash_Access();
@@ -183,6 +237,7 @@ esp_err_t wl_unmount(wl_handle_t handle)
         s_instances[handle].instance->~WL_Flash();
         free(s_instances[handle].instance);
         s_instances[handle].instance = NULL;
+        s_instances[handle].access = NULL;
         _lock_close(&s_instances[handle].lock); // also zeroes the lock variable
     }
     _lock_release(&s_instances_lock);
@@ -196,7 +251,7 @@ esp_err_t wl_erase_range(wl_handle_t handle, size_t start_addr, size_t size)
         return result;
     }
     _lock_acquire(&s_instances[handle].lock);
-    result = s_instances[handle].instance->erase_range(start_addr, size);
+    result = s_instances[handle].access->erase_range(start_addr, size);
     _lock_release(&s_instances[handle].lock);
     return result;
 }
@@ -208,7 +263,24 @@ esp_err_t wl_write(wl_handle_t handle, size_t dest_addr, const void *src, size_t
         return result;
     }
     _lock_acquire(&s_instances[handle].lock);
-    result = s_instances[handle].instance->write(dest_addr, src, size);
+    result = s_instances[handle].access->write(dest_addr, src, size);
+    _lock_release(&s_instances[handle].lock);
+    return result;
+}
+
+esp_err_t wl_write_sectors(wl_handle_t handle, size_t sector, const void *src, size_t count)
+{
+    esp_err_t result = check_handle(handle, __func__);
+    if (result != ESP_OK) {
+        return result;
+    }
+    Flash_Access *access = s_instances[handle].access;
+    size_t sectors = access->chip_size() / access->sector_size();
+    if ((count > sectors) || (sector > sectors - count)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    _lock_acquire(&s_instances[handle].lock);
+    result = access->write_sectors(sector, src, count);
     _lock_release(&s_instances[handle].lock);
     return result;
 }
@@ -220,7 +292,34 @@ esp_err_t wl_read(wl_handle_t handle, size_t src_addr, void *dest, size_t size)
         return result;
     }
     _lock_acquire(&s_instances[handle].lock);
-    result = s_instances[handle].instance->read(src_addr, dest, size);
+    result = s_instances[handle].access->read(src_addr, dest, size);
+    _lock_release(&s_instances[handle].lock);
+    return result;
+}
+
+esp_err_t wl_flush(wl_handle_t handle)
+{
+    esp_err_t result = check_handle(handle, __func__);
+    if (result != ESP_OK) {
+        return result;
+    }
+    if (s_instances[handle].cache == NULL) {
+        return ESP_OK;
+    }
+    _lock_acquire(&s_instances[handle].lock);
+    result = s_instances[handle].cache->flush();
+    _lock_release(&s_instances[handle].lock);
+    return result;
+}
+
+esp_err_t wl_maintenance(wl_handle_t handle, size_t budget)
+{
+    esp_err_t result = check_handle(handle, __func__);
+    if (result != ESP_OK) {
+        return result;
+    }
+    _lock_acquire(&s_instances[handle].lock);
+    result = s_instances[handle].instance->maintenance(budget);
     _lock_release(&s_instances[handle].lock);
     return result;
 }
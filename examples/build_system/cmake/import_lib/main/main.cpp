@@ -23,7 +23,7 @@ extern "C" void app_main(void)
 {
     // Do example setup
     ESP_LOGI(TAG, "Setting up...");
-    esp_vfs_fat_mount_config_t mount_config;
+    esp_vfs_fat_mount_config_t mount_config = {};
     mount_config.max_files = 4;
     mount_config.format_if_mount_failed = true;
     mount_config.allocation_unit_size = CONFIG_WL_SECTOR_SIZE;
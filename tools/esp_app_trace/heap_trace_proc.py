@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+#
+# Decodes heap trace events streamed to the host by heap_trace_init_tohost()
+#
+
+from __future__ import print_function
+import argparse
+import struct
+import sys
+
+ESP32_HEAP_TRACE_MAGIC = 0x4854
+ESP32_HEAP_TRACE_HDR_FMT = '<HBB'
+ESP32_HEAP_TRACE_HDR_SZ = struct.calcsize(ESP32_HEAP_TRACE_HDR_FMT)
+ESP32_HEAP_TRACE_EVT_FMT = '<LLL'
+ESP32_HEAP_TRACE_EVT_SZ = struct.calcsize(ESP32_HEAP_TRACE_EVT_FMT)
+
+ESP32_HEAP_TRACE_EVENT_ALLOC = 0
+ESP32_HEAP_TRACE_EVENT_FREE = 1
+
+
+class ESPHeapTraceEvent(object):
+    def __init__(self, event, ccount, address, size, callers):
+        super(ESPHeapTraceEvent, self).__init__()
+        self.event = event
+        self.ccount = ccount
+        self.address = address
+        self.size = size
+        self.callers = callers
+
+    def callers_str(self):
+        return ':'.join('0x%08x' % c for c in self.callers if c != 0)
+
+    def __repr__(self):
+        if self.event == ESP32_HEAP_TRACE_EVENT_ALLOC:
+            return "%d bytes (@ 0x%08x) allocated CPU %d ccount 0x%08x caller %s" % (
+                self.size, self.address, self.ccount & 1, self.ccount & ~3, self.callers_str())
+        return "0x%08x freed CPU %d ccount 0x%08x caller %s" % (
+            self.address, self.ccount & 1, self.ccount & ~3, self.callers_str())
+
+
+def heap_trace_parse(fname):
+    """Returns the list of events in the trace file, and the number of bytes which couldn't be decoded"""
+    try:
+        with open(fname, 'rb') as ftrc:
+            data = ftrc.read()
+    except IOError as e:
+        print("Failed to open trace file (%s)!" % e)
+        sys.exit(2)
+
+    events = []
+    skipped = 0
+    off = 0
+    while off + ESP32_HEAP_TRACE_HDR_SZ + ESP32_HEAP_TRACE_EVT_SZ <= len(data):
+        magic, event, depth = struct.unpack_from(ESP32_HEAP_TRACE_HDR_FMT, data, off)
+        evt_sz = ESP32_HEAP_TRACE_HDR_SZ + ESP32_HEAP_TRACE_EVT_SZ + 4 * depth
+        if magic != ESP32_HEAP_TRACE_MAGIC or event > ESP32_HEAP_TRACE_EVENT_FREE or off + evt_sz > len(data):
+            # not the start of an event, look for the next one
+            off += 1
+            skipped += 1
+            continue
+        ccount, address, size = struct.unpack_from(ESP32_HEAP_TRACE_EVT_FMT, data, off + ESP32_HEAP_TRACE_HDR_SZ)
+        callers = struct.unpack_from('<%dL' % depth, data, off + ESP32_HEAP_TRACE_HDR_SZ + ESP32_HEAP_TRACE_EVT_SZ)
+        events.append(ESPHeapTraceEvent(event, ccount, address, size, callers))
+        off += evt_sz
+    return events, skipped + len(data) - off
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ESP32 Heap Trace Parse Tool')
+
+    parser.add_argument('file', help='Path to heap trace file', type=str)
+    parser.add_argument('--print-events', '-p', help='Print all events', action='store_true')
+
+    args = parser.parse_args()
+
+    events, skipped = heap_trace_parse(args.file)
+
+    # allocations which are still alive at the end of the trace, by address
+    alive = {}
+    total_allocs = 0
+    total_frees = 0
+    for i, evt in enumerate(events):
+        if args.print_events:
+            print(evt)
+        if evt.event == ESP32_HEAP_TRACE_EVENT_ALLOC:
+            total_allocs += 1
+            alive[evt.address] = (i, evt)
+        else:
+            total_frees += 1
+            alive.pop(evt.address, None)
+
+    print("====================================================================")
+    leaked = [evt for i, evt in sorted(alive.values(), key=lambda a: a[0])]
+    for evt in leaked:
+        print(evt)
+    print("%d bytes 'leaked' in trace (%d allocations)" % (sum(e.size for e in leaked), len(leaked)))
+    print("total allocations %d total frees %d" % (total_allocs, total_frees))
+    if skipped:
+        print("(NB: %d bytes of the trace file could not be decoded.)" % skipped)
+
+
+if __name__ == '__main__':
+    main()